@@ -1,98 +1,303 @@
 #include "custom_agent.h"
+#include "custom_transport.h"
+#include <agent.h>
 #include <gst/webrtc/nice/nice.h>
 
+/* Checks go out every few ms instead of libnice's 20 ms, and the first
+ * retransmission comes sooner */
+#define LITE_STUN_PACING_TIMER_MS 5
+#define LITE_STUN_INITIAL_TIMEOUT_MS 100
+
 struct _CustomICEAgent {
   GstWebRTCICE parent;
   GstWebRTCNice *nice_agent;
+
+  gboolean lite;
+  /* Local address to the one advertised for it, the same unless NATed */
+  GHashTable *host_addresses;
+  gboolean local_addresses_set;
+
+  /* Set when every session shares the mux port, there is no libnice agent
+   * then */
+  UdpMux *mux;
+  GPtrArray *streams;
+
+  GstWebRTCICEOnCandidateFunc on_candidate;
+  gpointer on_candidate_data;
+  GDestroyNotify on_candidate_notify;
+
+  ImpairScenario *impair;
+  ImpairDirection impair_directions;
+  guint32 impair_seed;
 };
 
 /* *INDENT-OFF* */
 G_DEFINE_TYPE(CustomICEAgent, customice_agent, GST_TYPE_WEBRTC_ICE)
 /* *INDENT-ON* */
 
+static void customice_agent_on_candidate(GstWebRTCICE *nice_agent, guint stream_id, const gchar *candidate, gpointer user_data);
+
 GstWebRTCICEStream *customice_agent_add_stream(GstWebRTCICE *ice, guint session_id) {
-  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  CustomICEAgent *agent = CUSTOMICE_AGENT(ice);
+  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(agent->nice_agent);
+  if (agent->mux != NULL) {
+    gchar **addresses = (gchar **)g_hash_table_get_keys_as_array(agent->host_addresses, NULL);
+    CustomICEStream *stream = customice_stream_new(session_id, agent->mux, (const gchar *const *)addresses, customice_agent_on_candidate, agent);
+
+    g_free(addresses);
+    g_ptr_array_add(agent->streams, stream);
+    return gst_object_ref(GST_WEBRTC_ICE_STREAM(stream));
+  }
   return gst_webrtc_ice_add_stream(c_ice, session_id);
 }
 
+/* Between webrtcbin and nicesrc/nicesink or the mux's appsrc/appsink, the
+ * same for both kinds of transport */
+static void customice_agent_impair_transport(CustomICEAgent *agent, GstWebRTCICEStream *stream, GstWebRTCICETransport *transport) {
+  static GQuark impaired_quark = 0;
+  GstPad *pad;
+  gchar *name;
+  guint32 seed = (agent->impair_seed << 16) ^ (stream->stream_id << 8) ^ (transport->component << 2);
+
+  if (impaired_quark == 0)
+    impaired_quark = g_quark_from_static_string("customice-impaired");
+  if (g_object_get_qdata(G_OBJECT(transport), impaired_quark) != NULL)
+    return;
+  g_object_set_qdata(G_OBJECT(transport), impaired_quark, GINT_TO_POINTER(TRUE));
+
+  if (agent->impair_directions & IMPAIR_SEND) {
+    pad = gst_element_get_static_pad(transport->sink, "sink");
+    name = g_strdup_printf("%u/%u/%u send", agent->impair_seed, stream->stream_id, transport->component);
+    impair_pad(pad, agent->impair, seed | IMPAIR_SEND, name);
+    g_free(name);
+    gst_object_unref(pad);
+  }
+  if (agent->impair_directions & IMPAIR_RECEIVE) {
+    pad = gst_element_get_static_pad(transport->src, "src");
+    name = g_strdup_printf("%u/%u/%u receive", agent->impair_seed, stream->stream_id, transport->component);
+    impair_pad(pad, agent->impair, seed | IMPAIR_RECEIVE, name);
+    g_free(name);
+    gst_object_unref(pad);
+  }
+}
+
 GstWebRTCICETransport *customice_agent_find_transport(GstWebRTCICE *ice, GstWebRTCICEStream *stream, GstWebRTCICEComponent component) {
-  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
-  return gst_webrtc_ice_find_transport(c_ice, stream, component);
+  CustomICEAgent *agent = CUSTOMICE_AGENT(ice);
+  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(agent->nice_agent);
+  GstWebRTCICETransport *transport;
+
+  if (agent->mux != NULL)
+    transport = gst_webrtc_ice_stream_find_transport(stream, component);
+  else
+    transport = gst_webrtc_ice_find_transport(c_ice, stream, component);
+
+  if (transport != NULL && agent->impair != NULL)
+    customice_agent_impair_transport(agent, stream, transport);
+  return transport;
+}
+
+/* libnice and the mux only ever see the local address, the peer gets the
+ * public one */
+static void customice_agent_on_candidate(G_GNUC_UNUSED GstWebRTCICE *nice_agent, guint stream_id, const gchar *candidate, gpointer user_data) {
+  CustomICEAgent *agent = CUSTOMICE_AGENT(user_data);
+  gchar **fields;
+  const gchar *advertised;
+
+  if (agent->on_candidate == NULL)
+    return;
+
+  /* candidate:<foundation> <component> <transport> <priority> <address> ... */
+  fields = g_strsplit(candidate, " ", -1);
+  if (g_strv_length(fields) > 4 && (advertised = g_hash_table_lookup(agent->host_addresses, fields[4])) != NULL && g_strcmp0(advertised, fields[4]) != 0) {
+    gchar *rewritten;
+
+    g_free(fields[4]);
+    fields[4] = g_strdup(advertised);
+    rewritten = g_strjoinv(" ", fields);
+    agent->on_candidate(GST_WEBRTC_ICE(agent), stream_id, rewritten, agent->on_candidate_data);
+    g_free(rewritten);
+  } else {
+    agent->on_candidate(GST_WEBRTC_ICE(agent), stream_id, candidate, agent->on_candidate_data);
+  }
+  g_strfreev(fields);
+}
+
+/* Has to happen before the first gathering, libnice only reads its local
+ * addresses then */
+static void customice_agent_set_local_addresses(CustomICEAgent *agent) {
+  NiceAgent *nice;
+  GHashTableIter iter;
+  gpointer local;
+
+  agent->local_addresses_set = TRUE;
+
+  g_object_get(agent->nice_agent, "agent", &nice, NULL);
+  g_object_set(nice, "upnp", FALSE, "stun-pacing-timer", LITE_STUN_PACING_TIMER_MS, "stun-initial-timeout", LITE_STUN_INITIAL_TIMEOUT_MS, NULL);
+
+  g_hash_table_iter_init(&iter, agent->host_addresses);
+  while (g_hash_table_iter_next(&iter, &local, NULL)) {
+    NiceAddress address;
+
+    nice_address_init(&address);
+    if (nice_address_set_from_string(&address, local))
+      nice_agent_add_local_address(nice, &address);
+    else
+      g_printerr("Ignoring invalid ICE host address %s\n", (const gchar *)local);
+  }
+  g_object_unref(nice);
 }
 
 void customice_agent_add_candidate(GstWebRTCICE *ice, GstWebRTCICEStream *stream, const gchar *candidate, GstPromise *promise) {
   GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  if (CUSTOMICE_AGENT(ice)->mux != NULL) {
+    /* The peer's checks tell us its addresses */
+    if (promise != NULL)
+      gst_promise_reply(promise, NULL);
+    return;
+  }
   gst_webrtc_ice_add_candidate(c_ice, stream, candidate, promise);
 }
 
 gboolean customice_agent_set_remote_credentials(GstWebRTCICE *ice, GstWebRTCICEStream *stream, const gchar *ufrag, const gchar *pwd) {
   GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  if (CUSTOMICE_AGENT(ice)->mux != NULL)
+    return TRUE;
   return gst_webrtc_ice_set_remote_credentials(c_ice, stream, ufrag, pwd);
 }
 
 gboolean customice_agent_add_turn_server(GstWebRTCICE *ice, const gchar *uri) {
   GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  if (CUSTOMICE_AGENT(ice)->lite)
+    return TRUE;
   return gst_webrtc_ice_add_turn_server(c_ice, uri);
 }
 
 gboolean customice_agent_set_local_credentials(GstWebRTCICE *ice, GstWebRTCICEStream *stream, const gchar *ufrag, const gchar *pwd) {
   GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  if (CUSTOMICE_AGENT(ice)->mux != NULL)
+    return customice_stream_set_local_credentials(CUSTOMICE_STREAM(stream), ufrag, pwd);
   return gst_webrtc_ice_set_local_credentials(c_ice, stream, ufrag, pwd);
 }
 
 gboolean customice_agent_gather_candidates(GstWebRTCICE *ice, GstWebRTCICEStream *stream) {
-  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  CustomICEAgent *agent = CUSTOMICE_AGENT(ice);
+  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(agent->nice_agent);
+  if (agent->mux != NULL)
+    return gst_webrtc_ice_stream_gather_candidates(stream);
+  if (agent->lite && !agent->local_addresses_set)
+    customice_agent_set_local_addresses(agent);
   return gst_webrtc_ice_gather_candidates(c_ice, stream);
 }
 
 void customice_agent_set_is_controller(GstWebRTCICE *ice, gboolean controller) {
   GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  /* The mux is a lite agent, always controlled */
+  if (CUSTOMICE_AGENT(ice)->mux != NULL)
+    return;
   gst_webrtc_ice_set_is_controller(c_ice, controller);
 }
 
 gboolean customice_agent_get_is_controller(GstWebRTCICE *ice) {
   GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  if (CUSTOMICE_AGENT(ice)->mux != NULL)
+    return FALSE;
   return gst_webrtc_ice_get_is_controller(c_ice);
 }
 
 void customice_agent_set_force_relay(GstWebRTCICE *ice, gboolean force_relay) {
   GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  if (CUSTOMICE_AGENT(ice)->mux != NULL)
+    return;
   gst_webrtc_ice_set_force_relay(c_ice, force_relay);
 }
 
 void customice_agent_set_tos(GstWebRTCICE *ice, GstWebRTCICEStream *stream, guint tos) {
   GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  /* The socket is shared with every other session */
+  if (CUSTOMICE_AGENT(ice)->mux != NULL)
+    return;
   gst_webrtc_ice_set_tos(c_ice, stream, tos);
 }
 
 void customice_agent_set_on_ice_candidate(GstWebRTCICE *ice, GstWebRTCICEOnCandidateFunc func, gpointer user_data, GDestroyNotify notify) {
-  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
-  gst_webrtc_ice_set_on_ice_candidate(c_ice, func, user_data, notify);
+  CustomICEAgent *agent = CUSTOMICE_AGENT(ice);
+  if (agent->on_candidate_notify != NULL)
+    agent->on_candidate_notify(agent->on_candidate_data);
+  agent->on_candidate = func;
+  agent->on_candidate_data = user_data;
+  agent->on_candidate_notify = notify;
 }
 
 void customice_agent_set_stun_server(GstWebRTCICE *ice, const gchar *uri_s) {
   GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  if (CUSTOMICE_AGENT(ice)->lite)
+    return;
   gst_webrtc_ice_set_stun_server(c_ice, uri_s);
 }
 
 gchar *customice_agent_get_stun_server(GstWebRTCICE *ice) {
   GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  if (c_ice == NULL)
+    return NULL;
   return gst_webrtc_ice_get_stun_server(c_ice);
 }
 
 void customice_agent_set_turn_server(GstWebRTCICE *ice, const gchar *uri_s) {
   GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  if (CUSTOMICE_AGENT(ice)->lite)
+    return;
   gst_webrtc_ice_set_turn_server(c_ice, uri_s);
 }
 
 gchar *customice_agent_get_turn_server(GstWebRTCICE *ice) {
   GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  if (c_ice == NULL)
+    return NULL;
   return gst_webrtc_ice_get_turn_server(c_ice);
 }
 
+GstWebRTCICECandidateStats **customice_agent_get_local_candidates(GstWebRTCICE *ice, GstWebRTCICEStream *stream) {
+  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  if (c_ice == NULL)
+    return g_new0(GstWebRTCICECandidateStats *, 1);
+  return gst_webrtc_ice_get_local_candidates(c_ice, stream);
+}
+
+GstWebRTCICECandidateStats **customice_agent_get_remote_candidates(GstWebRTCICE *ice, GstWebRTCICEStream *stream) {
+  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  if (c_ice == NULL)
+    return g_new0(GstWebRTCICECandidateStats *, 1);
+  return gst_webrtc_ice_get_remote_candidates(c_ice, stream);
+}
+
+gboolean customice_agent_get_selected_pair(GstWebRTCICE *ice, GstWebRTCICEStream *stream, GstWebRTCICECandidateStats **local_stats, GstWebRTCICECandidateStats **remote_stats) {
+  GstWebRTCICE *c_ice = GST_WEBRTC_ICE(CUSTOMICE_AGENT(ice)->nice_agent);
+  if (c_ice == NULL)
+    return FALSE;
+  return gst_webrtc_ice_get_selected_pair(c_ice, stream, local_stats, remote_stats);
+}
+
+static void customice_agent_finalize(GObject *object) {
+  CustomICEAgent *agent = CUSTOMICE_AGENT(object);
+
+  if (agent->on_candidate_notify != NULL)
+    agent->on_candidate_notify(agent->on_candidate_data);
+  g_hash_table_unref(agent->host_addresses);
+  g_ptr_array_unref(agent->streams);
+  if (agent->nice_agent != NULL)
+    gst_object_unref(agent->nice_agent);
+  if (agent->impair != NULL)
+    impair_scenario_unref(agent->impair);
+
+  G_OBJECT_CLASS(customice_agent_parent_class)->finalize(object);
+}
+
 static void customice_agent_class_init(CustomICEAgentClass *klass) {
+  GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
   GstWebRTCICEClass *gst_webrtc_ice_class = GST_WEBRTC_ICE_CLASS(klass);
 
+  gobject_class->finalize = customice_agent_finalize;
+
   // override virtual functions
   gst_webrtc_ice_class->add_candidate = customice_agent_add_candidate;
   gst_webrtc_ice_class->add_stream = customice_agent_add_stream;
@@ -100,6 +305,9 @@ static void customice_agent_class_init(CustomICEAgentClass *klass) {
   gst_webrtc_ice_class->find_transport = customice_agent_find_transport;
   gst_webrtc_ice_class->gather_candidates = customice_agent_gather_candidates;
   gst_webrtc_ice_class->get_is_controller = customice_agent_get_is_controller;
+  gst_webrtc_ice_class->get_local_candidates = customice_agent_get_local_candidates;
+  gst_webrtc_ice_class->get_remote_candidates = customice_agent_get_remote_candidates;
+  gst_webrtc_ice_class->get_selected_pair = customice_agent_get_selected_pair;
   gst_webrtc_ice_class->get_stun_server = customice_agent_get_stun_server;
   gst_webrtc_ice_class->get_turn_server = customice_agent_get_turn_server;
   gst_webrtc_ice_class->set_force_relay = customice_agent_set_force_relay;
@@ -113,9 +321,61 @@ static void customice_agent_class_init(CustomICEAgentClass *klass) {
 }
 
 static void customice_agent_init(CustomICEAgent *ice) {
-  ice->nice_agent = gst_webrtc_nice_new("nice_agent");
+  ice->host_addresses = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, g_free);
+  ice->streams = g_ptr_array_new_with_free_func(gst_object_unref);
+}
+
+static void customice_agent_add_host_addresses(CustomICEAgent *agent, const gchar *const *host_addresses) {
+  guint i;
+
+  for (i = 0; host_addresses[i] != NULL; i++) {
+    gchar **parts = g_strsplit(host_addresses[i], "=", 2);
+
+    g_hash_table_insert(agent->host_addresses, g_strdup(parts[0]), g_strdup(parts[1] != NULL ? parts[1] : parts[0]));
+    g_strfreev(parts);
+  }
 }
 
 CustomICEAgent *customice_agent_new(const gchar *name) {
-  return g_object_new(CUSTOMICE_TYPE_AGENT, "name", name, NULL);
+  CustomICEAgent *agent;
+
+  agent = g_object_new(CUSTOMICE_TYPE_AGENT, "name", name, NULL);
+  agent->nice_agent = gst_object_ref_sink(gst_webrtc_nice_new("nice_agent"));
+  gst_webrtc_ice_set_on_ice_candidate(GST_WEBRTC_ICE(agent->nice_agent), customice_agent_on_candidate, agent, NULL);
+  return agent;
+}
+
+CustomICEAgent *customice_agent_new_lite(const gchar *name, const gchar *const *host_addresses) {
+  CustomICEAgent *agent;
+
+  g_return_val_if_fail(host_addresses != NULL && host_addresses[0] != NULL, NULL);
+
+  agent = customice_agent_new(name);
+  agent->lite = TRUE;
+  /* A server on a known address has no use for TCP candidates either */
+  g_object_set(agent->nice_agent, "ice-tcp", FALSE, NULL);
+  customice_agent_add_host_addresses(agent, host_addresses);
+  return agent;
+}
+
+CustomICEAgent *customice_agent_new_muxed(const gchar *name, const gchar *const *host_addresses, UdpMux *mux) {
+  CustomICEAgent *agent;
+
+  g_return_val_if_fail(host_addresses != NULL && host_addresses[0] != NULL && mux != NULL, NULL);
+
+  agent = g_object_new(CUSTOMICE_TYPE_AGENT, "name", name, NULL);
+  agent->lite = TRUE;
+  agent->mux = mux;
+  customice_agent_add_host_addresses(agent, host_addresses);
+  return agent;
+}
+
+void customice_agent_set_impairment(CustomICEAgent *agent, ImpairScenario *scenario, ImpairDirection directions, guint32 seed) {
+  g_return_if_fail(CUSTOMICE_IS_AGENT(agent) && scenario != NULL);
+
+  if (agent->impair != NULL)
+    impair_scenario_unref(agent->impair);
+  agent->impair = impair_scenario_ref(scenario);
+  agent->impair_directions = directions;
+  agent->impair_seed = seed;
 }
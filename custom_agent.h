@@ -4,6 +4,9 @@
 #define GST_USE_UNSTABLE_API
 #include <gst/webrtc/ice.h>
 
+#include "webrtc-impair.h"
+#include "webrtc-udpmux.h"
+
 G_BEGIN_DECLS
 
 #define CUSTOMICE_TYPE_AGENT (customice_agent_get_type())
@@ -11,6 +14,23 @@ G_DECLARE_FINAL_TYPE(CustomICEAgent, customice_agent, CUSTOMICE, AGENT, GstWebRT
 
 CustomICEAgent *customice_agent_new(const gchar *name);
 
+/* Fast-connect agent for servers with known addresses: only the configured
+ * host addresses become candidates, no STUN, TURN or UPnP server is ever
+ * asked, and checks are paced as fast as libnice allows. Each address is
+ * "LOCAL" or "LOCAL=PUBLIC" behind a 1:1 NAT, in which case PUBLIC is
+ * advertised instead. */
+CustomICEAgent *customice_agent_new_lite(const gchar *name, const gchar *const *host_addresses);
+
+/* Lite agent without libnice, its sessions send and receive on the shared
+ * port of @mux, which has to outlive the agent. The SDP has to carry
+ * a=ice-lite, so the peer takes the controlling role and nominates */
+CustomICEAgent *customice_agent_new_muxed(const gchar *name, const gchar *const *host_addresses, UdpMux *mux);
+
+/* Runs every transport the agent hands out through @scenario, in the
+ * given @directions. @seed tells the agent apart from others sharing the
+ * scenario and keeps its loss pattern the same from one run to the next */
+void customice_agent_set_impairment(CustomICEAgent *agent, ImpairScenario *scenario, ImpairDirection directions, guint32 seed);
+
 G_END_DECLS
 
 #endif /* __CUSTOM_AGENT_H__ */
\ No newline at end of file
@@ -0,0 +1,244 @@
+#include "custom_transport.h"
+#include <gst/app/app.h>
+
+/* Host candidate priority with type preference 126 (RFC 8445 5.1.2.1) */
+#define HOST_CANDIDATE_PRIORITY(index, component_id) ((126u << 24) | ((65535u - (index)) << 8) | (256u - (component_id)))
+
+struct _CustomICETransport {
+  GstWebRTCICETransport parent;
+  UdpMux *mux;
+  /* Not the object lock, which the mux threads take on a state change while
+   * the session is locked */
+  GMutex session_lock;
+  UdpMuxSession *session;
+};
+
+struct _CustomICEStream {
+  GstWebRTCICEStream parent;
+  UdpMux *mux;
+  gchar **addresses;
+  GstWebRTCICEOnCandidateFunc on_candidate;
+  gpointer on_candidate_data;
+
+  CustomICETransport *transports[2];
+  gchar *ufrag;
+  gchar *pwd;
+};
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE(CustomICETransport, customice_transport, GST_TYPE_WEBRTC_ICE_TRANSPORT)
+G_DEFINE_TYPE(CustomICEStream, customice_stream, GST_TYPE_WEBRTC_ICE_STREAM)
+/* *INDENT-ON* */
+
+static void customice_transport_receive(const guint8 *data, gsize size, gpointer user_data) {
+  GstWebRTCICETransport *transport = GST_WEBRTC_ICE_TRANSPORT(user_data);
+
+  gst_app_src_push_buffer(GST_APP_SRC(transport->src), gst_buffer_new_memdup(data, size));
+}
+
+static void customice_transport_selected(gpointer user_data) {
+  GstWebRTCICETransport *transport = GST_WEBRTC_ICE_TRANSPORT(user_data);
+
+  gst_webrtc_ice_transport_connection_state_change(transport, GST_WEBRTC_ICE_CONNECTION_STATE_CONNECTED);
+  gst_webrtc_ice_transport_selected_pair_change(transport);
+}
+
+/* A fragmented frame comes down as a buffer list from the payloader through
+ * srtpenc, and goes out in one batch */
+static void customice_transport_send_list(CustomICETransport *transport, GstBufferList *list) {
+  GstBuffer *buffers[UDP_MUX_BATCH_SIZE];
+  GstMapInfo maps[UDP_MUX_BATCH_SIZE];
+  UdpMuxPacket packets[UDP_MUX_BATCH_SIZE];
+  guint i, n, offset, length;
+
+  length = gst_buffer_list_length(list);
+  for (offset = 0; offset < length; offset += UDP_MUX_BATCH_SIZE) {
+    n = 0;
+    for (i = offset; i < MIN(length, offset + UDP_MUX_BATCH_SIZE); i++) {
+      buffers[n] = gst_buffer_list_get(list, i);
+      if (!gst_buffer_map(buffers[n], &maps[n], GST_MAP_READ))
+        continue;
+      packets[n].data = maps[n].data;
+      packets[n].size = maps[n].size;
+      n++;
+    }
+
+    udp_mux_session_send_many(transport->session, packets, n);
+
+    for (i = 0; i < n; i++)
+      gst_buffer_unmap(buffers[i], &maps[i]);
+  }
+}
+
+static GstFlowReturn customice_transport_new_sample(GstAppSink *appsink, gpointer user_data) {
+  CustomICETransport *transport = CUSTOMICE_TRANSPORT(user_data);
+  GstSample *sample;
+  GstBuffer *buffer;
+  GstBufferList *list;
+  GstMapInfo map;
+
+  sample = gst_app_sink_pull_sample(appsink);
+  if (sample == NULL)
+    return GST_FLOW_EOS;
+
+  /* Dropped like nicesink does while no pair is selected */
+  g_mutex_lock(&transport->session_lock);
+  if (transport->session != NULL) {
+    list = gst_sample_get_buffer_list(sample);
+    buffer = gst_sample_get_buffer(sample);
+    if (list != NULL) {
+      customice_transport_send_list(transport, list);
+    } else if (buffer != NULL && gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+      udp_mux_session_send(transport->session, map.data, map.size);
+      gst_buffer_unmap(buffer, &map);
+    }
+  }
+  g_mutex_unlock(&transport->session_lock);
+
+  gst_sample_unref(sample);
+  return GST_FLOW_OK;
+}
+
+static void customice_transport_constructed(GObject *object) {
+  GstWebRTCICETransport *transport = GST_WEBRTC_ICE_TRANSPORT(object);
+  GstAppSinkCallbacks callbacks = {NULL};
+
+  G_OBJECT_CLASS(customice_transport_parent_class)->constructed(object);
+
+  /* webrtcbin adds both to its transport bins, like nicesrc and nicesink.
+   * We keep our own refs, the mux threads may still call back while the
+   * bins go away */
+  transport->src = gst_object_ref_sink(gst_element_factory_make("appsrc", NULL));
+  g_object_set(transport->src, "is-live", TRUE, "do-timestamp", TRUE, "format", GST_FORMAT_TIME, NULL);
+  gst_util_set_object_arg(G_OBJECT(transport->src), "leaky-type", "downstream");
+
+  transport->sink = gst_object_ref_sink(gst_element_factory_make("appsink", NULL));
+  g_object_set(transport->sink, "sync", FALSE, "async", FALSE, "enable-last-sample", FALSE, "buffer-list", TRUE, NULL);
+  callbacks.new_sample = customice_transport_new_sample;
+  gst_app_sink_set_callbacks(GST_APP_SINK(transport->sink), &callbacks, transport, NULL);
+}
+
+static void customice_transport_finalize(GObject *object) {
+  CustomICETransport *transport = CUSTOMICE_TRANSPORT(object);
+  GstWebRTCICETransport *ice_transport = GST_WEBRTC_ICE_TRANSPORT(object);
+  GstAppSinkCallbacks callbacks = {NULL};
+
+  gst_app_sink_set_callbacks(GST_APP_SINK(ice_transport->sink), &callbacks, NULL, NULL);
+  if (transport->session != NULL)
+    udp_mux_session_free(transport->session);
+  gst_object_unref(ice_transport->sink);
+  gst_object_unref(ice_transport->src);
+  g_mutex_clear(&transport->session_lock);
+
+  G_OBJECT_CLASS(customice_transport_parent_class)->finalize(object);
+}
+
+static void customice_transport_class_init(CustomICETransportClass *klass) {
+  GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+
+  gobject_class->constructed = customice_transport_constructed;
+  gobject_class->finalize = customice_transport_finalize;
+}
+
+static void customice_transport_init(CustomICETransport *transport) {
+  g_mutex_init(&transport->session_lock);
+}
+
+static gboolean customice_transport_set_local_credentials(CustomICETransport *transport, const gchar *ufrag, const gchar *pwd) {
+  UdpMuxSession *session, *old_session;
+
+  session = udp_mux_session_new(transport->mux, ufrag, pwd, customice_transport_receive, customice_transport_selected, transport);
+  if (session == NULL)
+    return FALSE;
+
+  g_mutex_lock(&transport->session_lock);
+  old_session = transport->session;
+  transport->session = session;
+  g_mutex_unlock(&transport->session_lock);
+
+  if (old_session != NULL)
+    udp_mux_session_free(old_session);
+  return TRUE;
+}
+
+static GstWebRTCICETransport *customice_stream_find_transport(GstWebRTCICEStream *ice_stream, GstWebRTCICEComponent component) {
+  CustomICEStream *stream = CUSTOMICE_STREAM(ice_stream);
+
+  if (stream->transports[component] == NULL) {
+    stream->transports[component] = g_object_new(CUSTOMICE_TYPE_TRANSPORT, "component", component, NULL);
+    stream->transports[component]->mux = stream->mux;
+    if (component == GST_WEBRTC_ICE_COMPONENT_RTP && stream->ufrag != NULL)
+      customice_transport_set_local_credentials(stream->transports[component], stream->ufrag, stream->pwd);
+  }
+
+  return gst_object_ref(GST_WEBRTC_ICE_TRANSPORT(stream->transports[component]));
+}
+
+static gboolean customice_stream_gather_candidates(GstWebRTCICEStream *ice_stream) {
+  CustomICEStream *stream = CUSTOMICE_STREAM(ice_stream);
+  GstWebRTCICETransport *transport;
+  guint i;
+
+  if (stream->ufrag == NULL)
+    return FALSE;
+
+  /* Nothing to wait for, every candidate is known up front */
+  transport = customice_stream_find_transport(ice_stream, GST_WEBRTC_ICE_COMPONENT_RTP);
+  gst_webrtc_ice_transport_gathering_state_change(transport, GST_WEBRTC_ICE_GATHERING_STATE_GATHERING);
+  for (i = 0; stream->addresses[i] != NULL; i++) {
+    gchar *candidate = g_strdup_printf("candidate:%u 1 UDP %u %s %u typ host", i + 1, HOST_CANDIDATE_PRIORITY(i, 1), stream->addresses[i], udp_mux_get_port(stream->mux));
+
+    stream->on_candidate(NULL, ice_stream->stream_id, candidate, stream->on_candidate_data);
+    g_free(candidate);
+  }
+  gst_webrtc_ice_transport_gathering_state_change(transport, GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE);
+  gst_object_unref(transport);
+
+  return TRUE;
+}
+
+static void customice_stream_finalize(GObject *object) {
+  CustomICEStream *stream = CUSTOMICE_STREAM(object);
+
+  g_clear_object(&stream->transports[GST_WEBRTC_ICE_COMPONENT_RTP]);
+  g_clear_object(&stream->transports[GST_WEBRTC_ICE_COMPONENT_RTCP]);
+  g_strfreev(stream->addresses);
+  g_free(stream->ufrag);
+  g_free(stream->pwd);
+
+  G_OBJECT_CLASS(customice_stream_parent_class)->finalize(object);
+}
+
+static void customice_stream_class_init(CustomICEStreamClass *klass) {
+  GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+  GstWebRTCICEStreamClass *stream_class = GST_WEBRTC_ICE_STREAM_CLASS(klass);
+
+  gobject_class->finalize = customice_stream_finalize;
+  stream_class->find_transport = customice_stream_find_transport;
+  stream_class->gather_candidates = customice_stream_gather_candidates;
+}
+
+static void customice_stream_init(G_GNUC_UNUSED CustomICEStream *stream) {
+}
+
+CustomICEStream *customice_stream_new(guint stream_id, UdpMux *mux, const gchar *const *addresses, GstWebRTCICEOnCandidateFunc on_candidate, gpointer user_data) {
+  CustomICEStream *stream;
+
+  stream = g_object_new(CUSTOMICE_TYPE_STREAM, "stream-id", stream_id, NULL);
+  stream->mux = mux;
+  stream->addresses = g_strdupv((gchar **)addresses);
+  stream->on_candidate = on_candidate;
+  stream->on_candidate_data = user_data;
+  return stream;
+}
+
+gboolean customice_stream_set_local_credentials(CustomICEStream *stream, const gchar *ufrag, const gchar *pwd) {
+  g_free(stream->ufrag);
+  g_free(stream->pwd);
+  stream->ufrag = g_strdup(ufrag);
+  stream->pwd = g_strdup(pwd);
+
+  if (stream->transports[GST_WEBRTC_ICE_COMPONENT_RTP] == NULL)
+    return TRUE;
+  return customice_transport_set_local_credentials(stream->transports[GST_WEBRTC_ICE_COMPONENT_RTP], ufrag, pwd);
+}
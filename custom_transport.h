@@ -0,0 +1,32 @@
+#ifndef __CUSTOM_TRANSPORT_H__
+#define __CUSTOM_TRANSPORT_H__
+
+#define GST_USE_UNSTABLE_API
+#include <gst/webrtc/ice.h>
+
+#include "webrtc-udpmux.h"
+
+G_BEGIN_DECLS
+
+/* ICE stream and transport of the custom agent on a shared UdpMux: the
+ * transport hands webrtcbin an appsrc and an appsink in place of nicesrc
+ * and nicesink, and only the RTP component is ever connected, webrtcbin
+ * always muxes RTCP with RTP */
+
+#define CUSTOMICE_TYPE_TRANSPORT (customice_transport_get_type())
+G_DECLARE_FINAL_TYPE(CustomICETransport, customice_transport, CUSTOMICE, TRANSPORT, GstWebRTCICETransport)
+
+#define CUSTOMICE_TYPE_STREAM (customice_stream_get_type())
+G_DECLARE_FINAL_TYPE(CustomICEStream, customice_stream, CUSTOMICE, STREAM, GstWebRTCICEStream)
+
+/* Gathering announces a host candidate on the mux port for each of
+ * @addresses through @on_candidate, @user_data has to outlive the stream */
+CustomICEStream *customice_stream_new(guint stream_id, UdpMux *mux, const gchar *const *addresses, GstWebRTCICEOnCandidateFunc on_candidate, gpointer user_data);
+
+/* Registers the stream with the mux under @ufrag, replacing the previous
+ * credentials on an ICE restart */
+gboolean customice_stream_set_local_credentials(CustomICEStream *stream, const gchar *ufrag, const gchar *pwd);
+
+G_END_DECLS
+
+#endif /* __CUSTOM_TRANSPORT_H__ */
@@ -224,11 +224,17 @@ public class WebRTCSendRecv {
 			sdpMessage.parseBuffer(sdpStr);
 			webRTCBin.setRemoteDescription(new WebRTCSessionDescription(WebRTCSDPType.ANSWER, sdpMessage));
 		} else if (json.containsKey("ice")) {
-			JsonObject iceJson = json.getJsonObject("ice");
-			String candidate = iceJson.getString("candidate");
-			int sdpMLineIndex = iceJson.getInt("sdpMLineIndex");
-			LOG.info(() -> "Adding ICE candidate : " + candidate);
-			webRTCBin.addIceCandidate(sdpMLineIndex, candidate);
+			// A single candidate, or a batch of them
+			JsonValue ice = json.get("ice");
+			List<JsonObject> candidates = ice.getValueType() == JsonValue.ValueType.ARRAY
+					? ice.asJsonArray().getValuesAs(JsonObject.class)
+					: List.of(ice.asJsonObject());
+			for (JsonObject iceJson : candidates) {
+				String candidate = iceJson.getString("candidate");
+				int sdpMLineIndex = iceJson.getInt("sdpMLineIndex");
+				LOG.info(() -> "Adding ICE candidate : " + candidate);
+				webRTCBin.addIceCandidate(sdpMLineIndex, candidate);
+			}
 		}
 	}
 
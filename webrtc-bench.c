@@ -0,0 +1,650 @@
+/*
+ * Load generator for webrtc-unidirectional-h264: starts the server in
+ * --benchmark mode, connects N headless viewers to it over loopback and
+ * reports what every viewer costs the server.
+ *
+ * Latency is measured per decoded frame from the RTCP sender report
+ * timestamps, which the server puts on its pipeline clock in --benchmark
+ * mode, so server and viewers have to run on the same host.
+ */
+#include <glib.h>
+#include <gst/gst.h>
+#include <gst/sdp/sdp.h>
+
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define GST_USE_UNSTABLE_API
+#include <gst/webrtc/webrtc.h>
+
+#include <json-glib/json-glib.h>
+#include <libsoup/soup.h>
+#include <stdio.h>
+#include <string.h>
+
+#define SOUP_HTTP_PORT 57778
+#define SERVER_START_TIMEOUT_SECONDS 10
+#define VIEWER_CONNECT_INTERVAL_MS 50
+
+typedef struct _BenchViewer BenchViewer;
+
+struct _BenchViewer {
+  guint index;
+  SoupWebsocketConnection *connection;
+  GstElement *pipeline;
+  GstElement *webrtcbin;
+  gint64 connect_time;
+  gint64 first_frame_time;
+};
+
+typedef struct _ProcessUsage {
+  gdouble cpu_seconds;
+  gdouble rss_mib;
+  guint threads;
+  /* Voluntary and involuntary, summed over the live threads */
+  guint64 context_switches;
+} ProcessUsage;
+
+static gchar *server_path = "./webrtc-unidirectional-h264";
+static gchar *server_args = NULL;
+static gchar *server_url = NULL;
+static gint n_viewers = 8;
+static gint warmup_seconds = 5;
+static gint duration_seconds = 20;
+
+static GOptionEntry entries[] = {
+    {"server", 0, 0, G_OPTION_ARG_FILENAME, &server_path, "Server binary to start, empty to use an already running server", "PATH"},
+    {"server-args", 0, 0, G_OPTION_ARG_STRING, &server_args, "Extra arguments for the server, e.g. \"--shared-encode\"", "ARGS"},
+    {"url", 0, 0, G_OPTION_ARG_STRING, &server_url, "Websocket URL of the server (default: ws://127.0.0.1:57778/ws)", "URL"},
+    {"viewers", 0, 0, G_OPTION_ARG_INT, &n_viewers, "Number of viewers", "N"},
+    {"warmup", 0, 0, G_OPTION_ARG_INT, &warmup_seconds, "Seconds to wait after the last viewer connected before measuring", "SECONDS"},
+    {"duration", 0, 0, G_OPTION_ARG_INT, &duration_seconds, "Seconds to measure", "SECONDS"},
+    {NULL},
+};
+
+static GMainLoop *loop = NULL;
+static SoupSession *session = NULL;
+static GPtrArray *viewers = NULL;
+static GstCaps *ntp_timestamp_caps = NULL;
+static GstClock *system_clock = NULL;
+static GPid server_pid = 0;
+
+/* Filled from streaming threads */
+static GMutex latencies_lock;
+static GArray *latencies = NULL; /* gdouble, ms */
+static gboolean measuring = FALSE;
+
+typedef struct _PendingText {
+  BenchViewer *viewer;
+  gchar *text;
+} PendingText;
+
+static gboolean send_pending_text(gpointer user_data) {
+  PendingText *pending = (PendingText *)user_data;
+
+  if (pending->viewer->connection != NULL && soup_websocket_connection_get_state(pending->viewer->connection) == SOUP_WEBSOCKET_STATE_OPEN)
+    soup_websocket_connection_send_text(pending->viewer->connection, pending->text);
+
+  g_free(pending->text);
+  g_free(pending);
+  return G_SOURCE_REMOVE;
+}
+
+/* Called from webrtcbin threads, the websocket is only touched from the
+ * main loop */
+static void send_json(BenchViewer *viewer, const gchar *type, JsonObject *data) {
+  PendingText *pending;
+  JsonObject *object;
+  JsonNode *root;
+  JsonGenerator *generator;
+  gchar *text;
+
+  object = json_object_new();
+  json_object_set_string_member(object, "type", type);
+  json_object_set_object_member(object, "data", data);
+
+  root = json_node_init_object(json_node_alloc(), object);
+  generator = json_generator_new();
+  json_generator_set_root(generator, root);
+  text = json_generator_to_data(generator, NULL);
+
+  pending = g_new0(PendingText, 1);
+  pending->viewer = viewer;
+  pending->text = text;
+  g_idle_add(send_pending_text, pending);
+
+  g_object_unref(generator);
+  json_node_free(root);
+  json_object_unref(object);
+}
+
+static GstPadProbeReturn on_rendered_frame(G_GNUC_UNUSED GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  BenchViewer *viewer = (BenchViewer *)user_data;
+  GstReferenceTimestampMeta *meta;
+  GstClockTime now;
+
+  /* Same clock as the server pipeline, which runs on this host */
+  now = gst_clock_get_time(system_clock);
+
+  g_mutex_lock(&latencies_lock);
+  if (viewer->first_frame_time == 0)
+    viewer->first_frame_time = g_get_monotonic_time();
+
+  /* Only there once the first sender report arrived */
+  meta = gst_buffer_get_reference_timestamp_meta(GST_PAD_PROBE_INFO_BUFFER(info), ntp_timestamp_caps);
+  if (measuring && meta != NULL && now > meta->timestamp) {
+    gdouble latency = (gdouble)(now - meta->timestamp) / GST_MSECOND;
+    g_array_append_val(latencies, latency);
+  }
+  g_mutex_unlock(&latencies_lock);
+
+  return GST_PAD_PROBE_OK;
+}
+
+static void on_decoded_pad(G_GNUC_UNUSED GstElement *decodebin, GstPad *pad, BenchViewer *viewer) {
+  GstElement *sink;
+  GstPad *sinkpad;
+
+  /* Rendering is simulated by a synchronized fakesink, so latency includes
+   * waiting for the render time like a real video sink would */
+  sink = gst_element_factory_make_full("fakesink", "sync", TRUE, "async", FALSE, NULL);
+  gst_bin_add(GST_BIN(viewer->pipeline), sink);
+  gst_element_sync_state_with_parent(sink);
+
+  sinkpad = gst_element_get_static_pad(sink, "sink");
+  gst_pad_add_probe(sinkpad, GST_PAD_PROBE_TYPE_BUFFER, on_rendered_frame, viewer, NULL);
+  gst_pad_link(pad, sinkpad);
+  gst_object_unref(sinkpad);
+}
+
+static void on_incoming_stream(G_GNUC_UNUSED GstElement *webrtcbin, GstPad *pad, BenchViewer *viewer) {
+  GstElement *element;
+  GstCaps *caps;
+  GstPad *sinkpad;
+  const gchar *media;
+
+  if (GST_PAD_DIRECTION(pad) != GST_PAD_SRC)
+    return;
+
+  caps = gst_pad_get_current_caps(pad);
+  media = caps ? gst_structure_get_string(gst_caps_get_structure(caps, 0), "media") : NULL;
+
+  /* Only video is decoded, audio is just drained */
+  if (g_strcmp0(media, "video") == 0) {
+    element = gst_element_factory_make("decodebin", NULL);
+    g_signal_connect(element, "pad-added", G_CALLBACK(on_decoded_pad), viewer);
+  } else {
+    element = gst_element_factory_make_full("fakesink", "sync", FALSE, "async", FALSE, NULL);
+  }
+  if (caps != NULL)
+    gst_caps_unref(caps);
+
+  gst_bin_add(GST_BIN(viewer->pipeline), element);
+  gst_element_sync_state_with_parent(element);
+
+  sinkpad = gst_element_get_static_pad(element, "sink");
+  gst_pad_link(pad, sinkpad);
+  gst_object_unref(sinkpad);
+}
+
+static void on_ice_candidate(G_GNUC_UNUSED GstElement *webrtcbin, guint mline_index, gchar *candidate, BenchViewer *viewer) {
+  JsonObject *data;
+
+  data = json_object_new();
+  json_object_set_int_member(data, "sdpMLineIndex", mline_index);
+  json_object_set_string_member(data, "candidate", candidate);
+  send_json(viewer, "ice", data);
+}
+
+static void on_answer_created(GstPromise *promise, gpointer user_data) {
+  BenchViewer *viewer = (BenchViewer *)user_data;
+  GstWebRTCSessionDescription *answer = NULL;
+  const GstStructure *reply;
+  JsonObject *data;
+  gchar *sdp_string;
+
+  reply = gst_promise_get_reply(promise);
+  if (reply != NULL)
+    gst_structure_get(reply, "answer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &answer, NULL);
+  gst_promise_unref(promise);
+
+  if (answer == NULL) {
+    gst_printerr("Viewer %u could not create an answer\n", viewer->index);
+    return;
+  }
+
+  g_signal_emit_by_name(viewer->webrtcbin, "set-local-description", answer, NULL);
+
+  sdp_string = gst_sdp_message_as_text(answer->sdp);
+  data = json_object_new();
+  json_object_set_string_member(data, "type", "answer");
+  json_object_set_string_member(data, "sdp", sdp_string);
+  send_json(viewer, "sdp", data);
+
+  g_free(sdp_string);
+  gst_webrtc_session_description_free(answer);
+}
+
+static void on_offer_set(GstPromise *promise, gpointer user_data) {
+  BenchViewer *viewer = (BenchViewer *)user_data;
+
+  gst_promise_unref(promise);
+  promise = gst_promise_new_with_change_func(on_answer_created, viewer, NULL);
+  g_signal_emit_by_name(viewer->webrtcbin, "create-answer", NULL, promise);
+}
+
+static void on_server_message(G_GNUC_UNUSED SoupWebsocketConnection *connection, SoupWebsocketDataType data_type, GBytes *message, gpointer user_data) {
+  BenchViewer *viewer = (BenchViewer *)user_data;
+  JsonParser *parser;
+  JsonObject *object, *data;
+  const gchar *type;
+  gconstpointer bytes;
+  gsize size;
+
+  if (data_type != SOUP_WEBSOCKET_DATA_TEXT)
+    return;
+
+  bytes = g_bytes_get_data(message, &size);
+  parser = json_parser_new();
+  if (!json_parser_load_from_data(parser, bytes, size, NULL) || !JSON_NODE_HOLDS_OBJECT(json_parser_get_root(parser)))
+    goto out;
+
+  object = json_node_get_object(json_parser_get_root(parser));
+  if (!json_object_has_member(object, "type") || !json_object_has_member(object, "data"))
+    goto out;
+  type = json_object_get_string_member(object, "type");
+  data = JSON_NODE_HOLDS_OBJECT(json_object_get_member(object, "data")) ? json_object_get_object_member(object, "data") : NULL;
+
+  if (g_strcmp0(type, "sdp") == 0 && data != NULL) {
+    GstSDPMessage *sdp;
+    GstWebRTCSessionDescription *offer;
+    GstPromise *promise;
+    const gchar *sdp_string = json_object_get_string_member(data, "sdp");
+
+    gst_sdp_message_new(&sdp);
+    if (gst_sdp_message_parse_buffer((const guint8 *)sdp_string, strlen(sdp_string), sdp) != GST_SDP_OK) {
+      gst_sdp_message_free(sdp);
+      goto out;
+    }
+
+    offer = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_OFFER, sdp);
+    promise = gst_promise_new_with_change_func(on_offer_set, viewer, NULL);
+    g_signal_emit_by_name(viewer->webrtcbin, "set-remote-description", offer, promise);
+    gst_webrtc_session_description_free(offer);
+  } else if (g_strcmp0(type, "ice") == 0 && JSON_NODE_HOLDS_ARRAY(json_object_get_member(object, "data"))) {
+    /* The server batches its candidates */
+    JsonArray *candidates = json_object_get_array_member(object, "data");
+    guint i;
+
+    for (i = 0; i < json_array_get_length(candidates); i++) {
+      data = json_array_get_object_element(candidates, i);
+      g_signal_emit_by_name(viewer->webrtcbin, "add-ice-candidate", (guint)json_object_get_int_member(data, "sdpMLineIndex"), json_object_get_string_member(data, "candidate"));
+    }
+  }
+
+out:
+  g_object_unref(parser);
+}
+
+static gboolean create_viewer_pipeline(BenchViewer *viewer) {
+  GstElement *rtpbin;
+
+  viewer->pipeline = gst_pipeline_new(NULL);
+  /* No stun-server, loopback host candidates are all we need */
+  viewer->webrtcbin = gst_element_factory_make_full("webrtcbin", "bundle-policy", GST_WEBRTC_BUNDLE_POLICY_MAX_BUNDLE, NULL);
+  if (viewer->webrtcbin == NULL)
+    return FALSE;
+  gst_bin_add(GST_BIN(viewer->pipeline), viewer->webrtcbin);
+
+  rtpbin = gst_bin_get_by_name(GST_BIN(viewer->webrtcbin), "rtpbin");
+  g_object_set(rtpbin, "add-reference-timestamp-meta", TRUE, NULL);
+  gst_object_unref(rtpbin);
+
+  g_signal_connect(viewer->webrtcbin, "on-ice-candidate", G_CALLBACK(on_ice_candidate), viewer);
+  g_signal_connect(viewer->webrtcbin, "pad-added", G_CALLBACK(on_incoming_stream), viewer);
+
+  return gst_element_set_state(viewer->pipeline, GST_STATE_PLAYING) != GST_STATE_CHANGE_FAILURE;
+}
+
+static void on_viewer_connected(SoupSession *soup_session, GAsyncResult *res, gpointer user_data) {
+  BenchViewer *viewer = (BenchViewer *)user_data;
+  GError *error = NULL;
+
+  viewer->connection = soup_session_websocket_connect_finish(soup_session, res, &error);
+  if (error != NULL) {
+    gst_printerr("Viewer %u could not connect: %s\n", viewer->index, error->message);
+    g_error_free(error);
+    return;
+  }
+
+  g_signal_connect(viewer->connection, "message", G_CALLBACK(on_server_message), viewer);
+}
+
+static gboolean connect_next_viewer(G_GNUC_UNUSED gpointer user_data) {
+  BenchViewer *viewer;
+  SoupMessage *message;
+
+  viewer = g_new0(BenchViewer, 1);
+  viewer->index = viewers->len;
+  g_ptr_array_add(viewers, viewer);
+
+  if (!create_viewer_pipeline(viewer)) {
+    gst_printerr("Could not create viewer pipeline\n");
+    g_main_loop_quit(loop);
+    return G_SOURCE_REMOVE;
+  }
+
+  viewer->connect_time = g_get_monotonic_time();
+  message = soup_message_new(SOUP_METHOD_GET, server_url);
+  soup_session_websocket_connect_async(session, message, NULL, NULL, NULL, (GAsyncReadyCallback)on_viewer_connected, viewer);
+  g_object_unref(message);
+
+  return viewers->len < (guint)n_viewers ? G_SOURCE_CONTINUE : G_SOURCE_REMOVE;
+}
+
+static void free_viewer(gpointer viewer_ptr) {
+  BenchViewer *viewer = (BenchViewer *)viewer_ptr;
+
+  if (viewer->connection != NULL) {
+    if (soup_websocket_connection_get_state(viewer->connection) == SOUP_WEBSOCKET_STATE_OPEN)
+      soup_websocket_connection_close(viewer->connection, 1000, "");
+    g_object_unref(viewer->connection);
+  }
+  if (viewer->pipeline != NULL) {
+    gst_element_set_state(viewer->pipeline, GST_STATE_NULL);
+    gst_object_unref(viewer->pipeline);
+  }
+  g_free(viewer);
+}
+
+static guint64 parse_status_field(const gchar *contents, const gchar *name) {
+  const gchar *field = strstr(contents, name);
+
+  return field != NULL ? g_ascii_strtoull(field + strlen(name), NULL, 10) : 0;
+}
+
+/* The ones in /proc/<pid>/status only count the main thread */
+static guint64 get_context_switches(GPid pid) {
+  gchar *path, *contents;
+  const gchar *name;
+  GDir *dir;
+  guint64 total = 0;
+
+  path = g_strdup_printf("/proc/%d/task", (gint)pid);
+  dir = g_dir_open(path, 0, NULL);
+  g_free(path);
+  if (dir == NULL)
+    return 0;
+
+  while ((name = g_dir_read_name(dir)) != NULL) {
+    path = g_strdup_printf("/proc/%d/task/%s/status", (gint)pid, name);
+    if (g_file_get_contents(path, &contents, NULL, NULL)) {
+      total += parse_status_field(contents, "\nvoluntary_ctxt_switches:") + parse_status_field(contents, "nonvoluntary_ctxt_switches:");
+      g_free(contents);
+    }
+    g_free(path);
+  }
+  g_dir_close(dir);
+
+  return total;
+}
+
+/* Stops the server and returns the context switches of every thread it
+ * ever ran, ended ones included, which /proc loses. 0 without wait4() */
+static guint64 stop_server(GPid pid) {
+  guint64 switches = 0;
+
+#ifdef G_OS_UNIX
+  struct rusage usage;
+
+  kill(pid, SIGTERM);
+  if (wait4(pid, NULL, 0, &usage) == pid)
+    switches = usage.ru_nvcsw + usage.ru_nivcsw;
+#endif
+  g_spawn_close_pid(pid);
+
+  return switches;
+}
+
+/* utime + stime, VmRSS, threads and context switches from /proc, FALSE
+ * where there is no procfs */
+static gboolean get_process_usage(GPid pid, ProcessUsage *usage) {
+  gchar *path, *contents;
+  gchar **fields;
+  gchar *rss;
+  gboolean ret = FALSE;
+
+  path = g_strdup_printf("/proc/%d/stat", (gint)pid);
+  if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+    g_free(path);
+    return FALSE;
+  }
+  g_free(path);
+
+  /* The command name may contain spaces, count fields after its ')' */
+  fields = g_strsplit(strrchr(contents, ')') + 2, " ", -1);
+  if (g_strv_length(fields) > 12)
+    usage->cpu_seconds = (g_ascii_strtod(fields[11], NULL) + g_ascii_strtod(fields[12], NULL)) / sysconf(_SC_CLK_TCK);
+  g_strfreev(fields);
+  g_free(contents);
+
+  path = g_strdup_printf("/proc/%d/status", (gint)pid);
+  if (g_file_get_contents(path, &contents, NULL, NULL) && (rss = strstr(contents, "VmRSS:")) != NULL) {
+    usage->rss_mib = g_ascii_strtod(rss + strlen("VmRSS:"), NULL) / 1024.0;
+    usage->threads = parse_status_field(contents, "Threads:");
+    ret = TRUE;
+  }
+  g_free(contents);
+  g_free(path);
+
+  usage->context_switches = get_context_switches(pid);
+  return ret;
+}
+
+static gint compare_double(gconstpointer a, gconstpointer b) {
+  gdouble da = *(const gdouble *)a, db = *(const gdouble *)b;
+  return (da > db) - (da < db);
+}
+
+static void print_percentiles(const gchar *name, GArray *values) {
+  if (values->len == 0) {
+    gst_print("%-24s no samples\n", name);
+    return;
+  }
+
+  g_array_sort(values, compare_double);
+  gst_print("%-24s p50 %7.1f  p90 %7.1f  p99 %7.1f  max %7.1f  (%u samples)\n", name, //
+            g_array_index(values, gdouble, values->len / 2), g_array_index(values, gdouble, values->len * 9 / 10), g_array_index(values, gdouble, values->len * 99 / 100), g_array_index(values, gdouble, values->len - 1), values->len);
+}
+
+static gboolean wait_for_server(void) {
+  GSocketClient *client;
+  gint64 deadline;
+
+  client = g_socket_client_new();
+  deadline = g_get_monotonic_time() + SERVER_START_TIMEOUT_SECONDS * G_USEC_PER_SEC;
+
+  while (g_get_monotonic_time() < deadline) {
+    GSocketConnection *connection = g_socket_client_connect_to_host(client, "127.0.0.1", SOUP_HTTP_PORT, NULL, NULL);
+
+    if (connection != NULL) {
+      g_object_unref(connection);
+      g_object_unref(client);
+      return TRUE;
+    }
+    g_usleep(100 * 1000);
+  }
+
+  g_object_unref(client);
+  return FALSE;
+}
+
+static gboolean stop_measuring(G_GNUC_UNUSED gpointer user_data) {
+  g_main_loop_quit(loop);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean start_measuring(gpointer user_data) {
+  ProcessUsage *usage = (ProcessUsage *)user_data;
+
+  g_mutex_lock(&latencies_lock);
+  measuring = TRUE;
+  g_mutex_unlock(&latencies_lock);
+
+  if (server_pid != 0)
+    get_process_usage(server_pid, usage);
+
+  g_timeout_add_seconds(duration_seconds, stop_measuring, NULL);
+  return G_SOURCE_REMOVE;
+}
+
+#ifdef G_OS_UNIX
+static gboolean exit_sighandler(G_GNUC_UNUSED gpointer user_data) {
+  g_main_loop_quit(loop);
+  return G_SOURCE_REMOVE;
+}
+#endif
+
+int gst_main(int argc, char *argv[]) {
+  GOptionContext *context;
+  GError *error = NULL;
+  ProcessUsage idle = {0}, start = {0}, end = {0};
+  GArray *first_frame_times;
+  guint64 context_switches = 0;
+  guint i, n_started = 0;
+
+  context = g_option_context_new("- load test for webrtc-unidirectional-h264");
+  g_option_context_add_main_entries(context, entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    gst_printerr("Error initializing: %s\n", error->message);
+    return -1;
+  }
+
+  if (n_viewers <= 0 || duration_seconds <= 0) {
+    gst_printerr("--viewers and --duration must be positive\n");
+    return -1;
+  }
+  if (server_url == NULL)
+    server_url = g_strdup_printf("ws://127.0.0.1:%d/ws", SOUP_HTTP_PORT);
+
+  if (server_path != NULL && server_path[0] != '\0') {
+    gchar **extra_argv = NULL;
+    GPtrArray *server_argv = g_ptr_array_new();
+
+    g_ptr_array_add(server_argv, server_path);
+    g_ptr_array_add(server_argv, "--benchmark");
+    if (server_args != NULL && !g_shell_parse_argv(server_args, NULL, &extra_argv, &error)) {
+      gst_printerr("Invalid --server-args: %s\n", error->message);
+      return -1;
+    }
+    for (i = 0; extra_argv != NULL && extra_argv[i] != NULL; i++)
+      g_ptr_array_add(server_argv, extra_argv[i]);
+    g_ptr_array_add(server_argv, NULL);
+
+    if (!g_spawn_async(NULL, (gchar **)server_argv->pdata, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL, NULL, NULL, &server_pid, &error)) {
+      gst_printerr("Could not start %s: %s\n", server_path, error->message);
+      return -1;
+    }
+    g_ptr_array_unref(server_argv);
+    g_strfreev(extra_argv);
+
+    if (!wait_for_server()) {
+      gst_printerr("Server did not come up within %d seconds\n", SERVER_START_TIMEOUT_SECONDS);
+      goto out;
+    }
+    get_process_usage(server_pid, &idle);
+  }
+
+  ntp_timestamp_caps = gst_caps_new_empty_simple("timestamp/x-ntp");
+  latencies = g_array_new(FALSE, FALSE, sizeof(gdouble));
+  viewers = g_ptr_array_new_with_free_func(free_viewer);
+  session = soup_session_new();
+  system_clock = gst_system_clock_obtain();
+  loop = g_main_loop_new(NULL, FALSE);
+
+#ifdef G_OS_UNIX
+  g_unix_signal_add(SIGINT, exit_sighandler, NULL);
+#endif
+
+  gst_print("Connecting %d viewers to %s\n", n_viewers, server_url);
+  connect_next_viewer(NULL);
+  if (n_viewers > 1)
+    g_timeout_add(VIEWER_CONNECT_INTERVAL_MS, connect_next_viewer, NULL);
+  g_timeout_add((n_viewers * VIEWER_CONNECT_INTERVAL_MS) + warmup_seconds * 1000, start_measuring, &start);
+
+  g_main_loop_run(loop);
+
+  if (server_pid != 0) {
+    get_process_usage(server_pid, &end);
+    context_switches = stop_server(server_pid);
+    server_pid = 0;
+  }
+
+  g_mutex_lock(&latencies_lock);
+  measuring = FALSE;
+  first_frame_times = g_array_new(FALSE, FALSE, sizeof(gdouble));
+  for (i = 0; i < viewers->len; i++) {
+    BenchViewer *viewer = g_ptr_array_index(viewers, i);
+
+    if (viewer->first_frame_time != 0) {
+      gdouble ttff = (gdouble)(viewer->first_frame_time - viewer->connect_time) / 1000.0;
+      g_array_append_val(first_frame_times, ttff);
+      n_started++;
+    }
+  }
+  g_mutex_unlock(&latencies_lock);
+
+  gst_print("\nviewers                  %u requested, %u playing\n", viewers->len, n_started);
+  if (end.cpu_seconds > 0) {
+    gdouble cpu = 100.0 * (end.cpu_seconds - start.cpu_seconds) / duration_seconds;
+
+    gst_print("server cpu               %.1f%% total, %.2f%% per viewer\n", cpu, cpu / MAX(n_started, 1));
+    gst_print("server rss               %.1f MiB idle, %.1f MiB loaded, %.2f MiB per viewer\n", idle.rss_mib, end.rss_mib, (end.rss_mib - idle.rss_mib) / MAX(n_started, 1));
+    gst_print("server threads           %u idle, %u loaded, %.1f per viewer\n", idle.threads, end.threads, (gdouble)((gint)end.threads - (gint)idle.threads) / MAX(n_started, 1));
+    /* Threads that ended during the measurement still count, as do the
+     * few that ended before it while the server started up */
+    if (context_switches > start.context_switches) {
+      gdouble switches = (gdouble)(context_switches - start.context_switches) / duration_seconds;
+
+      gst_print("server context switches  %.0f/s, %.1f/s per viewer\n", switches, switches / MAX(n_started, 1));
+    }
+  }
+  print_percentiles("time to first frame ms", first_frame_times);
+  print_percentiles("latency ms", latencies);
+  g_array_unref(first_frame_times);
+
+  g_ptr_array_unref(viewers);
+  g_object_unref(session);
+  g_main_loop_unref(loop);
+  g_array_unref(latencies);
+  gst_caps_unref(ntp_timestamp_caps);
+  gst_object_unref(system_clock);
+
+out:
+  if (server_pid != 0)
+    stop_server(server_pid);
+
+  return n_started == (guint)n_viewers ? 0 : 1;
+}
+
+#ifdef __APPLE__
+int mac_main_function(int argc, char **argv, gpointer user_data) {
+  gst_init(&argc, &argv);
+  return gst_main(argc, argv);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+#ifdef __APPLE__
+  gst_macos_main(mac_main_function, argc, argv, NULL);
+#else
+  gst_init(&argc, &argv);
+  return gst_main(argc, argv);
+#endif
+}
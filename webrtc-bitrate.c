@@ -0,0 +1,233 @@
+#include "webrtc-bitrate.h"
+
+#define GST_USE_UNSTABLE_API
+#include <gst/webrtc/webrtc.h>
+
+#define BITRATE_INTERVAL_MS 500
+#define BITRATE_MIN 100000
+#define BITRATE_MAX 2500000
+#define BITRATE_START 500000
+/* Loss thresholds and reactions of the loss based half of Google Congestion
+ * Control */
+#define BITRATE_LOSS_HIGH 0.10
+#define BITRATE_LOSS_LOW 0.02
+#define BITRATE_INCREASE_FACTOR 1.08
+/* Queues building up on the path show as RTT growing over its minimum long
+ * before anything is lost */
+#define BITRATE_RTT_OVERUSE 1.5
+#define BITRATE_OVERUSE_FACTOR 0.85
+/* Leave room for audio, RTP and FEC overhead */
+#define BITRATE_VIDEO_SHARE 0.85
+/* Encoder updates smaller than this aren't worth a rate control reset */
+#define BITRATE_MIN_CHANGE 0.05
+#define BITRATE_UPSWITCH_INTERVALS 4
+
+typedef struct _BitrateStep {
+  guint bitrate; /* bit/s needed to go to this step */
+  gint width;
+  gint height;
+  gint framerate;
+} BitrateStep;
+
+/* Lower framerate first, resolution after that: a smooth small picture
+ * beats a sharp slideshow */
+static const BitrateStep steps[] = {
+    {0, 320, 180, 15},
+    {250000, 640, 360, 15},
+    {600000, 640, 360, 30},
+    {1500000, 1280, 720, 30},
+};
+
+struct _BitrateController {
+  GstElement *webrtcbin;
+  GstElement *encoder;
+  GstElement *capsfilter;
+  StatsCollector *stats;
+  gboolean encoder_in_kbps;
+
+  GSource *timeout_source;
+  gulong aux_sender_id;
+  GMutex lock;
+  GstElement *gcc;
+  gulong gcc_notify_id;
+
+  gint gcc_estimate; /* atomic, bit/s, 0 until rtpgccbwe reports */
+  gdouble estimate;  /* bit/s, from receiver reports */
+  gint64 last_timestamp;
+  gdouble min_rtt;
+
+  guint applied_bitrate;
+  guint step;
+  guint upswitch_intervals;
+};
+
+static void on_gcc_estimated_bitrate(GObject *gcc, G_GNUC_UNUSED GParamSpec *pspec, gpointer user_data) {
+  BitrateController *controller = (BitrateController *)user_data;
+  guint estimated_bitrate;
+
+  /* Streaming thread, picked up by the next bitrate_controller_update() */
+  g_object_get(gcc, "estimated-bitrate", &estimated_bitrate, NULL);
+  g_atomic_int_set(&controller->gcc_estimate, (gint)MIN(estimated_bitrate, G_MAXINT));
+}
+
+static GstElement *on_request_aux_sender(G_GNUC_UNUSED GstElement *webrtcbin, G_GNUC_UNUSED GstWebRTCDTLSTransport *transport, gpointer user_data) {
+  BitrateController *controller = (BitrateController *)user_data;
+  GstElement *gcc;
+
+  gcc = gst_element_factory_make("rtpgccbwe", NULL);
+  if (gcc == NULL)
+    return NULL;
+
+  g_object_set(gcc, "min-bitrate", (guint)BITRATE_MIN, "max-bitrate", (guint)BITRATE_MAX, "estimated-bitrate", (guint)BITRATE_START, NULL);
+
+  /* With max-bundle there is a single transport, hence a single estimator */
+  g_mutex_lock(&controller->lock);
+  if (controller->gcc == NULL) {
+    controller->gcc = gst_object_ref(gcc);
+    controller->gcc_notify_id = g_signal_connect(gcc, "notify::estimated-bitrate", G_CALLBACK(on_gcc_estimated_bitrate), controller);
+  }
+  g_mutex_unlock(&controller->lock);
+
+  gst_print("Using rtpgccbwe for congestion control\n");
+  return gcc;
+}
+
+/* GCC style estimate from the two newest samples: back off by the loss
+ * fraction when loss is high or the RTT shows queues building, probe
+ * upwards slowly while the path is clean */
+static void bitrate_controller_update_estimate(BitrateController *controller) {
+  StatsSample samples[2];
+  guint64 sent, lost;
+  gdouble fraction_lost = 0.0;
+  gdouble sent_bitrate;
+
+  if (stats_collector_get_samples(controller->stats, samples, 2) < 2 || samples[0].timestamp == controller->last_timestamp)
+    return;
+  controller->last_timestamp = samples[0].timestamp;
+
+  sent = samples[0].packets[STATS_OUTBOUND] > samples[1].packets[STATS_OUTBOUND] ? samples[0].packets[STATS_OUTBOUND] - samples[1].packets[STATS_OUTBOUND] : 0;
+  lost = MAX(samples[0].packets_lost[STATS_OUTBOUND] - samples[1].packets_lost[STATS_OUTBOUND], 0);
+  if (sent + lost > 0)
+    fraction_lost = (gdouble)lost / (sent + lost);
+  sent_bitrate = samples[0].bitrate[STATS_OUTBOUND];
+
+  if (samples[0].rtt > 0.0 && (controller->min_rtt == 0.0 || samples[0].rtt < controller->min_rtt))
+    controller->min_rtt = samples[0].rtt;
+
+  if (fraction_lost > BITRATE_LOSS_HIGH)
+    controller->estimate = sent_bitrate * (1.0 - 0.5 * fraction_lost);
+  else if (controller->min_rtt > 0.0 && samples[0].rtt > controller->min_rtt * BITRATE_RTT_OVERUSE)
+    controller->estimate = MIN(controller->estimate, sent_bitrate) * BITRATE_OVERUSE_FACTOR;
+  else if (fraction_lost < BITRATE_LOSS_LOW)
+    controller->estimate = MAX(controller->estimate, sent_bitrate) * BITRATE_INCREASE_FACTOR;
+
+  controller->estimate = CLAMP(controller->estimate, BITRATE_MIN, BITRATE_MAX);
+}
+
+static void bitrate_controller_apply_step(BitrateController *controller, guint step) {
+  GstCaps *caps;
+
+  controller->step = step;
+  caps = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT, steps[step].width, "height", G_TYPE_INT, steps[step].height, "framerate", GST_TYPE_FRACTION, steps[step].framerate, 1, NULL);
+  g_object_set(controller->capsfilter, "caps", caps, NULL);
+  gst_caps_unref(caps);
+}
+
+static void bitrate_controller_apply_bitrate(BitrateController *controller, guint bitrate) {
+  controller->applied_bitrate = bitrate;
+  if (controller->encoder_in_kbps)
+    g_object_set(controller->encoder, "bitrate", bitrate / 1000, NULL);
+  else
+    g_object_set(controller->encoder, "target-bitrate", (gint)bitrate, NULL);
+}
+
+static gboolean bitrate_controller_update(gpointer user_data) {
+  BitrateController *controller = (BitrateController *)user_data;
+  gdouble estimate;
+  guint bitrate;
+  guint target;
+
+  bitrate_controller_update_estimate(controller);
+
+  estimate = g_atomic_int_get(&controller->gcc_estimate);
+  if (estimate == 0)
+    estimate = controller->estimate;
+
+  bitrate = estimate * BITRATE_VIDEO_SHARE;
+  if (ABS((gdouble)bitrate - controller->applied_bitrate) > controller->applied_bitrate * BITRATE_MIN_CHANGE)
+    bitrate_controller_apply_bitrate(controller, bitrate);
+
+  for (target = G_N_ELEMENTS(steps) - 1; target > 0; target--) {
+    if (steps[target].bitrate <= bitrate)
+      break;
+  }
+
+  /* Going down is immediate, going up has to hold for a while since every
+   * caps change costs a keyframe */
+  if (target > controller->step) {
+    if (++controller->upswitch_intervals < BITRATE_UPSWITCH_INTERVALS)
+      return G_SOURCE_CONTINUE;
+  } else if (target == controller->step) {
+    controller->upswitch_intervals = 0;
+    return G_SOURCE_CONTINUE;
+  }
+
+  controller->upswitch_intervals = 0;
+  gst_print("Adapting video to %dx%d@%d at %u kbit/s\n", steps[target].width, steps[target].height, steps[target].framerate, bitrate / 1000);
+  bitrate_controller_apply_step(controller, target);
+
+  return G_SOURCE_CONTINUE;
+}
+
+BitrateController *bitrate_controller_new(GstElement *webrtcbin, GstElement *encoder, GstElement *capsfilter, StatsCollector *stats) {
+  BitrateController *controller;
+  guint step;
+
+  controller = g_new0(BitrateController, 1);
+  controller->webrtcbin = gst_object_ref(webrtcbin);
+  controller->encoder = gst_object_ref(encoder);
+  controller->capsfilter = gst_object_ref(capsfilter);
+  controller->stats = stats;
+  /* A collector backing off to its longest interval on a quiet path would
+   * make the ramp up crawl at one increase every few seconds */
+  stats_collector_pin_interval(stats);
+  controller->encoder_in_kbps = g_object_class_find_property(G_OBJECT_GET_CLASS(encoder), "target-bitrate") == NULL;
+  controller->estimate = BITRATE_START;
+  g_mutex_init(&controller->lock);
+
+  for (step = G_N_ELEMENTS(steps) - 1; step > 0; step--) {
+    if (steps[step].bitrate <= BITRATE_START * BITRATE_VIDEO_SHARE)
+      break;
+  }
+  bitrate_controller_apply_step(controller, step);
+  bitrate_controller_apply_bitrate(controller, BITRATE_START * BITRATE_VIDEO_SHARE);
+
+  controller->aux_sender_id = g_signal_connect(webrtcbin, "request-aux-sender", G_CALLBACK(on_request_aux_sender), controller);
+
+  controller->timeout_source = g_timeout_source_new(BITRATE_INTERVAL_MS);
+  g_source_set_callback(controller->timeout_source, bitrate_controller_update, controller, NULL);
+  g_source_attach(controller->timeout_source, g_main_context_get_thread_default());
+
+  return controller;
+}
+
+void bitrate_controller_free(BitrateController *controller) {
+  g_return_if_fail(controller != NULL);
+
+  g_source_destroy(controller->timeout_source);
+  g_source_unref(controller->timeout_source);
+
+  g_signal_handler_disconnect(controller->webrtcbin, controller->aux_sender_id);
+  g_mutex_lock(&controller->lock);
+  if (controller->gcc != NULL) {
+    g_signal_handler_disconnect(controller->gcc, controller->gcc_notify_id);
+    gst_clear_object(&controller->gcc);
+  }
+  g_mutex_unlock(&controller->lock);
+  g_mutex_clear(&controller->lock);
+
+  gst_object_unref(controller->capsfilter);
+  gst_object_unref(controller->encoder);
+  gst_object_unref(controller->webrtcbin);
+  g_free(controller);
+}
@@ -0,0 +1,30 @@
+#ifndef __WEBRTC_BITRATE_H__
+#define __WEBRTC_BITRATE_H__
+
+#include <gst/gst.h>
+
+#include "webrtc-stats.h"
+
+G_BEGIN_DECLS
+
+typedef struct _BitrateController BitrateController;
+
+/* Congestion control for one session. The estimate comes from rtpgccbwe
+ * (delay based, fed by transport-cc feedback) when the plugin is installed
+ * and TWCC got negotiated, otherwise from the loss and RTT in the RTCP
+ * receiver reports that @stats collects, polled at its shortest interval
+ * from then on.
+ *
+ * The estimate drives the bitrate of @encoder ("target-bitrate" in bit/s as
+ * on vp8enc or "bitrate" in kbit/s as on x264enc) and, through @capsfilter
+ * placed after videoscale and videorate, the resolution and framerate.
+ *
+ * Must be created before @webrtcbin leaves the NULL state so rtpgccbwe can
+ * be hooked in as its aux sender */
+BitrateController *bitrate_controller_new(GstElement *webrtcbin, GstElement *encoder, GstElement *capsfilter, StatsCollector *stats);
+
+void bitrate_controller_free(BitrateController *controller);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_BITRATE_H__ */
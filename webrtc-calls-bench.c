@@ -0,0 +1,309 @@
+/*
+ * Calls per core for webrtc-sendrecv: starts webrtc-signaling-server, a
+ * headless webrtc-sendrecv waiting for N calls and another one placing them,
+ * waits until media flows in every call and then reports the CPU both
+ * processes spend per call.
+ *
+ * A call counts as established once the callee reports inbound RTP for it
+ * on its Prometheus endpoint.
+ */
+#include <glib.h>
+#include <libsoup/soup.h>
+#include <string.h>
+
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define SIGNALING_PORT 8443
+#define SERVER_START_TIMEOUT_SECONDS 10
+#define SETUP_TIMEOUT_SECONDS 120
+#define CALLEE_METRICS_PORT 9101
+#define CALLER_METRICS_PORT 9102
+#define CALLEE_ID "bench"
+
+typedef struct _ProcessUsage {
+  gdouble cpu_seconds;
+  gdouble rss_mib;
+} ProcessUsage;
+
+static gchar *server_path = "./webrtc-signaling-server";
+static gchar *sendrecv_path = "./webrtc-sendrecv";
+static gchar *sendrecv_args = NULL;
+static gint n_calls = 8;
+static gint warmup_seconds = 5;
+static gint duration_seconds = 20;
+
+static GOptionEntry entries[] = {
+    {"server", 0, 0, G_OPTION_ARG_FILENAME, &server_path, "Signaling server binary to start", "PATH"},
+    {"sendrecv", 0, 0, G_OPTION_ARG_FILENAME, &sendrecv_path, "webrtc-sendrecv binary to start", "PATH"},
+    {"sendrecv-args", 0, 0, G_OPTION_ARG_STRING, &sendrecv_args, "Extra arguments for both webrtc-sendrecv processes", "ARGS"},
+    {"calls", 0, 0, G_OPTION_ARG_INT, &n_calls, "Number of concurrent calls", "N"},
+    {"warmup", 0, 0, G_OPTION_ARG_INT, &warmup_seconds, "Seconds to wait once all calls are up", "SECONDS"},
+    {"duration", 0, 0, G_OPTION_ARG_INT, &duration_seconds, "Seconds to measure", "SECONDS"},
+    {NULL},
+};
+
+static gint interrupted = FALSE;
+
+/* utime + stime and VmRSS from /proc, FALSE where there is no procfs */
+static gboolean get_process_usage(GPid pid, ProcessUsage *usage) {
+  gchar *path, *contents;
+  gchar **fields;
+  gchar *rss;
+  gboolean ret = FALSE;
+
+  path = g_strdup_printf("/proc/%d/stat", (gint)pid);
+  if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+    g_free(path);
+    return FALSE;
+  }
+  g_free(path);
+
+  /* The command name may contain spaces, count fields after its ')' */
+  fields = g_strsplit(strrchr(contents, ')') + 2, " ", -1);
+  if (g_strv_length(fields) > 12)
+    usage->cpu_seconds = (g_ascii_strtod(fields[11], NULL) + g_ascii_strtod(fields[12], NULL)) / sysconf(_SC_CLK_TCK);
+  g_strfreev(fields);
+  g_free(contents);
+
+  path = g_strdup_printf("/proc/%d/status", (gint)pid);
+  if (g_file_get_contents(path, &contents, NULL, NULL) && (rss = strstr(contents, "VmRSS:")) != NULL) {
+    usage->rss_mib = g_ascii_strtod(rss + strlen("VmRSS:"), NULL) / 1024.0;
+    ret = TRUE;
+  }
+  g_free(contents);
+  g_free(path);
+
+  return ret;
+}
+
+static gboolean wait_for_port(guint16 port) {
+  GSocketClient *client;
+  gint64 deadline;
+
+  client = g_socket_client_new();
+  deadline = g_get_monotonic_time() + SERVER_START_TIMEOUT_SECONDS * G_USEC_PER_SEC;
+
+  while (g_get_monotonic_time() < deadline && !g_atomic_int_get(&interrupted)) {
+    GSocketConnection *connection = g_socket_client_connect_to_host(client, "127.0.0.1", port, NULL, NULL);
+
+    if (connection != NULL) {
+      g_object_unref(connection);
+      g_object_unref(client);
+      return TRUE;
+    }
+    g_usleep(100 * 1000);
+  }
+
+  g_object_unref(client);
+  return FALSE;
+}
+
+/* Sessions on @port with inbound RTP, -1 when the metrics can't be read */
+static gint count_established_calls(SoupSession *session, guint16 port) {
+  SoupMessage *message;
+  gchar *url;
+  gchar **lines;
+  const gchar *prefix = "webrtc_bitrate_bits_per_second{";
+  gint established = 0;
+  guint i;
+
+  url = g_strdup_printf("http://127.0.0.1:%u/metrics", port);
+  message = soup_message_new(SOUP_METHOD_GET, url);
+  g_free(url);
+
+  if (soup_session_send_message(session, message) != SOUP_STATUS_OK) {
+    g_object_unref(message);
+    return -1;
+  }
+
+  lines = g_strsplit(message->response_body->data, "\n", -1);
+  for (i = 0; lines[i] != NULL; i++) {
+    gchar *value;
+
+    if (!g_str_has_prefix(lines[i], prefix) || strstr(lines[i], "direction=\"inbound\"") == NULL)
+      continue;
+    value = strrchr(lines[i], ' ');
+    if (value != NULL && g_ascii_strtod(value + 1, NULL) > 0)
+      established++;
+  }
+  g_strfreev(lines);
+  g_object_unref(message);
+
+  return established;
+}
+
+static gboolean spawn(const gchar *path, const gchar *const *args, const gchar *extra_args, GPid *pid) {
+  GPtrArray *argv;
+  gchar **extra_argv = NULL;
+  GError *error = NULL;
+  gboolean ret;
+  guint i;
+
+  if (extra_args != NULL && !g_shell_parse_argv(extra_args, NULL, &extra_argv, &error)) {
+    g_printerr("Invalid arguments '%s': %s\n", extra_args, error->message);
+    g_error_free(error);
+    return FALSE;
+  }
+
+  argv = g_ptr_array_new();
+  g_ptr_array_add(argv, (gpointer)path);
+  for (i = 0; args != NULL && args[i] != NULL; i++)
+    g_ptr_array_add(argv, (gpointer)args[i]);
+  for (i = 0; extra_argv != NULL && extra_argv[i] != NULL; i++)
+    g_ptr_array_add(argv, extra_argv[i]);
+  g_ptr_array_add(argv, NULL);
+
+  ret = g_spawn_async(NULL, (gchar **)argv->pdata, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL, NULL, NULL, pid, &error);
+  if (!ret) {
+    g_printerr("Could not start %s: %s\n", path, error->message);
+    g_error_free(error);
+  }
+  g_ptr_array_unref(argv);
+  g_strfreev(extra_argv);
+
+  return ret;
+}
+
+static void stop(GPid pid) {
+  if (pid == 0)
+    return;
+#ifdef G_OS_UNIX
+  kill(pid, SIGTERM);
+  waitpid(pid, NULL, 0);
+#endif
+  g_spawn_close_pid(pid);
+}
+
+#ifdef G_OS_UNIX
+static gboolean exit_sighandler(G_GNUC_UNUSED gpointer user_data) {
+  g_atomic_int_set(&interrupted, TRUE);
+  return G_SOURCE_REMOVE;
+}
+
+static gpointer signal_thread(gpointer user_data) {
+  g_main_loop_run((GMainLoop *)user_data);
+  return NULL;
+}
+#endif
+
+int main(int argc, char *argv[]) {
+  GOptionContext *context;
+  GError *error = NULL;
+  SoupSession *session;
+  ProcessUsage callee_start = {0}, callee_end = {0}, caller_start = {0}, caller_end = {0};
+  GPid server_pid = 0, callee_pid = 0, caller_pid = 0;
+  gchar *calls_arg, *callee_metrics_arg, *caller_metrics_arg;
+  gint64 setup_start = 0, deadline;
+  gdouble setup_seconds = 0, cpu_percent, cpu_per_call;
+  gint established = 0;
+  gboolean ok = FALSE;
+#ifdef G_OS_UNIX
+  GMainLoop *signal_loop;
+#endif
+
+  context = g_option_context_new("- calls per core of webrtc-sendrecv");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Error initializing: %s\n", error->message);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (n_calls <= 0 || duration_seconds <= 0) {
+    g_printerr("--calls and --duration must be positive\n");
+    return -1;
+  }
+
+#ifdef G_OS_UNIX
+  /* The main thread only sleeps and polls the metrics */
+  signal_loop = g_main_loop_new(NULL, FALSE);
+  g_unix_signal_add(SIGINT, exit_sighandler, NULL);
+  g_thread_unref(g_thread_new("signals", signal_thread, signal_loop));
+#endif
+
+  session = soup_session_new_with_options(SOUP_SESSION_TIMEOUT, 5, NULL);
+  calls_arg = g_strdup_printf("--calls=%d", n_calls);
+  callee_metrics_arg = g_strdup_printf("--metrics-port=%d", CALLEE_METRICS_PORT);
+  caller_metrics_arg = g_strdup_printf("--metrics-port=%d", CALLER_METRICS_PORT);
+
+  if (!spawn(server_path, NULL, NULL, &server_pid))
+    goto out;
+  if (!wait_for_port(SIGNALING_PORT)) {
+    g_printerr("Signaling server did not come up within %d seconds\n", SERVER_START_TIMEOUT_SECONDS);
+    goto out;
+  }
+
+  {
+    const gchar *callee_args[] = {"--our-id=" CALLEE_ID, calls_arg, "--headless", callee_metrics_arg, NULL};
+    const gchar *caller_args[] = {"--peer-id=" CALLEE_ID, calls_arg, "--headless", caller_metrics_arg, NULL};
+
+    if (!spawn(sendrecv_path, callee_args, sendrecv_args, &callee_pid))
+      goto out;
+    if (!wait_for_port(CALLEE_METRICS_PORT)) {
+      g_printerr("Callee did not come up within %d seconds\n", SERVER_START_TIMEOUT_SECONDS);
+      goto out;
+    }
+    /* The callee registers its ids before the first one gets called, a
+     * caller that is too early fails and retries its slot */
+    g_usleep(G_USEC_PER_SEC);
+
+    g_print("Placing %d calls\n", n_calls);
+    setup_start = g_get_monotonic_time();
+    if (!spawn(sendrecv_path, caller_args, sendrecv_args, &caller_pid))
+      goto out;
+  }
+
+  deadline = setup_start + SETUP_TIMEOUT_SECONDS * G_USEC_PER_SEC;
+  while (!g_atomic_int_get(&interrupted) && g_get_monotonic_time() < deadline) {
+    established = count_established_calls(session, CALLEE_METRICS_PORT);
+    if (established >= n_calls)
+      break;
+    g_usleep(250 * 1000);
+  }
+  if (established < n_calls) {
+    g_printerr("Only %d of %d calls established\n", MAX(established, 0), n_calls);
+    goto out;
+  }
+  setup_seconds = (gdouble)(g_get_monotonic_time() - setup_start) / G_USEC_PER_SEC;
+
+  g_usleep(warmup_seconds * G_USEC_PER_SEC);
+  get_process_usage(callee_pid, &callee_start);
+  get_process_usage(caller_pid, &caller_start);
+  g_usleep(duration_seconds * G_USEC_PER_SEC);
+  get_process_usage(callee_pid, &callee_end);
+  get_process_usage(caller_pid, &caller_end);
+  established = count_established_calls(session, CALLEE_METRICS_PORT);
+  ok = !g_atomic_int_get(&interrupted);
+
+  if (ok) {
+    /* Both ends of every call, as a single process would run them */
+    cpu_percent = 100.0 * (callee_end.cpu_seconds - callee_start.cpu_seconds + caller_end.cpu_seconds - caller_start.cpu_seconds) / duration_seconds;
+    cpu_per_call = cpu_percent / n_calls;
+
+    g_print("\ncalls                    %d requested, %d with media at the end\n", n_calls, MAX(established, 0));
+    g_print("setup                    %.2f s until every call had media\n", setup_seconds);
+    g_print("cpu                      %.1f%% callee, %.1f%% caller\n", 100.0 * (callee_end.cpu_seconds - callee_start.cpu_seconds) / duration_seconds, //
+            100.0 * (caller_end.cpu_seconds - caller_start.cpu_seconds) / duration_seconds);
+    g_print("rss                      %.1f MiB callee, %.1f MiB caller, %.1f MiB per call end\n", callee_end.rss_mib, caller_end.rss_mib, (callee_end.rss_mib + caller_end.rss_mib) / (2 * n_calls));
+    g_print("cpu per call             %.2f%% for both ends\n", cpu_per_call);
+    if (cpu_per_call > 0)
+      g_print("calls per core           %.1f\n", 100.0 / cpu_per_call);
+  }
+
+out:
+  /* Callers first, so the callee does not count their hangups as failures */
+  stop(caller_pid);
+  stop(callee_pid);
+  stop(server_pid);
+  g_free(calls_arg);
+  g_free(callee_metrics_arg);
+  g_free(caller_metrics_arg);
+  g_object_unref(session);
+
+  return ok ? 0 : 1;
+}
@@ -1,20 +1,107 @@
 #include "webrtc-common.h"
 
-gchar *get_string_from_json_object(JsonObject *object) {
-  JsonNode *root;
-  JsonGenerator *generator;
-  gchar *text;
-
-  /* Make it the root node */
-  root = json_node_init_object(json_node_alloc(), object);
-  generator = json_generator_new();
-  json_generator_set_root(generator, root);
-  text = json_generator_to_data(generator, NULL);
-
-  /* Release everything */
-  g_object_unref(generator);
-  json_node_free(root);
-  return text;
+/* Fits a typical offer or answer without growing */
+#define SIGNALING_BUFFER_SIZE 8192
+
+/* A session failing again right after being rebuilt most likely fails for
+ * good, the viewer is better off reconnecting */
+#define RECEIVER_ENTRY_MAX_REBUILDS 3
+
+static void on_candidates_ready(gchar *message, gpointer user_data) {
+  outbox_push(((ReceiverEntry *)user_data)->outbox, message);
+}
+
+ReceiverEntry *receiver_entry_new(void) {
+  static gint next_id = 0;
+  ReceiverEntry *receiver_entry;
+
+  receiver_entry = g_new0(ReceiverEntry, 1);
+  receiver_entry->id = (guint)g_atomic_int_add(&next_id, 1);
+  g_queue_init(&receiver_entry->pending_candidates);
+  g_mutex_init(&receiver_entry->lock);
+  receiver_entry->context = g_main_context_ref_thread_default();
+  receiver_entry->outbox = outbox_new(0);
+  receiver_entry->scratch = g_string_sized_new(SIGNALING_BUFFER_SIZE);
+  receiver_entry->send_buffer = g_string_sized_new(SIGNALING_BUFFER_SIZE);
+  receiver_entry->trickle = trickle_batch_new("{\"type\":\"ice\",\"data\":[", on_candidates_ready, receiver_entry);
+
+  return receiver_entry;
+}
+
+/* Safe from any thread. Ends the session when negotiation can't go on, the
+ * viewer gets to see @what in the close frame */
+void receiver_entry_fail(ReceiverEntry *receiver_entry, const gchar *what, const GError *error) {
+  gst_printerr("%s: %s\n", what, error != NULL ? error->message : "unknown error");
+  outbox_close(receiver_entry->outbox, SOUP_WEBSOCKET_CLOSE_POLICY_VIOLATION, what);
+}
+
+void receiver_entry_set_rebuild(ReceiverEntry *receiver_entry, ReceiverEntryFactory factory, gpointer user_data) {
+  receiver_entry->rebuild = factory;
+  receiver_entry->rebuild_data = user_data;
+}
+
+void receiver_entry_attach_connection(ReceiverEntry *receiver_entry, SoupWebsocketConnection *connection) {
+  GMainContext *context;
+
+  g_signal_connect(G_OBJECT(connection), "message", G_CALLBACK(soup_websocket_message_cb), (gpointer)receiver_entry);
+
+  /* A pre-warmed entry was built on the main context, move it and all of
+   * its timers over to the shard that accepted the connection */
+  context = g_main_context_ref_thread_default();
+  if (context != receiver_entry->context) {
+    GstBus *bus = gst_pipeline_get_bus(GST_PIPELINE(receiver_entry->pipeline));
+    gst_bus_remove_watch(bus);
+    gst_bus_add_watch(bus, receiver_entry_bus_watch_cb, receiver_entry);
+    gst_object_unref(bus);
+
+    trickle_batch_set_context(receiver_entry->trickle, context);
+    if (receiver_entry->ladder != NULL)
+      ladder_controller_set_context(receiver_entry->ladder, context);
+    if (receiver_entry->stats != NULL)
+      stats_collector_set_context(receiver_entry->stats, context);
+  }
+  g_main_context_unref(receiver_entry->context);
+  receiver_entry->context = context;
+
+  /* Sends the offer and candidates gathered while the entry was pre-warmed */
+  outbox_attach(receiver_entry->outbox, connection);
+}
+
+ReceiverEntryTable *receiver_entry_table_new(void) {
+  ReceiverEntryTable *table;
+
+  table = g_new0(ReceiverEntryTable, 1);
+  table->entries = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, destroy_receiver_entry);
+  g_mutex_init(&table->lock);
+
+  return table;
+}
+
+void receiver_entry_table_insert(ReceiverEntryTable *table, SoupWebsocketConnection *connection, ReceiverEntry *receiver_entry) {
+  receiver_entry->table = table;
+  receiver_entry->connection = connection;
+
+  g_mutex_lock(&table->lock);
+  g_hash_table_replace(table->entries, connection, receiver_entry);
+  g_mutex_unlock(&table->lock);
+}
+
+void receiver_entry_table_remove(ReceiverEntryTable *table, SoupWebsocketConnection *connection) {
+  gpointer receiver_entry = NULL;
+
+  /* Tear down outside of the lock, other shards keep inserting meanwhile */
+  g_mutex_lock(&table->lock);
+  g_hash_table_steal_extended(table->entries, connection, NULL, &receiver_entry);
+  g_mutex_unlock(&table->lock);
+
+  if (receiver_entry != NULL)
+    destroy_receiver_entry(receiver_entry);
+}
+
+void receiver_entry_table_free(ReceiverEntryTable *table) {
+  g_hash_table_destroy(table->entries);
+  g_mutex_clear(&table->lock);
+  g_free(table);
 }
 
 gboolean bus_watch_cb(GstBus *bus, GstMessage *message, gpointer user_data) {
@@ -25,8 +112,10 @@ gboolean bus_watch_cb(GstBus *bus, GstMessage *message, gpointer user_data) {
     GError *error = NULL;
     gchar *debug = NULL;
 
+    /* Session pipelines and the shared encoder handle their errors in their
+     * own watch, anything else only gets logged */
     gst_message_parse_error(message, &error, &debug);
-    g_error("Error on bus: %s (debug: %s)", error->message, debug);
+    gst_printerr("Error on bus: %s (debug: %s)\n", error->message, debug);
     g_error_free(error);
     g_free(debug);
     break;
@@ -51,68 +140,245 @@ gboolean bus_watch_cb(GstBus *bus, GstMessage *message, gpointer user_data) {
   return G_SOURCE_CONTINUE;
 }
 
+/* From a webrtcbin thread. A rebuilt session that got its viewer connected
+ * again works, only failures in a row count against the limit */
+static void on_rebuilt_connection_state_notify(GstElement *webrtcbin, G_GNUC_UNUSED GParamSpec *pspec, gpointer user_data) {
+  ReceiverEntry *receiver_entry = (ReceiverEntry *)user_data;
+  GstWebRTCPeerConnectionState state;
+
+  g_object_get(webrtcbin, "connection-state", &state, NULL);
+  if (state == GST_WEBRTC_PEER_CONNECTION_STATE_CONNECTED)
+    g_atomic_int_set(&receiver_entry->rebuilds, 0);
+}
+
+/* On the context owning the connection. The viewer gets a new offer on the
+ * same websocket and starts over with a new peer connection */
+static gboolean receiver_entry_rebuild(ReceiverEntry *receiver_entry) {
+  ReceiverEntryTable *table = receiver_entry->table;
+  SoupWebsocketConnection *connection = receiver_entry->connection;
+  ReceiverEntry *rebuilt;
+
+  if (table == NULL || receiver_entry->rebuild == NULL || g_atomic_int_get(&receiver_entry->rebuilds) >= RECEIVER_ENTRY_MAX_REBUILDS)
+    return FALSE;
+
+  rebuilt = receiver_entry->rebuild(receiver_entry->rebuild_data);
+  if (rebuilt == NULL)
+    return FALSE;
+  receiver_entry_set_rebuild(rebuilt, receiver_entry->rebuild, receiver_entry->rebuild_data);
+  rebuilt->rebuilds = g_atomic_int_get(&receiver_entry->rebuilds) + 1;
+  g_signal_connect(rebuilt->webrtcbin, "notify::connection-state", G_CALLBACK(on_rebuilt_connection_state_notify), rebuilt);
+
+  g_signal_handlers_disconnect_by_data(connection, receiver_entry);
+  receiver_entry_attach_connection(rebuilt, connection);
+  rebuilt->table = table;
+  rebuilt->connection = connection;
+
+  /* The closed handler runs on this context too, so the failed entry is
+   * still the one in the table */
+  g_mutex_lock(&table->lock);
+  g_hash_table_steal(table->entries, connection);
+  g_hash_table_insert(table->entries, connection, rebuilt);
+  g_mutex_unlock(&table->lock);
+
+  /* The failed webrtcbin may still gather a candidate or fail a promise
+   * while the reaper takes it down, none of which may reach the websocket
+   * the rebuilt session now uses */
+  outbox_detach(receiver_entry->outbox);
+  g_signal_handlers_disconnect_by_data(receiver_entry->webrtcbin, receiver_entry);
+
+  destroy_receiver_entry(receiver_entry);
+  return TRUE;
+}
+
+gboolean receiver_entry_bus_watch_cb(GstBus *bus, GstMessage *message, gpointer user_data) {
+  ReceiverEntry *receiver_entry = (ReceiverEntry *)user_data;
+  GError *error = NULL;
+  gchar *debug = NULL;
+
+  if (GST_MESSAGE_TYPE(message) != GST_MESSAGE_ERROR)
+    return bus_watch_cb(bus, message, receiver_entry->pipeline);
+
+  /* Elements downstream of the failing one often post their own */
+  if (receiver_entry->failed)
+    return G_SOURCE_CONTINUE;
+  receiver_entry->failed = TRUE;
+
+  gst_message_parse_error(message, &error, &debug);
+  gst_printerr("Session %p failed in %s: %s (debug: %s)\n", (gpointer)receiver_entry, GST_MESSAGE_SRC_NAME(message), error->message, debug);
+  stats_count_failure(STATS_FAILURE_PIPELINE);
+
+  if (receiver_entry_rebuild(receiver_entry))
+    stats_count_rebuild();
+  else
+    receiver_entry_fail(receiver_entry, "Session pipeline failed", error);
+
+  g_error_free(error);
+  g_free(debug);
+  return G_SOURCE_CONTINUE;
+}
+
+/* The rest of the entry, on the context owning its websocket, once the
+ * pipeline is gone and no webrtcbin thread can call back anymore */
+static gboolean receiver_entry_free(gpointer receiver_entry_ptr) {
+  ReceiverEntry *receiver_entry = (ReceiverEntry *)receiver_entry_ptr;
+
+  /* Nothing left in webrtcbin to gather more candidates */
+  trickle_batch_free(receiver_entry->trickle);
+
+  outbox_free(receiver_entry->outbox);
+  g_queue_clear_full(&receiver_entry->pending_candidates, pending_candidate_free);
+  g_string_free(receiver_entry->scratch, TRUE);
+  g_string_free(receiver_entry->send_buffer, TRUE);
+  g_main_context_unref(receiver_entry->context);
+  g_mutex_clear(&receiver_entry->lock);
+  g_free(receiver_entry);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Called on a reaper thread */
+static void receiver_entry_reaped(gpointer receiver_entry_ptr) {
+  ReceiverEntry *receiver_entry = (ReceiverEntry *)receiver_entry_ptr;
+
+  gst_object_unref(GST_OBJECT(receiver_entry->webrtcbin));
+  g_main_context_invoke(receiver_entry->context, receiver_entry_free, receiver_entry);
+}
+
+/* Only unhooks the session from everything shared here, taking the pipeline
+ * down is left to a reaper thread */
 void destroy_receiver_entry(gpointer receiver_entry_ptr) {
   ReceiverEntry *receiver_entry = (ReceiverEntry *)receiver_entry_ptr;
 
   g_assert(receiver_entry != NULL);
 
+  if (receiver_entry->ladder != NULL)
+    ladder_controller_free(receiver_entry->ladder);
+  if (receiver_entry->stats != NULL)
+    stats_collector_free(receiver_entry->stats);
+
   if (receiver_entry->pipeline != NULL) {
     GstBus *bus;
 
-    gst_element_set_state(GST_ELEMENT(receiver_entry->pipeline), GST_STATE_NULL);
+    if (receiver_entry->fanout != NULL)
+      fanout_source_detach(receiver_entry->fanout, receiver_entry->pipeline);
+    if (receiver_entry->forward != NULL)
+      forward_hub_detach(receiver_entry->forward, receiver_entry->pipeline);
 
     bus = gst_pipeline_get_bus(GST_PIPELINE(receiver_entry->pipeline));
     gst_bus_remove_watch(bus);
     gst_object_unref(bus);
 
+    if (session_reaper_reap(receiver_entry->pipeline, receiver_entry_reaped, receiver_entry))
+      return;
+
+    /* At exit */
+    gst_element_set_state(GST_ELEMENT(receiver_entry->pipeline), GST_STATE_NULL);
     gst_object_unref(GST_OBJECT(receiver_entry->webrtcbin));
     gst_object_unref(GST_OBJECT(receiver_entry->pipeline));
   }
 
-  if (receiver_entry->connection != NULL)
-    g_object_unref(G_OBJECT(receiver_entry->connection));
+  receiver_entry_free(receiver_entry);
+}
 
-  g_free(receiver_entry);
+/* The negotiation runs as a chain of promise change functions, called from
+ * the webrtcbin operation thread, so no main context ever waits on webrtcbin:
+ *
+ *   create-offer -> on_offer_created_cb -> set-local-description ->
+ *   on_local_description_set -> offer sent to the viewer
+ *
+ *   answer received -> set-remote-description -> on_remote_description_set
+ *   -> queued candidates added
+ *
+ * Any failure along the way closes the session through receiver_entry_fail() */
+
+static void send_offer(ReceiverEntry *receiver_entry, GstWebRTCSessionDescription *offer) {
+  gchar *sdp_string;
+
+  sdp_string = gst_sdp_message_as_text(offer->sdp);
+  gst_print("Negotiation offer created:\n%s\n", sdp_string);
+
+  /* Only ever called from the webrtcbin operation thread */
+  signaling_write_sdp(receiver_entry->send_buffer, "offer", sdp_string);
+  outbox_push(receiver_entry->outbox, g_strndup(receiver_entry->send_buffer->str, receiver_entry->send_buffer->len));
+  g_free(sdp_string);
+
+  /* Candidates gathered so far follow right behind the offer */
+  trickle_batch_release(receiver_entry->trickle);
+}
+
+typedef struct _LocalDescription {
+  ReceiverEntry *receiver_entry;
+  GstWebRTCSessionDescription *offer;
+} LocalDescription;
+
+static void local_description_free(gpointer local_ptr) {
+  LocalDescription *local = (LocalDescription *)local_ptr;
+
+  gst_webrtc_session_description_free(local->offer);
+  g_free(local);
+}
+
+static void on_local_description_set(GstPromise *promise, gpointer user_data) {
+  LocalDescription *local = (LocalDescription *)user_data;
+  GError *error = NULL;
+
+  if (get_promise_reply(promise, NULL, &error))
+    send_offer(local->receiver_entry, local->offer);
+  else
+    receiver_entry_fail(local->receiver_entry, "Could not set the local description", error);
+
+  g_clear_error(&error);
+  gst_promise_unref(promise);
 }
 
 void on_offer_created_cb(GstPromise *promise, gpointer user_data) {
-  gchar *sdp_string;
-  gchar *json_string;
-  JsonObject *sdp_json;
-  JsonObject *sdp_data_json;
-  GstStructure const *reply;
+  const GstStructure *reply;
   GstPromise *local_desc_promise;
+  LocalDescription *local;
   GstWebRTCSessionDescription *offer = NULL;
+  GError *error = NULL;
   ReceiverEntry *receiver_entry = (ReceiverEntry *)user_data;
 
-  reply = gst_promise_get_reply(promise);
-  gst_structure_get(reply, "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offer, NULL);
+  if (!get_promise_reply(promise, &reply, &error) || !gst_structure_get(reply, "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offer, NULL)) {
+    receiver_entry_fail(receiver_entry, "Could not create an offer", error);
+    g_clear_error(&error);
+    gst_promise_unref(promise);
+    return;
+  }
   gst_promise_unref(promise);
 
-  local_desc_promise = gst_promise_new();
+  /* The offer only goes out once webrtcbin accepted it */
+  local = g_new0(LocalDescription, 1);
+  local->receiver_entry = receiver_entry;
+  local->offer = offer;
+  local_desc_promise = gst_promise_new_with_change_func(on_local_description_set, local, local_description_free);
   g_signal_emit_by_name(receiver_entry->webrtcbin, "set-local-description", offer, local_desc_promise);
-  gst_promise_interrupt(local_desc_promise);
-  gst_promise_unref(local_desc_promise);
-
-  sdp_string = gst_sdp_message_as_text(offer->sdp);
-  gst_print("Negotiation offer created:\n%s\n", sdp_string);
-
-  sdp_json = json_object_new();
-  json_object_set_string_member(sdp_json, "type", "sdp");
+}
 
-  sdp_data_json = json_object_new();
-  json_object_set_string_member(sdp_data_json, "type", "offer");
-  json_object_set_string_member(sdp_data_json, "sdp", sdp_string);
-  json_object_set_object_member(sdp_json, "data", sdp_data_json);
+static void on_remote_description_set(GstPromise *promise, gpointer user_data) {
+  ReceiverEntry *receiver_entry = (ReceiverEntry *)user_data;
+  PendingCandidate *pending;
+  GQueue candidates;
+  GError *error = NULL;
 
-  json_string = get_string_from_json_object(sdp_json);
-  json_object_unref(sdp_json);
+  if (!get_promise_reply(promise, NULL, &error)) {
+    receiver_entry_fail(receiver_entry, "Could not set the remote description", error);
+    g_clear_error(&error);
+    gst_promise_unref(promise);
+    return;
+  }
+  gst_promise_unref(promise);
 
-  soup_websocket_connection_send_text(receiver_entry->connection, json_string);
-  g_free(json_string);
-  g_free(sdp_string);
+  g_mutex_lock(&receiver_entry->lock);
+  receiver_entry->remote_description_set = TRUE;
+  candidates = receiver_entry->pending_candidates;
+  g_queue_init(&receiver_entry->pending_candidates);
+  g_mutex_unlock(&receiver_entry->lock);
 
-  gst_webrtc_session_description_free(offer);
+  while ((pending = g_queue_pop_head(&candidates)) != NULL) {
+    g_signal_emit_by_name(receiver_entry->webrtcbin, "add-ice-candidate", pending->mline_index, pending->candidate);
+    pending_candidate_free(pending);
+  }
 }
 
 void on_negotiation_needed_cb(GstElement *webrtcbin, gpointer user_data) {
@@ -126,154 +392,148 @@ void on_negotiation_needed_cb(GstElement *webrtcbin, gpointer user_data) {
 }
 
 void on_ice_candidate_cb(G_GNUC_UNUSED GstElement *webrtcbin, guint mline_index, gchar *candidate, gpointer user_data) {
-  JsonObject *ice_json;
-  JsonObject *ice_data_json;
-  gchar *json_string;
   ReceiverEntry *receiver_entry = (ReceiverEntry *)user_data;
 
-  ice_json = json_object_new();
-  json_object_set_string_member(ice_json, "type", "ice");
+  trickle_batch_add(receiver_entry->trickle, mline_index, candidate);
+}
+
+void on_ice_gathering_state_notify_cb(GstElement *webrtcbin, G_GNUC_UNUSED GParamSpec *pspec, gpointer user_data) {
+  GstWebRTCICEGatheringState ice_gathering_state;
+  ReceiverEntry *receiver_entry = (ReceiverEntry *)user_data;
+
+  g_object_get(webrtcbin, "ice-gathering-state", &ice_gathering_state, NULL);
+  if (ice_gathering_state == GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE)
+    trickle_batch_add(receiver_entry->trickle, 0, NULL);
+}
+
+/* Ends the session when the viewer's answer is unusable, without it there
+ * is nothing left to negotiate */
+static void reject_remote_answer(ReceiverEntry *receiver_entry, const gchar *reason) {
+  GError *error = g_error_new_literal(G_IO_ERROR, G_IO_ERROR_INVALID_DATA, reason);
+
+  stats_count_failure(STATS_FAILURE_SIGNALING);
+  receiver_entry_fail(receiver_entry, "Invalid answer", error);
+  g_error_free(error);
+}
+
+static void add_remote_candidate(ReceiverEntry *receiver_entry, const SignalingCandidate *candidate) {
+  const gchar *candidate_string;
+
+  if (candidate->mline_index < 0) {
+    gst_printerr("Received ICE message without mline index, ignoring\n");
+    return;
+  }
+
+  if (!candidate->has_candidate) {
+    gst_printerr("Received ICE message without ICE candidate string, ignoring\n");
+    return;
+  }
+  /* An empty string marks the end of candidates */
+  candidate_string = signaling_string_unescape(&candidate->candidate, receiver_entry->scratch);
 
-  ice_data_json = json_object_new();
-  json_object_set_int_member(ice_data_json, "sdpMLineIndex", mline_index);
-  json_object_set_string_member(ice_data_json, "candidate", candidate);
-  json_object_set_object_member(ice_json, "data", ice_data_json);
+  gst_print("Received ICE candidate with mline index %d; candidate: %s\n", candidate->mline_index, candidate_string);
 
-  json_string = get_string_from_json_object(ice_json);
-  json_object_unref(ice_json);
+  g_mutex_lock(&receiver_entry->lock);
+  if (!receiver_entry->remote_description_set) {
+    g_queue_push_tail(&receiver_entry->pending_candidates, pending_candidate_new(candidate->mline_index, candidate_string));
+    g_mutex_unlock(&receiver_entry->lock);
+    return;
+  }
+  g_mutex_unlock(&receiver_entry->lock);
 
-  soup_websocket_connection_send_text(receiver_entry->connection, json_string);
-  g_free(json_string);
+  g_signal_emit_by_name(receiver_entry->webrtcbin, "add-ice-candidate", (guint)candidate->mline_index, candidate_string);
+}
+
+static void set_remote_answer(ReceiverEntry *receiver_entry, const SignalingMessage *signaling_message) {
+  const gchar *sdp_string;
+  GstPromise *promise;
+  GstSDPMessage *sdp;
+  GstWebRTCSessionDescription *answer;
+  int ret;
+
+  if (!signaling_message->has_sdp_type) {
+    reject_remote_answer(receiver_entry, "Received SDP message without type field");
+    return;
+  }
+
+  if (!signaling_string_equal(&signaling_message->sdp_type, "answer")) {
+    gst_printerr("Expected SDP message type \"answer\", got \"%.*s\"\n", (int)signaling_message->sdp_type.length, signaling_message->sdp_type.data);
+    reject_remote_answer(receiver_entry, "Expected SDP message type \"answer\"");
+    return;
+  }
+
+  if (!signaling_message->has_sdp) {
+    reject_remote_answer(receiver_entry, "Received SDP message without SDP string");
+    return;
+  }
+  sdp_string = signaling_string_unescape(&signaling_message->sdp, receiver_entry->scratch);
+
+  gst_print("Received SDP:\n%s\n", sdp_string);
+
+  ret = gst_sdp_message_new(&sdp);
+  g_assert_cmphex(ret, ==, GST_SDP_OK);
+
+  ret = gst_sdp_message_parse_buffer((guint8 *)sdp_string, receiver_entry->scratch->len, sdp);
+  if (ret != GST_SDP_OK) {
+    gst_sdp_message_free(sdp);
+    reject_remote_answer(receiver_entry, "Could not parse SDP string");
+    return;
+  }
+
+  answer = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_ANSWER, sdp);
+  g_assert_nonnull(answer);
+
+  promise = gst_promise_new_with_change_func(on_remote_description_set, receiver_entry, NULL);
+  g_signal_emit_by_name(receiver_entry->webrtcbin, "set-remote-description", answer, promise);
+  gst_webrtc_session_description_free(answer);
 }
 
 void soup_websocket_message_cb(G_GNUC_UNUSED SoupWebsocketConnection *connection, SoupWebsocketDataType data_type, GBytes *message, gpointer user_data) {
   gsize size;
   const gchar *data;
-  gchar *data_string;
-  const gchar *type_string;
-  JsonNode *root_json;
-  JsonObject *root_json_object;
-  JsonObject *data_json_object;
-  JsonParser *json_parser = NULL;
+  guint i;
+  SignalingMessage signaling_message;
   ReceiverEntry *receiver_entry = (ReceiverEntry *)user_data;
 
   switch (data_type) {
   case SOUP_WEBSOCKET_DATA_BINARY:
-    g_error("Received unknown binary message, ignoring\n");
+    gst_printerr("Received unknown binary message, ignoring\n");
     return;
 
   case SOUP_WEBSOCKET_DATA_TEXT:
+    /* Parsed in place, nothing gets copied but the strings we hand on */
     data = g_bytes_get_data(message, &size);
-    /* Convert to NULL-terminated string */
-    data_string = g_strndup(data, size);
     break;
 
   default:
     g_assert_not_reached();
   }
 
-  json_parser = json_parser_new();
-  if (!json_parser_load_from_data(json_parser, data_string, -1, NULL))
-    goto unknown_message;
-
-  root_json = json_parser_get_root(json_parser);
-  if (!JSON_NODE_HOLDS_OBJECT(root_json))
+  if (!signaling_message_parse(data, size, &signaling_message))
     goto unknown_message;
 
-  root_json_object = json_node_get_object(root_json);
+  switch (signaling_message.type) {
+  case SIGNALING_MESSAGE_SDP:
+    set_remote_answer(receiver_entry, &signaling_message);
+    return;
 
-  if (!json_object_has_member(root_json_object, "type")) {
-    g_error("Received message without type field\n");
-    goto cleanup;
-  }
-  type_string = json_object_get_string_member(root_json_object, "type");
+  case SIGNALING_MESSAGE_ICE:
+    /* A single candidate, or a batch of them */
+    for (i = 0; i < signaling_message.n_candidates; i++)
+      add_remote_candidate(receiver_entry, &signaling_message.candidates[i]);
+    return;
 
-  if (!json_object_has_member(root_json_object, "data")) {
-    g_error("Received message without data field\n");
-    goto cleanup;
+  default:
+    break;
   }
-  data_json_object = json_object_get_object_member(root_json_object, "data");
-
-  if (g_strcmp0(type_string, "sdp") == 0) {
-    const gchar *sdp_type_string;
-    const gchar *sdp_string;
-    GstPromise *promise;
-    GstSDPMessage *sdp;
-    GstWebRTCSessionDescription *answer;
-    int ret;
-
-    if (!json_object_has_member(data_json_object, "type")) {
-      g_error("Received SDP message without type field\n");
-      goto cleanup;
-    }
-    sdp_type_string = json_object_get_string_member(data_json_object, "type");
-
-    if (g_strcmp0(sdp_type_string, "answer") != 0) {
-      g_error("Expected SDP message type \"answer\", got \"%s\"\n", sdp_type_string);
-      goto cleanup;
-    }
-
-    if (!json_object_has_member(data_json_object, "sdp")) {
-      g_error("Received SDP message without SDP string\n");
-      goto cleanup;
-    }
-    sdp_string = json_object_get_string_member(data_json_object, "sdp");
-
-    gst_print("Received SDP:\n%s\n", sdp_string);
-
-    ret = gst_sdp_message_new(&sdp);
-    g_assert_cmphex(ret, ==, GST_SDP_OK);
-
-    ret = gst_sdp_message_parse_buffer((guint8 *)sdp_string, strlen(sdp_string), sdp);
-    if (ret != GST_SDP_OK) {
-      g_error("Could not parse SDP string\n");
-      goto cleanup;
-    }
-
-    answer = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_ANSWER, sdp);
-    g_assert_nonnull(answer);
-
-    promise = gst_promise_new();
-    g_signal_emit_by_name(receiver_entry->webrtcbin, "set-remote-description", answer, promise);
-    gst_promise_interrupt(promise);
-    gst_promise_unref(promise);
-    gst_webrtc_session_description_free(answer);
-  } else if (g_strcmp0(type_string, "ice") == 0) {
-    guint mline_index;
-    const gchar *candidate_string;
-
-    if (!json_object_has_member(data_json_object, "sdpMLineIndex")) {
-      g_error("Received ICE message without mline index\n");
-      goto cleanup;
-    }
-    mline_index = json_object_get_int_member(data_json_object, "sdpMLineIndex");
-
-    if (!json_object_has_member(data_json_object, "candidate")) {
-      g_error("Received ICE message without ICE candidate string\n");
-      goto cleanup;
-    }
-    candidate_string = json_object_get_string_member(data_json_object, "candidate");
-
-    gst_print("Received ICE candidate with mline index %u; candidate: %s\n", mline_index, candidate_string);
-
-    g_signal_emit_by_name(receiver_entry->webrtcbin, "add-ice-candidate", mline_index, candidate_string);
-  } else
-    goto unknown_message;
-
-cleanup:
-  if (json_parser != NULL)
-    g_object_unref(G_OBJECT(json_parser));
-  g_free(data_string);
-  return;
 
 unknown_message:
-  g_error("Unknown message \"%s\", ignoring", data_string);
-  goto cleanup;
+  gst_printerr("Unknown message \"%.*s\", ignoring\n", (int)size, data);
 }
 
 void soup_websocket_closed_cb(SoupWebsocketConnection *connection, gpointer user_data) {
-  GHashTable *receiver_entry_table = (GHashTable *)user_data;
-  g_hash_table_remove(receiver_entry_table, connection);
+  ReceiverEntryTable *receiver_entry_table = (ReceiverEntryTable *)user_data;
+  receiver_entry_table_remove(receiver_entry_table, connection);
   gst_print("Closed websocket connection %p\n", (gpointer)connection);
 }
 
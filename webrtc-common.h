@@ -13,31 +13,115 @@
 #define GST_USE_UNSTABLE_API
 #include <gst/webrtc/webrtc.h>
 
-#include <json-glib/json-glib.h>
 #include <libsoup/soup.h>
 #include <string.h>
 
+#include "webrtc-fanout.h"
+#include "webrtc-forward.h"
+#include "webrtc-keyframe.h"
+#include "webrtc-ladder.h"
+#include "webrtc-latency.h"
+#include "webrtc-negotiation.h"
+#include "webrtc-outbox.h"
+#include "webrtc-pool.h"
+#include "webrtc-reaper.h"
+#include "webrtc-record.h"
+#include "webrtc-scaleconvert.h"
+#include "webrtc-shard.h"
+#include "webrtc-signaling.h"
+#include "webrtc-stats.h"
+#include "webrtc-taskpool.h"
+#include "webrtc-trickle.h"
+
 G_BEGIN_DECLS
 
 typedef struct _ReceiverEntry ReceiverEntry;
+typedef struct _ReceiverEntryTable ReceiverEntryTable;
 
 struct _ReceiverEntry {
-  SoupWebsocketConnection *connection;
+  /* Never reused, unlike the address, so it tells sessions apart on
+   * /metrics over time */
+  guint id;
+  /* Everything sent while the entry sits pre-warmed in a pool is kept here
+   * until a viewer takes it */
+  Outbox *outbox;
+  /* Guards the candidate state below */
+  GMutex lock;
+  TrickleBatch *trickle;
+  /* Reused for every message going out, or coming in on the owning context */
+  GString *send_buffer;
+  GString *scratch;
+
+  /* Remote candidates are held back until the answer is applied, webrtcbin
+   * would drop them before */
+  gboolean remote_description_set;
+  GQueue pending_candidates;
+
+  /* Thread default context of the shard owning the connection and the bus
+   * watch */
+  GMainContext *context;
 
   GstElement *pipeline;
   GstElement *webrtcbin;
+
+  /* Set when the media comes from a shared encoder instead of the session
+   * pipeline itself */
+  FanoutSource *fanout;
+  /* Set when the session publishes to or subscribes from forwarded RTP */
+  ForwardHub *forward;
+  LadderController *ladder;
+  StatsCollector *stats;
+
+  /* Builds the replacement when the pipeline fails, NULL ends the session
+   * instead */
+  ReceiverEntryFactory rebuild;
+  gpointer rebuild_data;
+  /* In a row, back to 0 once a rebuilt session connects. Atomic */
+  gint rebuilds;
+  gboolean failed;
+  /* Set once in the table, the outbox holds the connection */
+  ReceiverEntryTable *table;
+  SoupWebsocketConnection *connection;
 };
 
-gchar *get_string_from_json_object(JsonObject *object);
+/* Connection to ReceiverEntry map shared by every shard */
+struct _ReceiverEntryTable {
+  GHashTable *entries;
+  GMutex lock;
+};
+
+ReceiverEntry *receiver_entry_new(void);
+
+void receiver_entry_fail(ReceiverEntry *receiver_entry, const gchar *what, const GError *error);
+
+/* Should the pipeline fail, the session is replaced by one from @factory,
+ * renegotiating with the viewer from scratch, instead of being closed */
+void receiver_entry_set_rebuild(ReceiverEntry *receiver_entry, ReceiverEntryFactory factory, gpointer user_data);
+
+void receiver_entry_attach_connection(ReceiverEntry *receiver_entry, SoupWebsocketConnection *connection);
+
+ReceiverEntryTable *receiver_entry_table_new(void);
+
+void receiver_entry_table_insert(ReceiverEntryTable *table, SoupWebsocketConnection *connection, ReceiverEntry *receiver_entry);
+
+void receiver_entry_table_remove(ReceiverEntryTable *table, SoupWebsocketConnection *connection);
+
+void receiver_entry_table_free(ReceiverEntryTable *table);
 
 gboolean bus_watch_cb(GstBus *bus, GstMessage *message, gpointer user_data);
 
+/* Bus watch of a session pipeline, @user_data being its ReceiverEntry. An
+ * error only takes down that session */
+gboolean receiver_entry_bus_watch_cb(GstBus *bus, GstMessage *message, gpointer user_data);
+
 void soup_websocket_message_cb(G_GNUC_UNUSED SoupWebsocketConnection *connection, SoupWebsocketDataType data_type, GBytes *message, gpointer user_data);
 
 void on_negotiation_needed_cb(GstElement *webrtcbin, gpointer user_data);
 
 void on_ice_candidate_cb(G_GNUC_UNUSED GstElement *webrtcbin, guint mline_index, gchar *candidate, gpointer user_data);
 
+void on_ice_gathering_state_notify_cb(GstElement *webrtcbin, G_GNUC_UNUSED GParamSpec *pspec, gpointer user_data);
+
 void destroy_receiver_entry(gpointer receiver_entry_ptr);
 
 void soup_websocket_closed_cb(SoupWebsocketConnection *connection, gpointer user_data);
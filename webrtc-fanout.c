@@ -0,0 +1,451 @@
+#include "webrtc-common.h"
+
+#include <gst/video/video.h>
+
+/* About two seconds of video, what a session may fall behind the shared
+ * encoder before it skips ahead */
+#define FANOUT_SINK_MAX_BUFFERS 64
+#define FANOUT_SINK_MAX_BYTES (4 * 1024 * 1024)
+
+typedef struct _FanoutSink FanoutSink;
+typedef struct _FanoutTrack FanoutTrack;
+typedef struct _FanoutProbe FanoutProbe;
+
+struct _FanoutSink {
+  GstElement *pipeline;
+  GstElement *appsrc;
+  /* Delta units are dropped until the first keyframe so a late joiner never
+   * starts decoding in the middle of a GOP */
+  gboolean waiting_keyframe;
+  /* Set once the session's appsrc filled up, it resumes at the next keyframe
+   * of the same layer */
+  gboolean behind;
+};
+
+struct _FanoutTrack {
+  FanoutSource *fanout;
+  gchar *name;
+  gchar *group;
+  guint layer;
+  GstElement *appsink;
+  GPtrArray *sinks;
+};
+
+struct _FanoutSource {
+  GstElement *pipeline;
+  GPtrArray *tracks;
+  GMutex lock;
+
+  /* Quit when the shared pipeline fails */
+  GMainLoop *mainloop;
+  gboolean failed;
+};
+
+/* On the src pad of a session appsrc, lives as long as the session */
+struct _FanoutProbe {
+  FanoutSource *fanout;
+  GstElement *pipeline;
+  gchar *group;
+};
+
+static void fanout_sink_free(gpointer sink_ptr) {
+  FanoutSink *sink = (FanoutSink *)sink_ptr;
+
+  gst_object_unref(sink->appsrc);
+  gst_object_unref(sink->pipeline);
+  g_free(sink);
+}
+
+static void fanout_track_free(gpointer track_ptr) {
+  FanoutTrack *track = (FanoutTrack *)track_ptr;
+
+  g_ptr_array_unref(track->sinks);
+  gst_object_unref(track->appsink);
+  g_free(track->group);
+  g_free(track->name);
+  g_free(track);
+}
+
+static void fanout_track_parse_name(FanoutTrack *track) {
+  const gchar *separator = strrchr(track->name, '_');
+  guint64 layer;
+
+  if (separator != NULL && g_ascii_string_to_unsigned(separator + 1, 10, 0, G_MAXUINT, &layer, NULL)) {
+    track->group = g_strndup(track->name, separator - track->name);
+    track->layer = (guint)layer;
+  } else {
+    track->group = g_strdup(track->name);
+    track->layer = 0;
+  }
+}
+
+static FanoutTrack *fanout_source_find_track(FanoutSource *fanout, const gchar *group, guint layer) {
+  guint i;
+
+  for (i = 0; i < fanout->tracks->len; i++) {
+    FanoutTrack *track = g_ptr_array_index(fanout->tracks, i);
+    if (track->layer == layer && g_strcmp0(track->group, group) == 0)
+      return track;
+  }
+  return NULL;
+}
+
+/* Called with the lock held once a session got its first keyframe on @track:
+ * whatever layer of the same group it was fed from before is dropped now, so
+ * the switch happens exactly at the keyframe boundary */
+static void fanout_track_remove_siblings(FanoutTrack *track, GstElement *pipeline) {
+  FanoutSource *fanout = track->fanout;
+  guint i, j;
+
+  for (i = 0; i < fanout->tracks->len; i++) {
+    FanoutTrack *sibling = g_ptr_array_index(fanout->tracks, i);
+
+    if (sibling == track || g_strcmp0(sibling->group, track->group) != 0)
+      continue;
+
+    for (j = sibling->sinks->len; j > 0; j--) {
+      FanoutSink *sink = g_ptr_array_index(sibling->sinks, j - 1);
+      if (sink->pipeline == pipeline)
+        g_ptr_array_remove_index_fast(sibling->sinks, j - 1);
+    }
+  }
+}
+
+/* Called with the lock held when @pipeline asks for @target: a switch to
+ * another layer of the same group still waiting for its keyframe is
+ * superseded, so repeated requests never leave more than one behind */
+static void fanout_track_cancel_switches(FanoutTrack *target, GstElement *pipeline) {
+  FanoutSource *fanout = target->fanout;
+  guint i, j;
+
+  for (i = 0; i < fanout->tracks->len; i++) {
+    FanoutTrack *track = g_ptr_array_index(fanout->tracks, i);
+
+    if (track == target || g_strcmp0(track->group, target->group) != 0)
+      continue;
+
+    for (j = track->sinks->len; j > 0; j--) {
+      FanoutSink *sink = g_ptr_array_index(track->sinks, j - 1);
+      if (sink->pipeline == pipeline && sink->waiting_keyframe)
+        g_ptr_array_remove_index_fast(track->sinks, j - 1);
+    }
+  }
+}
+
+static void fanout_probe_free(gpointer probe_ptr) {
+  FanoutProbe *probe = (FanoutProbe *)probe_ptr;
+
+  g_free(probe->group);
+  g_free(probe);
+}
+
+/* A viewer's PLI/FIR comes up from its webrtcbin as a force-key-unit event,
+ * which the appsrc would drop. Hand it to whichever shared encoder feeds the
+ * viewer right now */
+static GstPadProbeReturn fanout_on_upstream_event(G_GNUC_UNUSED GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  FanoutProbe *probe = (FanoutProbe *)user_data;
+  FanoutSource *fanout = probe->fanout;
+  GPtrArray *appsinks;
+  guint i, j;
+
+  if (!gst_video_event_is_force_key_unit(GST_PAD_PROBE_INFO_EVENT(info)))
+    return GST_PAD_PROBE_OK;
+
+  appsinks = g_ptr_array_new_with_free_func(gst_object_unref);
+  g_mutex_lock(&fanout->lock);
+  for (i = 0; i < fanout->tracks->len; i++) {
+    FanoutTrack *track = g_ptr_array_index(fanout->tracks, i);
+
+    if (g_strcmp0(track->group, probe->group) != 0)
+      continue;
+    for (j = 0; j < track->sinks->len; j++) {
+      if (((FanoutSink *)g_ptr_array_index(track->sinks, j))->pipeline == probe->pipeline) {
+        g_ptr_array_add(appsinks, gst_object_ref(track->appsink));
+        break;
+      }
+    }
+  }
+  g_mutex_unlock(&fanout->lock);
+
+  /* The encoder's keyframe limiter merges these across viewers */
+  for (i = 0; i < appsinks->len; i++)
+    gst_element_send_event(g_ptr_array_index(appsinks, i), gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+  g_ptr_array_unref(appsinks);
+
+  return GST_PAD_PROBE_DROP;
+}
+
+static GstFlowReturn fanout_track_new_sample(GstAppSink *appsink, gpointer user_data) {
+  FanoutTrack *track = (FanoutTrack *)user_data;
+  GstSample *sample;
+  GstBuffer *buffer;
+  gboolean is_keyframe;
+  guint i;
+
+  sample = gst_app_sink_pull_sample(appsink);
+  if (sample == NULL)
+    return GST_FLOW_EOS;
+
+  buffer = gst_sample_get_buffer(sample);
+  is_keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+
+  g_mutex_lock(&track->fanout->lock);
+  for (i = 0; i < track->sinks->len; i++) {
+    FanoutSink *sink = g_ptr_array_index(track->sinks, i);
+
+    /* A session that doesn't keep up drops frames up to the next keyframe
+     * rather than queueing them without end */
+    if (!sink->behind && gst_app_src_get_current_level_buffers(GST_APP_SRC(sink->appsrc)) >= FANOUT_SINK_MAX_BUFFERS) {
+      gst_print("Viewer %p falls behind on \"%s\", skipping to the next keyframe\n", (gpointer)sink->pipeline, track->name);
+      sink->behind = TRUE;
+    }
+    if (sink->behind) {
+      if (!is_keyframe)
+        continue;
+      sink->behind = FALSE;
+    }
+
+    if (sink->waiting_keyframe) {
+      if (!is_keyframe)
+        continue;
+      sink->waiting_keyframe = FALSE;
+      fanout_track_remove_siblings(track, sink->pipeline);
+    }
+
+    /* Does not take ownership, every session only adds a buffer ref */
+    gst_app_src_push_sample(GST_APP_SRC(sink->appsrc), sample);
+  }
+  g_mutex_unlock(&track->fanout->lock);
+
+  gst_sample_unref(sample);
+  return GST_FLOW_OK;
+}
+
+FanoutSource *fanout_source_new(const gchar *pipeline_description, GError **error) {
+  FanoutSource *fanout;
+  GstIterator *iter;
+  GValue item = G_VALUE_INIT;
+  GstAppSinkCallbacks callbacks = {NULL};
+
+  fanout = g_new0(FanoutSource, 1);
+  g_mutex_init(&fanout->lock);
+  fanout->tracks = g_ptr_array_new_with_free_func(fanout_track_free);
+
+  fanout->pipeline = gst_parse_launch(pipeline_description, error);
+  if (fanout->pipeline == NULL || (error != NULL && *error != NULL)) {
+    fanout_source_free(fanout);
+    return NULL;
+  }
+
+  callbacks.new_sample = fanout_track_new_sample;
+
+  iter = gst_bin_iterate_sinks(GST_BIN(fanout->pipeline));
+  while (gst_iterator_next(iter, &item) == GST_ITERATOR_OK) {
+    GstElement *element = g_value_get_object(&item);
+
+    if (GST_IS_APP_SINK(element)) {
+      FanoutTrack *track = g_new0(FanoutTrack, 1);
+
+      track->fanout = fanout;
+      track->name = gst_element_get_name(element);
+      track->appsink = gst_object_ref(element);
+      fanout_track_parse_name(track);
+      track->sinks = g_ptr_array_new_with_free_func(fanout_sink_free);
+
+      g_object_set(element, "sync", FALSE, "max-buffers", 1, "drop", FALSE, NULL);
+      gst_app_sink_set_callbacks(GST_APP_SINK(element), &callbacks, track, NULL);
+      g_ptr_array_add(fanout->tracks, track);
+
+      gst_print("Shared encoder track \"%s\"\n", track->name);
+    }
+    g_value_reset(&item);
+  }
+  g_value_unset(&item);
+  gst_iterator_free(iter);
+
+  return fanout;
+}
+
+/* A pipeline in ERROR doesn't come back by itself, and every viewer would
+ * keep getting nothing from it */
+static gboolean fanout_bus_watch_cb(GstBus *bus, GstMessage *message, gpointer user_data) {
+  FanoutSource *fanout = (FanoutSource *)user_data;
+  GError *error = NULL;
+  gchar *debug = NULL;
+
+  if (GST_MESSAGE_TYPE(message) != GST_MESSAGE_ERROR)
+    return bus_watch_cb(bus, message, fanout->pipeline);
+
+  if (fanout->failed)
+    return G_SOURCE_CONTINUE;
+  fanout->failed = TRUE;
+
+  gst_message_parse_error(message, &error, &debug);
+  gst_printerr("Shared encoder failed in %s: %s (debug: %s), stopping\n", GST_MESSAGE_SRC_NAME(message), error->message, debug);
+  g_error_free(error);
+  g_free(debug);
+
+  g_main_loop_quit(fanout->mainloop);
+  return G_SOURCE_CONTINUE;
+}
+
+gboolean fanout_source_start(FanoutSource *fanout, GMainLoop *mainloop) {
+  GstBus *bus;
+
+  g_return_val_if_fail(fanout != NULL, FALSE);
+
+  fanout->mainloop = g_main_loop_ref(mainloop);
+  bus = gst_pipeline_get_bus(GST_PIPELINE(fanout->pipeline));
+  gst_bus_add_watch(bus, fanout_bus_watch_cb, fanout);
+  gst_object_unref(bus);
+
+  if (gst_element_set_state(fanout->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+    return FALSE;
+
+  /* Sessions slave to our clock and base time, so wait until both exist */
+  return gst_element_get_state(fanout->pipeline, NULL, NULL, GST_CLOCK_TIME_NONE) != GST_STATE_CHANGE_FAILURE;
+}
+
+void fanout_source_attach(FanoutSource *fanout, GstElement *pipeline) {
+  GstClock *clock;
+  guint i;
+
+  g_return_if_fail(fanout != NULL);
+
+  /* Timestamps from the shared pipeline stay valid in the session pipeline
+   * as long as both run on the same clock with the same base time */
+  clock = gst_element_get_clock(fanout->pipeline);
+  if (clock != NULL) {
+    gst_pipeline_use_clock(GST_PIPELINE(pipeline), clock);
+    gst_object_unref(clock);
+  }
+  gst_element_set_base_time(pipeline, gst_element_get_base_time(fanout->pipeline));
+  gst_element_set_start_time(pipeline, GST_CLOCK_TIME_NONE);
+
+  g_mutex_lock(&fanout->lock);
+  for (i = 0; i < fanout->tracks->len; i++) {
+    FanoutTrack *track = g_ptr_array_index(fanout->tracks, i);
+    GstElement *appsrc;
+    FanoutSink *sink;
+    FanoutProbe *probe;
+    GstPad *srcpad;
+
+    if (track->layer != 0)
+      continue;
+
+    appsrc = gst_bin_get_by_name(GST_BIN(pipeline), track->group);
+    if (appsrc == NULL)
+      continue;
+
+    /* Bounded, and whatever still doesn't fit is dropped rather than
+     * blocking the shared encoder */
+    g_object_set(appsrc, "max-buffers", (guint64)FANOUT_SINK_MAX_BUFFERS, "max-bytes", (guint64)FANOUT_SINK_MAX_BYTES, NULL);
+    gst_util_set_object_arg(G_OBJECT(appsrc), "leaky-type", "downstream");
+
+    sink = g_new0(FanoutSink, 1);
+    sink->pipeline = gst_object_ref(pipeline);
+    sink->appsrc = appsrc;
+    sink->waiting_keyframe = TRUE;
+    g_ptr_array_add(track->sinks, sink);
+
+    probe = g_new0(FanoutProbe, 1);
+    probe->fanout = fanout;
+    probe->pipeline = pipeline;
+    probe->group = g_strdup(track->group);
+    srcpad = gst_element_get_static_pad(appsrc, "src");
+    gst_pad_add_probe(srcpad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, fanout_on_upstream_event, probe, fanout_probe_free);
+    gst_object_unref(srcpad);
+
+    /* Don't make the new viewer wait for the next scheduled IDR */
+    gst_element_send_event(track->appsink, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+  }
+  g_mutex_unlock(&fanout->lock);
+}
+
+void fanout_source_detach(FanoutSource *fanout, GstElement *pipeline) {
+  guint i, j;
+
+  g_return_if_fail(fanout != NULL);
+
+  g_mutex_lock(&fanout->lock);
+  for (i = 0; i < fanout->tracks->len; i++) {
+    FanoutTrack *track = g_ptr_array_index(fanout->tracks, i);
+
+    for (j = track->sinks->len; j > 0; j--) {
+      FanoutSink *sink = g_ptr_array_index(track->sinks, j - 1);
+      if (sink->pipeline == pipeline)
+        g_ptr_array_remove_index_fast(track->sinks, j - 1);
+    }
+  }
+  g_mutex_unlock(&fanout->lock);
+}
+
+void fanout_source_select_layer(FanoutSource *fanout, GstElement *pipeline, const gchar *group, guint layer) {
+  FanoutTrack *target;
+  GstElement *appsrc;
+  FanoutSink *sink;
+  guint i;
+
+  g_return_if_fail(fanout != NULL);
+
+  g_mutex_lock(&fanout->lock);
+  target = fanout_source_find_track(fanout, group, layer);
+  if (target == NULL)
+    goto out;
+
+  fanout_track_cancel_switches(target, pipeline);
+  for (i = 0; i < target->sinks->len; i++) {
+    if (((FanoutSink *)g_ptr_array_index(target->sinks, i))->pipeline == pipeline)
+      goto out;
+  }
+
+  appsrc = gst_bin_get_by_name(GST_BIN(pipeline), group);
+  if (appsrc == NULL)
+    goto out;
+
+  /* Keeps being fed from the current layer until @target has a keyframe */
+  sink = g_new0(FanoutSink, 1);
+  sink->pipeline = gst_object_ref(pipeline);
+  sink->appsrc = appsrc;
+  sink->waiting_keyframe = TRUE;
+  g_ptr_array_add(target->sinks, sink);
+
+  gst_element_send_event(target->appsink, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+
+out:
+  g_mutex_unlock(&fanout->lock);
+}
+
+gboolean fanout_source_has_failed(FanoutSource *fanout) {
+  g_return_val_if_fail(fanout != NULL, FALSE);
+
+  return fanout->failed;
+}
+
+void fanout_source_limit_keyframes(FanoutSource *fanout, guint min_interval_ms) {
+  g_return_if_fail(fanout != NULL);
+
+  keyframe_limiter_install_all(GST_BIN(fanout->pipeline), min_interval_ms);
+}
+
+void fanout_source_free(FanoutSource *fanout) {
+  g_return_if_fail(fanout != NULL);
+
+  if (fanout->pipeline != NULL) {
+    GstBus *bus;
+
+    gst_element_set_state(fanout->pipeline, GST_STATE_NULL);
+
+    bus = gst_pipeline_get_bus(GST_PIPELINE(fanout->pipeline));
+    gst_bus_remove_watch(bus);
+    gst_object_unref(bus);
+  }
+
+  g_ptr_array_unref(fanout->tracks);
+  if (fanout->pipeline != NULL)
+    gst_object_unref(fanout->pipeline);
+  if (fanout->mainloop != NULL)
+    g_main_loop_unref(fanout->mainloop);
+  g_mutex_clear(&fanout->lock);
+  g_free(fanout);
+}
@@ -0,0 +1,40 @@
+#ifndef __WEBRTC_FANOUT_H__
+#define __WEBRTC_FANOUT_H__
+
+#include <gst/app/app.h>
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* One capture+encode pipeline shared by every session. Each appsink named
+ * "<track>" in the shared pipeline feeds every attached session pipeline
+ * through an appsrc with the same name.
+ *
+ * Appsinks named "<track>_<layer>" are renditions of one track: a session
+ * pipeline has a single appsrc "<track>", starts on layer 0 and is moved
+ * between layers with fanout_source_select_layer(). */
+typedef struct _FanoutSource FanoutSource;
+
+FanoutSource *fanout_source_new(const gchar *pipeline_description, GError **error);
+
+/* Should the shared pipeline fail, @mainloop is quit: it won't recover on
+ * its own and the viewers would get nothing from it */
+gboolean fanout_source_start(FanoutSource *fanout, GMainLoop *mainloop);
+
+/* Whether the shared pipeline failed, for the exit status */
+gboolean fanout_source_has_failed(FanoutSource *fanout);
+
+void fanout_source_attach(FanoutSource *fanout, GstElement *pipeline);
+
+void fanout_source_detach(FanoutSource *fanout, GstElement *pipeline);
+
+void fanout_source_select_layer(FanoutSource *fanout, GstElement *pipeline, const gchar *group, guint layer);
+
+/* Coalesces the keyframe requests of all viewers, see keyframe_limiter_install() */
+void fanout_source_limit_keyframes(FanoutSource *fanout, guint min_interval_ms);
+
+void fanout_source_free(FanoutSource *fanout);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_FANOUT_H__ */
@@ -0,0 +1,471 @@
+#include "webrtc-common.h"
+
+#include <gst/rtp/rtp.h>
+#include <gst/video/video.h>
+
+/* Subscribers asking for a keyframe within this interval share one request
+ * to the publisher, so a burst of PLIs after a loss doesn't turn into a burst
+ * of keyframes */
+#define FORWARD_KEYFRAME_REQUEST_INTERVAL_MS 500
+/* What a subscriber may fall behind its publisher, in packets and bytes.
+ * Beyond that the oldest packets go, and the subscriber's loss recovery
+ * asks for a keyframe */
+#define FORWARD_SINK_MAX_BUFFERS 1024
+#define FORWARD_SINK_MAX_BYTES (2 * 1024 * 1024)
+
+typedef enum {
+  FORWARD_CODEC_OTHER,
+  FORWARD_CODEC_H264,
+  FORWARD_CODEC_VP8,
+} ForwardCodec;
+
+typedef struct _ForwardSink ForwardSink;
+typedef struct _ForwardTrack ForwardTrack;
+typedef struct _ForwardProbe ForwardProbe;
+
+struct _ForwardSink {
+  GstElement *pipeline;
+  GstElement *appsrc;
+  /* Payload type negotiated by the subscriber, -1 to keep the publisher's */
+  gint payload_type;
+  /* Packets are dropped until a keyframe starts, a subscriber never starts
+   * decoding in the middle of a GOP */
+  gboolean waiting_keyframe;
+};
+
+struct _ForwardTrack {
+  gchar *name;
+  ForwardCodec codec;
+  GstElement *pipeline;
+  GstElement *appsink;
+  GPtrArray *sinks;
+  gint64 last_keyframe_request;
+};
+
+struct _ForwardHub {
+  /* Tracks in the order they were published, the newest publisher of a name
+   * comes last */
+  GPtrArray *tracks;
+  GPtrArray *subscribers;
+  GMutex lock;
+};
+
+struct _ForwardProbe {
+  ForwardHub *hub;
+  gchar *name;
+};
+
+static void forward_sink_free(gpointer sink_ptr) {
+  ForwardSink *sink = (ForwardSink *)sink_ptr;
+
+  gst_object_unref(sink->appsrc);
+  gst_object_unref(sink->pipeline);
+  g_free(sink);
+}
+
+static void forward_track_free(gpointer track_ptr) {
+  ForwardTrack *track = (ForwardTrack *)track_ptr;
+
+  g_ptr_array_unref(track->sinks);
+  gst_object_unref(track->appsink);
+  gst_object_unref(track->pipeline);
+  g_free(track->name);
+  g_free(track);
+}
+
+static void forward_probe_free(gpointer probe_ptr) {
+  ForwardProbe *probe = (ForwardProbe *)probe_ptr;
+
+  g_free(probe->name);
+  g_free(probe);
+}
+
+/* RFC 6184: an IDR slice or the SPS in front of it, alone, aggregated in a
+ * STAP-A or at the start of a FU-A */
+static gboolean forward_h264_is_keyframe_start(const guint8 *payload, guint size) {
+  guint offset, nal_size;
+
+  if (size < 1)
+    return FALSE;
+
+  switch (payload[0] & 0x1f) {
+  case 5:
+  case 7:
+    return TRUE;
+  case 24:
+    for (offset = 1; offset + 2 < size; offset += nal_size) {
+      nal_size = (payload[offset] << 8) | payload[offset + 1];
+      offset += 2;
+      if ((payload[offset] & 0x1f) == 5 || (payload[offset] & 0x1f) == 7)
+        return TRUE;
+    }
+    return FALSE;
+  case 28:
+    return size >= 2 && (payload[1] & 0x80) && (payload[1] & 0x1f) == 5;
+  default:
+    return FALSE;
+  }
+}
+
+/* RFC 7741: the first packet of partition 0 of a frame without the inverse
+ * key frame flag */
+static gboolean forward_vp8_is_keyframe_start(const guint8 *payload, guint size) {
+  guint offset = 1;
+
+  if (size < 1 || !(payload[0] & 0x10) || (payload[0] & 0x07) != 0)
+    return FALSE;
+
+  if (payload[0] & 0x80) {
+    guint8 extension;
+
+    if (size < 2)
+      return FALSE;
+    extension = payload[1];
+    offset = 2;
+    if ((extension & 0x80) && offset < size)
+      offset += (payload[offset] & 0x80) ? 2 : 1;
+    if (extension & 0x40)
+      offset++;
+    if (extension & 0x30)
+      offset++;
+  }
+
+  return offset < size && (payload[offset] & 0x01) == 0;
+}
+
+static gboolean forward_is_keyframe_start(ForwardCodec codec, GstBuffer *buffer) {
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  gboolean ret = FALSE;
+
+  /* Every audio packet is a fine place to start */
+  if (codec == FORWARD_CODEC_OTHER)
+    return TRUE;
+
+  if (!gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp))
+    return FALSE;
+
+  if (codec == FORWARD_CODEC_H264)
+    ret = forward_h264_is_keyframe_start(gst_rtp_buffer_get_payload(&rtp), gst_rtp_buffer_get_payload_len(&rtp));
+  else if (codec == FORWARD_CODEC_VP8)
+    ret = forward_vp8_is_keyframe_start(gst_rtp_buffer_get_payload(&rtp), gst_rtp_buffer_get_payload_len(&rtp));
+
+  gst_rtp_buffer_unmap(&rtp);
+  return ret;
+}
+
+/* A new buffer sharing the payload memory of @buffer, with a copy of the
+ * RTP header in front of it that carries @payload_type */
+static GstBuffer *forward_rewrite_payload_type(GstBuffer *buffer, guint header_len, gint payload_type) {
+  GstBuffer *rewritten;
+  guint8 *header;
+
+  header = g_malloc(header_len);
+  gst_buffer_extract(buffer, 0, header, header_len);
+  header[1] = (header[1] & 0x80) | (payload_type & 0x7f);
+
+  rewritten = gst_buffer_copy(buffer);
+  gst_buffer_resize(rewritten, header_len, -1);
+  gst_buffer_prepend_memory(rewritten, gst_memory_new_wrapped(0, header, header_len, 0, header_len, header, g_free));
+  return rewritten;
+}
+
+static void forward_sink_push(ForwardSink *sink, GstBuffer *buffer) {
+  GstRTPBuffer rtp = GST_RTP_BUFFER_INIT;
+  gboolean same = TRUE;
+  guint header_len = 0;
+
+  /* Only the header is copied, and only if the payload types differ */
+  if (sink->payload_type >= 0 && gst_rtp_buffer_map(buffer, GST_MAP_READ, &rtp)) {
+    same = gst_rtp_buffer_get_payload_type(&rtp) == sink->payload_type;
+    header_len = gst_rtp_buffer_get_header_len(&rtp);
+    gst_rtp_buffer_unmap(&rtp);
+  }
+
+  if (same)
+    gst_app_src_push_buffer(GST_APP_SRC(sink->appsrc), gst_buffer_ref(buffer));
+  else
+    gst_app_src_push_buffer(GST_APP_SRC(sink->appsrc), forward_rewrite_payload_type(buffer, header_len, sink->payload_type));
+}
+
+/* Called with the lock held */
+static ForwardTrack *forward_hub_find_newest_track(ForwardHub *hub, const gchar *name) {
+  guint i;
+
+  for (i = hub->tracks->len; i > 0; i--) {
+    ForwardTrack *track = g_ptr_array_index(hub->tracks, i - 1);
+    if (g_strcmp0(track->name, name) == 0)
+      return track;
+  }
+  return NULL;
+}
+
+/* Called with the lock held */
+static void forward_track_add_sink(ForwardTrack *track, GstElement *pipeline) {
+  GstElement *appsrc;
+  ForwardSink *sink;
+  GstCaps *caps;
+
+  appsrc = gst_bin_get_by_name(GST_BIN(pipeline), track->name);
+  if (appsrc == NULL)
+    return;
+
+  /* A stalled subscriber drops packets instead of queueing them without end
+   * under the hub lock */
+  g_object_set(appsrc, "max-buffers", (guint64)FORWARD_SINK_MAX_BUFFERS, "max-bytes", (guint64)FORWARD_SINK_MAX_BYTES, NULL);
+  gst_util_set_object_arg(G_OBJECT(appsrc), "leaky-type", "downstream");
+
+  sink = g_new0(ForwardSink, 1);
+  sink->pipeline = gst_object_ref(pipeline);
+  sink->appsrc = appsrc;
+  sink->payload_type = -1;
+  sink->waiting_keyframe = TRUE;
+
+  caps = gst_app_src_get_caps(GST_APP_SRC(appsrc));
+  if (caps != NULL) {
+    if (!gst_caps_is_empty(caps))
+      gst_structure_get_int(gst_caps_get_structure(caps, 0), "payload", &sink->payload_type);
+    gst_caps_unref(caps);
+  }
+
+  g_ptr_array_add(track->sinks, sink);
+}
+
+/* Called with the lock held once a subscriber got its first keyframe from
+ * @track: whatever older publisher of the same name fed it is dropped now,
+ * so a new publisher takes over exactly at a keyframe */
+static void forward_track_remove_older(ForwardHub *hub, ForwardTrack *track, GstElement *pipeline) {
+  guint i, j;
+
+  for (i = 0; i < hub->tracks->len; i++) {
+    ForwardTrack *older = g_ptr_array_index(hub->tracks, i);
+
+    if (older == track)
+      break;
+    if (g_strcmp0(older->name, track->name) != 0)
+      continue;
+
+    for (j = older->sinks->len; j > 0; j--) {
+      ForwardSink *sink = g_ptr_array_index(older->sinks, j - 1);
+      if (sink->pipeline == pipeline)
+        g_ptr_array_remove_index_fast(older->sinks, j - 1);
+    }
+  }
+}
+
+static GstFlowReturn forward_track_new_sample(GstAppSink *appsink, gpointer user_data) {
+  ForwardHub *hub = (ForwardHub *)user_data;
+  ForwardTrack *track = NULL;
+  GstSample *sample;
+  GstBuffer *buffer;
+  gint is_keyframe = -1;
+  guint i;
+
+  sample = gst_app_sink_pull_sample(appsink);
+  if (sample == NULL)
+    return GST_FLOW_EOS;
+  buffer = gst_sample_get_buffer(sample);
+
+  g_mutex_lock(&hub->lock);
+  /* Looked up every time, the publisher may have left in the meantime */
+  for (i = 0; i < hub->tracks->len && track == NULL; i++) {
+    if (((ForwardTrack *)g_ptr_array_index(hub->tracks, i))->appsink == GST_ELEMENT(appsink))
+      track = g_ptr_array_index(hub->tracks, i);
+  }
+
+  for (i = 0; track != NULL && i < track->sinks->len; i++) {
+    ForwardSink *sink = g_ptr_array_index(track->sinks, i);
+
+    if (sink->waiting_keyframe) {
+      if (is_keyframe < 0)
+        is_keyframe = forward_is_keyframe_start(track->codec, buffer);
+      if (!is_keyframe)
+        continue;
+      sink->waiting_keyframe = FALSE;
+      forward_track_remove_older(hub, track, sink->pipeline);
+    }
+
+    forward_sink_push(sink, buffer);
+  }
+  g_mutex_unlock(&hub->lock);
+
+  gst_sample_unref(sample);
+  return GST_FLOW_OK;
+}
+
+static void forward_hub_request_keyframe(ForwardHub *hub, const gchar *name) {
+  ForwardTrack *track;
+  GstElement *appsink = NULL;
+  gint64 now = g_get_monotonic_time();
+
+  g_mutex_lock(&hub->lock);
+  track = forward_hub_find_newest_track(hub, name);
+  if (track != NULL && track->codec != FORWARD_CODEC_OTHER && now - track->last_keyframe_request >= FORWARD_KEYFRAME_REQUEST_INTERVAL_MS * 1000) {
+    track->last_keyframe_request = now;
+    appsink = gst_object_ref(track->appsink);
+  }
+  g_mutex_unlock(&hub->lock);
+
+  /* Travels up into the publisher's rtpsession, which sends the PLI/FIR */
+  if (appsink != NULL) {
+    gst_element_send_event(appsink, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+    gst_object_unref(appsink);
+  }
+}
+
+/* Keyframe requests of a subscriber come up from its webrtcbin as
+ * force-key-unit events, there is no encoder here to handle them */
+static GstPadProbeReturn forward_on_upstream_event(G_GNUC_UNUSED GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  ForwardProbe *probe = (ForwardProbe *)user_data;
+
+  if (!gst_video_event_is_force_key_unit(GST_PAD_PROBE_INFO_EVENT(info)))
+    return GST_PAD_PROBE_OK;
+
+  forward_hub_request_keyframe(probe->hub, probe->name);
+  return GST_PAD_PROBE_DROP;
+}
+
+ForwardHub *forward_hub_new(void) {
+  ForwardHub *hub;
+
+  hub = g_new0(ForwardHub, 1);
+  g_mutex_init(&hub->lock);
+  hub->tracks = g_ptr_array_new_with_free_func(forward_track_free);
+  hub->subscribers = g_ptr_array_new_with_free_func(gst_object_unref);
+
+  return hub;
+}
+
+void forward_hub_publish_pad(ForwardHub *hub, GstElement *pipeline, GstPad *pad) {
+  GstCaps *caps;
+  const GstStructure *structure;
+  const gchar *media, *encoding_name;
+  GstAppSinkCallbacks callbacks = {NULL};
+  ForwardTrack *track;
+  GstPad *sinkpad;
+  guint i;
+
+  g_return_if_fail(hub != NULL);
+
+  /* A tee src pad has no caps until the first buffer went through */
+  caps = gst_pad_get_current_caps(pad);
+  if (caps == NULL)
+    caps = gst_pad_query_caps(pad, NULL);
+  if (caps == NULL || gst_caps_is_empty(caps) || !gst_caps_is_fixed(caps)) {
+    gst_printerr("Pad '%s' has no caps, not forwarding it\n", GST_PAD_NAME(pad));
+    gst_clear_caps(&caps);
+    return;
+  }
+
+  track = g_new0(ForwardTrack, 1);
+  structure = gst_caps_get_structure(caps, 0);
+  media = gst_structure_get_string(structure, "media");
+  encoding_name = gst_structure_get_string(structure, "encoding-name");
+  track->name = g_strdup(media != NULL ? media : GST_PAD_NAME(pad));
+  if (g_strcmp0(encoding_name, "H264") == 0)
+    track->codec = FORWARD_CODEC_H264;
+  else if (g_strcmp0(encoding_name, "VP8") == 0)
+    track->codec = FORWARD_CODEC_VP8;
+  gst_caps_unref(caps);
+
+  track->pipeline = gst_object_ref(pipeline);
+  track->sinks = g_ptr_array_new_with_free_func(forward_sink_free);
+
+  /* Straight out of the jitterbuffer, nothing is synchronised or queued */
+  track->appsink = gst_object_ref(gst_element_factory_make("appsink", NULL));
+  g_object_set(track->appsink, "sync", FALSE, "async", FALSE, NULL);
+  callbacks.new_sample = forward_track_new_sample;
+  gst_app_sink_set_callbacks(GST_APP_SINK(track->appsink), &callbacks, hub, NULL);
+
+  gst_bin_add(GST_BIN(pipeline), track->appsink);
+  gst_element_sync_state_with_parent(track->appsink);
+  sinkpad = gst_element_get_static_pad(track->appsink, "sink");
+  gst_pad_link(pad, sinkpad);
+  gst_object_unref(sinkpad);
+
+  g_mutex_lock(&hub->lock);
+  for (i = 0; i < hub->subscribers->len; i++)
+    forward_track_add_sink(track, g_ptr_array_index(hub->subscribers, i));
+  g_ptr_array_add(hub->tracks, track);
+  g_mutex_unlock(&hub->lock);
+
+  gst_print("Forwarding %s track of %p\n", track->name, (gpointer)pipeline);
+
+  /* Subscribers already waiting don't have to wait for the next keyframe */
+  forward_hub_request_keyframe(hub, track->name);
+}
+
+void forward_hub_attach(ForwardHub *hub, GstElement *pipeline) {
+  GstIterator *iter;
+  GValue item = G_VALUE_INIT;
+  GPtrArray *names;
+  guint i;
+
+  g_return_if_fail(hub != NULL);
+
+  names = g_ptr_array_new_with_free_func(g_free);
+  iter = gst_bin_iterate_sources(GST_BIN(pipeline));
+  while (gst_iterator_next(iter, &item) == GST_ITERATOR_OK) {
+    GstElement *element = g_value_get_object(&item);
+
+    if (GST_IS_APP_SRC(element)) {
+      ForwardProbe *probe = g_new0(ForwardProbe, 1);
+      GstPad *srcpad = gst_element_get_static_pad(element, "src");
+
+      probe->hub = hub;
+      probe->name = gst_element_get_name(element);
+      g_ptr_array_add(names, g_strdup(probe->name));
+      gst_pad_add_probe(srcpad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, forward_on_upstream_event, probe, forward_probe_free);
+      gst_object_unref(srcpad);
+    }
+    g_value_reset(&item);
+  }
+  g_value_unset(&item);
+  gst_iterator_free(iter);
+
+  g_mutex_lock(&hub->lock);
+  g_ptr_array_add(hub->subscribers, gst_object_ref(pipeline));
+  for (i = 0; i < names->len; i++) {
+    ForwardTrack *track = forward_hub_find_newest_track(hub, g_ptr_array_index(names, i));
+    if (track != NULL)
+      forward_track_add_sink(track, pipeline);
+  }
+  g_mutex_unlock(&hub->lock);
+
+  /* Don't make the new subscriber wait for the publisher's next keyframe */
+  for (i = 0; i < names->len; i++)
+    forward_hub_request_keyframe(hub, g_ptr_array_index(names, i));
+  g_ptr_array_unref(names);
+}
+
+void forward_hub_detach(ForwardHub *hub, GstElement *pipeline) {
+  guint i, j;
+
+  g_return_if_fail(hub != NULL);
+
+  g_mutex_lock(&hub->lock);
+  g_ptr_array_remove(hub->subscribers, pipeline);
+  for (i = hub->tracks->len; i > 0; i--) {
+    ForwardTrack *track = g_ptr_array_index(hub->tracks, i - 1);
+
+    if (track->pipeline == pipeline) {
+      g_ptr_array_remove_index(hub->tracks, i - 1);
+      continue;
+    }
+
+    for (j = track->sinks->len; j > 0; j--) {
+      ForwardSink *sink = g_ptr_array_index(track->sinks, j - 1);
+      if (sink->pipeline == pipeline)
+        g_ptr_array_remove_index_fast(track->sinks, j - 1);
+    }
+  }
+  g_mutex_unlock(&hub->lock);
+}
+
+void forward_hub_free(ForwardHub *hub) {
+  g_return_if_fail(hub != NULL);
+
+  g_ptr_array_unref(hub->tracks);
+  g_ptr_array_unref(hub->subscribers);
+  g_mutex_clear(&hub->lock);
+  g_free(hub);
+}
@@ -0,0 +1,32 @@
+#ifndef __WEBRTC_FORWARD_H__
+#define __WEBRTC_FORWARD_H__
+
+#include <gst/app/app.h>
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Selective forwarding: the RTP of one publisher session is handed packet by
+ * packet to every subscriber session, without depayloading, decoding or
+ * encoding. A publisher track is named after the media of its webrtcbin src
+ * pad ("video" or "audio") and feeds the appsrc with the same name in every
+ * subscriber pipeline.
+ *
+ * Subscribers start at the next keyframe, keyframe requests (PLI/FIR) of the
+ * subscribers are relayed to the publisher, coalesced. A newer publisher
+ * takes over from the previous one at its first keyframe. */
+typedef struct _ForwardHub ForwardHub;
+
+ForwardHub *forward_hub_new(void);
+
+void forward_hub_publish_pad(ForwardHub *hub, GstElement *pipeline, GstPad *pad);
+
+void forward_hub_attach(ForwardHub *hub, GstElement *pipeline);
+
+void forward_hub_detach(ForwardHub *hub, GstElement *pipeline);
+
+void forward_hub_free(ForwardHub *hub);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_FORWARD_H__ */
@@ -0,0 +1,604 @@
+#include "webrtc-impair.h"
+
+#include <gio/gio.h>
+#include <string.h>
+
+#define IMPAIR_DEFAULT_BURST 16384
+#define IMPAIR_DEFAULT_QUEUE_US (500 * G_TIME_SPAN_MILLISECOND)
+
+typedef struct _ImpairParams ImpairParams;
+typedef struct _ImpairPhase ImpairPhase;
+typedef struct _ImpairPacket ImpairPacket;
+typedef struct _Impairment Impairment;
+
+struct _ImpairParams {
+  gdouble loss;
+  gdouble gilbert_p, gilbert_r, gilbert_bad, gilbert_good;
+  gint64 delay, jitter;
+  gdouble reorder;
+  /* bit/s, 0 for no limit */
+  guint64 rate;
+  guint burst;
+  gint64 queue;
+};
+
+struct _ImpairPhase {
+  gint64 offset;
+  gboolean repeat;
+  ImpairParams params;
+};
+
+struct _ImpairScenario {
+  gint ref_count;
+  guint32 seed;
+  /* By offset */
+  GArray *phases;
+};
+
+/* A held buffer, or a serialized event that has to stay behind the buffers
+ * held before it */
+struct _ImpairPacket {
+  GstBuffer *buffer;
+  GstEvent *event;
+  gint64 arrival, release;
+};
+
+/* One direction of one transport. Held packets leave from a task of its own,
+ * as from a queue, together with the events that came after them */
+struct _Impairment {
+  gint ref_count;
+  ImpairScenario *scenario;
+  gchar *name;
+  GWeakRef pad;
+  GstTask *task;
+  GRecMutex task_lock;
+
+  GMutex lock;
+  /* Signalled when the head of the held packets changes */
+  GCond cond;
+  gboolean stopping;
+  GRand *rand;
+  /* Monotonic time of the first packet, phases count from there */
+  gint64 start;
+  /* Gilbert-Elliott state */
+  gboolean bad;
+  /* Token bucket, filled up to when the last packet leaves it */
+  gdouble tokens;
+  gint64 bucket_time;
+  gint64 last_release;
+  /* ImpairPacket, by release time */
+  GQueue held;
+  guint held_events;
+
+  guint64 packets, lost, overflowed, reordered;
+};
+
+static const ImpairParams clean_params = {0};
+
+/* Set to the pad a released packet goes through, which the probe lets by */
+static GPrivate impair_forwarding;
+
+/* === Scenarios ================================================ */
+
+static gboolean parse_time(const gchar *value, gint64 *time) {
+  gchar *end;
+  gdouble number = g_ascii_strtod(value, &end);
+
+  if (end == value || number < 0)
+    return FALSE;
+  if (g_ascii_strcasecmp(end, "us") == 0)
+    *time = number;
+  else if (g_ascii_strcasecmp(end, "ms") == 0 || *end == '\0')
+    *time = number * G_TIME_SPAN_MILLISECOND;
+  else if (g_ascii_strcasecmp(end, "s") == 0)
+    *time = number * G_TIME_SPAN_SECOND;
+  else
+    return FALSE;
+  return TRUE;
+}
+
+static gboolean parse_probability(const gchar *value, gdouble *probability) {
+  gchar *end;
+  gdouble number = g_ascii_strtod(value, &end);
+
+  if (end == value)
+    return FALSE;
+  if (*end == '%') {
+    number /= 100;
+    end++;
+  }
+  if (*end != '\0' || number < 0 || number > 1)
+    return FALSE;
+  *probability = number;
+  return TRUE;
+}
+
+/* 800kbit with a @base of 1000, 16kb with 1024 */
+static gboolean parse_scaled(const gchar *value, const gchar *unit, gdouble base, guint64 *out) {
+  gchar *end;
+  gdouble number = g_ascii_strtod(value, &end), scale;
+
+  if (end == value || number < 0)
+    return FALSE;
+  if (*end == '\0' || g_ascii_strcasecmp(end, unit) == 0)
+    scale = 1;
+  else if ((*end == 'k' || *end == 'K') && g_ascii_strcasecmp(end + 1, unit) == 0)
+    scale = base;
+  else if ((*end == 'm' || *end == 'M') && g_ascii_strcasecmp(end + 1, unit) == 0)
+    scale = base * base;
+  else
+    return FALSE;
+  *out = number * scale;
+  return TRUE;
+}
+
+static gboolean parse_gilbert(const gchar *value, ImpairParams *params) {
+  gchar **parts = g_strsplit(value, ",", -1);
+  guint n = g_strv_length(parts);
+  gboolean ret;
+
+  params->gilbert_bad = 1;
+  params->gilbert_good = 0;
+  ret = (n >= 2 && n <= 4) && parse_probability(parts[0], &params->gilbert_p) && parse_probability(parts[1], &params->gilbert_r) && //
+        (n < 3 || parse_probability(parts[2], &params->gilbert_bad)) && (n < 4 || parse_probability(parts[3], &params->gilbert_good));
+  g_strfreev(parts);
+  return ret;
+}
+
+static gboolean parse_settings(const gchar *const *tokens, ImpairParams *params, GError **error) {
+  guint i;
+
+  *params = clean_params;
+  params->burst = IMPAIR_DEFAULT_BURST;
+  params->queue = IMPAIR_DEFAULT_QUEUE_US;
+
+  for (i = 0; tokens[i] != NULL; i++) {
+    const gchar *value = strchr(tokens[i], '=');
+    gsize key_length;
+    guint64 number;
+    gboolean ret;
+
+    if (value == NULL) {
+      g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "expected KEY=VALUE, got %s", tokens[i]);
+      return FALSE;
+    }
+    key_length = value - tokens[i];
+    value++;
+
+#define KEY_IS(key) (key_length == strlen(key) && strncmp(tokens[i], key, key_length) == 0)
+    if (KEY_IS("loss")) {
+      ret = parse_probability(value, &params->loss);
+    } else if (KEY_IS("gilbert")) {
+      ret = parse_gilbert(value, params);
+    } else if (KEY_IS("delay")) {
+      ret = parse_time(value, &params->delay);
+    } else if (KEY_IS("jitter")) {
+      ret = parse_time(value, &params->jitter);
+    } else if (KEY_IS("reorder")) {
+      ret = parse_probability(value, &params->reorder);
+    } else if (KEY_IS("rate")) {
+      ret = parse_scaled(value, "bit", 1000, &params->rate);
+    } else if (KEY_IS("burst")) {
+      ret = parse_scaled(value, "b", 1024, &number) && number > 0 && number <= G_MAXUINT;
+      params->burst = number;
+    } else if (KEY_IS("queue")) {
+      ret = parse_time(value, &params->queue);
+    } else {
+      g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "unknown impairment %.*s", (gint)key_length, tokens[i]);
+      return FALSE;
+    }
+#undef KEY_IS
+
+    if (!ret) {
+      g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "invalid value in %s", tokens[i]);
+      return FALSE;
+    }
+  }
+  return TRUE;
+}
+
+static gchar **split_tokens(const gchar *line) {
+  gchar **tokens = g_strsplit_set(line, " \t\r", -1);
+  guint i, n = 0;
+
+  /* Runs of blanks leave empty tokens behind */
+  for (i = 0; tokens[i] != NULL; i++) {
+    if (*tokens[i] != '\0')
+      tokens[n++] = tokens[i];
+    else
+      g_free(tokens[i]);
+  }
+  tokens[n] = NULL;
+  return tokens;
+}
+
+static ImpairScenario *impair_scenario_alloc(guint32 seed) {
+  ImpairScenario *scenario;
+
+  scenario = g_new0(ImpairScenario, 1);
+  scenario->ref_count = 1;
+  scenario->seed = seed;
+  scenario->phases = g_array_new(FALSE, TRUE, sizeof(ImpairPhase));
+  return scenario;
+}
+
+ImpairScenario *impair_scenario_new(const gchar *settings, guint32 seed, GError **error) {
+  ImpairScenario *scenario;
+  ImpairPhase phase = {0};
+  gchar **tokens;
+  gboolean ret;
+
+  tokens = split_tokens(settings);
+  ret = parse_settings((const gchar *const *)tokens, &phase.params, error);
+  g_strfreev(tokens);
+  if (!ret)
+    return NULL;
+
+  scenario = impair_scenario_alloc(seed);
+  g_array_append_val(scenario->phases, phase);
+  return scenario;
+}
+
+ImpairScenario *impair_scenario_new_from_file(const gchar *path, guint32 seed, GError **error) {
+  ImpairScenario *scenario;
+  gchar *contents, **lines;
+  guint i;
+
+  if (!g_file_get_contents(path, &contents, NULL, error))
+    return NULL;
+
+  scenario = impair_scenario_alloc(seed);
+  lines = g_strsplit(contents, "\n", -1);
+  g_free(contents);
+
+  for (i = 0; lines[i] != NULL; i++) {
+    ImpairPhase phase = {0};
+    gchar *comment, **tokens;
+    gboolean ret;
+
+    if ((comment = strchr(lines[i], '#')) != NULL)
+      *comment = '\0';
+    tokens = split_tokens(lines[i]);
+    if (tokens[0] == NULL) {
+      g_strfreev(tokens);
+      continue;
+    }
+
+    ret = parse_time(tokens[0], &phase.offset);
+    if (!ret) {
+      g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "line %u: invalid offset %s", i + 1, tokens[0]);
+    } else if (scenario->phases->len > 0 && phase.offset < g_array_index(scenario->phases, ImpairPhase, scenario->phases->len - 1).offset) {
+      g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "line %u: offsets have to ascend", i + 1);
+      ret = FALSE;
+    } else if (g_strcmp0(tokens[1], "repeat") == 0 && tokens[2] == NULL) {
+      phase.repeat = TRUE;
+    } else {
+      ret = parse_settings((const gchar *const *)tokens + 1, &phase.params, error);
+      if (!ret)
+        g_prefix_error(error, "line %u: ", i + 1);
+    }
+    g_strfreev(tokens);
+
+    if (!ret) {
+      g_strfreev(lines);
+      impair_scenario_unref(scenario);
+      return NULL;
+    }
+    g_array_append_val(scenario->phases, phase);
+  }
+  g_strfreev(lines);
+
+  return scenario;
+}
+
+ImpairScenario *impair_scenario_ref(ImpairScenario *scenario) {
+  g_atomic_int_inc(&scenario->ref_count);
+  return scenario;
+}
+
+void impair_scenario_unref(ImpairScenario *scenario) {
+  if (!g_atomic_int_dec_and_test(&scenario->ref_count))
+    return;
+  g_array_unref(scenario->phases);
+  g_free(scenario);
+}
+
+static const ImpairParams *impair_scenario_lookup(ImpairScenario *scenario, gint64 elapsed) {
+  const ImpairParams *params = &clean_params;
+  guint i;
+
+  for (i = 0; i < scenario->phases->len; i++) {
+    ImpairPhase *phase = &g_array_index(scenario->phases, ImpairPhase, i);
+
+    if (phase->repeat && phase->offset > 0)
+      return impair_scenario_lookup(scenario, elapsed % phase->offset);
+    if (phase->offset > elapsed)
+      break;
+    params = &phase->params;
+  }
+  return params;
+}
+
+/* === Impairments ============================================== */
+
+static Impairment *impairment_ref(Impairment *impairment) {
+  g_atomic_int_inc(&impairment->ref_count);
+  return impairment;
+}
+
+static void impair_packet_free(gpointer packet_ptr) {
+  ImpairPacket *packet = (ImpairPacket *)packet_ptr;
+
+  if (packet->buffer != NULL)
+    gst_buffer_unref(packet->buffer);
+  if (packet->event != NULL)
+    gst_event_unref(packet->event);
+  g_free(packet);
+}
+
+static void impairment_unref(gpointer user_data) {
+  Impairment *impairment = (Impairment *)user_data;
+
+  if (!g_atomic_int_dec_and_test(&impairment->ref_count))
+    return;
+
+  if (impairment->packets > 0)
+    gst_print("Impairment %s: %" G_GUINT64_FORMAT " packets, %" G_GUINT64_FORMAT " lost, %" G_GUINT64_FORMAT " over the rate limit, %" G_GUINT64_FORMAT " reordered\n", impairment->name, //
+              impairment->packets, impairment->lost, impairment->overflowed, impairment->reordered);
+
+  g_queue_clear_full(&impairment->held, impair_packet_free);
+  g_weak_ref_clear(&impairment->pad);
+  g_rand_free(impairment->rand);
+  g_rec_mutex_clear(&impairment->task_lock);
+  g_cond_clear(&impairment->cond);
+  g_mutex_clear(&impairment->lock);
+  impair_scenario_unref(impairment->scenario);
+  g_free(impairment->name);
+  g_free(impairment);
+}
+
+static void impairment_forward(GstPad *pad, ImpairPacket *packet, gint64 now) {
+  GstBuffer *buffer;
+
+  g_private_set(&impair_forwarding, pad);
+  if (packet->event != NULL) {
+    if (GST_PAD_IS_SRC(pad))
+      gst_pad_push_event(pad, packet->event);
+    else
+      gst_pad_send_event(pad, packet->event);
+  } else {
+    buffer = gst_buffer_make_writable(packet->buffer);
+    if (GST_BUFFER_PTS_IS_VALID(buffer))
+      GST_BUFFER_PTS(buffer) += (now - packet->arrival) * GST_USECOND;
+    if (GST_BUFFER_DTS_IS_VALID(buffer))
+      GST_BUFFER_DTS(buffer) += (now - packet->arrival) * GST_USECOND;
+
+    if (GST_PAD_IS_SRC(pad))
+      gst_pad_push(pad, buffer);
+    else
+      gst_pad_chain(pad, buffer);
+  }
+  g_private_set(&impair_forwarding, NULL);
+  g_free(packet);
+}
+
+/* Task function, waits for the next packet due and sends it on with
+ * everything else due by then, in the order they were held */
+static void impairment_loop(gpointer user_data) {
+  Impairment *impairment = (Impairment *)user_data;
+  GQueue due = G_QUEUE_INIT;
+  ImpairPacket *packet;
+  GstPad *pad;
+  gint64 now;
+
+  g_mutex_lock(&impairment->lock);
+  now = g_get_monotonic_time();
+  while (!impairment->stopping && ((packet = g_queue_peek_head(&impairment->held)) == NULL || packet->release > now)) {
+    if (packet == NULL)
+      g_cond_wait(&impairment->cond, &impairment->lock);
+    else
+      g_cond_wait_until(&impairment->cond, &impairment->lock, packet->release);
+    now = g_get_monotonic_time();
+  }
+  while (!impairment->stopping && (packet = g_queue_peek_head(&impairment->held)) != NULL && packet->release <= now) {
+    g_queue_push_tail(&due, g_queue_pop_head(&impairment->held));
+    if (packet->event != NULL)
+      impairment->held_events--;
+  }
+  g_mutex_unlock(&impairment->lock);
+
+  pad = g_weak_ref_get(&impairment->pad);
+  while ((packet = g_queue_pop_head(&due)) != NULL) {
+    if (pad != NULL)
+      impairment_forward(pad, packet, now);
+    else
+      impair_packet_free(packet);
+  }
+  if (pad != NULL)
+    gst_object_unref(pad);
+}
+
+/* Called with the lock held */
+static void impairment_hold(Impairment *impairment, GstBuffer *buffer, GstEvent *event, gint64 now, gint64 release) {
+  ImpairPacket *packet;
+  GList *link;
+
+  packet = g_new0(ImpairPacket, 1);
+  packet->buffer = buffer != NULL ? gst_buffer_ref(buffer) : NULL;
+  packet->event = event;
+  packet->arrival = now;
+  packet->release = release;
+  if (event != NULL)
+    impairment->held_events++;
+
+  /* Mostly appended, only reordered packets go further in, and never past
+   * an event */
+  for (link = impairment->held.tail; link != NULL && ((ImpairPacket *)link->data)->release > release && ((ImpairPacket *)link->data)->event == NULL; link = link->prev)
+    ;
+  if (link != NULL)
+    g_queue_insert_after(&impairment->held, link, packet);
+  else
+    g_queue_push_head(&impairment->held, packet);
+
+  if (impairment->held.head->data == packet)
+    g_cond_signal(&impairment->cond);
+}
+
+/* TRUE when @buffer was lost or held back, FALSE when it goes on right away */
+static gboolean impairment_take(Impairment *impairment, GstBuffer *buffer) {
+  const ImpairParams *params;
+  gint64 now = g_get_monotonic_time(), depart = now, release;
+  gdouble loss, tokens = 0, size = gst_buffer_get_size(buffer);
+  gboolean reordered = FALSE, taken = TRUE;
+
+  g_mutex_lock(&impairment->lock);
+  if (impairment->start == 0)
+    impairment->start = now;
+  params = impair_scenario_lookup(impairment->scenario, now - impairment->start);
+  impairment->packets++;
+
+  if (params->gilbert_p > 0 || params->gilbert_r > 0) {
+    if (impairment->bad ? g_rand_double(impairment->rand) < params->gilbert_r : g_rand_double(impairment->rand) < params->gilbert_p)
+      impairment->bad = !impairment->bad;
+    loss = impairment->bad ? params->gilbert_bad : params->gilbert_good;
+  } else {
+    loss = params->loss;
+  }
+  if (loss > 0 && g_rand_double(impairment->rand) < loss) {
+    impairment->lost++;
+    goto out;
+  }
+
+  if (params->rate > 0) {
+    gint64 t0 = MAX(now, impairment->bucket_time);
+
+    tokens = MIN(params->burst, impairment->tokens + (t0 - impairment->bucket_time) * params->rate / 8e6);
+    if (tokens >= size) {
+      depart = t0;
+      tokens -= size;
+    } else {
+      depart = t0 + (size - tokens) * 8e6 / params->rate;
+      tokens = 0;
+    }
+    if (depart - now > params->queue) {
+      impairment->overflowed++;
+      goto out;
+    }
+    impairment->tokens = tokens;
+    impairment->bucket_time = depart;
+  }
+
+  release = depart + params->delay;
+  if (params->jitter > 0)
+    release = MAX(depart, release + g_rand_double_range(impairment->rand, -params->jitter, params->jitter));
+  if (params->reorder > 0 && g_rand_double(impairment->rand) < params->reorder) {
+    reordered = TRUE;
+    release = depart;
+    impairment->reordered++;
+  } else {
+    release = MAX(release, impairment->last_release);
+    impairment->last_release = release;
+  }
+
+  if (release <= now && (g_queue_is_empty(&impairment->held) || (reordered && impairment->held_events == 0)))
+    taken = FALSE;
+  else
+    impairment_hold(impairment, buffer, NULL, now, release);
+
+out:
+  g_mutex_unlock(&impairment->lock);
+  return taken;
+}
+
+/* TRUE when @event has to wait behind held packets, FALSE when it goes on
+ * right away */
+static gboolean impairment_take_event(Impairment *impairment, GstEvent *event) {
+  gboolean taken = FALSE;
+
+  g_mutex_lock(&impairment->lock);
+  if (GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_START) {
+    /* Whatever is held belongs to before the flush, as in a queue */
+    g_queue_clear_full(&impairment->held, impair_packet_free);
+    impairment->held_events = 0;
+  } else if (GST_EVENT_IS_SERIALIZED(event) && !g_queue_is_empty(&impairment->held)) {
+    impairment_hold(impairment, NULL, gst_event_ref(event), g_get_monotonic_time(), ((ImpairPacket *)impairment->held.tail->data)->release);
+    taken = TRUE;
+  }
+  g_mutex_unlock(&impairment->lock);
+
+  return taken;
+}
+
+static GstPadProbeReturn impairment_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  Impairment *impairment = (Impairment *)user_data;
+  GstBufferList *list, *passed;
+  guint i, length;
+
+  if (g_private_get(&impair_forwarding) == pad)
+    return GST_PAD_PROBE_OK;
+
+  if (info->type & (GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH))
+    return impairment_take_event(impairment, GST_PAD_PROBE_INFO_EVENT(info)) ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+
+  if (info->type & GST_PAD_PROBE_TYPE_BUFFER)
+    return impairment_take(impairment, GST_PAD_PROBE_INFO_BUFFER(info)) ? GST_PAD_PROBE_DROP : GST_PAD_PROBE_OK;
+
+  list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+  length = gst_buffer_list_length(list);
+  passed = gst_buffer_list_new_sized(length);
+  for (i = 0; i < length; i++) {
+    GstBuffer *buffer = gst_buffer_list_get(list, i);
+
+    if (!impairment_take(impairment, buffer))
+      gst_buffer_list_add(passed, gst_buffer_ref(buffer));
+  }
+
+  if (gst_buffer_list_length(passed) == length) {
+    gst_buffer_list_unref(passed);
+    return GST_PAD_PROBE_OK;
+  }
+  gst_buffer_list_unref(list);
+  GST_PAD_PROBE_INFO_DATA(info) = passed;
+  return gst_buffer_list_length(passed) > 0 ? GST_PAD_PROBE_OK : GST_PAD_PROBE_DROP;
+}
+
+/* The pad is gone, anything still held goes with the impairment. This may
+ * run on the task's own thread, which is why it isn't joined */
+static void impairment_detach(gpointer user_data) {
+  Impairment *impairment = (Impairment *)user_data;
+
+  g_mutex_lock(&impairment->lock);
+  impairment->stopping = TRUE;
+  g_cond_signal(&impairment->cond);
+  g_mutex_unlock(&impairment->lock);
+
+  gst_task_stop(impairment->task);
+  gst_object_unref(impairment->task);
+  impairment_unref(impairment);
+}
+
+void impair_pad(GstPad *pad, ImpairScenario *scenario, guint32 seed, const gchar *name) {
+  Impairment *impairment;
+  guint32 seeds[2];
+
+  g_return_if_fail(GST_IS_PAD(pad) && scenario != NULL);
+
+  seeds[0] = scenario->seed;
+  seeds[1] = seed;
+
+  impairment = g_new0(Impairment, 1);
+  impairment->ref_count = 1;
+  impairment->scenario = impair_scenario_ref(scenario);
+  impairment->name = g_strdup(name);
+  g_weak_ref_init(&impairment->pad, pad);
+  g_mutex_init(&impairment->lock);
+  g_cond_init(&impairment->cond);
+  impairment->rand = g_rand_new_with_seed_array(seeds, G_N_ELEMENTS(seeds));
+
+  g_rec_mutex_init(&impairment->task_lock);
+  impairment->task = gst_task_new(impairment_loop, impairment_ref(impairment), impairment_unref);
+  gst_task_set_lock(impairment->task, &impairment->task_lock);
+  gst_task_start(impairment->task);
+
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH, impairment_probe, impairment, impairment_detach);
+}
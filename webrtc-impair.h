@@ -0,0 +1,61 @@
+#ifndef __WEBRTC_IMPAIR_H__
+#define __WEBRTC_IMPAIR_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Network impairment for lab runs, in place of netem: packets of an ICE
+ * transport are lost, delayed, reordered and rate limited on their way
+ * between webrtcbin and the socket.
+ *
+ * A scenario is a list of phases, each starting at an offset from the
+ * moment the transport carries its first packet and replacing the settings
+ * of the previous one:
+ *
+ *   # offset  settings
+ *   0s        delay=40ms jitter=5ms loss=0.5%
+ *   20s       delay=40ms rate=600kbit burst=16kb queue=300ms
+ *   40s       gilbert=2%,30%
+ *   60s       repeat
+ *
+ *   loss=P            independent (Bernoulli) loss
+ *   gilbert=P,R[,B,G] Gilbert-Elliott bursts: good to bad with P, bad to good
+ *                     with R, loss B in the bad state (100%) and G in the
+ *                     good one (0%)
+ *   delay=T jitter=T  one-way delay, spread evenly by +-jitter but kept in
+ *                     order as a FIFO queue would
+ *   reorder=P         P of the packets skip the delay and overtake the rest
+ *   rate=R burst=S    token bucket of R bit/s (bit, kbit, mbit) and S bytes
+ *                     (b, kb, mb), 16kb by default
+ *   queue=T           packets the bucket would hold longer are tail dropped,
+ *                     500ms by default
+ *
+ * Times take us, ms or s, ms when bare, and probabilities a fraction or a
+ * percentage. An offset alone leaves the network clean and "repeat" starts
+ * over. Loss and reordering are drawn from a generator seeded per scenario
+ * and per transport, so a run sees the same pattern every time. */
+
+typedef struct _ImpairScenario ImpairScenario;
+
+typedef enum {
+  IMPAIR_SEND = 1 << 0,
+  IMPAIR_RECEIVE = 1 << 1,
+} ImpairDirection;
+
+/* A single phase from settings as on one line, without the offset */
+ImpairScenario *impair_scenario_new(const gchar *settings, guint32 seed, GError **error);
+
+ImpairScenario *impair_scenario_new_from_file(const gchar *path, guint32 seed, GError **error);
+
+ImpairScenario *impair_scenario_ref(ImpairScenario *scenario);
+void impair_scenario_unref(ImpairScenario *scenario);
+
+/* Impairs the buffers going through @pad for as long as it lives, a source
+ * pad pushing them or a sink pad taking them. @seed tells apart the pads
+ * sharing a scenario, @name goes into the summary printed at the end */
+void impair_pad(GstPad *pad, ImpairScenario *scenario, guint32 seed, const gchar *name);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_IMPAIR_H__ */
@@ -0,0 +1,133 @@
+#include "webrtc-keyframe.h"
+
+#include <gst/video/video.h>
+
+typedef struct _KeyframeLimiter KeyframeLimiter;
+
+/* Owned by the encoder's src pad probe, and by the pending timeout while a
+ * request is held back */
+struct _KeyframeLimiter {
+  gint ref_count;
+  GMutex lock;
+  GMainContext *context;
+  GWeakRef encoder;
+  gint64 min_interval;
+
+  gint64 last_request;
+  GSource *pending_source;
+  /* The held back request we send ourselves once the interval is over */
+  guint32 own_seqnum;
+  guint n_coalesced;
+};
+
+static KeyframeLimiter *keyframe_limiter_ref(KeyframeLimiter *limiter) {
+  g_atomic_int_inc(&limiter->ref_count);
+  return limiter;
+}
+
+static void keyframe_limiter_unref(gpointer limiter_ptr) {
+  KeyframeLimiter *limiter = (KeyframeLimiter *)limiter_ptr;
+
+  if (!g_atomic_int_dec_and_test(&limiter->ref_count))
+    return;
+
+  if (limiter->n_coalesced > 0)
+    gst_print("Coalesced %u keyframe requests\n", limiter->n_coalesced);
+
+  if (limiter->pending_source != NULL)
+    g_source_unref(limiter->pending_source);
+  g_weak_ref_clear(&limiter->encoder);
+  g_main_context_unref(limiter->context);
+  g_mutex_clear(&limiter->lock);
+  g_free(limiter);
+}
+
+static gboolean keyframe_limiter_dispatch(gpointer user_data) {
+  KeyframeLimiter *limiter = (KeyframeLimiter *)user_data;
+  GstElement *encoder;
+  GstEvent *event;
+
+  event = gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0);
+
+  g_mutex_lock(&limiter->lock);
+  g_clear_pointer(&limiter->pending_source, g_source_unref);
+  limiter->last_request = g_get_monotonic_time();
+  limiter->own_seqnum = gst_event_get_seqnum(event);
+  g_mutex_unlock(&limiter->lock);
+
+  encoder = g_weak_ref_get(&limiter->encoder);
+  if (encoder != NULL) {
+    gst_element_send_event(encoder, event);
+    gst_object_unref(encoder);
+  } else {
+    gst_event_unref(event);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn keyframe_limiter_on_upstream_event(G_GNUC_UNUSED GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  KeyframeLimiter *limiter = (KeyframeLimiter *)user_data;
+  GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+  GstPadProbeReturn ret = GST_PAD_PROBE_DROP;
+  gint64 now, elapsed;
+
+  if (!gst_video_event_is_force_key_unit(event))
+    return GST_PAD_PROBE_OK;
+
+  now = g_get_monotonic_time();
+  g_mutex_lock(&limiter->lock);
+  elapsed = now - limiter->last_request;
+
+  if (gst_event_get_seqnum(event) == limiter->own_seqnum) {
+    ret = GST_PAD_PROBE_OK;
+  } else if (limiter->pending_source != NULL) {
+    /* Rides along with the one already held back */
+    limiter->n_coalesced++;
+  } else if (limiter->last_request == 0 || elapsed >= limiter->min_interval) {
+    limiter->last_request = now;
+    ret = GST_PAD_PROBE_OK;
+  } else {
+    limiter->n_coalesced++;
+    limiter->pending_source = g_timeout_source_new((limiter->min_interval - elapsed) / 1000 + 1);
+    g_source_set_callback(limiter->pending_source, keyframe_limiter_dispatch, keyframe_limiter_ref(limiter), keyframe_limiter_unref);
+    g_source_attach(limiter->pending_source, limiter->context);
+  }
+  g_mutex_unlock(&limiter->lock);
+
+  return ret;
+}
+
+void keyframe_limiter_install(GstElement *encoder, guint min_interval_ms) {
+  KeyframeLimiter *limiter;
+  GstPad *pad;
+
+  pad = gst_element_get_static_pad(encoder, "src");
+  g_return_if_fail(pad != NULL);
+
+  limiter = g_new0(KeyframeLimiter, 1);
+  limiter->ref_count = 1;
+  g_mutex_init(&limiter->lock);
+  limiter->context = g_main_context_ref_thread_default();
+  g_weak_ref_init(&limiter->encoder, encoder);
+  limiter->min_interval = (gint64)min_interval_ms * 1000;
+
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_UPSTREAM, keyframe_limiter_on_upstream_event, limiter, keyframe_limiter_unref);
+  gst_object_unref(pad);
+}
+
+void keyframe_limiter_install_all(GstBin *bin, guint min_interval_ms) {
+  GstIterator *iter;
+  GValue item = G_VALUE_INIT;
+
+  iter = gst_bin_iterate_recurse(bin);
+  while (gst_iterator_next(iter, &item) == GST_ITERATOR_OK) {
+    GstElement *element = g_value_get_object(&item);
+
+    if (GST_IS_VIDEO_ENCODER(element))
+      keyframe_limiter_install(element, min_interval_ms);
+    g_value_reset(&item);
+  }
+  g_value_unset(&item);
+  gst_iterator_free(iter);
+}
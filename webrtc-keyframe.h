@@ -0,0 +1,26 @@
+#ifndef __WEBRTC_KEYFRAME_H__
+#define __WEBRTC_KEYFRAME_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Encoders run with a practically infinite GOP and only produce an IDR when
+ * asked to: a receiver's PLI/FIR or a new viewer, both reaching the encoder
+ * as upstream force-key-unit events.
+ *
+ * The limiter lets one request through per interval. A request arriving
+ * sooner is held back until the interval is over and any more in between
+ * ride along with it, so a burst of requests from many viewers costs a
+ * single keyframe. */
+#define KEYFRAME_MIN_INTERVAL_MS 500
+
+/* Limits the requests reaching @encoder, for as long as it lives */
+void keyframe_limiter_install(GstElement *encoder, guint min_interval_ms);
+
+/* Same for every video encoder in @bin */
+void keyframe_limiter_install_all(GstBin *bin, guint min_interval_ms);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_KEYFRAME_H__ */
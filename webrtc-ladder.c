@@ -0,0 +1,241 @@
+#include "webrtc-common.h"
+
+#include <stdio.h>
+
+#define LADDER_INTERVAL_MS 1000
+/* Loss thresholds of the loss based half of Google Congestion Control */
+#define LADDER_LOSS_HIGH 0.10
+#define LADDER_LOSS_LOW 0.02
+#define LADDER_INCREASE_FACTOR 1.08
+/* Going up needs the estimate to hold for a while, going down is immediate */
+#define LADDER_UPSWITCH_INTERVALS 3
+
+struct _LadderController {
+  gint ref_count;
+
+  FanoutSource *fanout;
+  GstElement *pipeline;
+  GstElement *webrtcbin;
+  GArray *renditions;
+
+  GSource *timeout_source;
+  gint stats_pending;
+
+  guint layer;
+  gdouble estimate; /* bit/s */
+  guint64 last_bytes_sent;
+  gint64 last_time;
+  guint upswitch_intervals;
+};
+
+typedef struct _LadderStats {
+  guint ssrc;
+  gboolean has_bytes_sent;
+  guint64 bytes_sent;
+  gboolean has_fraction_lost;
+  gdouble fraction_lost;
+} LadderStats;
+
+static gint compare_rendition_bitrate(gconstpointer a, gconstpointer b) {
+  const LadderRendition *ra = a;
+  const LadderRendition *rb = b;
+  return (gint)ra->bitrate - (gint)rb->bitrate;
+}
+
+GArray *ladder_renditions_parse(const gchar *spec) {
+  GArray *renditions;
+  gchar **items;
+  guint i;
+
+  renditions = g_array_new(FALSE, TRUE, sizeof(LadderRendition));
+  items = g_strsplit(spec, ",", -1);
+
+  for (i = 0; items[i] != NULL; i++) {
+    LadderRendition rendition;
+
+    if (sscanf(g_strstrip(items[i]), "%ux%u@%u", &rendition.width, &rendition.height, &rendition.bitrate) != 3 || rendition.width == 0 || rendition.height == 0 || rendition.bitrate == 0) {
+      g_printerr("Invalid rendition \"%s\", expected WIDTHxHEIGHT@KBPS\n", items[i]);
+      g_strfreev(items);
+      g_array_unref(renditions);
+      return NULL;
+    }
+    g_array_append_val(renditions, rendition);
+  }
+  g_strfreev(items);
+
+  if (renditions->len == 0) {
+    g_array_unref(renditions);
+    return NULL;
+  }
+
+  g_array_sort(renditions, compare_rendition_bitrate);
+  return renditions;
+}
+
+static LadderController *ladder_controller_ref(LadderController *ladder) {
+  g_atomic_int_inc(&ladder->ref_count);
+  return ladder;
+}
+
+static void ladder_controller_unref(gpointer ladder_ptr) {
+  LadderController *ladder = (LadderController *)ladder_ptr;
+
+  if (!g_atomic_int_dec_and_test(&ladder->ref_count))
+    return;
+
+  gst_object_unref(ladder->webrtcbin);
+  gst_object_unref(ladder->pipeline);
+  g_array_unref(ladder->renditions);
+  g_free(ladder);
+}
+
+static gboolean on_ladder_stat(G_GNUC_UNUSED GQuark field_id, const GValue *value, gpointer user_data) {
+  LadderStats *stats = (LadderStats *)user_data;
+  const GstStructure *s;
+  GstWebRTCStatsType type;
+  guint ssrc;
+
+  if (!GST_VALUE_HOLDS_STRUCTURE(value))
+    return TRUE;
+
+  s = gst_value_get_structure(value);
+  if (!gst_structure_get(s, "type", GST_TYPE_WEBRTC_STATS_TYPE, &type, NULL))
+    return TRUE;
+  if (!gst_structure_get_uint(s, "ssrc", &ssrc) || ssrc != stats->ssrc)
+    return TRUE;
+
+  if (type == GST_WEBRTC_STATS_OUTBOUND_RTP)
+    stats->has_bytes_sent = gst_structure_get_uint64(s, "bytes-sent", &stats->bytes_sent);
+  else if (type == GST_WEBRTC_STATS_REMOTE_INBOUND_RTP)
+    stats->has_fraction_lost = gst_structure_get_double(s, "fraction-lost", &stats->fraction_lost);
+
+  return TRUE;
+}
+
+static void ladder_update(LadderController *ladder, const LadderStats *stats) {
+  LadderRendition *current;
+  gdouble sent_bitrate;
+  gint64 now;
+  guint target;
+
+  now = g_get_monotonic_time();
+  if (ladder->last_time == 0 || stats->bytes_sent < ladder->last_bytes_sent) {
+    ladder->last_time = now;
+    ladder->last_bytes_sent = stats->bytes_sent;
+    return;
+  }
+
+  sent_bitrate = (stats->bytes_sent - ladder->last_bytes_sent) * 8.0 * G_USEC_PER_SEC / MAX(now - ladder->last_time, 1);
+  ladder->last_time = now;
+  ladder->last_bytes_sent = stats->bytes_sent;
+
+  if (stats->has_fraction_lost && stats->fraction_lost > LADDER_LOSS_HIGH)
+    ladder->estimate = sent_bitrate * (1.0 - 0.5 * stats->fraction_lost);
+  else if (!stats->has_fraction_lost || stats->fraction_lost < LADDER_LOSS_LOW)
+    ladder->estimate = MAX(ladder->estimate, sent_bitrate) * LADDER_INCREASE_FACTOR;
+
+  /* No point probing past the top layer, it only slows down the next drop */
+  ladder->estimate = MIN(ladder->estimate, g_array_index(ladder->renditions, LadderRendition, ladder->renditions->len - 1).bitrate * 1000.0 * LADDER_INCREASE_FACTOR);
+
+  /* Highest layer that fits the estimate, the lowest one as a floor */
+  for (target = ladder->renditions->len - 1; target > 0; target--) {
+    if (g_array_index(ladder->renditions, LadderRendition, target).bitrate * 1000.0 <= ladder->estimate)
+      break;
+  }
+
+  if (target > ladder->layer) {
+    if (++ladder->upswitch_intervals < LADDER_UPSWITCH_INTERVALS)
+      return;
+  } else if (target == ladder->layer) {
+    ladder->upswitch_intervals = 0;
+    return;
+  }
+
+  ladder->upswitch_intervals = 0;
+  ladder->layer = target;
+  current = &g_array_index(ladder->renditions, LadderRendition, target);
+  gst_print("Switching viewer %p to %ux%u@%u (estimate %.0f kbit/s)\n", (gpointer)ladder->pipeline, current->width, current->height, current->bitrate, ladder->estimate / 1000.0);
+  fanout_source_select_layer(ladder->fanout, ladder->pipeline, "video", target);
+}
+
+static void on_ladder_get_stats(GstPromise *promise, gpointer user_data) {
+  LadderController *ladder = (LadderController *)user_data;
+  LadderStats stats = {0};
+  const GstStructure *reply;
+  GstStructure *payloader_stats = NULL;
+  GstElement *payloader;
+
+  reply = gst_promise_get_reply(promise);
+  payloader = gst_bin_get_by_name(GST_BIN(ladder->pipeline), "payloader");
+
+  if (reply != NULL && payloader != NULL) {
+    g_object_get(payloader, "stats", &payloader_stats, NULL);
+    if (payloader_stats != NULL && gst_structure_get_uint(payloader_stats, "ssrc", &stats.ssrc)) {
+      gst_structure_foreach(reply, on_ladder_stat, &stats);
+      if (stats.has_bytes_sent)
+        ladder_update(ladder, &stats);
+    }
+  }
+
+  if (payloader_stats != NULL)
+    gst_structure_free(payloader_stats);
+  if (payloader != NULL)
+    gst_object_unref(payloader);
+  gst_promise_unref(promise);
+
+  g_atomic_int_set(&ladder->stats_pending, 0);
+}
+
+static gboolean ladder_poll_stats(gpointer user_data) {
+  LadderController *ladder = (LadderController *)user_data;
+  GstPromise *promise;
+
+  /* Skip a tick rather than piling up requests on a busy webrtcbin */
+  if (!g_atomic_int_compare_and_exchange(&ladder->stats_pending, 0, 1))
+    return G_SOURCE_CONTINUE;
+
+  promise = gst_promise_new_with_change_func(on_ladder_get_stats, ladder_controller_ref(ladder), ladder_controller_unref);
+  g_signal_emit_by_name(ladder->webrtcbin, "get-stats", NULL, promise);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void ladder_controller_attach(LadderController *ladder, GMainContext *context) {
+  ladder->timeout_source = g_timeout_source_new(LADDER_INTERVAL_MS);
+  g_source_set_callback(ladder->timeout_source, ladder_poll_stats, ladder, NULL);
+  g_source_attach(ladder->timeout_source, context);
+}
+
+LadderController *ladder_controller_new(FanoutSource *fanout, GstElement *pipeline, GstElement *webrtcbin, GArray *renditions) {
+  LadderController *ladder;
+
+  ladder = g_new0(LadderController, 1);
+  ladder->ref_count = 1;
+  ladder->fanout = fanout;
+  ladder->pipeline = gst_object_ref(pipeline);
+  ladder->webrtcbin = gst_object_ref(webrtcbin);
+  ladder->renditions = g_array_ref(renditions);
+
+  /* Every viewer starts on the cheapest layer and earns its way up */
+  ladder->layer = 0;
+  ladder->estimate = g_array_index(renditions, LadderRendition, 0).bitrate * 1000.0;
+
+  ladder_controller_attach(ladder, g_main_context_get_thread_default());
+  return ladder;
+}
+
+void ladder_controller_set_context(LadderController *ladder, GMainContext *context) {
+  g_return_if_fail(ladder != NULL);
+
+  g_source_destroy(ladder->timeout_source);
+  g_source_unref(ladder->timeout_source);
+  ladder_controller_attach(ladder, context);
+}
+
+void ladder_controller_free(LadderController *ladder) {
+  g_return_if_fail(ladder != NULL);
+
+  g_source_destroy(ladder->timeout_source);
+  g_source_unref(ladder->timeout_source);
+  ladder_controller_unref(ladder);
+}
@@ -0,0 +1,35 @@
+#ifndef __WEBRTC_LADDER_H__
+#define __WEBRTC_LADDER_H__
+
+#include <gst/gst.h>
+
+#include "webrtc-fanout.h"
+
+G_BEGIN_DECLS
+
+typedef struct _LadderRendition LadderRendition;
+typedef struct _LadderController LadderController;
+
+struct _LadderRendition {
+  guint width;
+  guint height;
+  guint bitrate; /* kbit/s */
+};
+
+/* Parses "1280x720@1200,640x360@600" into renditions sorted by ascending
+ * bitrate, so layer 0 is always the cheapest one */
+GArray *ladder_renditions_parse(const gchar *spec);
+
+/* Periodically estimates the bandwidth towards one viewer from the webrtcbin
+ * stats and moves it to the best fitting layer of the "video" track. Polls
+ * from the thread-default main context */
+LadderController *ladder_controller_new(FanoutSource *fanout, GstElement *pipeline, GstElement *webrtcbin, GArray *renditions);
+
+/* Moves the polling over to @context, call from the thread running it */
+void ladder_controller_set_context(LadderController *ladder, GMainContext *context);
+
+void ladder_controller_free(LadderController *ladder);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_LADDER_H__ */
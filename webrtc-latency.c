@@ -0,0 +1,197 @@
+#include "webrtc-latency.h"
+
+#include <gst/rtp/rtp.h>
+#include <string.h>
+
+#define LATENCY_NTP_URI "urn:ietf:params:rtp-hdrext:ntp-64"
+/* Seconds between 1900-01-01 and 1970-01-01 */
+#define LATENCY_NTP_UNIX_OFFSET G_GUINT64_CONSTANT(2208988800)
+#define LATENCY_BUCKET_MS 5
+#define LATENCY_N_BUCKETS 200
+#define LATENCY_REPORT_INTERVAL (5 * G_USEC_PER_SEC)
+
+typedef struct _LatencyHistogram {
+  gchar *stream_name;
+  guint buckets[LATENCY_N_BUCKETS + 1]; /* last one is everything above */
+  guint count;
+  gdouble max;
+  gint64 last_report;
+} LatencyHistogram;
+
+static GstCaps *ntp_caps = NULL;
+
+static GstCaps *latency_ntp_caps(void) {
+  static gsize initialized = 0;
+
+  if (g_once_init_enter(&initialized)) {
+    ntp_caps = gst_caps_new_empty_simple("timestamp/x-ntp");
+    GST_MINI_OBJECT_FLAG_SET(ntp_caps, GST_MINI_OBJECT_FLAG_MAY_BE_LEAKED);
+    g_once_init_leave(&initialized, 1);
+  }
+  return ntp_caps;
+}
+
+static GstClockTime latency_ntp_now(void) {
+  return g_get_real_time() * GST_USECOND + LATENCY_NTP_UNIX_OFFSET * GST_SECOND;
+}
+
+/* Wall clock time, in NTP nanoseconds, at which @clock_time on the clock of
+ * @element was or will be reached */
+static GstClockTime latency_clock_to_ntp(GstElement *element, GstClockTime clock_time) {
+  GstClock *clock;
+  GstClockTime now;
+  GstClockTimeDiff offset;
+
+  clock = gst_element_get_clock(element);
+  if (clock == NULL)
+    return GST_CLOCK_TIME_NONE;
+  now = gst_clock_get_time(clock);
+  gst_object_unref(clock);
+
+  offset = GST_CLOCK_DIFF(now, clock_time);
+  return latency_ntp_now() + offset;
+}
+
+static GstPadProbeReturn on_capture_probe(GstPad *pad, GstPadProbeInfo *info, G_GNUC_UNUSED gpointer user_data) {
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  GstElement *element;
+  GstClockTime capture_time;
+
+  if (!GST_BUFFER_PTS_IS_VALID(buffer))
+    return GST_PAD_PROBE_OK;
+
+  element = gst_pad_get_parent_element(pad);
+  if (element == NULL)
+    return GST_PAD_PROBE_OK;
+
+  /* Live sources timestamp with the running time of the capture */
+  capture_time = latency_clock_to_ntp(element, gst_element_get_base_time(element) + GST_BUFFER_PTS(buffer));
+  gst_object_unref(element);
+
+  if (GST_CLOCK_TIME_IS_VALID(capture_time)) {
+    buffer = gst_buffer_make_writable(buffer);
+    gst_buffer_add_reference_timestamp_meta(buffer, latency_ntp_caps(), capture_time, GST_CLOCK_TIME_NONE);
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+void latency_stamp_capture(GstPad *pad) {
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_capture_probe, NULL, NULL);
+}
+
+gboolean latency_add_header_extension(GstElement *payloader, guint id) {
+  GstRTPHeaderExtension *extension;
+
+  extension = gst_rtp_header_extension_create_from_uri(LATENCY_NTP_URI);
+  if (extension == NULL) {
+    gst_printerr("No RTP header extension for %s, is rtpmanager installed?\n", LATENCY_NTP_URI);
+    return FALSE;
+  }
+
+  gst_rtp_header_extension_set_id(extension, id);
+  g_signal_emit_by_name(payloader, "add-extension", extension);
+  gst_object_unref(extension);
+
+  return TRUE;
+}
+
+static gdouble latency_histogram_percentile(LatencyHistogram *histogram, gdouble percentile) {
+  guint target = (guint)(histogram->count * percentile);
+  guint seen = 0;
+  guint i;
+
+  for (i = 0; i <= LATENCY_N_BUCKETS; i++) {
+    seen += histogram->buckets[i];
+    if (seen > target)
+      return MIN((i + 1) * LATENCY_BUCKET_MS, histogram->max);
+  }
+  return histogram->max;
+}
+
+static void latency_histogram_report(LatencyHistogram *histogram) {
+  gst_print("Latency %s: p50 %.0f ms, p90 %.0f ms, p99 %.0f ms, max %.0f ms over %u frames\n", histogram->stream_name, //
+            latency_histogram_percentile(histogram, 0.50), latency_histogram_percentile(histogram, 0.90), latency_histogram_percentile(histogram, 0.99), histogram->max, histogram->count);
+
+  memset(histogram->buckets, 0, sizeof(histogram->buckets));
+  histogram->count = 0;
+  histogram->max = 0;
+}
+
+static void latency_histogram_free(gpointer histogram_ptr) {
+  LatencyHistogram *histogram = (LatencyHistogram *)histogram_ptr;
+
+  if (histogram->count > 0)
+    latency_histogram_report(histogram);
+  g_free(histogram->stream_name);
+  g_free(histogram);
+}
+
+static GstPadProbeReturn on_render_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  LatencyHistogram *histogram = (LatencyHistogram *)user_data;
+  GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+  GstReferenceTimestampMeta *meta;
+  GstEvent *event;
+  const GstSegment *segment;
+  GstElement *sink;
+  GstClockTime running_time, render_time;
+  gdouble latency;
+  gint64 now;
+
+  meta = gst_buffer_get_reference_timestamp_meta(buffer, latency_ntp_caps());
+  if (meta == NULL || !GST_BUFFER_PTS_IS_VALID(buffer))
+    return GST_PAD_PROBE_OK;
+
+  event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+  if (event == NULL)
+    return GST_PAD_PROBE_OK;
+  gst_event_parse_segment(event, &segment);
+  running_time = gst_segment_to_running_time(segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+  gst_event_unref(event);
+
+  /* The probe runs when the frame reaches the sink, which then waits for its
+   * running time plus the pipeline latency before showing it */
+  sink = gst_pad_get_parent_element(pad);
+  if (sink == NULL || !GST_CLOCK_TIME_IS_VALID(running_time)) {
+    gst_clear_object(&sink);
+    return GST_PAD_PROBE_OK;
+  }
+  render_time = gst_element_get_base_time(sink) + running_time;
+  if (GST_ELEMENT_PARENT(sink) != NULL && GST_IS_PIPELINE(GST_ELEMENT_PARENT(sink)))
+    render_time += gst_pipeline_get_latency(GST_PIPELINE(GST_ELEMENT_PARENT(sink)));
+  render_time = latency_clock_to_ntp(sink, render_time);
+  gst_object_unref(sink);
+
+  if (!GST_CLOCK_TIME_IS_VALID(render_time))
+    return GST_PAD_PROBE_OK;
+
+  render_time = MAX(render_time, latency_ntp_now());
+  latency = (gdouble)GST_CLOCK_DIFF(meta->timestamp, render_time) / GST_MSECOND;
+  if (latency < 0)
+    return GST_PAD_PROBE_OK;
+
+  histogram->buckets[MIN((guint)(latency / LATENCY_BUCKET_MS), LATENCY_N_BUCKETS)]++;
+  histogram->count++;
+  histogram->max = MAX(histogram->max, latency);
+
+  now = g_get_monotonic_time();
+  if (histogram->last_report == 0)
+    histogram->last_report = now;
+  else if (now - histogram->last_report >= LATENCY_REPORT_INTERVAL) {
+    histogram->last_report = now;
+    latency_histogram_report(histogram);
+  }
+
+  return GST_PAD_PROBE_OK;
+}
+
+void latency_histogram_attach(GstPad *pad, const gchar *stream_name) {
+  LatencyHistogram *histogram;
+
+  histogram = g_new0(LatencyHistogram, 1);
+  histogram->stream_name = g_strdup(stream_name);
+
+  /* Only ever touched from the streaming thread of @pad */
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, on_render_probe, histogram, latency_histogram_free);
+}
@@ -0,0 +1,29 @@
+#ifndef __WEBRTC_LATENCY_H__
+#define __WEBRTC_LATENCY_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Glass-to-glass latency. The sender puts the wall clock capture time of
+ * every frame into a GstReferenceTimestampMeta (timestamp/x-ntp), which the
+ * NTP-64 RTP header extension carries to the receiver. There the depayloader
+ * turns it back into the same meta, and the time left until the frame is
+ * rendered goes into a histogram. Sender and receiver clocks have to be NTP
+ * synchronized when they run on different hosts */
+
+/* Stamps the buffers going through @pad, any raw or encoded video pad
+ * upstream of the payloader works since the capture time is derived from
+ * the buffer PTS */
+void latency_stamp_capture(GstPad *pad);
+
+/* Makes @payloader send the stamped capture times as header extension @id */
+gboolean latency_add_header_extension(GstElement *payloader, guint id);
+
+/* Measures every buffer reaching the video sink pad @pad and periodically
+ * prints the latency percentiles of @stream_name */
+void latency_histogram_attach(GstPad *pad, const gchar *stream_name);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_LATENCY_H__ */
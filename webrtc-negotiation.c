@@ -0,0 +1,36 @@
+#include "webrtc-negotiation.h"
+
+PendingCandidate *pending_candidate_new(guint mline_index, const gchar *candidate) {
+  PendingCandidate *pending = g_new0(PendingCandidate, 1);
+
+  pending->mline_index = mline_index;
+  pending->candidate = g_strdup(candidate);
+  return pending;
+}
+
+void pending_candidate_free(gpointer pending_ptr) {
+  PendingCandidate *pending = (PendingCandidate *)pending_ptr;
+
+  g_free(pending->candidate);
+  g_free(pending);
+}
+
+gboolean get_promise_reply(GstPromise *promise, const GstStructure **reply, GError **error) {
+  const GstStructure *structure;
+
+  if (gst_promise_wait(promise) != GST_PROMISE_RESULT_REPLIED) {
+    g_set_error_literal(error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED, "operation was interrupted");
+    return FALSE;
+  }
+
+  structure = gst_promise_get_reply(promise);
+  if (structure != NULL && gst_structure_has_field(structure, "error")) {
+    if (!gst_structure_get(structure, "error", G_TYPE_ERROR, error, NULL))
+      g_set_error_literal(error, GST_CORE_ERROR, GST_CORE_ERROR_FAILED, "unknown error");
+    return FALSE;
+  }
+
+  if (reply != NULL)
+    *reply = structure;
+  return TRUE;
+}
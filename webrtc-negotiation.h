@@ -0,0 +1,29 @@
+#ifndef __WEBRTC_NEGOTIATION_H__
+#define __WEBRTC_NEGOTIATION_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Offer/answer plumbing around webrtcbin, the same for the sessions of
+ * the servers and the calls of webrtc-sendrecv */
+
+/* A remote candidate held back until the remote description is applied,
+ * webrtcbin would drop it before */
+typedef struct _PendingCandidate {
+  guint mline_index;
+  gchar *candidate;
+} PendingCandidate;
+
+PendingCandidate *pending_candidate_new(guint mline_index, const gchar *candidate);
+
+void pending_candidate_free(gpointer pending_ptr);
+
+/* webrtcbin resolves its promises before calling the change function, so
+ * gst_promise_wait() only reads the result there. Returns FALSE with @error
+ * set when the operation failed, @reply may be NULL */
+gboolean get_promise_reply(GstPromise *promise, const GstStructure **reply, GError **error);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_NEGOTIATION_H__ */
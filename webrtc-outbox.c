@@ -0,0 +1,196 @@
+#include "webrtc-outbox.h"
+
+struct _Outbox {
+  GMutex lock;
+  GMainContext *context;
+  /* NULL until attached */
+  SoupWebsocketConnection *connection;
+  GQueue messages;
+  guint max_messages;
+  /* Idle source flushing the messages, or the source waiting for the socket
+   * to drain when the peer doesn't keep up */
+  GSource *flush_source;
+
+  /* Set by outbox_close(), the connection gets closed once the queue is
+   * flushed. outbox_close_now() drops the queue and doesn't wait for the
+   * socket at all */
+  gboolean closing;
+  gboolean close_now;
+  gushort close_code;
+  gchar *close_reason;
+};
+
+static gboolean outbox_flush(gpointer user_data);
+
+static gboolean on_connection_writable(G_GNUC_UNUSED GObject *stream, gpointer user_data) {
+  return outbox_flush(user_data);
+}
+
+/* Called with the lock held */
+static gboolean outbox_wait_writable(Outbox *outbox) {
+  GOutputStream *output;
+
+  output = g_io_stream_get_output_stream(soup_websocket_connection_get_io_stream(outbox->connection));
+  if (!G_IS_POLLABLE_OUTPUT_STREAM(output) || !g_pollable_output_stream_can_poll(G_POLLABLE_OUTPUT_STREAM(output)) || g_pollable_output_stream_is_writable(G_POLLABLE_OUTPUT_STREAM(output)))
+    return FALSE;
+
+  outbox->flush_source = g_pollable_output_stream_create_source(G_POLLABLE_OUTPUT_STREAM(output), NULL);
+  g_source_set_callback(outbox->flush_source, (GSourceFunc)on_connection_writable, outbox, NULL);
+  g_source_attach(outbox->flush_source, outbox->context);
+  return TRUE;
+}
+
+static gboolean outbox_flush(gpointer user_data) {
+  Outbox *outbox = (Outbox *)user_data;
+  SoupWebsocketConnection *connection = NULL;
+  gchar *close_reason = NULL;
+  gushort close_code = 0;
+  gboolean close_now = FALSE;
+  gchar *text;
+
+  g_mutex_lock(&outbox->lock);
+  g_clear_pointer(&outbox->flush_source, g_source_unref);
+
+  while ((text = g_queue_peek_head(&outbox->messages)) != NULL) {
+    if (soup_websocket_connection_get_state(outbox->connection) == SOUP_WEBSOCKET_STATE_OPEN) {
+      if (outbox_wait_writable(outbox)) {
+        g_mutex_unlock(&outbox->lock);
+        return G_SOURCE_REMOVE;
+      }
+      soup_websocket_connection_send_text(outbox->connection, text);
+    }
+    g_queue_pop_head(&outbox->messages);
+    g_free(text);
+  }
+
+  if (outbox->closing && outbox->close_code != 0) {
+    connection = g_object_ref(outbox->connection);
+    close_code = outbox->close_code;
+    close_reason = g_steal_pointer(&outbox->close_reason);
+    close_now = outbox->close_now;
+    outbox->close_code = 0;
+  }
+  g_mutex_unlock(&outbox->lock);
+
+  /* Closing ends up in the closed handler of the connection, which usually
+   * frees the outbox, so keep it outside of the lock */
+  if (connection != NULL) {
+    if (soup_websocket_connection_get_state(connection) == SOUP_WEBSOCKET_STATE_OPEN)
+      soup_websocket_connection_close(connection, close_code, close_reason);
+    /* The close frame would queue up behind everything the peer didn't
+     * read, take the socket down under it instead */
+    if (close_now)
+      g_io_stream_close(soup_websocket_connection_get_io_stream(connection), NULL, NULL);
+    g_object_unref(connection);
+  }
+  g_free(close_reason);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Called with the lock held */
+static void outbox_schedule_flush(Outbox *outbox) {
+  if (outbox->connection == NULL || outbox->flush_source != NULL)
+    return;
+
+  outbox->flush_source = g_idle_source_new();
+  g_source_set_callback(outbox->flush_source, outbox_flush, outbox, NULL);
+  g_source_attach(outbox->flush_source, outbox->context);
+}
+
+Outbox *outbox_new(guint max_messages) {
+  Outbox *outbox;
+
+  outbox = g_new0(Outbox, 1);
+  g_mutex_init(&outbox->lock);
+  g_queue_init(&outbox->messages);
+  outbox->context = g_main_context_ref_thread_default();
+  outbox->max_messages = max_messages;
+
+  return outbox;
+}
+
+void outbox_attach(Outbox *outbox, SoupWebsocketConnection *connection) {
+  g_mutex_lock(&outbox->lock);
+  g_main_context_unref(outbox->context);
+  outbox->context = g_main_context_ref_thread_default();
+  g_clear_object(&outbox->connection);
+  outbox->connection = g_object_ref(connection);
+
+  /* Whatever was pushed before */
+  outbox_schedule_flush(outbox);
+  g_mutex_unlock(&outbox->lock);
+}
+
+void outbox_detach(Outbox *outbox) {
+  g_mutex_lock(&outbox->lock);
+  outbox->closing = TRUE;
+  outbox->close_code = 0;
+  g_queue_clear_full(&outbox->messages, g_free);
+  if (outbox->flush_source != NULL) {
+    g_source_destroy(outbox->flush_source);
+    g_clear_pointer(&outbox->flush_source, g_source_unref);
+  }
+  g_clear_object(&outbox->connection);
+  g_mutex_unlock(&outbox->lock);
+}
+
+gboolean outbox_push(Outbox *outbox, gchar *text) {
+  g_mutex_lock(&outbox->lock);
+  if (outbox->closing || (outbox->max_messages > 0 && outbox->messages.length >= outbox->max_messages)) {
+    g_mutex_unlock(&outbox->lock);
+    g_free(text);
+    return FALSE;
+  }
+
+  g_queue_push_tail(&outbox->messages, text);
+  outbox_schedule_flush(outbox);
+  g_mutex_unlock(&outbox->lock);
+
+  return TRUE;
+}
+
+void outbox_close(Outbox *outbox, gushort code, const gchar *reason) {
+  g_mutex_lock(&outbox->lock);
+  if (!outbox->closing) {
+    outbox->closing = TRUE;
+    outbox->close_code = code;
+    outbox->close_reason = g_strdup(reason);
+    outbox_schedule_flush(outbox);
+  }
+  g_mutex_unlock(&outbox->lock);
+}
+
+void outbox_close_now(Outbox *outbox, gushort code, const gchar *reason) {
+  g_mutex_lock(&outbox->lock);
+  /* Unless the connection was closed already */
+  if (!outbox->close_now && (!outbox->closing || outbox->close_code != 0)) {
+    outbox->closing = TRUE;
+    outbox->close_now = TRUE;
+    outbox->close_code = code;
+    g_free(outbox->close_reason);
+    outbox->close_reason = g_strdup(reason);
+    g_queue_clear_full(&outbox->messages, g_free);
+
+    /* A flush waiting for the socket to drain would never get to it */
+    if (outbox->flush_source != NULL) {
+      g_source_destroy(outbox->flush_source);
+      g_clear_pointer(&outbox->flush_source, g_source_unref);
+    }
+    outbox_schedule_flush(outbox);
+  }
+  g_mutex_unlock(&outbox->lock);
+}
+
+void outbox_free(Outbox *outbox) {
+  if (outbox->flush_source != NULL) {
+    g_source_destroy(outbox->flush_source);
+    g_source_unref(outbox->flush_source);
+  }
+  g_clear_object(&outbox->connection);
+  g_queue_clear_full(&outbox->messages, g_free);
+  g_free(outbox->close_reason);
+  g_main_context_unref(outbox->context);
+  g_mutex_clear(&outbox->lock);
+  g_free(outbox);
+}
@@ -0,0 +1,47 @@
+#ifndef __WEBRTC_OUTBOX_H__
+#define __WEBRTC_OUTBOX_H__
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+G_BEGIN_DECLS
+
+typedef struct _Outbox Outbox;
+
+/* Send queue of one websocket peer. Messages can be pushed from any thread,
+ * they are written from the thread default context of whoever attached the
+ * connection, and only as fast as the socket drains: libsoup queues whatever
+ * the socket doesn't take right away, so the rest is kept here instead of
+ * piling up unbounded inside the connection.
+ *
+ * Messages pushed before a connection is attached are kept until then.
+ * @max_messages bounds the queue, 0 leaves it unbounded */
+Outbox *outbox_new(guint max_messages);
+
+/* Moves the outbox over to the calling thread's default context and starts
+ * flushing into @connection */
+void outbox_attach(Outbox *outbox, SoupWebsocketConnection *connection);
+
+/* Lets go of the connection for good, whatever is queued or pushed later is
+ * dropped and closing does nothing. For handing the connection over to
+ * another outbox */
+void outbox_detach(Outbox *outbox);
+
+/* Safe from any thread, takes ownership of @text. Returns FALSE, dropping
+ * @text, when the queue is full or the outbox is closing */
+gboolean outbox_push(Outbox *outbox, gchar *text);
+
+/* Safe from any thread. Closes the connection with @code and @reason once
+ * everything pushed before was written. Only the first call counts */
+void outbox_close(Outbox *outbox, gushort code, const gchar *reason);
+
+/* Safe from any thread. Drops whatever is still queued and closes the
+ * connection right away, for a peer that stopped reading. Also overrides a
+ * pending outbox_close() */
+void outbox_close_now(Outbox *outbox, gushort code, const gchar *reason);
+
+void outbox_free(Outbox *outbox);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_OUTBOX_H__ */
@@ -0,0 +1,91 @@
+#include "webrtc-common.h"
+
+struct _ReceiverEntryPool {
+  guint size;
+  ReceiverEntryFactory factory;
+  gpointer user_data;
+
+  GQueue entries;
+  GMutex lock;
+  guint refill_id;
+};
+
+/* One entry per idle iteration at low priority, so refilling never holds up
+ * signaling for sessions that are already live */
+static gboolean receiver_entry_pool_refill(gpointer user_data) {
+  ReceiverEntryPool *pool = (ReceiverEntryPool *)user_data;
+  ReceiverEntry *receiver_entry;
+  guint length;
+
+  g_mutex_lock(&pool->lock);
+  length = pool->entries.length;
+  if (length >= pool->size)
+    pool->refill_id = 0;
+  g_mutex_unlock(&pool->lock);
+
+  if (length >= pool->size)
+    return G_SOURCE_REMOVE;
+
+  receiver_entry = pool->factory(pool->user_data);
+  if (receiver_entry == NULL) {
+    g_mutex_lock(&pool->lock);
+    pool->refill_id = 0;
+    g_mutex_unlock(&pool->lock);
+    return G_SOURCE_REMOVE;
+  }
+
+  g_mutex_lock(&pool->lock);
+  g_queue_push_tail(&pool->entries, receiver_entry);
+  g_mutex_unlock(&pool->lock);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* Shards take entries from their own threads, the refill itself always runs
+ * on the main context. Called with the lock held */
+static void receiver_entry_pool_schedule_refill(ReceiverEntryPool *pool) {
+  if (pool->refill_id == 0)
+    pool->refill_id = g_idle_add_full(G_PRIORITY_LOW, receiver_entry_pool_refill, pool, NULL);
+}
+
+ReceiverEntryPool *receiver_entry_pool_new(guint size, ReceiverEntryFactory factory, gpointer user_data) {
+  ReceiverEntryPool *pool;
+
+  pool = g_new0(ReceiverEntryPool, 1);
+  pool->size = size;
+  pool->factory = factory;
+  pool->user_data = user_data;
+  g_queue_init(&pool->entries);
+  g_mutex_init(&pool->lock);
+
+  gst_print("Pre-warming %u sessions\n", size);
+  g_mutex_lock(&pool->lock);
+  receiver_entry_pool_schedule_refill(pool);
+  g_mutex_unlock(&pool->lock);
+
+  return pool;
+}
+
+ReceiverEntry *receiver_entry_pool_take(ReceiverEntryPool *pool) {
+  ReceiverEntry *receiver_entry;
+
+  g_return_val_if_fail(pool != NULL, NULL);
+
+  g_mutex_lock(&pool->lock);
+  receiver_entry = g_queue_pop_head(&pool->entries);
+  receiver_entry_pool_schedule_refill(pool);
+  g_mutex_unlock(&pool->lock);
+
+  return receiver_entry;
+}
+
+void receiver_entry_pool_free(ReceiverEntryPool *pool) {
+  g_return_if_fail(pool != NULL);
+
+  if (pool->refill_id != 0)
+    g_source_remove(pool->refill_id);
+
+  g_queue_clear_full(&pool->entries, destroy_receiver_entry);
+  g_mutex_clear(&pool->lock);
+  g_free(pool);
+}
@@ -0,0 +1,25 @@
+#ifndef __WEBRTC_POOL_H__
+#define __WEBRTC_POOL_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _ReceiverEntry ReceiverEntry;
+typedef struct _ReceiverEntryPool ReceiverEntryPool;
+
+/* Builds a complete session that is already PLAYING and negotiating, with no
+ * connection attached yet */
+typedef ReceiverEntry *(*ReceiverEntryFactory)(gpointer user_data);
+
+ReceiverEntryPool *receiver_entry_pool_new(guint size, ReceiverEntryFactory factory, gpointer user_data);
+
+/* Returns a pre-warmed entry, or NULL when the pool ran dry. Either way the
+ * pool is refilled in the background */
+ReceiverEntry *receiver_entry_pool_take(ReceiverEntryPool *pool);
+
+void receiver_entry_pool_free(ReceiverEntryPool *pool);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_POOL_H__ */
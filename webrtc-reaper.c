@@ -0,0 +1,61 @@
+#include "webrtc-reaper.h"
+
+typedef struct _ReaperJob {
+  GstElement *pipeline;
+  GDestroyNotify reaped;
+  gpointer user_data;
+} ReaperJob;
+
+/* Guards the pool pointer, NULL before the first session and once stopped */
+static GMutex reaper_lock;
+static GThreadPool *reaper_pool = NULL;
+static gboolean reaper_stopped = FALSE;
+
+static void reaper_run(gpointer data, G_GNUC_UNUSED gpointer user_data) {
+  ReaperJob *job = (ReaperJob *)data;
+
+  gst_element_set_state(job->pipeline, GST_STATE_NULL);
+  gst_object_unref(job->pipeline);
+  if (job->reaped != NULL)
+    job->reaped(job->user_data);
+
+  g_free(job);
+}
+
+gboolean session_reaper_reap(GstElement *pipeline, GDestroyNotify reaped, gpointer user_data) {
+  ReaperJob *job;
+
+  g_return_val_if_fail(GST_IS_ELEMENT(pipeline), FALSE);
+
+  g_mutex_lock(&reaper_lock);
+  if (reaper_stopped) {
+    g_mutex_unlock(&reaper_lock);
+    return FALSE;
+  }
+  /* Mostly waiting on threads to join, so one per core keeps up with a
+   * mass disconnect without competing much with the live sessions */
+  if (reaper_pool == NULL)
+    reaper_pool = g_thread_pool_new(reaper_run, NULL, MAX(g_get_num_processors(), 1), FALSE, NULL);
+
+  job = g_new0(ReaperJob, 1);
+  job->pipeline = pipeline;
+  job->reaped = reaped;
+  job->user_data = user_data;
+  g_thread_pool_push(reaper_pool, job, NULL);
+  g_mutex_unlock(&reaper_lock);
+
+  return TRUE;
+}
+
+void session_reaper_stop(void) {
+  GThreadPool *pool;
+
+  g_mutex_lock(&reaper_lock);
+  reaper_stopped = TRUE;
+  pool = reaper_pool;
+  reaper_pool = NULL;
+  g_mutex_unlock(&reaper_lock);
+
+  if (pool != NULL)
+    g_thread_pool_free(pool, FALSE, TRUE);
+}
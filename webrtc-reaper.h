@@ -0,0 +1,24 @@
+#ifndef __WEBRTC_REAPER_H__
+#define __WEBRTC_REAPER_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Tears session pipelines down on background threads. Taking a live
+ * x264enc, webrtcbin and libnice pipeline to NULL joins every one of its
+ * threads and can take a good hundred milliseconds, which the main loop
+ * would otherwise spend on each disconnect, stalling signaling for all
+ * other sessions when many viewers drop at once. */
+
+/* Takes over the caller's ref on @pipeline, sets it to NULL and drops it on
+ * a reaper thread, then calls @reaped there. Returns FALSE, doing nothing,
+ * once the reaper is stopped, the caller tears down itself then */
+gboolean session_reaper_reap(GstElement *pipeline, GDestroyNotify reaped, gpointer user_data);
+
+/* Waits for everything handed over so far. At exit, before gst_deinit() */
+void session_reaper_stop(void);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_REAPER_H__ */
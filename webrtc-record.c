@@ -0,0 +1,175 @@
+#include "webrtc-common.h"
+
+#include <gst/app/app.h>
+
+/* Written out in full buffers, a multiple of every page and block size */
+#define RECORD_WRITE_BUFFER_SIZE (1 << 20)
+/* A slow disk drops recorded packets rather than holding up playback and
+ * forwarding on the other branches */
+#define RECORD_QUEUE_DESC "queue max-size-buffers=0 max-size-bytes=0 max-size-time=3000000000 leaky=downstream"
+
+typedef struct _TrackRecorder TrackRecorder;
+
+struct _TrackRecorder {
+  gchar *path;
+  /* NULL once writing failed, the session goes on without recording */
+  GOutputStream *stream;
+  guint flush_interval_ms;
+  gint64 last_flush;
+};
+
+gboolean record_format_parse(const gchar *name, RecordFormat *format) {
+  if (g_strcmp0(name, "mp4") == 0)
+    *format = RECORD_FORMAT_MP4;
+  else if (g_strcmp0(name, "mkv") == 0)
+    *format = RECORD_FORMAT_MKV;
+  else
+    return FALSE;
+  return TRUE;
+}
+
+static void track_recorder_close(TrackRecorder *recorder) {
+  GError *error = NULL;
+
+  if (recorder->stream == NULL)
+    return;
+
+  /* Flushes whatever is left in the buffer */
+  if (!g_output_stream_close(recorder->stream, NULL, &error)) {
+    gst_printerr("Could not close %s: %s\n", recorder->path, error->message);
+    g_error_free(error);
+  }
+  g_clear_object(&recorder->stream);
+}
+
+/* Runs when the appsink goes away with its pipeline */
+static void track_recorder_free(gpointer recorder_ptr) {
+  TrackRecorder *recorder = (TrackRecorder *)recorder_ptr;
+
+  track_recorder_close(recorder);
+  gst_print("Recorded %s\n", recorder->path);
+  g_free(recorder->path);
+  g_free(recorder);
+}
+
+static GstFlowReturn track_recorder_new_sample(GstAppSink *appsink, gpointer user_data) {
+  TrackRecorder *recorder = (TrackRecorder *)user_data;
+  GstSample *sample;
+  GstBuffer *buffer;
+  GstMapInfo map;
+  GError *error = NULL;
+  gint64 now;
+
+  sample = gst_app_sink_pull_sample(appsink);
+  if (sample == NULL)
+    return GST_FLOW_EOS;
+
+  if (recorder->stream == NULL)
+    goto out;
+
+  buffer = gst_sample_get_buffer(sample);
+  if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+    g_output_stream_write_all(recorder->stream, map.data, map.size, NULL, NULL, &error);
+    gst_buffer_unmap(buffer, &map);
+  }
+
+  /* The muxer cuts a fragment per interval, this makes it reach the disk */
+  now = g_get_monotonic_time();
+  if (error == NULL && now - recorder->last_flush >= (gint64)recorder->flush_interval_ms * 1000) {
+    recorder->last_flush = now;
+    g_output_stream_flush(recorder->stream, NULL, &error);
+  }
+
+  if (error != NULL) {
+    gst_printerr("Stopped recording %s: %s\n", recorder->path, error->message);
+    g_error_free(error);
+    track_recorder_close(recorder);
+  }
+
+out:
+  gst_sample_unref(sample);
+  return GST_FLOW_OK;
+}
+
+gboolean record_track(GstElement *pipeline, GstPad *pad, const gchar *path_prefix, RecordFormat format, guint flush_interval_ms, GError **error) {
+  GstCaps *caps;
+  const GstStructure *structure;
+  const gchar *media, *encoding_name, *depay_desc;
+  gchar *mux_desc, *description;
+  GstElement *bin, *appsink;
+  GstPad *sinkpad;
+  GFile *file;
+  GFileOutputStream *file_stream;
+  TrackRecorder *recorder;
+  GstAppSinkCallbacks callbacks = {NULL};
+
+  /* A tee src pad has no caps until the first buffer went through */
+  caps = gst_pad_get_current_caps(pad);
+  if (caps == NULL)
+    caps = gst_pad_query_caps(pad, NULL);
+  if (caps == NULL || gst_caps_is_empty(caps) || !gst_caps_is_fixed(caps)) {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_NEGOTIATION, "pad '%s' has no caps", GST_PAD_NAME(pad));
+    gst_clear_caps(&caps);
+    return FALSE;
+  }
+
+  structure = gst_caps_get_structure(caps, 0);
+  media = gst_structure_get_string(structure, "media");
+  encoding_name = gst_structure_get_string(structure, "encoding-name");
+  if (g_strcmp0(encoding_name, "H264") == 0) {
+    depay_desc = "rtph264depay ! h264parse";
+  } else if (g_strcmp0(encoding_name, "OPUS") == 0) {
+    depay_desc = "rtpopusdepay ! opusparse";
+  } else {
+    g_set_error(error, GST_CORE_ERROR, GST_CORE_ERROR_NOT_IMPLEMENTED, "can't record %s", encoding_name != NULL ? encoding_name : "unknown encoding");
+    gst_caps_unref(caps);
+    return FALSE;
+  }
+
+  if (format == RECORD_FORMAT_MP4)
+    mux_desc = g_strdup_printf("mp4mux fragment-duration=%u", flush_interval_ms);
+  else
+    mux_desc = g_strdup_printf("matroskamux streamable=true max-cluster-duration=%" G_GUINT64_FORMAT, (guint64)flush_interval_ms * GST_MSECOND);
+
+  description = g_strdup_printf(RECORD_QUEUE_DESC " ! %s ! %s ! appsink name=writer sync=false async=false", depay_desc, mux_desc);
+  bin = gst_parse_bin_from_description(description, TRUE, error);
+  g_free(description);
+  g_free(mux_desc);
+  if (bin == NULL) {
+    gst_caps_unref(caps);
+    return FALSE;
+  }
+
+  recorder = g_new0(TrackRecorder, 1);
+  recorder->path = g_strdup_printf("%s-%s.%s", path_prefix, media != NULL ? media : GST_PAD_NAME(pad), format == RECORD_FORMAT_MP4 ? "mp4" : "mkv");
+  recorder->flush_interval_ms = flush_interval_ms;
+  recorder->last_flush = g_get_monotonic_time();
+  gst_caps_unref(caps);
+
+  file = g_file_new_for_path(recorder->path);
+  file_stream = g_file_replace(file, NULL, FALSE, G_FILE_CREATE_NONE, NULL, error);
+  g_object_unref(file);
+  if (file_stream == NULL) {
+    gst_object_unref(bin);
+    g_free(recorder->path);
+    g_free(recorder);
+    return FALSE;
+  }
+  recorder->stream = g_buffered_output_stream_new_sized(G_OUTPUT_STREAM(file_stream), RECORD_WRITE_BUFFER_SIZE);
+  g_object_unref(file_stream);
+
+  appsink = gst_bin_get_by_name(GST_BIN(bin), "writer");
+  callbacks.new_sample = track_recorder_new_sample;
+  gst_app_sink_set_callbacks(GST_APP_SINK(appsink), &callbacks, recorder, track_recorder_free);
+  gst_object_unref(appsink);
+
+  gst_bin_add(GST_BIN(pipeline), bin);
+  gst_element_sync_state_with_parent(bin);
+
+  sinkpad = gst_element_get_static_pad(bin, "sink");
+  gst_pad_link(pad, sinkpad);
+  gst_object_unref(sinkpad);
+
+  gst_print("Recording to %s\n", recorder->path);
+  return TRUE;
+}
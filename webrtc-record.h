@@ -0,0 +1,29 @@
+#ifndef __WEBRTC_RECORD_H__
+#define __WEBRTC_RECORD_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* Passthrough recording of an incoming track: the RTP is depayloaded,
+ * parsed and muxed into a fragmented MP4 or a streamable Matroska file, it
+ * is never decoded. One file per track, so tracks showing up at different
+ * times never need a muxer pad after its header went out.
+ *
+ * The muxed stream goes through a large write buffer, written out in full
+ * buffers and at least every flush interval, which is also the fragment
+ * duration. Whatever was flushed is playable even if the process dies. */
+typedef enum {
+  RECORD_FORMAT_MP4,
+  RECORD_FORMAT_MKV,
+} RecordFormat;
+
+gboolean record_format_parse(const gchar *name, RecordFormat *format);
+
+/* Records what comes out of @pad into "<path_prefix>-<media>.<ext>". The
+ * branch lives in @pipeline, the file is closed when the pipeline goes */
+gboolean record_track(GstElement *pipeline, GstPad *pad, const gchar *path_prefix, RecordFormat format, guint flush_interval_ms, GError **error);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_RECORD_H__ */
@@ -9,6 +9,20 @@
 #define SOUP_HTTP_PORT 57778
 #define STUN_SERVER "stun.l.google.com:19302"
 
+gint pool_size = 0;
+gboolean task_pool = FALSE;
+gboolean rebuild_on_error = FALSE;
+gboolean measure_latency = FALSE;
+gint n_shards = 1;
+gboolean forward = FALSE;
+gchar *record_dir = NULL;
+gchar *record_format_name = NULL;
+gint record_flush_interval = 1000;
+RecordFormat record_format = RECORD_FORMAT_MP4;
+
+ReceiverEntryPool *receiver_entry_pool = NULL;
+ForwardHub *forward_hub = NULL;
+
 const gchar *html_source = " \n \
 <html>\n \
   <head>\n \
@@ -20,9 +34,13 @@ const gchar *html_source = " \n \
         ws.onmessage = async (event) => {\n \
           try {\n \
             const { type, data } = JSON.parse(event.data)\n \
+            if (type == 'sdp' && conn) {\n \
+              conn.close()\n \
+              conn = null\n \
+            }\n \
             if (!conn) {\n \
               conn = new RTCPeerConnection({ iceServers: [{ urls: 'stun:" STUN_SERVER "' }] })\n \
-              conn.onicecandidate = (event) => event.candidate && ws.send(JSON.stringify({ type: 'ice', data: event.candidate }))\n \
+              conn.onicecandidate = (event) => ws.send(JSON.stringify({ type: 'ice', data: event.candidate || { candidate: '', sdpMLineIndex: 0 } }))\n \
             }\n \
             if (type == 'sdp') {\n \
               await conn.setRemoteDescription(data)\n \
@@ -32,7 +50,48 @@ const gchar *html_source = " \n \
               await conn.setLocalDescription(desc)\n \
               ws.send(JSON.stringify({ type: 'sdp', data: conn.localDescription }))\n \
             } else if (type == 'ice') {\n \
-              await conn.addIceCandidate(new RTCIceCandidate(data))\n \
+              for (const candidate of [].concat(data)) await conn.addIceCandidate(candidate)\n \
+            }\n \
+          } catch (err) {\n \
+            console.error(err)\n \
+          }\n \
+        }\n \
+      }\n \
+    </script>\n \
+  </head>\n \
+  <body>\n \
+  </body>\n \
+</html>\n \
+";
+
+/* Page of a subscriber to the forwarded publisher, in --forward mode */
+const gchar *html_watch_source = " \n \
+<html>\n \
+  <head>\n \
+    <script type='text/javascript'>\n \
+      window.onload = () => {\n \
+        var l = window.location\n \
+        var ws = new WebSocket(`${l.protocol}watch-ws`)\n \
+        var conn\n \
+        ws.onmessage = async (event) => {\n \
+          try {\n \
+            const { type, data } = JSON.parse(event.data)\n \
+            if (type == 'sdp' && conn) {\n \
+              conn.close()\n \
+              conn = null\n \
+            }\n \
+            if (!conn) {\n \
+              conn = new RTCPeerConnection({ iceServers: [{ urls: 'stun:" STUN_SERVER "' }] })\n \
+              conn.ontrack = (event) => (document.getElementById('stream').srcObject = event.streams[0])\n \
+              conn.onicecandidate = (event) => ws.send(JSON.stringify({ type: 'ice', data: event.candidate || { candidate: '', sdpMLineIndex: 0 } }))\n \
+            }\n \
+            if (type == 'sdp') {\n \
+              await conn.setRemoteDescription(data)\n \
+              const desc = await conn.createAnswer()\n \
+              await conn.setLocalDescription(desc)\n \
+              ws.send(JSON.stringify({ type: 'sdp', data: conn.localDescription }))\n \
+            } else if (type == 'ice') {\n \
+              for (const candidate of [].concat(data)) await conn.addIceCandidate(candidate)\n \
             }\n \
           } catch (err) {\n \
             console.error(err)\n \
@@ -42,11 +101,14 @@ const gchar *html_source = " \n \
     </script>\n \
   </head>\n \
   <body>\n \
+    <div>\n \
+      <video id='stream' autoplay playsinline muted>Your browser does not support video</video>\n \
+    </div>\n \
   </body>\n \
 </html>\n \
 ";
 
-static void handle_media_stream(GstPad *pad, GstElement *pipe, const char *convert_name, const char *sink_name) {
+static GstElement *handle_media_stream(GstPad *pad, GstElement *pipe, const char *convert_name, const char *sink_name) {
   GstPad *qpad;
   GstElement *q, *conv, *resample, *sink;
   GstPadLinkReturn ret;
@@ -83,6 +145,9 @@ static void handle_media_stream(GstPad *pad, GstElement *pipe, const char *conve
 
   ret = gst_pad_link(pad, qpad);
   g_assert_cmphex(ret, ==, GST_PAD_LINK_OK);
+  gst_object_unref(qpad);
+
+  return sink;
 }
 
 static void on_incoming_decodebin_stream(GstElement *decodebin, GstPad *pad, GstElement *pipe) {
@@ -98,7 +163,13 @@ static void on_incoming_decodebin_stream(GstElement *decodebin, GstPad *pad, Gst
   name = gst_structure_get_name(gst_caps_get_structure(caps, 0));
 
   if (g_str_has_prefix(name, "video")) {
-    handle_media_stream(pad, pipe, "videoconvert", "autovideosink");
+    GstElement *sink = handle_media_stream(pad, pipe, "videoconvert", "autovideosink");
+
+    if (measure_latency) {
+      GstPad *sinkpad = gst_element_get_static_pad(sink, "sink");
+      latency_histogram_attach(sinkpad, GST_PAD_NAME(pad));
+      gst_object_unref(sinkpad);
+    }
   } else if (g_str_has_prefix(name, "audio")) {
     handle_media_stream(pad, pipe, "audioconvert", "autoaudiosink");
   } else {
@@ -113,6 +184,42 @@ static void on_incoming_stream(GstElement *webrtc, GstPad *pad, ReceiverEntry *r
   if (GST_PAD_DIRECTION(pad) != GST_PAD_SRC)
     return;
 
+  /* The recording branch gets the RTP as it came in, next to the playback or
+   * forwarding branch */
+  if (record_dir != NULL) {
+    GstElement *tee;
+    GstPad *teepad;
+    gchar *path_prefix;
+    GError *error = NULL;
+
+    tee = gst_element_factory_make("tee", NULL);
+    gst_bin_add(GST_BIN(receiver_entry->pipeline), tee);
+    gst_element_sync_state_with_parent(tee);
+    sinkpad = gst_element_get_static_pad(tee, "sink");
+    gst_pad_link(pad, sinkpad);
+    gst_object_unref(sinkpad);
+
+    path_prefix = g_strdup_printf("%s/%" G_GINT64_FORMAT "-%p", record_dir, g_get_real_time() / G_USEC_PER_SEC, (gpointer)receiver_entry);
+    teepad = gst_element_request_pad_simple(tee, "src_%u");
+    if (!record_track(receiver_entry->pipeline, teepad, path_prefix, record_format, record_flush_interval, &error)) {
+      gst_printerr("Could not record %s: %s\n", GST_PAD_NAME(pad), error->message);
+      g_error_free(error);
+      gst_element_release_request_pad(tee, teepad);
+    }
+    gst_object_unref(teepad);
+    g_free(path_prefix);
+
+    /* Playback or forwarding below takes it from here */
+    pad = gst_element_request_pad_simple(tee, "src_%u");
+    gst_object_unref(pad);
+  }
+
+  /* The RTP goes out to the subscribers as it came in */
+  if (receiver_entry->forward != NULL) {
+    forward_hub_publish_pad(receiver_entry->forward, receiver_entry->pipeline, pad);
+    return;
+  }
+
   decodebin = gst_element_factory_make("decodebin", NULL);
   g_signal_connect(decodebin, "pad-added", G_CALLBACK(on_incoming_decodebin_stream), receiver_entry->pipeline);
   gst_bin_add(GST_BIN(receiver_entry->pipeline), decodebin);
@@ -123,25 +230,16 @@ static void on_incoming_stream(GstElement *webrtc, GstPad *pad, ReceiverEntry *r
   gst_object_unref(sinkpad);
 }
 
-void soup_websocket_handler(G_GNUC_UNUSED SoupServer *server, SoupWebsocketConnection *connection, G_GNUC_UNUSED const char *path, G_GNUC_UNUSED SoupClientContext *client_context, gpointer user_data) {
+ReceiverEntry *create_receiver_entry(G_GNUC_UNUSED gpointer user_data) {
   ReceiverEntry *receiver_entry;
-  GHashTable *receiver_entry_table = (GHashTable *)user_data;
-
-  gst_print("Processing new websocket connection %p", (gpointer)connection);
-
-  g_signal_connect(G_OBJECT(connection), "closed", G_CALLBACK(soup_websocket_closed_cb), (gpointer)receiver_entry_table);
-
   GError *error;
   GstWebRTCRTPTransceiver *trans;
   GstCaps *video_caps;
   GstBus *bus;
+  gchar *label;
 
-  receiver_entry = g_new0(ReceiverEntry, 1);
-  receiver_entry->connection = connection;
-
-  g_object_ref(G_OBJECT(connection));
-
-  g_signal_connect(G_OBJECT(connection), "message", G_CALLBACK(soup_websocket_message_cb), (gpointer)receiver_entry);
+  receiver_entry = receiver_entry_new();
+  receiver_entry->forward = forward_hub;
 
   // === pipeline config =============================
   error = NULL;
@@ -158,8 +256,10 @@ void soup_websocket_handler(G_GNUC_UNUSED SoupServer *server, SoupWebsocketConne
       "webrtcbin. ",
       &error);
   if (error != NULL) {
-    g_error("Could not create WebRTC pipeline: %s\n", error->message);
+    gst_printerr("Could not create WebRTC pipeline: %s\n", error->message);
     g_error_free(error);
+    /* Possibly partial, with no webrtcbin to go with it */
+    g_clear_pointer(&receiver_entry->pipeline, gst_object_unref);
     goto cleanup;
   }
 
@@ -171,6 +271,14 @@ void soup_websocket_handler(G_GNUC_UNUSED SoupServer *server, SoupWebsocketConne
   /* Incoming streams will be exposed via this signal */
   g_signal_connect(receiver_entry->webrtcbin, "pad-added", G_CALLBACK(on_incoming_stream), receiver_entry);
 
+  /* Browsers don't send the NTP-64 header extension, but the capture times
+   * in their RTCP sender reports get us the same meta */
+  if (measure_latency) {
+    GstElement *rtpbin = gst_bin_get_by_name(GST_BIN(receiver_entry->webrtcbin), "rtpbin");
+    g_object_set(rtpbin, "add-reference-timestamp-meta", TRUE, NULL);
+    gst_object_unref(rtpbin);
+  }
+
 #if 0
   GstElement *rtpbin = gst_bin_get_by_name (GST_BIN (receiver_entry->webrtcbin), "rtpbin");
   g_object_set (rtpbin, "latency", 40, NULL);
@@ -186,19 +294,157 @@ void soup_websocket_handler(G_GNUC_UNUSED SoupServer *server, SoupWebsocketConne
   g_signal_connect(receiver_entry->webrtcbin, "on-negotiation-needed", G_CALLBACK(on_negotiation_needed_cb), (gpointer)receiver_entry);
 
   g_signal_connect(receiver_entry->webrtcbin, "on-ice-candidate", G_CALLBACK(on_ice_candidate_cb), (gpointer)receiver_entry);
+  g_signal_connect(receiver_entry->webrtcbin, "notify::ice-gathering-state", G_CALLBACK(on_ice_gathering_state_notify_cb), (gpointer)receiver_entry);
+
+  if (task_pool)
+    session_task_pool_install(receiver_entry->pipeline);
 
   bus = gst_pipeline_get_bus(GST_PIPELINE(receiver_entry->pipeline));
-  gst_bus_add_watch(bus, bus_watch_cb, receiver_entry->pipeline);
+  gst_bus_add_watch(bus, receiver_entry_bus_watch_cb, receiver_entry);
   gst_object_unref(bus);
 
-  if (gst_element_set_state(receiver_entry->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
-    g_error("Could not start pipeline");
+  label = g_strdup_printf("%u", receiver_entry->id);
+  receiver_entry->stats = stats_collector_new(receiver_entry->webrtcbin, label);
+  g_free(label);
+
+  if (gst_element_set_state(receiver_entry->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    gst_printerr("Could not start pipeline\n");
+    goto cleanup;
+  }
 
-  g_hash_table_replace(receiver_entry_table, connection, receiver_entry);
-  return;
+  return receiver_entry;
 
 cleanup:
+  stats_count_failure(STATS_FAILURE_SETUP);
   destroy_receiver_entry((gpointer)receiver_entry);
+  return NULL;
+}
+
+/* Receives nothing, sends whatever the publisher sends. The caps are the
+ * ones the publisher's transceivers are set up with above, so the packets go
+ * out unchanged */
+ReceiverEntry *create_subscriber_entry(G_GNUC_UNUSED gpointer user_data) {
+  ReceiverEntry *receiver_entry;
+  GError *error;
+  GstWebRTCRTPTransceiver *trans;
+  GArray *transceivers;
+  GstBus *bus;
+  gchar *label;
+  guint i;
+
+  receiver_entry = receiver_entry_new();
+  receiver_entry->forward = forward_hub;
+
+  error = NULL;
+  receiver_entry->pipeline = gst_parse_launch( //
+      "webrtcbin name=webrtcbin stun-server=stun://" STUN_SERVER " "
+      "appsrc name=video is-live=true format=time do-timestamp=true "
+      "caps=\"application/x-rtp,media=video,encoding-name=H264,payload=" RTP_PAYLOAD_TYPE ",clock-rate=90000,packetization-mode=(string)1,profile-level-id=(string)42c016\" ! "
+      "webrtcbin. "
+      "appsrc name=audio is-live=true format=time do-timestamp=true "
+      "caps=\"application/x-rtp,media=audio,encoding-name=OPUS,payload=" RTP_AUDIO_PAYLOAD_TYPE ",clock-rate=48000\" ! "
+      "webrtcbin. ",
+      &error);
+  if (error != NULL) {
+    gst_printerr("Could not create WebRTC pipeline: %s\n", error->message);
+    g_error_free(error);
+    /* Possibly partial, with no webrtcbin to go with it */
+    g_clear_pointer(&receiver_entry->pipeline, gst_object_unref);
+    goto cleanup;
+  }
+
+  receiver_entry->webrtcbin = gst_bin_get_by_name(GST_BIN(receiver_entry->pipeline), "webrtcbin");
+  g_assert(receiver_entry->webrtcbin != NULL);
+
+  g_signal_emit_by_name(receiver_entry->webrtcbin, "get-transceivers", &transceivers);
+  for (i = 0; i < transceivers->len; i++) {
+    trans = g_array_index(transceivers, GstWebRTCRTPTransceiver *, i);
+    g_object_set(trans, "direction", GST_WEBRTC_RTP_TRANSCEIVER_DIRECTION_SENDONLY, NULL);
+  }
+  g_array_unref(transceivers);
+
+  g_signal_connect(receiver_entry->webrtcbin, "on-negotiation-needed", G_CALLBACK(on_negotiation_needed_cb), (gpointer)receiver_entry);
+
+  g_signal_connect(receiver_entry->webrtcbin, "on-ice-candidate", G_CALLBACK(on_ice_candidate_cb), (gpointer)receiver_entry);
+  g_signal_connect(receiver_entry->webrtcbin, "notify::ice-gathering-state", G_CALLBACK(on_ice_gathering_state_notify_cb), (gpointer)receiver_entry);
+
+  if (task_pool)
+    session_task_pool_install(receiver_entry->pipeline);
+
+  bus = gst_pipeline_get_bus(GST_PIPELINE(receiver_entry->pipeline));
+  gst_bus_add_watch(bus, receiver_entry_bus_watch_cb, receiver_entry);
+  gst_object_unref(bus);
+
+  forward_hub_attach(forward_hub, receiver_entry->pipeline);
+
+  label = g_strdup_printf("%u", receiver_entry->id);
+  receiver_entry->stats = stats_collector_new(receiver_entry->webrtcbin, label);
+  g_free(label);
+
+  if (gst_element_set_state(receiver_entry->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    gst_printerr("Could not start pipeline\n");
+    goto cleanup;
+  }
+
+  return receiver_entry;
+
+cleanup:
+  stats_count_failure(STATS_FAILURE_SETUP);
+  destroy_receiver_entry((gpointer)receiver_entry);
+  return NULL;
+}
+
+void soup_websocket_handler(G_GNUC_UNUSED SoupServer *server, SoupWebsocketConnection *connection, G_GNUC_UNUSED const char *path, G_GNUC_UNUSED SoupClientContext *client_context, gpointer user_data) {
+  ReceiverEntry *receiver_entry = NULL;
+  ReceiverEntryTable *receiver_entry_table = (ReceiverEntryTable *)user_data;
+
+  gst_print("Processing new websocket connection %p", (gpointer)connection);
+
+  g_signal_connect(G_OBJECT(connection), "closed", G_CALLBACK(soup_websocket_closed_cb), (gpointer)receiver_entry_table);
+
+  if (receiver_entry_pool != NULL)
+    receiver_entry = receiver_entry_pool_take(receiver_entry_pool);
+  if (receiver_entry == NULL)
+    receiver_entry = create_receiver_entry(NULL);
+  if (receiver_entry == NULL) {
+    soup_websocket_connection_close(connection, SOUP_WEBSOCKET_CLOSE_SERVER_ERROR, "Could not create a session");
+    return;
+  }
+  if (rebuild_on_error)
+    receiver_entry_set_rebuild(receiver_entry, create_receiver_entry, NULL);
+
+  receiver_entry_attach_connection(receiver_entry, connection);
+  receiver_entry_table_insert(receiver_entry_table, connection, receiver_entry);
+}
+
+void soup_websocket_watch_handler(G_GNUC_UNUSED SoupServer *server, SoupWebsocketConnection *connection, G_GNUC_UNUSED const char *path, G_GNUC_UNUSED SoupClientContext *client_context, gpointer user_data) {
+  ReceiverEntry *receiver_entry;
+  ReceiverEntryTable *receiver_entry_table = (ReceiverEntryTable *)user_data;
+
+  gst_print("Processing new subscriber websocket connection %p", (gpointer)connection);
+
+  g_signal_connect(G_OBJECT(connection), "closed", G_CALLBACK(soup_websocket_closed_cb), (gpointer)receiver_entry_table);
+
+  receiver_entry = create_subscriber_entry(NULL);
+  if (receiver_entry == NULL) {
+    soup_websocket_connection_close(connection, SOUP_WEBSOCKET_CLOSE_SERVER_ERROR, "Could not create a session");
+    return;
+  }
+  if (rebuild_on_error)
+    receiver_entry_set_rebuild(receiver_entry, create_subscriber_entry, NULL);
+
+  receiver_entry_attach_connection(receiver_entry, connection);
+  receiver_entry_table_insert(receiver_entry_table, connection, receiver_entry);
+}
+
+void setup_soup_server(SoupServer *soup_server, gpointer user_data) {
+  soup_server_add_handler(soup_server, "/", soup_http_handler, (gpointer)html_source, NULL);
+  soup_server_add_handler(soup_server, "/metrics", stats_metrics_handler, NULL, NULL);
+  soup_server_add_websocket_handler(soup_server, "/ws", NULL, NULL, soup_websocket_handler, user_data, NULL);
+  if (forward_hub != NULL) {
+    soup_server_add_handler(soup_server, "/watch", soup_http_handler, (gpointer)html_watch_source, NULL);
+    soup_server_add_websocket_handler(soup_server, "/watch-ws", NULL, NULL, soup_websocket_watch_handler, user_data, NULL);
+  }
 }
 
 #if defined(G_OS_UNIX) || defined(__APPLE__)
@@ -210,14 +456,51 @@ gboolean exit_sighandler(gpointer user_data) {
 }
 #endif
 
+static GOptionEntry entries[] = {
+    {"measure-latency", 0, 0, G_OPTION_ARG_NONE, &measure_latency, "Print glass-to-glass latency histograms of the received video", NULL},
+    {"pool-size", 0, 0, G_OPTION_ARG_INT, &pool_size, "Number of pre-warmed sessions kept ready for new senders", "N"},
+    {"shards", 0, 0, G_OPTION_ARG_INT, &n_shards, "Number of worker threads, each serving its share of the sessions from its own main context", "N"},
+    {"record", 0, 0, G_OPTION_ARG_FILENAME, &record_dir, "Record every incoming track into DIR without decoding it", "DIR"},
+    {"record-format", 0, 0, G_OPTION_ARG_STRING, &record_format_name, "Container of the recordings: mp4 (fragmented, default) or mkv", "FORMAT"},
+    {"record-flush-interval", 0, 0, G_OPTION_ARG_INT, &record_flush_interval, "Fragment duration of the recordings and how often they are written out (default 1000)", "MS"},
+    {"forward", 0, 0, G_OPTION_ARG_NONE, &forward, "Forward the RTP of the latest sender to every viewer of /watch instead of decoding it", NULL},
+    {"task-pool", 0, 0, G_OPTION_ARG_NONE, &task_pool, "Run the streaming threads of every session on one shared pool, which reuses up to one parked thread per core and pins each thread to a core, and every codec single threaded", NULL},
+    {"rebuild-on-error", 0, 0, G_OPTION_ARG_NONE, &rebuild_on_error, "Build a session whose pipeline fails again for the same viewer, instead of closing it", NULL},
+    {NULL},
+};
+
 int gst_main(int argc, char *argv[]) {
   GMainLoop *mainloop;
-  SoupServer *soup_server;
-  GHashTable *receiver_entry_table;
+  SoupServer *soup_server = NULL;
+  GPtrArray *shards = NULL;
+  ReceiverEntryTable *receiver_entry_table;
+  GOptionContext *context;
+  GError *error = NULL;
 
   setlocale(LC_ALL, "");
 
-  receiver_entry_table = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, destroy_receiver_entry);
+  context = g_option_context_new("- gstreamer webrtc recvonly demo");
+  g_option_context_add_main_entries(context, entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Error initializing: %s\n", error->message);
+    return -1;
+  }
+
+  if (record_format_name != NULL && !record_format_parse(record_format_name, &record_format)) {
+    g_printerr("Unknown --record-format %s\n", record_format_name);
+    return -1;
+  }
+  if (record_flush_interval <= 0) {
+    g_printerr("--record-flush-interval must be positive\n");
+    return -1;
+  }
+  if (record_dir != NULL && g_mkdir_with_parents(record_dir, 0755) != 0) {
+    g_printerr("Could not create %s\n", record_dir);
+    return -1;
+  }
+
+  receiver_entry_table = receiver_entry_table_new();
 
   mainloop = g_main_loop_new(NULL, FALSE);
   g_assert(mainloop != NULL);
@@ -227,17 +510,45 @@ int gst_main(int argc, char *argv[]) {
   g_unix_signal_add(SIGTERM, exit_sighandler, mainloop);
 #endif
 
-  soup_server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "webrtc-soup-server", NULL);
-  soup_server_add_handler(soup_server, "/", soup_http_handler, (gpointer)html_source, NULL);
-  soup_server_add_websocket_handler(soup_server, "/ws", NULL, NULL, soup_websocket_handler, (gpointer)receiver_entry_table, NULL);
-  soup_server_listen_all(soup_server, SOUP_HTTP_PORT, (SoupServerListenOptions)0, NULL);
+  if (forward)
+    forward_hub = forward_hub_new();
+
+  if (pool_size > 0)
+    receiver_entry_pool = receiver_entry_pool_new(pool_size, create_receiver_entry, NULL);
+
+  if (n_shards > 1) {
+    shards = session_shards_start(n_shards, SOUP_HTTP_PORT, setup_soup_server, receiver_entry_table, &error);
+    if (shards == NULL) {
+      g_printerr("Could not start shards: %s\n", error->message);
+      g_error_free(error);
+      return -1;
+    }
+  } else {
+    soup_server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "webrtc-soup-server", NULL);
+    setup_soup_server(soup_server, (gpointer)receiver_entry_table);
+    soup_server_listen_all(soup_server, SOUP_HTTP_PORT, (SoupServerListenOptions)0, NULL);
+  }
 
   gst_print("WebRTC page link: http://127.0.0.1:%d/\n", (gint)SOUP_HTTP_PORT);
+  if (forward_hub != NULL)
+    gst_print("Forwarded stream: http://127.0.0.1:%d/watch\n", (gint)SOUP_HTTP_PORT);
 
   g_main_loop_run(mainloop);
 
-  g_object_unref(G_OBJECT(soup_server));
-  g_hash_table_destroy(receiver_entry_table);
+  /* Sessions already on their way down hand their entries back to the
+   * context they came from, shards included, so before those stop */
+  session_reaper_stop();
+  while (g_main_context_iteration(NULL, FALSE))
+    ;
+  if (shards != NULL)
+    session_shards_stop(shards);
+  if (soup_server != NULL)
+    g_object_unref(G_OBJECT(soup_server));
+  receiver_entry_table_free(receiver_entry_table);
+  if (receiver_entry_pool != NULL)
+    receiver_entry_pool_free(receiver_entry_pool);
+  if (forward_hub != NULL)
+    forward_hub_free(forward_hub);
   g_main_loop_unref(mainloop);
 
   gst_deinit();
@@ -0,0 +1,200 @@
+/*
+ * Per frame cost of scaling and converting a camera frame for x264enc: the
+ * stock videoscale ! videoconvert against the fused scaleconvert element,
+ * both fed the same frame over and over as fast as they take it.
+ */
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <math.h>
+#include <sys/resource.h>
+
+#include "webrtc-scaleconvert.h"
+
+static gint frames = 600;
+static gchar *format = NULL;
+static gint in_width = 1920;
+static gint in_height = 1080;
+static gint out_width = 640;
+static gint out_height = 360;
+
+static GOptionEntry entries[] = {
+    {"frames", 0, 0, G_OPTION_ARG_INT, &frames, "Frames per measurement (default: 600)", "N"},
+    {"format", 0, 0, G_OPTION_ARG_STRING, &format, "Input format: YUY2, NV12 or I420 (default: YUY2)", "FORMAT"},
+    {"width", 0, 0, G_OPTION_ARG_INT, &in_width, "Input width (default: 1920)", "PIXELS"},
+    {"height", 0, 0, G_OPTION_ARG_INT, &in_height, "Input height (default: 1080)", "PIXELS"},
+    {"out-width", 0, 0, G_OPTION_ARG_INT, &out_width, "Output width (default: 640)", "PIXELS"},
+    {"out-height", 0, 0, G_OPTION_ARG_INT, &out_height, "Output height (default: 360)", "PIXELS"},
+    {NULL},
+};
+
+static gdouble cpu_seconds(void) {
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+/* Runs @convert between the repeated frame and a sink taking I420 at the
+ * output size, or nothing but the source when NULL. Returns the time per
+ * frame in us, negative on failure, and the last frame in @last */
+static gdouble run(const gchar *name, const gchar *convert, gdouble baseline, GstSample **last) {
+  GstElement *pipeline, *sink, *scaleconvert;
+  GstMessage *message;
+  GError *error = NULL;
+  gchar *description;
+  gchar *path = NULL;
+  gint64 start;
+  gdouble cpu, wall = -1;
+
+  if (convert != NULL)
+    description = g_strdup_printf("videotestsrc pattern=smpte num-buffers=1 ! video/x-raw,format=%s,width=%d,height=%d,framerate=30/1 ! "
+                                  "imagefreeze num-buffers=%d ! %s ! video/x-raw,format=I420,width=%d,height=%d ! fakesink name=sink sync=false",
+                                  format, in_width, in_height, frames, convert, out_width, out_height);
+  else
+    description = g_strdup_printf("videotestsrc pattern=smpte num-buffers=1 ! video/x-raw,format=%s,width=%d,height=%d,framerate=30/1 ! "
+                                  "imagefreeze num-buffers=%d ! fakesink name=sink sync=false",
+                                  format, in_width, in_height, frames);
+  pipeline = gst_parse_launch(description, &error);
+  g_free(description);
+  if (error != NULL) {
+    g_printerr("Could not create %s pipeline: %s\n", name, error->message);
+    g_error_free(error);
+    if (pipeline != NULL)
+      gst_object_unref(pipeline);
+    return -1;
+  }
+
+  /* Negotiation stays out of it */
+  gst_element_set_state(pipeline, GST_STATE_PAUSED);
+  gst_element_get_state(pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+  scaleconvert = gst_bin_get_by_name(GST_BIN(pipeline), "scaleconvert");
+  if (scaleconvert != NULL) {
+    path = g_strdup(scale_convert_get_path(scaleconvert));
+    gst_object_unref(scaleconvert);
+  }
+
+  cpu = cpu_seconds();
+  start = g_get_monotonic_time();
+  gst_element_set_state(pipeline, GST_STATE_PLAYING);
+  message = gst_bus_timed_pop_filtered(GST_ELEMENT_BUS(pipeline), GST_CLOCK_TIME_NONE, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+
+  if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+    gst_message_parse_error(message, &error, NULL);
+    g_printerr("%s failed: %s\n", name, error->message);
+    g_error_free(error);
+  } else {
+    wall = (g_get_monotonic_time() - start) / (gdouble)frames;
+    cpu = (cpu_seconds() - cpu) * 1e6 / frames;
+
+    if (baseline >= 0)
+      g_print("%-24s %8.1f us/frame %8.1f us cpu/frame %8.1f us/frame over the source\n", name, wall, cpu, wall - baseline);
+    else
+      g_print("%-24s %8.1f us/frame %8.1f us cpu/frame\n", name, wall, cpu);
+    if (path != NULL)
+      g_print("%-24s %s\n", "", path);
+
+    if (last != NULL) {
+      sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+      g_object_get(sink, "last-sample", last, NULL);
+      gst_object_unref(sink);
+    }
+  }
+
+  g_free(path);
+  gst_message_unref(message);
+  gst_element_set_state(pipeline, GST_STATE_NULL);
+  gst_object_unref(pipeline);
+
+  return wall;
+}
+
+/* Over the three planes, the stock output taken as the reference */
+static gdouble psnr(GstSample *reference, GstSample *sample) {
+  GstVideoInfo info;
+  GstVideoFrame a, b;
+  gdouble error = 0;
+  guint64 n = 0;
+  guint c;
+  gint x, y;
+
+  if (!gst_video_info_from_caps(&info, gst_sample_get_caps(reference)))
+    return 0;
+  if (!gst_video_frame_map(&a, &info, gst_sample_get_buffer(reference), GST_MAP_READ))
+    return 0;
+  if (!gst_video_frame_map(&b, &info, gst_sample_get_buffer(sample), GST_MAP_READ)) {
+    gst_video_frame_unmap(&a);
+    return 0;
+  }
+
+  for (c = 0; c < GST_VIDEO_FRAME_N_COMPONENTS(&a); c++) {
+    for (y = 0; y < GST_VIDEO_FRAME_COMP_HEIGHT(&a, c); y++) {
+      const guint8 *p = GST_VIDEO_FRAME_COMP_DATA(&a, c) + y * GST_VIDEO_FRAME_COMP_STRIDE(&a, c);
+      const guint8 *q = GST_VIDEO_FRAME_COMP_DATA(&b, c) + y * GST_VIDEO_FRAME_COMP_STRIDE(&b, c);
+
+      for (x = 0; x < GST_VIDEO_FRAME_COMP_WIDTH(&a, c); x++) {
+        gint d = p[x] - q[x];
+
+        error += d * d;
+        n++;
+      }
+    }
+  }
+
+  gst_video_frame_unmap(&a);
+  gst_video_frame_unmap(&b);
+
+  if (error == 0)
+    return INFINITY;
+  return 10 * log10(255.0 * 255.0 * n / error);
+}
+
+int main(int argc, char *argv[]) {
+  GOptionContext *context;
+  GError *error = NULL;
+  GstSample *stock = NULL, *fused = NULL;
+  gchar *stock_desc;
+  gdouble baseline;
+
+  context = g_option_context_new("- scale and convert benchmark");
+  g_option_context_add_main_entries(context, entries, NULL);
+  g_option_context_add_group(context, gst_init_get_option_group());
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Error initializing: %s\n", error->message);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (format == NULL)
+    format = g_strdup("YUY2");
+  if (frames <= 0 || in_width <= 0 || in_height <= 0 || out_width <= 0 || out_height <= 0) {
+    g_printerr("--frames and the sizes must be positive\n");
+    return -1;
+  }
+
+  if (!scale_convert_register()) {
+    g_printerr("Could not register scaleconvert\n");
+    return -1;
+  }
+
+  g_print("%s %dx%d to I420 %dx%d, %d frames each, scaleconvert with %s\n", format, in_width, in_height, out_width, out_height, frames, scale_convert_get_simd());
+
+  baseline = run("source only", NULL, -1, NULL);
+  if (baseline < 0)
+    return -1;
+
+  /* As the capture chain had it, scaling before converting */
+  stock_desc = g_strdup_printf("videoscale ! video/x-raw,width=%d,height=%d ! videoconvert", out_width, out_height);
+  run("videoscale ! videoconvert", stock_desc, baseline, &stock);
+  run("scaleconvert", "scaleconvert name=scaleconvert", baseline, &fused);
+  g_free(stock_desc);
+
+  if (stock != NULL && fused != NULL)
+    g_print("scaleconvert PSNR against videoscale ! videoconvert: %.1f dB\n", psnr(stock, fused));
+
+  if (stock != NULL)
+    gst_sample_unref(stock);
+  if (fused != NULL)
+    gst_sample_unref(fused);
+  g_free(format);
+  return 0;
+}
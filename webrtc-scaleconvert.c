@@ -0,0 +1,489 @@
+#include "webrtc-scaleconvert.h"
+
+#include <gst/video/gstvideofilter.h>
+#include <gst/video/video.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SCALE_CONVERT_X86
+#include <immintrin.h>
+#endif
+
+typedef struct _ScaleConvert ScaleConvert;
+typedef struct _ScaleConvertClass ScaleConvertClass;
+typedef struct _ScaleTap ScaleTap;
+typedef struct _ScaleGather ScaleGather;
+
+/* Blends @n bytes of @second into @first by @weight / 128 */
+typedef void (*ScaleBlendFunc)(guint8 *dest, const guint8 *first, const guint8 *second, gint weight, gint n);
+/* Takes every @step th byte of @src for up to @n output bytes, returns how
+ * many it did */
+typedef gint (*ScaleGatherFunc)(guint8 *dest, const guint8 *src, gint step, const guint8 (*masks)[16], gint n);
+
+/* Where one output sample comes from: bytes (columns) or rows of the two
+ * nearest input samples, and the weight of the second one in 1/128 */
+struct _ScaleTap {
+  gint first;
+  gint second;
+  gint weight;
+};
+
+/* Taps evenly spaced by @step bytes, up to 16, with one weight, as an integer
+ * ratio gives: the first @count outputs are then byte shuffles of the @step
+ * loads under every 16 of them, @masks[k] picking what falls in load k */
+struct _ScaleGather {
+  gint count;
+  gint step;
+  gint first;
+  gint second;
+  gint weight;
+  guint8 masks[16][16];
+};
+
+struct _ScaleConvert {
+  GstVideoFilter parent;
+
+  /* Luma, then chroma shared by U and V */
+  ScaleTap *columns[2];
+  ScaleTap *rows[2];
+  ScaleGather gathers[2];
+  /* Input bytes blended per row */
+  gint span[2];
+  /* U and V interleaved in the same input row, YUY2 and NV12 */
+  gboolean interleaved;
+  guint8 *row;
+  /* Second samples of the gathered columns, before blending */
+  guint8 *column;
+  gchar *path;
+};
+
+struct _ScaleConvertClass {
+  GstVideoFilterClass parent_class;
+};
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE(ScaleConvert, scale_convert, GST_TYPE_VIDEO_FILTER)
+/* *INDENT-ON* */
+
+static GstStaticPadTemplate sink_template = GST_STATIC_PAD_TEMPLATE("sink", GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS(GST_VIDEO_CAPS_MAKE("{ YUY2, NV12, I420 }")));
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS(GST_VIDEO_CAPS_MAKE("I420")));
+
+static ScaleBlendFunc scale_blend = NULL;
+static ScaleGatherFunc scale_gather = NULL;
+static const gchar *scale_simd = "scalar";
+
+/* Rounds like the SIMD versions: both sides stay exact in 16 bits, the
+ * difference times 127 at most */
+static void scale_blend_scalar(guint8 *dest, const guint8 *first, const guint8 *second, gint weight, gint n) {
+  gint i;
+
+  for (i = 0; i < n; i++)
+    dest[i] = first[i] + (((second[i] - first[i]) * weight + 64) >> 7);
+}
+
+#ifdef SCALE_CONVERT_X86
+__attribute__((target("sse4.1"))) static void scale_blend_sse41(guint8 *dest, const guint8 *first, const guint8 *second, gint weight, gint n) {
+  const __m128i w = _mm_set1_epi16(weight);
+  const __m128i round = _mm_set1_epi16(64);
+  gint i;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)(first + i));
+    __m128i b = _mm_loadu_si128((const __m128i *)(second + i));
+    __m128i a_lo = _mm_cvtepu8_epi16(a);
+    __m128i a_hi = _mm_cvtepu8_epi16(_mm_srli_si128(a, 8));
+    __m128i b_lo = _mm_cvtepu8_epi16(b);
+    __m128i b_hi = _mm_cvtepu8_epi16(_mm_srli_si128(b, 8));
+
+    a_lo = _mm_add_epi16(a_lo, _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(b_lo, a_lo), w), round), 7));
+    a_hi = _mm_add_epi16(a_hi, _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(b_hi, a_hi), w), round), 7));
+    _mm_storeu_si128((__m128i *)(dest + i), _mm_packus_epi16(a_lo, a_hi));
+  }
+  scale_blend_scalar(dest + i, first + i, second + i, weight, n - i);
+}
+
+__attribute__((target("sse4.1"))) static gint scale_gather_sse41(guint8 *dest, const guint8 *src, gint step, const guint8 (*masks)[16], gint n) {
+  gint i, k;
+
+  for (i = 0; i + 16 <= n; i += 16) {
+    const guint8 *in = src + (gssize)i * step;
+    __m128i out = _mm_setzero_si128();
+
+    for (k = 0; k < step; k++)
+      out = _mm_or_si128(out, _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + 16 * k)), _mm_loadu_si128((const __m128i *)masks[k])));
+    _mm_storeu_si128((__m128i *)(dest + i), out);
+  }
+
+  return i;
+}
+
+__attribute__((target("avx2"))) static void scale_blend_avx2(guint8 *dest, const guint8 *first, const guint8 *second, gint weight, gint n) {
+  const __m256i w = _mm256_set1_epi16(weight);
+  const __m256i round = _mm256_set1_epi16(64);
+  gint i;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    __m256i a = _mm256_loadu_si256((const __m256i *)(first + i));
+    __m256i b = _mm256_loadu_si256((const __m256i *)(second + i));
+    __m256i a_lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(a));
+    __m256i a_hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(a, 1));
+    __m256i b_lo = _mm256_cvtepu8_epi16(_mm256_castsi256_si128(b));
+    __m256i b_hi = _mm256_cvtepu8_epi16(_mm256_extracti128_si256(b, 1));
+
+    a_lo = _mm256_add_epi16(a_lo, _mm256_srai_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(b_lo, a_lo), w), round), 7));
+    a_hi = _mm256_add_epi16(a_hi, _mm256_srai_epi16(_mm256_add_epi16(_mm256_mullo_epi16(_mm256_sub_epi16(b_hi, a_hi), w), round), 7));
+    /* Packing works per 128 bit lane */
+    _mm256_storeu_si256((__m256i *)(dest + i), _mm256_permute4x64_epi64(_mm256_packus_epi16(a_lo, a_hi), 0xd8));
+  }
+  scale_blend_scalar(dest + i, first + i, second + i, weight, n - i);
+}
+
+/* Shuffles work per 128 bit lane, so the high one takes the next 16 outputs
+ * with the same masks */
+__attribute__((target("avx2"))) static gint scale_gather_avx2(guint8 *dest, const guint8 *src, gint step, const guint8 (*masks)[16], gint n) {
+  gint i, k;
+
+  for (i = 0; i + 32 <= n; i += 32) {
+    const guint8 *in = src + (gssize)i * step;
+    __m256i out = _mm256_setzero_si256();
+
+    for (k = 0; k < step; k++) {
+      __m256i mask = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)masks[k]));
+      __m256i window = _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(in + 16 * k))), _mm_loadu_si128((const __m128i *)(in + 16 * (step + k))), 1);
+
+      out = _mm256_or_si256(out, _mm256_shuffle_epi8(window, mask));
+    }
+    _mm256_storeu_si256((__m256i *)(dest + i), out);
+  }
+
+  return i + scale_gather_sse41(dest + i, src + (gssize)i * step, step, masks, n - i);
+}
+#endif
+
+/* Centers of the output samples mapped onto the input. @step is the
+ * distance between two input samples */
+static ScaleTap *scale_taps_new(gint in_size, gint out_size, gint step) {
+  ScaleTap *taps;
+  gint i;
+
+  taps = g_new(ScaleTap, out_size);
+  for (i = 0; i < out_size; i++) {
+    gint64 position = ((gint64)(2 * i + 1) * in_size << 16) / (2 * out_size) - (1 << 15);
+    gint index, weight;
+
+    position = MAX(position, 0);
+    index = position >> 16;
+    weight = ((position & 0xffff) + (1 << 8)) >> 9;
+    if (weight == 128) {
+      index++;
+      weight = 0;
+    }
+    if (index >= in_size - 1) {
+      index = in_size - 1;
+      weight = 0;
+    }
+
+    taps[i].first = index * step;
+    taps[i].second = (weight != 0 ? index + 1 : index) * step;
+    taps[i].weight = weight;
+  }
+
+  return taps;
+}
+
+/* Counts how many of @taps from the first one on can be gathered, none
+ * unless at least 16 of them are evenly spaced */
+static void scale_gather_init(ScaleGather *gather, const ScaleTap *taps, gint n) {
+  gint i, k, m;
+
+  memset(gather, 0, sizeof(*gather));
+  if (n < 16 || taps[1].first - taps[0].first < 1 || taps[1].first - taps[0].first > 16)
+    return;
+
+  gather->step = taps[1].first - taps[0].first;
+  gather->first = taps[0].first;
+  gather->second = taps[0].second;
+  gather->weight = taps[0].weight;
+  for (i = 0; i < n; i++) {
+    if (taps[i].first != gather->first + i * gather->step || taps[i].second - taps[i].first != gather->second - gather->first || taps[i].weight != gather->weight)
+      break;
+  }
+  /* Not worth a shuffle for less than one load */
+  gather->count = i >= 16 ? i : 0;
+
+  for (k = 0; k < gather->step; k++) {
+    for (m = 0; m < 16; m++)
+      gather->masks[k][m] = m * gather->step / 16 == k ? m * gather->step % 16 : 0x80;
+  }
+}
+
+static void scale_convert_clear(ScaleConvert *self) {
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS(self->columns); i++) {
+    g_clear_pointer(&self->columns[i], g_free);
+    g_clear_pointer(&self->rows[i], g_free);
+  }
+  g_clear_pointer(&self->row, g_free);
+  g_clear_pointer(&self->column, g_free);
+  g_clear_pointer(&self->path, g_free);
+}
+
+static GstCaps *scale_convert_transform_caps(G_GNUC_UNUSED GstBaseTransform *trans, GstPadDirection direction, GstCaps *caps, GstCaps *filter) {
+  GstCaps *result;
+  guint i;
+
+  result = gst_caps_new_empty();
+  for (i = 0; i < gst_caps_get_size(caps); i++) {
+    GstStructure *structure = gst_structure_copy(gst_caps_get_structure(caps, i));
+
+    gst_structure_set(structure, "width", GST_TYPE_INT_RANGE, 1, G_MAXINT, "height", GST_TYPE_INT_RANGE, 1, G_MAXINT, NULL);
+    gst_structure_remove_fields(structure, "format", "colorimetry", "chroma-site", "pixel-aspect-ratio", NULL);
+    if (direction == GST_PAD_SINK) {
+      gst_structure_set(structure, "format", G_TYPE_STRING, "I420", NULL);
+    } else {
+      GValue formats = G_VALUE_INIT;
+      GValue format = G_VALUE_INIT;
+      static const gchar *names[] = {"YUY2", "NV12", "I420"};
+      guint j;
+
+      g_value_init(&formats, GST_TYPE_LIST);
+      g_value_init(&format, G_TYPE_STRING);
+      for (j = 0; j < G_N_ELEMENTS(names); j++) {
+        g_value_set_static_string(&format, names[j]);
+        gst_value_list_append_value(&formats, &format);
+      }
+      gst_structure_take_value(structure, "format", &formats);
+      g_value_unset(&format);
+    }
+    result = gst_caps_merge_structure(result, structure);
+  }
+
+  if (filter != NULL) {
+    GstCaps *intersection = gst_caps_intersect_full(filter, result, GST_CAPS_INTERSECT_FIRST);
+
+    gst_caps_unref(result);
+    result = intersection;
+  }
+
+  return result;
+}
+
+/* Keeps the size unless told otherwise, and the display aspect ratio by
+ * way of the pixel aspect ratio, as videoscale does */
+static GstCaps *scale_convert_fixate_caps(G_GNUC_UNUSED GstBaseTransform *trans, GstPadDirection direction, GstCaps *caps, GstCaps *othercaps) {
+  GstStructure *in, *out;
+  gint in_width = 0, in_height = 0, out_width = 0, out_height = 0;
+  gint par_n = 1, par_d = 1;
+
+  othercaps = gst_caps_truncate(gst_caps_make_writable(othercaps));
+  in = gst_caps_get_structure(caps, 0);
+  out = gst_caps_get_structure(othercaps, 0);
+
+  gst_structure_get_int(in, "width", &in_width);
+  gst_structure_get_int(in, "height", &in_height);
+  if (in_width > 0)
+    gst_structure_fixate_field_nearest_int(out, "width", in_width);
+  if (in_height > 0)
+    gst_structure_fixate_field_nearest_int(out, "height", in_height);
+
+  if (direction == GST_PAD_SINK && gst_structure_get_int(out, "width", &out_width) && gst_structure_get_int(out, "height", &out_height) && in_width > 0 && in_height > 0) {
+    gst_structure_get_fraction(in, "pixel-aspect-ratio", &par_n, &par_d);
+    if (!gst_util_fraction_multiply(par_n, par_d, in_width * out_height, in_height * out_width, &par_n, &par_d)) {
+      par_n = 1;
+      par_d = 1;
+    }
+    if (gst_structure_has_field(out, "pixel-aspect-ratio"))
+      gst_structure_fixate_field_nearest_fraction(out, "pixel-aspect-ratio", par_n, par_d);
+    else
+      gst_structure_set(out, "pixel-aspect-ratio", GST_TYPE_FRACTION, par_n, par_d, NULL);
+  }
+
+  return gst_caps_fixate(othercaps);
+}
+
+static gboolean scale_convert_set_info(GstVideoFilter *filter, G_GNUC_UNUSED GstCaps *incaps, GstVideoInfo *in_info, G_GNUC_UNUSED GstCaps *outcaps, GstVideoInfo *out_info) {
+  ScaleConvert *self = (ScaleConvert *)filter;
+  gboolean blend_rows = FALSE;
+  const gchar *columns[2];
+  gint gap, y;
+  guint i;
+
+  scale_convert_clear(self);
+
+  for (i = 0; i < G_N_ELEMENTS(self->columns); i++) {
+    gint pstride = GST_VIDEO_INFO_COMP_PSTRIDE(in_info, i);
+
+    self->columns[i] = scale_taps_new(GST_VIDEO_INFO_COMP_WIDTH(in_info, i), GST_VIDEO_INFO_COMP_WIDTH(out_info, i), pstride);
+    self->rows[i] = scale_taps_new(GST_VIDEO_INFO_COMP_HEIGHT(in_info, i), GST_VIDEO_INFO_COMP_HEIGHT(out_info, i), 1);
+    self->span[i] = (GST_VIDEO_INFO_COMP_WIDTH(in_info, i) - 1) * pstride + 1;
+    scale_gather_init(&self->gathers[i], self->columns[i], GST_VIDEO_INFO_COMP_WIDTH(out_info, i));
+
+    for (y = 0; y < GST_VIDEO_INFO_COMP_HEIGHT(out_info, i); y++)
+      blend_rows |= self->rows[i][y].weight != 0;
+    columns[i] = scale_gather != NULL && self->gathers[i].count > 0 ? "shuffled" : "scalar";
+  }
+
+  self->interleaved = GST_VIDEO_INFO_COMP_PLANE(in_info, 1) == GST_VIDEO_INFO_COMP_PLANE(in_info, 2);
+  if (self->interleaved) {
+    gap = ABS((gint)GST_VIDEO_INFO_COMP_POFFSET(in_info, 2) - (gint)GST_VIDEO_INFO_COMP_POFFSET(in_info, 1));
+    self->span[1] += gap;
+  }
+  self->row = g_malloc(MAX(self->span[0], self->span[1]));
+  self->column = g_malloc(GST_VIDEO_INFO_COMP_WIDTH(out_info, 0));
+  self->path = g_strdup_printf("rows %s, luma columns %s, chroma columns %s", blend_rows ? scale_simd : "read in place", columns[0], columns[1]);
+
+  gst_base_transform_set_passthrough(GST_BASE_TRANSFORM(filter), GST_VIDEO_INFO_FORMAT(in_info) == GST_VIDEO_INFO_FORMAT(out_info) && GST_VIDEO_INFO_WIDTH(in_info) == GST_VIDEO_INFO_WIDTH(out_info) && GST_VIDEO_INFO_HEIGHT(in_info) == GST_VIDEO_INFO_HEIGHT(out_info));
+
+  return TRUE;
+}
+
+/* The input row at @tap, blended into the row buffer when it falls between
+ * two rows */
+static const guint8 *scale_convert_source_row(ScaleConvert *self, const guint8 *data, gint stride, const ScaleTap *tap, gint span) {
+  if (tap->weight == 0)
+    return data + (gssize)tap->first * stride;
+
+  scale_blend(self->row, data + (gssize)tap->first * stride, data + (gssize)tap->second * stride, tap->weight, span);
+  return self->row;
+}
+
+static void scale_convert_row_scalar(guint8 *dest, const guint8 *row, const ScaleTap *taps, gint n) {
+  gint i;
+
+  for (i = 0; i < n; i++) {
+    gint first = row[taps[i].first];
+
+    dest[i] = first + (((row[taps[i].second] - first) * taps[i].weight + 64) >> 7);
+  }
+}
+
+/* @n output bytes of component @c from the @length bytes of @row, shuffled
+ * as far as the loads stay inside the row */
+static void scale_convert_row(ScaleConvert *self, guint c, guint8 *dest, const guint8 *row, gint length, gint n) {
+  const ScaleGather *gather = &self->gathers[c];
+  gint done = 0;
+
+  if (scale_gather != NULL && gather->count > 0) {
+    done = MIN(gather->count, (length - MAX(gather->first, gather->second)) / gather->step);
+    done = scale_gather(dest, row + gather->first, gather->step, gather->masks, done);
+    if (gather->weight != 0) {
+      scale_gather(self->column, row + gather->second, gather->step, gather->masks, done);
+      scale_blend(dest, dest, self->column, gather->weight, done);
+    }
+  }
+
+  scale_convert_row_scalar(dest + done, row, self->columns[c] + done, n - done);
+}
+
+static GstFlowReturn scale_convert_transform_frame(GstVideoFilter *filter, GstVideoFrame *in_frame, GstVideoFrame *out_frame) {
+  ScaleConvert *self = (ScaleConvert *)filter;
+  const guint8 *in_y = GST_VIDEO_FRAME_COMP_DATA(in_frame, 0);
+  const guint8 *in_u = GST_VIDEO_FRAME_COMP_DATA(in_frame, 1);
+  const guint8 *in_v = GST_VIDEO_FRAME_COMP_DATA(in_frame, 2);
+  gint in_y_stride = GST_VIDEO_FRAME_COMP_STRIDE(in_frame, 0);
+  gint in_u_stride = GST_VIDEO_FRAME_COMP_STRIDE(in_frame, 1);
+  gint in_v_stride = GST_VIDEO_FRAME_COMP_STRIDE(in_frame, 2);
+  guint8 *out_y = GST_VIDEO_FRAME_COMP_DATA(out_frame, 0);
+  guint8 *out_u = GST_VIDEO_FRAME_COMP_DATA(out_frame, 1);
+  guint8 *out_v = GST_VIDEO_FRAME_COMP_DATA(out_frame, 2);
+  gint out_y_stride = GST_VIDEO_FRAME_COMP_STRIDE(out_frame, 0);
+  gint out_u_stride = GST_VIDEO_FRAME_COMP_STRIDE(out_frame, 1);
+  gint out_v_stride = GST_VIDEO_FRAME_COMP_STRIDE(out_frame, 2);
+  gint width = GST_VIDEO_FRAME_COMP_WIDTH(out_frame, 0);
+  gint height = GST_VIDEO_FRAME_COMP_HEIGHT(out_frame, 0);
+  gint chroma_width = GST_VIDEO_FRAME_COMP_WIDTH(out_frame, 1);
+  gint chroma_height = GST_VIDEO_FRAME_COMP_HEIGHT(out_frame, 1);
+  const guint8 *row;
+  gint y;
+
+  for (y = 0; y < height; y++) {
+    row = scale_convert_source_row(self, in_y, in_y_stride, &self->rows[0][y], self->span[0]);
+    scale_convert_row(self, 0, out_y + (gssize)y * out_y_stride, row, self->span[0], width);
+  }
+
+  if (self->interleaved) {
+    /* One blend for both */
+    const guint8 *base = MIN(in_u, in_v);
+
+    for (y = 0; y < chroma_height; y++) {
+      row = scale_convert_source_row(self, base, in_u_stride, &self->rows[1][y], self->span[1]);
+      scale_convert_row(self, 1, out_u + (gssize)y * out_u_stride, row + (in_u - base), self->span[1] - (in_u - base), chroma_width);
+      scale_convert_row(self, 1, out_v + (gssize)y * out_v_stride, row + (in_v - base), self->span[1] - (in_v - base), chroma_width);
+    }
+  } else {
+    for (y = 0; y < chroma_height; y++) {
+      row = scale_convert_source_row(self, in_u, in_u_stride, &self->rows[1][y], self->span[1]);
+      scale_convert_row(self, 1, out_u + (gssize)y * out_u_stride, row, self->span[1], chroma_width);
+      row = scale_convert_source_row(self, in_v, in_v_stride, &self->rows[1][y], self->span[1]);
+      scale_convert_row(self, 1, out_v + (gssize)y * out_v_stride, row, self->span[1], chroma_width);
+    }
+  }
+
+  return GST_FLOW_OK;
+}
+
+static void scale_convert_finalize(GObject *object) {
+  scale_convert_clear((ScaleConvert *)object);
+
+  G_OBJECT_CLASS(scale_convert_parent_class)->finalize(object);
+}
+
+static void scale_convert_class_init(ScaleConvertClass *klass) {
+  GObjectClass *object_class = G_OBJECT_CLASS(klass);
+  GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+  GstBaseTransformClass *transform_class = GST_BASE_TRANSFORM_CLASS(klass);
+  GstVideoFilterClass *filter_class = GST_VIDEO_FILTER_CLASS(klass);
+
+  object_class->finalize = scale_convert_finalize;
+
+  gst_element_class_add_static_pad_template(element_class, &sink_template);
+  gst_element_class_add_static_pad_template(element_class, &src_template);
+  gst_element_class_set_static_metadata(element_class, "Scale and convert", "Filter/Converter/Video/Scaler", "Scales YUY2, NV12 or I420 to I420 in a single pass", "gstreamer-example");
+
+  transform_class->transform_caps = scale_convert_transform_caps;
+  transform_class->fixate_caps = scale_convert_fixate_caps;
+  filter_class->set_info = scale_convert_set_info;
+  filter_class->transform_frame = scale_convert_transform_frame;
+
+  scale_blend = scale_blend_scalar;
+#ifdef SCALE_CONVERT_X86
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    scale_blend = scale_blend_avx2;
+    scale_gather = scale_gather_avx2;
+    scale_simd = "avx2";
+  } else if (__builtin_cpu_supports("sse4.1")) {
+    scale_blend = scale_blend_sse41;
+    scale_gather = scale_gather_sse41;
+    scale_simd = "sse4.1";
+  }
+#endif
+}
+
+static void scale_convert_init(G_GNUC_UNUSED ScaleConvert *self) {
+}
+
+gboolean scale_convert_register(void) {
+  return gst_element_register(NULL, "scaleconvert", GST_RANK_NONE, scale_convert_get_type());
+}
+
+gboolean scale_convert_accepts(GstCaps *caps) {
+  GstCaps *template = gst_static_pad_template_get_caps(&sink_template);
+  gboolean accepts = gst_caps_can_intersect(caps, template);
+
+  gst_caps_unref(template);
+  return accepts;
+}
+
+const gchar *scale_convert_get_simd(void) {
+  g_type_class_unref(g_type_class_ref(scale_convert_get_type()));
+  return scale_simd;
+}
+
+const gchar *scale_convert_get_path(GstElement *element) {
+  g_return_val_if_fail(G_TYPE_CHECK_INSTANCE_TYPE(element, scale_convert_get_type()), NULL);
+
+  return ((ScaleConvert *)element)->path;
+}
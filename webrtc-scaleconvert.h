@@ -0,0 +1,34 @@
+#ifndef __WEBRTC_SCALECONVERT_H__
+#define __WEBRTC_SCALECONVERT_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* scaleconvert: videoscale ! videoconvert in a single pass, for camera
+ * formats going to x264enc. Takes YUY2, NV12 or I420 and gives I420 at any
+ * size, bilinear like videoscale's default method.
+ *
+ * The frame is never written at its full size in between. Every output row
+ * needs two input rows, blended with AVX2 or SSE4.1 into a row buffer that
+ * stays in L1, or read in place when it falls on a single row, as it always
+ * does for 1080p to 360p. The output row then comes straight from it, by
+ * byte shuffles when the ratio is an integer, which also split U from V in
+ * YUY2 and NV12, and sample by sample otherwise. */
+
+/* Makes scaleconvert available to pipeline descriptions, after gst_init() */
+gboolean scale_convert_register(void);
+
+/* Whether a source producing @caps can feed scaleconvert directly */
+gboolean scale_convert_accepts(GstCaps *caps);
+
+/* What blending and shuffling run with: "avx2", "sse4.1" or "scalar" */
+const gchar *scale_convert_get_simd(void);
+
+/* How a negotiated scaleconvert @element makes its rows and columns, for
+ * telling whether the SIMD code runs at all at its sizes */
+const gchar *scale_convert_get_path(GstElement *element);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_SCALECONVERT_H__ */
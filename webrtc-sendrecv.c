@@ -15,6 +15,13 @@
 #include <gst/webrtc/webrtc.h>
 
 #include "custom_agent.h"
+#include "webrtc-bitrate.h"
+#include "webrtc-keyframe.h"
+#include "webrtc-latency.h"
+#include "webrtc-negotiation.h"
+#include "webrtc-stats.h"
+#include "webrtc-taskpool.h"
+#include "webrtc-trickle.h"
 
 /* For signaling */
 #include <json-glib/json-glib.h>
@@ -22,6 +29,10 @@
 
 #include <string.h>
 
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#endif
+
 enum AppState {
   APP_STATE_UNKNOWN = 0,
   APP_STATE_ERROR = 1, /* generic error */
@@ -45,12 +56,46 @@ enum AppState {
 #define GST_CAT_DEFAULT webrtc_sendrecv_debug
 GST_DEBUG_CATEGORY_STATIC(GST_CAT_DEFAULT);
 
+/* Seconds before a call slot that ended connects again, with --calls */
+#define CALL_RESTART_DELAY_SECONDS 1
+
+typedef struct _Call Call;
+
+/* Everything about one call: its signaling connection, its pipeline and
+ * where it stands in the state machine. The websocket and the pipeline are
+ * only touched from the main loop, webrtcbin threads hand over to it */
+struct _Call {
+  gint ref_count;
+  guint index;
+  enum AppState app_state;
+  /* Set once torn down, late callbacks still holding a reference bail out */
+  gboolean ended;
+
+  /* Exactly one of them is set, as with the command line options */
+  gchar *peer_id;
+  gchar *our_id;
+
+  SoupWebsocketConnection *ws_conn;
+  GstElement *pipeline, *webrtcbin, *audio_bin, *video_bin;
+  GObject *send_channel, *receive_channel;
+  StatsCollector *stats;
+  BitrateController *bitrate_controller;
+  TrickleBatch *trickle;
+
+  /* Remote candidates are held back until the remote description is
+   * applied */
+  gboolean remote_description_set;
+  GQueue pending_candidates;
+  /* Whether we send the offer once the pipeline is up */
+  gboolean create_offer;
+};
+
 static GMainLoop *loop;
-static GstElement *pipe1, *webrtc1, *audio_bin, *video_bin = NULL;
-static GObject *send_channel, *receive_channel;
+static SoupSession *session = NULL;
+/* The Call running in every slot, NULL while a slot waits for its restart */
+static GPtrArray *calls = NULL;
+static gboolean stopping = FALSE;
 
-static SoupWebsocketConnection *ws_conn = NULL;
-static enum AppState app_state = 0;
 static gchar *peer_id = NULL;
 static gchar *our_id = NULL;
 // static const gchar *server_url = "wss://webrtc.gstreamer.net:8443";
@@ -58,6 +103,22 @@ static const gchar *server_url = "ws://127.0.0.1:8443";
 static gboolean disable_ssl = FALSE;
 static gboolean remote_is_offerer = FALSE;
 static gboolean custom_ice = FALSE;
+static gchar **ice_hosts = NULL;
+static gint udp_mux_port = 0;
+static gint udp_mux_sockets = 1;
+static UdpMux *udp_mux = NULL;
+static gchar *impair_settings = NULL;
+static gchar *impair_script = NULL;
+static gint impair_seed = 1;
+static gchar *impair_direction = NULL;
+static ImpairScenario *impair_scenario = NULL;
+static ImpairDirection impair_directions = IMPAIR_SEND | IMPAIR_RECEIVE;
+static gint metrics_port = 0;
+static gboolean fixed_bitrate = FALSE;
+static gboolean measure_latency = FALSE;
+static gint n_calls = 1;
+static gboolean headless = FALSE;
+static gboolean task_pool = FALSE;
 
 static GOptionEntry entries[] = {
     {"peer-id", 0, 0, G_OPTION_ARG_STRING, &peer_id, "String ID of the peer to connect to", "ID"},
@@ -66,32 +127,138 @@ static GOptionEntry entries[] = {
     {"disable-ssl", 0, 0, G_OPTION_ARG_NONE, &disable_ssl, "Disable ssl", NULL},
     {"remote-offerer", 0, 0, G_OPTION_ARG_NONE, &remote_is_offerer, "Request that the peer generate the offer and we'll answer", NULL},
     {"custom-ice", 0, 0, G_OPTION_ARG_NONE, &custom_ice, "Use a custom ice agent", NULL},
+    {"ice-host", 0, 0, G_OPTION_ARG_STRING_ARRAY, &ice_hosts, "Only offer this host address, as LOCAL or LOCAL=PUBLIC behind a 1:1 NAT, and skip STUN for a fast connect. Repeat for more addresses, implies --custom-ice", "ADDRESS"},
+    {"udp-mux-port", 0, 0, G_OPTION_ARG_INT, &udp_mux_port, "Send and receive every call on this one UDP port, needs --ice-host and a peer that is not muxed itself", "PORT"},
+    {"udp-mux-sockets", 0, 0, G_OPTION_ARG_INT, &udp_mux_sockets, "Sockets sharing the --udp-mux-port, each read by its own thread (default: 1)", "N"},
+    {"impair", 0, 0, G_OPTION_ARG_STRING, &impair_settings, "Impair the network of every call, e.g. \"delay=40ms jitter=5ms loss=1% rate=800kbit\", implies --custom-ice", "SETTINGS"},
+    {"impair-script", 0, 0, G_OPTION_ARG_FILENAME, &impair_script, "Impair the network following the phases of a scenario file, implies --custom-ice", "FILE"},
+    {"impair-seed", 0, 0, G_OPTION_ARG_INT, &impair_seed, "Seed of the impairment's loss and reordering pattern (default: 1)", "N"},
+    {"impair-direction", 0, 0, G_OPTION_ARG_STRING, &impair_direction, "Impair what we send, what we receive or both (default: both)", "send|receive|both"},
+    {"measure-latency", 0, 0, G_OPTION_ARG_NONE, &measure_latency, "Send capture times in an NTP-64 RTP header extension and print glass-to-glass latency histograms of the received video", NULL},
+    {"fixed-bitrate", 0, 0, G_OPTION_ARG_NONE, &fixed_bitrate, "Keep the encoder settings fixed instead of adapting them to the congestion feedback", NULL},
+    {"metrics-port", 0, 0, G_OPTION_ARG_INT, &metrics_port, "Serve Prometheus metrics on http://0.0.0.0:PORT/metrics", "PORT"},
+    {"calls", 0, 0, G_OPTION_ARG_INT, &n_calls, "Number of concurrent calls, using the IDs ID-0 to ID-(N-1). Calls that end are set up again", "N"},
+    {"headless", 0, 0, G_OPTION_ARG_NONE, &headless, "Decode the received media into fakesinks instead of showing it", NULL},
+    {"task-pool", 0, 0, G_OPTION_ARG_NONE, &task_pool, "Run the streaming threads of every call on one shared pool, which reuses up to one parked thread per core and pins each thread to a core, and every codec single threaded", NULL},
     {NULL},
 };
 
-static gboolean cleanup_and_quit_loop(const gchar *msg, enum AppState state) {
+static void call_start(guint index);
+
+static Call *call_ref(Call *call) {
+  g_atomic_int_inc(&call->ref_count);
+  return call;
+}
+
+static void call_unref(gpointer call_ptr) {
+  Call *call = (Call *)call_ptr;
+
+  if (!g_atomic_int_dec_and_test(&call->ref_count))
+    return;
+
+  g_assert(call->pipeline == NULL && call->ws_conn == NULL);
+  g_free(call->peer_id);
+  g_free(call->our_id);
+  g_free(call);
+}
+
+static gboolean restart_call(gpointer user_data) {
+  if (!stopping)
+    call_start(GPOINTER_TO_UINT(user_data));
+  return G_SOURCE_REMOVE;
+}
+
+/* Main loop only. Tears the call down, then either sets its slot up again or,
+ * with a single call or when stopping, quits once no call is left */
+static void call_end(Call *call, const gchar *msg, enum AppState state) {
+  guint i;
+
   if (msg)
-    gst_printerr("%s\n", msg);
+    gst_printerr("Call %u: %s\n", call->index, msg);
   if (state > 0)
-    app_state = state;
+    call->app_state = state;
+  if (call->ended)
+    return;
+  call->ended = TRUE;
 
-  if (ws_conn) {
-    if (soup_websocket_connection_get_state(ws_conn) == SOUP_WEBSOCKET_STATE_OPEN)
-      /* This will call us again */
-      soup_websocket_connection_close(ws_conn, 1000, "");
-    else
-      g_clear_object(&ws_conn);
+  if (call->ws_conn) {
+    g_signal_handlers_disconnect_by_data(call->ws_conn, call);
+    if (soup_websocket_connection_get_state(call->ws_conn) == SOUP_WEBSOCKET_STATE_OPEN)
+      soup_websocket_connection_close(call->ws_conn, 1000, "");
+    g_clear_object(&call->ws_conn);
   }
 
-  if (loop) {
-    g_main_loop_quit(loop);
-    g_clear_pointer(&loop, g_main_loop_unref);
+  if (call->stats)
+    g_clear_pointer(&call->stats, stats_collector_free);
+
+  if (call->pipeline) {
+    GstBus *bus;
+
+    gst_element_set_state(GST_ELEMENT(call->pipeline), GST_STATE_NULL);
+    gst_print("Call %u: pipeline stopped\n", call->index);
+
+    bus = gst_pipeline_get_bus(GST_PIPELINE(call->pipeline));
+    gst_bus_remove_watch(bus);
+    gst_object_unref(bus);
+
+    gst_clear_object(&call->pipeline);
+    call->webrtcbin = NULL;
   }
 
-  /* To allow usage as a GSourceFunc */
+  if (call->bitrate_controller)
+    g_clear_pointer(&call->bitrate_controller, bitrate_controller_free);
+  g_queue_clear_full(&call->pending_candidates, pending_candidate_free);
+  if (call->trickle)
+    g_clear_pointer(&call->trickle, trickle_batch_free);
+
+  if (g_ptr_array_index(calls, call->index) == call) {
+    g_ptr_array_index(calls, call->index) = NULL;
+    if (n_calls > 1 && !stopping)
+      g_timeout_add_seconds(CALL_RESTART_DELAY_SECONDS, restart_call, GUINT_TO_POINTER(call->index));
+    call_unref(call);
+  }
+
+  if (n_calls > 1 && !stopping)
+    return;
+  for (i = 0; i < calls->len; i++)
+    if (g_ptr_array_index(calls, i) != NULL)
+      return;
+  if (loop)
+    g_main_loop_quit(loop);
+}
+
+typedef struct _CallFailure {
+  Call *call;
+  gchar *msg;
+  enum AppState state;
+} CallFailure;
+
+static gboolean on_call_failed(gpointer user_data) {
+  CallFailure *failure = (CallFailure *)user_data;
+
+  call_end(failure->call, failure->msg, failure->state);
   return G_SOURCE_REMOVE;
 }
 
+static void call_failure_free(gpointer failure_ptr) {
+  CallFailure *failure = (CallFailure *)failure_ptr;
+
+  call_unref(failure->call);
+  g_free(failure->msg);
+  g_free(failure);
+}
+
+/* Same from any thread, the call is ended on the main loop. Takes ownership
+ * of @msg */
+static void call_fail(Call *call, gchar *msg, enum AppState state) {
+  CallFailure *failure = g_new0(CallFailure, 1);
+
+  failure->call = call_ref(call);
+  failure->msg = msg;
+  failure->state = state;
+  g_idle_add_full(G_PRIORITY_DEFAULT, on_call_failed, failure, call_failure_free);
+}
+
 static gchar *get_string_from_json_object(JsonObject *object) {
   JsonNode *root;
   JsonGenerator *generator;
@@ -109,7 +276,7 @@ static gchar *get_string_from_json_object(JsonObject *object) {
   return text;
 }
 
-static void handle_media_stream(GstPad *pad, GstElement *pipe, const char *convert_name, const char *sink_name) {
+static GstElement *handle_media_stream(GstPad *pad, GstElement *pipe, const char *convert_name, const char *sink_name) {
   GstPad *qpad;
   GstElement *q, *conv, *resample, *sink;
   GstPadLinkReturn ret;
@@ -146,6 +313,9 @@ static void handle_media_stream(GstPad *pad, GstElement *pipe, const char *conve
 
   ret = gst_pad_link(pad, qpad);
   g_assert_cmphex(ret, ==, GST_PAD_LINK_OK);
+  gst_object_unref(qpad);
+
+  return sink;
 }
 
 static void on_incoming_decodebin_stream(GstElement *decodebin, GstPad *pad, GstElement *pipe) {
@@ -161,12 +331,19 @@ static void on_incoming_decodebin_stream(GstElement *decodebin, GstPad *pad, Gst
   name = gst_structure_get_name(gst_caps_get_structure(caps, 0));
 
   if (g_str_has_prefix(name, "video")) {
-    handle_media_stream(pad, pipe, "videoconvert", "autovideosink");
+    GstElement *sink = handle_media_stream(pad, pipe, "videoconvert", headless ? "fakesink" : "autovideosink");
+
+    if (measure_latency) {
+      GstPad *sinkpad = gst_element_get_static_pad(sink, "sink");
+      latency_histogram_attach(sinkpad, GST_PAD_NAME(pad));
+      gst_object_unref(sinkpad);
+    }
   } else if (g_str_has_prefix(name, "audio")) {
-    handle_media_stream(pad, pipe, "audioconvert", "autoaudiosink");
+    handle_media_stream(pad, pipe, "audioconvert", headless ? "fakesink" : "autoaudiosink");
   } else {
     gst_printerr("Unknown pad %s, ignoring", GST_PAD_NAME(pad));
   }
+  gst_caps_unref(caps);
 }
 
 static void on_incoming_stream(GstElement *webrtc, GstPad *pad, GstElement *pipe) {
@@ -186,44 +363,68 @@ static void on_incoming_stream(GstElement *webrtc, GstPad *pad, GstElement *pipe
   gst_object_unref(sinkpad);
 }
 
-static void send_ice_candidate_message(GstElement *webrtc G_GNUC_UNUSED, guint mlineindex, gchar *candidate, gpointer user_data G_GNUC_UNUSED) {
-  gchar *text;
-  JsonObject *ice, *msg;
+/* Batched candidates, on the main loop */
+static void send_ice_candidates_message(gchar *text, gpointer user_data) {
+  Call *call = (Call *)user_data;
 
-  if (app_state < PEER_CALL_NEGOTIATING) {
-    cleanup_and_quit_loop("Can't send ICE, not in call", APP_STATE_ERROR);
+  if (call->app_state < PEER_CALL_NEGOTIATING) {
+    call_end(call, "Can't send ICE, not in call", APP_STATE_ERROR);
+    g_free(text);
     return;
   }
 
-  ice = json_object_new();
-  json_object_set_string_member(ice, "candidate", candidate);
-  json_object_set_int_member(ice, "sdpMLineIndex", mlineindex);
-  msg = json_object_new();
-  json_object_set_object_member(msg, "ice", ice);
-  text = get_string_from_json_object(msg);
-  json_object_unref(msg);
-
-  soup_websocket_connection_send_text(ws_conn, text);
+  soup_websocket_connection_send_text(call->ws_conn, text);
   g_free(text);
 }
 
-static void send_sdp_to_peer(GstWebRTCSessionDescription *desc) {
+static void send_ice_candidate_message(GstElement *webrtc G_GNUC_UNUSED, guint mlineindex, gchar *candidate, gpointer user_data) {
+  trickle_batch_add(((Call *)user_data)->trickle, mlineindex, candidate);
+}
+
+static void on_ice_gathering_state_notify(GstElement *webrtcbin, GParamSpec *pspec G_GNUC_UNUSED, gpointer user_data) {
+  Call *call = (Call *)user_data;
+  GstWebRTCICEGatheringState ice_gather_state;
+  const gchar *new_state = "unknown";
+
+  g_object_get(webrtcbin, "ice-gathering-state", &ice_gather_state, NULL);
+  switch (ice_gather_state) {
+  case GST_WEBRTC_ICE_GATHERING_STATE_NEW:
+    new_state = "new";
+    break;
+  case GST_WEBRTC_ICE_GATHERING_STATE_GATHERING:
+    new_state = "gathering";
+    break;
+  case GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE:
+    new_state = "complete";
+    trickle_batch_add(call->trickle, 0, NULL);
+    break;
+  }
+  gst_print("Call %u: ICE gathering state changed to %s\n", call->index, new_state);
+}
+
+static void send_sdp_to_peer(Call *call, GstWebRTCSessionDescription *desc) {
   gchar *text;
   JsonObject *msg, *sdp;
 
-  if (app_state < PEER_CALL_NEGOTIATING) {
-    cleanup_and_quit_loop("Can't send SDP to peer, not in call", APP_STATE_ERROR);
+  if (call->app_state < PEER_CALL_NEGOTIATING) {
+    call_end(call, "Can't send SDP to peer, not in call", APP_STATE_ERROR);
     return;
   }
 
+  /* Makes the peer the controlling agent, which nominates the pair */
+  if (udp_mux != NULL)
+    gst_sdp_message_add_attribute(desc->sdp, "ice-lite", NULL);
+
   text = gst_sdp_message_as_text(desc->sdp);
   sdp = json_object_new();
 
   if (desc->type == GST_WEBRTC_SDP_TYPE_OFFER) {
-    gst_print("Sending offer:\n%s\n", text);
+    if (n_calls == 1)
+      gst_print("Sending offer:\n%s\n", text);
     json_object_set_string_member(sdp, "type", "offer");
   } else if (desc->type == GST_WEBRTC_SDP_TYPE_ANSWER) {
-    gst_print("Sending answer:\n%s\n", text);
+    if (n_calls == 1)
+      gst_print("Sending answer:\n%s\n", text);
     json_object_set_string_member(sdp, "type", "answer");
   } else {
     g_assert_not_reached();
@@ -237,150 +438,212 @@ static void send_sdp_to_peer(GstWebRTCSessionDescription *desc) {
   text = get_string_from_json_object(msg);
   json_object_unref(msg);
 
-  soup_websocket_connection_send_text(ws_conn, text);
+  soup_websocket_connection_send_text(call->ws_conn, text);
   g_free(text);
+
+  /* Candidates gathered so far follow right behind the description */
+  trickle_batch_release(call->trickle);
+}
+
+/* The promise change functions below run on the webrtcbin operation thread,
+ * they chain the next webrtcbin call and hand everything touching the
+ * websocket or the state machine over to the main loop, which never waits
+ * on a promise. Each of them holds a reference on its call */
+
+static void negotiation_failed(Call *call, const gchar *what, const GError *error) {
+  call_fail(call, g_strdup_printf("ERROR: %s: %s", what, error != NULL ? error->message : "unknown error"), PEER_CALL_ERROR);
+}
+
+/* A session description on its way through the chain */
+typedef struct _CallDescription {
+  Call *call;
+  GstWebRTCSessionDescription *desc;
+} CallDescription;
+
+static CallDescription *call_description_new(Call *call, const GstWebRTCSessionDescription *desc) {
+  CallDescription *call_desc = g_new0(CallDescription, 1);
+
+  call_desc->call = call_ref(call);
+  call_desc->desc = gst_webrtc_session_description_copy(desc);
+  return call_desc;
+}
+
+static void call_description_free(gpointer call_desc_ptr) {
+  CallDescription *call_desc = (CallDescription *)call_desc_ptr;
+
+  call_unref(call_desc->call);
+  gst_webrtc_session_description_free(call_desc->desc);
+  g_free(call_desc);
+}
+
+static gboolean on_local_description_applied(gpointer user_data) {
+  CallDescription *call_desc = (CallDescription *)user_data;
+
+  if (!call_desc->call->ended)
+    send_sdp_to_peer(call_desc->call, call_desc->desc);
+  return G_SOURCE_REMOVE;
+}
+
+static void on_local_description_set(GstPromise *promise, gpointer user_data) {
+  CallDescription *call_desc = (CallDescription *)user_data;
+  GError *error = NULL;
+
+  /* Only send what webrtcbin accepted */
+  if (get_promise_reply(promise, NULL, &error))
+    g_idle_add_full(G_PRIORITY_DEFAULT, on_local_description_applied, call_description_new(call_desc->call, call_desc->desc), call_description_free);
+  else
+    negotiation_failed(call_desc->call, "Could not set the local description", error);
+
+  g_clear_error(&error);
+  gst_promise_unref(promise);
+}
+
+static void set_local_description(Call *call, GstWebRTCSessionDescription *desc) {
+  GstPromise *promise;
+
+  promise = gst_promise_new_with_change_func(on_local_description_set, call_description_new(call, desc), call_description_free);
+  g_signal_emit_by_name(call->webrtcbin, "set-local-description", desc, promise);
+}
+
+static gboolean on_remote_description_applied(gpointer user_data) {
+  Call *call = (Call *)user_data;
+  PendingCandidate *pending;
+
+  if (call->ended)
+    return G_SOURCE_REMOVE;
+
+  call->remote_description_set = TRUE;
+  while ((pending = g_queue_pop_head(&call->pending_candidates)) != NULL) {
+    g_signal_emit_by_name(call->webrtcbin, "add-ice-candidate", pending->mline_index, pending->candidate);
+    pending_candidate_free(pending);
+  }
+
+  return G_SOURCE_REMOVE;
 }
 
 /* Offer created by our pipeline, to be sent to the peer */
 static void on_offer_created(GstPromise *promise, gpointer user_data) {
+  Call *call = (Call *)user_data;
   GstWebRTCSessionDescription *offer = NULL;
   const GstStructure *reply;
+  GError *error = NULL;
 
-  g_assert_cmphex(app_state, ==, PEER_CALL_NEGOTIATING);
+  if (get_promise_reply(promise, &reply, &error) && gst_structure_get(reply, "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offer, NULL)) {
+    set_local_description(call, offer);
+    gst_webrtc_session_description_free(offer);
+  } else {
+    negotiation_failed(call, "Could not create an offer", error);
+  }
 
-  g_assert_cmphex(gst_promise_wait(promise), ==, GST_PROMISE_RESULT_REPLIED);
-  reply = gst_promise_get_reply(promise);
-  gst_structure_get(reply, "offer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &offer, NULL);
+  g_clear_error(&error);
   gst_promise_unref(promise);
+}
 
-  promise = gst_promise_new();
-  g_signal_emit_by_name(webrtc1, "set-local-description", offer, promise);
-  gst_promise_interrupt(promise);
-  gst_promise_unref(promise);
+static gboolean on_negotiation_needed_main(gpointer user_data) {
+  Call *call = (Call *)user_data;
 
-  /* Send offer to peer */
-  send_sdp_to_peer(offer);
-  gst_webrtc_session_description_free(offer);
-}
+  if (call->ended)
+    return G_SOURCE_REMOVE;
 
-static void on_negotiation_needed(GstElement *element, gpointer user_data) {
-  gboolean create_offer = GPOINTER_TO_INT(user_data);
-  app_state = PEER_CALL_NEGOTIATING;
+  call->app_state = PEER_CALL_NEGOTIATING;
 
   if (remote_is_offerer) {
-    soup_websocket_connection_send_text(ws_conn, "OFFER_REQUEST");
-  } else if (create_offer) {
-    GstPromise *promise = gst_promise_new_with_change_func(on_offer_created, NULL, NULL);
-    g_signal_emit_by_name(webrtc1, "create-offer", NULL, promise);
+    soup_websocket_connection_send_text(call->ws_conn, "OFFER_REQUEST");
+  } else if (call->create_offer) {
+    GstPromise *promise = gst_promise_new_with_change_func(on_offer_created, call_ref(call), call_unref);
+    g_signal_emit_by_name(call->webrtcbin, "create-offer", NULL, promise);
   }
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Emitted from a webrtcbin thread, the state machine and the websocket
+ * belong to the main loop */
+static void on_negotiation_needed(GstElement *element, gpointer user_data) {
+  g_idle_add_full(G_PRIORITY_DEFAULT, on_negotiation_needed_main, call_ref((Call *)user_data), call_unref);
 }
 
 static void data_channel_on_error(GObject *dc, gpointer user_data) {
-  cleanup_and_quit_loop("Data channel error", 0);
+  call_fail((Call *)user_data, g_strdup("Data channel error"), 0);
 }
 
 static void data_channel_on_open(GObject *dc, gpointer user_data) {
   GBytes *bytes = g_bytes_new("data", strlen("data"));
-  gst_print("data channel opened\n");
+  gst_print("Call %u: data channel opened\n", ((Call *)user_data)->index);
   g_signal_emit_by_name(dc, "send-string", "Hi! from GStreamer");
   g_signal_emit_by_name(dc, "send-data", bytes);
   g_bytes_unref(bytes);
 }
 
 static void data_channel_on_close(GObject *dc, gpointer user_data) {
-  cleanup_and_quit_loop("Data channel closed", 0);
+  call_fail((Call *)user_data, g_strdup("Data channel closed"), 0);
 }
 
 static void data_channel_on_message_string(GObject *dc, gchar *str, gpointer user_data) {
-  gst_print("Received data channel message: %s\n", str);
+  gst_print("Call %u: received data channel message: %s\n", ((Call *)user_data)->index, str);
 }
 
-static void connect_data_channel_signals(GObject *data_channel) {
-  g_signal_connect(data_channel, "on-error", G_CALLBACK(data_channel_on_error), NULL);
-  g_signal_connect(data_channel, "on-open", G_CALLBACK(data_channel_on_open), NULL);
-  g_signal_connect(data_channel, "on-close", G_CALLBACK(data_channel_on_close), NULL);
-  g_signal_connect(data_channel, "on-message-string", G_CALLBACK(data_channel_on_message_string), NULL);
+/* The data channels live as long as the pipeline, which the call outlives */
+static void connect_data_channel_signals(Call *call, GObject *data_channel) {
+  g_signal_connect(data_channel, "on-error", G_CALLBACK(data_channel_on_error), call);
+  g_signal_connect(data_channel, "on-open", G_CALLBACK(data_channel_on_open), call);
+  g_signal_connect(data_channel, "on-close", G_CALLBACK(data_channel_on_close), call);
+  g_signal_connect(data_channel, "on-message-string", G_CALLBACK(data_channel_on_message_string), call);
 }
 
 static void on_data_channel(GstElement *webrtc, GObject *data_channel, gpointer user_data) {
-  connect_data_channel_signals(data_channel);
-  receive_channel = data_channel;
-}
+  Call *call = (Call *)user_data;
 
-static void on_ice_gathering_state_notify(GstElement *webrtcbin, GParamSpec *pspec, gpointer user_data) {
-  GstWebRTCICEGatheringState ice_gather_state;
-  const gchar *new_state = "unknown";
-
-  g_object_get(webrtcbin, "ice-gathering-state", &ice_gather_state, NULL);
-  switch (ice_gather_state) {
-  case GST_WEBRTC_ICE_GATHERING_STATE_NEW:
-    new_state = "new";
-    break;
-  case GST_WEBRTC_ICE_GATHERING_STATE_GATHERING:
-    new_state = "gathering";
-    break;
-  case GST_WEBRTC_ICE_GATHERING_STATE_COMPLETE:
-    new_state = "complete";
-    break;
-  }
-  gst_print("ICE gathering state changed to %s\n", new_state);
+  connect_data_channel_signals(call, data_channel);
+  call->receive_channel = data_channel;
 }
 
-static gboolean webrtcbin_get_stats(GstElement *webrtcbin);
+static void start_stats_collector(Call *call) {
+  GstElement *videopay, *videoenc, *videocaps;
+  GstPad *pad;
 
-static gboolean on_webrtcbin_stat(GQuark field_id, const GValue *value, gpointer unused) {
-  if (GST_VALUE_HOLDS_STRUCTURE(value)) {
-    GST_DEBUG("stat: \'%s\': %" GST_PTR_FORMAT, g_quark_to_string(field_id), gst_value_get_structure(value));
-  } else {
-    GST_FIXME("unknown field \'%s\' value type: \'%s\'", g_quark_to_string(field_id), g_type_name(G_VALUE_TYPE(value)));
-  }
-
-  return TRUE;
-}
-
-static void on_webrtcbin_get_stats(GstPromise *promise, GstElement *webrtcbin) {
-  const GstStructure *stats;
-
-  g_return_if_fail(gst_promise_wait(promise) == GST_PROMISE_RESULT_REPLIED);
+  call->stats = stats_collector_new(call->webrtcbin, call->peer_id ? call->peer_id : call->our_id);
 
-  stats = gst_promise_get_reply(promise);
-  gst_structure_foreach(stats, on_webrtcbin_stat, NULL);
+  videopay = gst_bin_get_by_name(GST_BIN(call->pipeline), "videopay");
+  g_assert_nonnull(videopay);
+  pad = gst_element_get_static_pad(videopay, "sink");
+  stats_collector_count_frames(call->stats, pad);
+  gst_object_unref(pad);
+  gst_object_unref(videopay);
 
-  g_timeout_add(100, (GSourceFunc)webrtcbin_get_stats, webrtcbin);
-}
-
-static gboolean webrtcbin_get_stats(GstElement *webrtcbin) {
-  GstPromise *promise;
-
-  promise = gst_promise_new_with_change_func((GstPromiseChangeFunc)on_webrtcbin_get_stats, webrtcbin, NULL);
-
-  GST_TRACE("emitting get-stats on %" GST_PTR_FORMAT, webrtcbin);
-  g_signal_emit_by_name(webrtcbin, "get-stats", NULL, promise);
-  gst_promise_unref(promise);
+  if (fixed_bitrate)
+    return;
 
-  return G_SOURCE_REMOVE;
+  videoenc = gst_bin_get_by_name(GST_BIN(call->pipeline), "videoenc");
+  g_assert_nonnull(videoenc);
+  videocaps = gst_bin_get_by_name(GST_BIN(call->pipeline), "videocaps");
+  g_assert_nonnull(videocaps);
+  call->bitrate_controller = bitrate_controller_new(call->webrtcbin, videoenc, videocaps, call->stats);
+  gst_object_unref(videocaps);
+  gst_object_unref(videoenc);
 }
 
 static gboolean bus_watch_cb(GstBus *bus, GstMessage *message, gpointer user_data) {
-  GstPipeline *pipeline = user_data;
+  Call *call = (Call *)user_data;
 
   switch (GST_MESSAGE_TYPE(message)) {
   case GST_MESSAGE_ASYNC_DONE: {
-    GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS(GST_BIN(pipe1), GST_DEBUG_GRAPH_SHOW_ALL, "webrtc-sendrecv.async-done");
+    GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS(GST_BIN(call->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "webrtc-sendrecv.async-done");
     break;
   }
   case GST_MESSAGE_ERROR: {
     GError *error = NULL;
     gchar *debug = NULL;
 
-    GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS(GST_BIN(pipe1), GST_DEBUG_GRAPH_SHOW_ALL, "webrtc-sendrecv.error");
+    GST_DEBUG_BIN_TO_DOT_FILE_WITH_TS(GST_BIN(call->pipeline), GST_DEBUG_GRAPH_SHOW_ALL, "webrtc-sendrecv.error");
 
     gst_message_parse_error(message, &error, &debug);
-    cleanup_and_quit_loop("ERROR: Error on bus", APP_STATE_ERROR);
     g_warning("Error on bus: %s (debug: %s)", error->message, debug);
     g_error_free(error);
     g_free(debug);
-    break;
+    /* Removes this watch */
+    call_end(call, "ERROR: Error on bus", APP_STATE_ERROR);
+    return G_SOURCE_REMOVE;
   }
   case GST_MESSAGE_WARNING: {
     GError *error = NULL;
@@ -393,7 +656,7 @@ static gboolean bus_watch_cb(GstBus *bus, GstMessage *message, gpointer user_dat
     break;
   }
   case GST_MESSAGE_LATENCY:
-    gst_bin_recalculate_latency(GST_BIN(pipeline));
+    gst_bin_recalculate_latency(GST_BIN(call->pipeline));
     break;
   default:
     break;
@@ -404,25 +667,29 @@ static gboolean bus_watch_cb(GstBus *bus, GstMessage *message, gpointer user_dat
 
 #define STUN_SERVER "stun://stun.l.google.com:19302"
 #define RTP_TWCC_URI "http://www.ietf.org/id/draft-holmer-rmcat-transport-wide-cc-extensions-01"
+#define RTP_NTP64_ID 2
 #define RTP_OPUS_DEFAULT_PT 97
 #define RTP_VP8_DEFAULT_PT 96
 
-static gboolean start_pipeline(gboolean create_offer, guint opus_pt, guint vp8_pt) {
+static gboolean start_pipeline(Call *call, gboolean create_offer, guint opus_pt, guint vp8_pt) {
   GstBus *bus;
   char *audio_desc, *video_desc;
   GstStateChangeReturn ret;
-  GstWebRTCICE *custom_agent;
+  GstWebRTCICE *custom_agent = NULL;
   GError *audio_error = NULL;
   GError *video_error = NULL;
 
-  pipe1 = gst_pipeline_new("webrtc-pipeline");
+  call->pipeline = gst_pipeline_new("webrtc-pipeline");
+  if (task_pool)
+    session_task_pool_install(call->pipeline);
+  call->create_offer = create_offer;
 
   audio_desc = g_strdup_printf( //
       "audiotestsrc is-live=true wave=red-noise ! audioconvert ! audioresample"
       "! queue ! opusenc perfect-timestamp=true ! rtpopuspay name=audiopay pt=%u "
       "! application/x-rtp, encoding-name=OPUS ! queue",
       opus_pt);
-  audio_bin = gst_parse_bin_from_description(audio_desc, TRUE, &audio_error);
+  call->audio_bin = gst_parse_bin_from_description(audio_desc, TRUE, &audio_error);
   g_free(audio_desc);
   if (audio_error) {
     gst_printerr("Failed to parse audio_bin: %s\n", audio_error->message);
@@ -431,40 +698,52 @@ static gboolean start_pipeline(gboolean create_offer, guint opus_pt, guint vp8_p
   }
 
   video_desc = g_strdup_printf( //
-      "videotestsrc is-live=true pattern=ball ! videoconvert ! queue ! "
-      /* increase the default keyframe distance, browsers have really long
-       * periods between keyframes and rely on PLI events on packet loss to
-       * fix corrupted video.
+      /* videorate and videoscale are passthrough until the bitrate
+       * controller puts caps on videocaps */
+      "videotestsrc is-live=true pattern=ball ! videorate ! videoscale ! capsfilter name=videocaps ! videoconvert ! queue ! "
+      /* no periodic keyframes at all, browsers have really long periods
+       * between keyframes and rely on PLI events on packet loss to fix
+       * corrupted video. The keyframe limiter below rate-limits those.
        */
-      "vp8enc deadline=1 keyframe-max-dist=2000 ! "
+      "vp8enc name=videoenc deadline=1 keyframe-mode=disabled ! "
       /* picture-id-mode=15-bit seems to make TWCC stats behave better, and
        * fixes stuttery video playback in Chrome */
       "rtpvp8pay name=videopay picture-id-mode=15-bit pt=%u ! queue",
       vp8_pt);
-  video_bin = gst_parse_bin_from_description(video_desc, TRUE, &video_error);
+  call->video_bin = gst_parse_bin_from_description(video_desc, TRUE, &video_error);
   g_free(video_desc);
   if (video_error) {
     gst_printerr("Failed to parse video_bin: %s\n", video_error->message);
     g_error_free(video_error);
     goto err;
   }
-
-  if (custom_ice) {
+  keyframe_limiter_install_all(GST_BIN(call->video_bin), KEYFRAME_MIN_INTERVAL_MS);
+
+  if (udp_mux != NULL) {
+    custom_agent = GST_WEBRTC_ICE(customice_agent_new_muxed("custom", (const gchar *const *)ice_hosts, udp_mux));
+    call->webrtcbin = gst_element_factory_make_full("webrtcbin", "name", "sendrecv", "ice-agent", custom_agent, NULL);
+  } else if (ice_hosts != NULL) {
+    custom_agent = GST_WEBRTC_ICE(customice_agent_new_lite("custom", (const gchar *const *)ice_hosts));
+    call->webrtcbin = gst_element_factory_make_full("webrtcbin", "name", "sendrecv", "ice-agent", custom_agent, NULL);
+  } else if (custom_ice || impair_scenario != NULL) {
     custom_agent = GST_WEBRTC_ICE(customice_agent_new("custom"));
-    webrtc1 = gst_element_factory_make_full("webrtcbin", "name", "sendrecv", "stun-server", STUN_SERVER, "ice-agent", custom_agent, NULL);
+    call->webrtcbin = gst_element_factory_make_full("webrtcbin", "name", "sendrecv", "stun-server", STUN_SERVER, "ice-agent", custom_agent, NULL);
   } else {
-    webrtc1 = gst_element_factory_make_full("webrtcbin", "name", "sendrecv", "stun-server", STUN_SERVER, NULL);
+    call->webrtcbin = gst_element_factory_make_full("webrtcbin", "name", "sendrecv", "stun-server", STUN_SERVER, NULL);
   }
-  g_assert_nonnull(webrtc1);
-  gst_util_set_object_arg(G_OBJECT(webrtc1), "bundle-policy", "max-bundle");
+  /* Seeded by slot, a restarted call sees the same network again */
+  if (custom_agent != NULL && impair_scenario != NULL)
+    customice_agent_set_impairment(CUSTOMICE_AGENT(custom_agent), impair_scenario, impair_directions, call->index);
+  g_assert_nonnull(call->webrtcbin);
+  gst_util_set_object_arg(G_OBJECT(call->webrtcbin), "bundle-policy", "max-bundle");
 
   /* Takes ownership of each: */
-  gst_bin_add_many(GST_BIN(pipe1), audio_bin, video_bin, webrtc1, NULL);
+  gst_bin_add_many(GST_BIN(call->pipeline), call->audio_bin, call->video_bin, call->webrtcbin, NULL);
 
-  if (!gst_element_link(audio_bin, webrtc1)) {
+  if (!gst_element_link(call->audio_bin, call->webrtcbin)) {
     gst_printerr("Failed to link audio_bin \n");
   }
-  if (!gst_element_link(video_bin, webrtc1)) {
+  if (!gst_element_link(call->video_bin, call->webrtcbin)) {
     gst_printerr("Failed to link video_bin \n");
   }
 
@@ -478,16 +757,22 @@ static gboolean start_pipeline(gboolean create_offer, guint opus_pt, guint vp8_p
     GstElement *videopay, *audiopay;
     GstRTPHeaderExtension *video_twcc, *audio_twcc;
 
-    videopay = gst_bin_get_by_name(GST_BIN(pipe1), "videopay");
+    videopay = gst_bin_get_by_name(GST_BIN(call->pipeline), "videopay");
     g_assert_nonnull(videopay);
     video_twcc = gst_rtp_header_extension_create_from_uri(RTP_TWCC_URI);
     g_assert_nonnull(video_twcc);
     gst_rtp_header_extension_set_id(video_twcc, 1);
     g_signal_emit_by_name(videopay, "add-extension", video_twcc);
     g_clear_object(&video_twcc);
+    if (measure_latency) {
+      GstPad *pad = gst_element_get_static_pad(videopay, "sink");
+      latency_stamp_capture(pad);
+      gst_object_unref(pad);
+      latency_add_header_extension(videopay, RTP_NTP64_ID);
+    }
     g_clear_object(&videopay);
 
-    audiopay = gst_bin_get_by_name(GST_BIN(pipe1), "audiopay");
+    audiopay = gst_bin_get_by_name(GST_BIN(call->pipeline), "audiopay");
     g_assert_nonnull(audiopay);
     audio_twcc = gst_rtp_header_extension_create_from_uri(RTP_TWCC_URI);
     g_assert_nonnull(audio_twcc);
@@ -499,133 +784,152 @@ static gboolean start_pipeline(gboolean create_offer, guint opus_pt, guint vp8_p
 
   /* This is the gstwebrtc entry point where we create the offer and so on. It
    * will be called when the pipeline goes to PLAYING. */
-  g_signal_connect(webrtc1, "on-negotiation-needed", G_CALLBACK(on_negotiation_needed), GINT_TO_POINTER(create_offer));
+  g_signal_connect(call->webrtcbin, "on-negotiation-needed", G_CALLBACK(on_negotiation_needed), call);
   /* We need to transmit this ICE candidate to the browser via the websockets
    * signaling server. Incoming ice candidates from the browser need to be
    * added by us too, see on_server_message() */
-  g_signal_connect(webrtc1, "on-ice-candidate", G_CALLBACK(send_ice_candidate_message), NULL);
-  g_signal_connect(webrtc1, "notify::ice-gathering-state", G_CALLBACK(on_ice_gathering_state_notify), NULL);
+  call->trickle = trickle_batch_new("{\"ice\":[", send_ice_candidates_message, call);
+  g_signal_connect(call->webrtcbin, "on-ice-candidate", G_CALLBACK(send_ice_candidate_message), call);
+  g_signal_connect(call->webrtcbin, "notify::ice-gathering-state", G_CALLBACK(on_ice_gathering_state_notify), call);
 
-  bus = gst_pipeline_get_bus(GST_PIPELINE(pipe1));
-  gst_bus_add_watch(bus, bus_watch_cb, pipe1);
+  bus = gst_pipeline_get_bus(GST_PIPELINE(call->pipeline));
+  gst_bus_add_watch(bus, bus_watch_cb, call);
   gst_object_unref(bus);
 
-  gst_element_set_state(pipe1, GST_STATE_READY);
+  gst_element_set_state(call->pipeline, GST_STATE_READY);
 
-  g_signal_emit_by_name(webrtc1, "create-data-channel", "channel", NULL, &send_channel);
-  if (send_channel) {
-    gst_print("Created data channel\n");
-    connect_data_channel_signals(send_channel);
+  g_signal_emit_by_name(call->webrtcbin, "create-data-channel", "channel", NULL, &call->send_channel);
+  if (call->send_channel) {
+    gst_print("Call %u: created data channel\n", call->index);
+    connect_data_channel_signals(call, call->send_channel);
   } else {
     gst_print("Could not create data channel, is usrsctp available?\n");
   }
 
-  g_signal_connect(webrtc1, "on-data-channel", G_CALLBACK(on_data_channel), NULL);
+  g_signal_connect(call->webrtcbin, "on-data-channel", G_CALLBACK(on_data_channel), call);
   /* Incoming streams will be exposed via this signal */
-  g_signal_connect(webrtc1, "pad-added", G_CALLBACK(on_incoming_stream), pipe1);
+  g_signal_connect(call->webrtcbin, "pad-added", G_CALLBACK(on_incoming_stream), call->pipeline);
 
-  g_timeout_add(100, (GSourceFunc)webrtcbin_get_stats, webrtc1);
+  start_stats_collector(call);
 
-  gst_print("Starting pipeline\n");
-  ret = gst_element_set_state(GST_ELEMENT(pipe1), GST_STATE_PLAYING);
+  gst_print("Call %u: starting pipeline\n", call->index);
+  ret = gst_element_set_state(GST_ELEMENT(call->pipeline), GST_STATE_PLAYING);
   if (ret == GST_STATE_CHANGE_FAILURE)
     goto err;
 
   return TRUE;
 
 err:
-  if (pipe1)
-    g_clear_object(&pipe1);
-  if (webrtc1)
-    webrtc1 = NULL;
+  /* call_end() takes care of whatever got set up */
   return FALSE;
 }
 
-static gboolean setup_call(void) {
+static gboolean setup_call(Call *call) {
   gchar *msg;
 
-  if (soup_websocket_connection_get_state(ws_conn) != SOUP_WEBSOCKET_STATE_OPEN)
+  if (soup_websocket_connection_get_state(call->ws_conn) != SOUP_WEBSOCKET_STATE_OPEN)
     return FALSE;
 
-  if (!peer_id)
+  if (!call->peer_id)
     return FALSE;
 
-  gst_print("Setting up signaling server call with %s\n", peer_id);
-  app_state = PEER_CONNECTING;
-  msg = g_strdup_printf("SESSION %s", peer_id);
-  soup_websocket_connection_send_text(ws_conn, msg);
+  gst_print("Call %u: setting up signaling server call with %s\n", call->index, call->peer_id);
+  call->app_state = PEER_CONNECTING;
+  msg = g_strdup_printf("SESSION %s", call->peer_id);
+  soup_websocket_connection_send_text(call->ws_conn, msg);
   g_free(msg);
   return TRUE;
 }
 
-static gboolean register_with_server(void) {
+static gboolean register_with_server(Call *call) {
   gchar *hello;
 
-  if (soup_websocket_connection_get_state(ws_conn) != SOUP_WEBSOCKET_STATE_OPEN)
+  if (soup_websocket_connection_get_state(call->ws_conn) != SOUP_WEBSOCKET_STATE_OPEN)
     return FALSE;
 
-  if (!our_id) {
+  if (!call->our_id) {
     gint32 id;
 
     id = g_random_int_range(10, 10000);
-    gst_print("Registering id %i with server\n", id);
+    gst_print("Call %u: registering id %i with server\n", call->index, id);
 
-    hello = g_strdup_printf("HELLO %i", id);
+    /* Random ids of concurrent calls would collide sooner or later */
+    if (n_calls > 1)
+      hello = g_strdup_printf("HELLO %i-%u", id, call->index);
+    else
+      hello = g_strdup_printf("HELLO %i", id);
   } else {
-    gst_print("Registering id %s with server\n", our_id);
+    gst_print("Call %u: registering id %s with server\n", call->index, call->our_id);
 
-    hello = g_strdup_printf("HELLO %s", our_id);
+    hello = g_strdup_printf("HELLO %s", call->our_id);
   }
 
-  app_state = SERVER_REGISTERING;
+  call->app_state = SERVER_REGISTERING;
 
   /* Register with the server with a random integer id. Reply will be received by on_server_message() */
-  soup_websocket_connection_send_text(ws_conn, hello);
+  soup_websocket_connection_send_text(call->ws_conn, hello);
   g_free(hello);
 
   return TRUE;
 }
 
-static void on_server_closed(SoupWebsocketConnection *conn G_GNUC_UNUSED, gpointer user_data G_GNUC_UNUSED) {
-  app_state = SERVER_CLOSED;
-  cleanup_and_quit_loop("Server connection closed", 0);
+static void on_server_closed(SoupWebsocketConnection *conn G_GNUC_UNUSED, gpointer user_data) {
+  call_end((Call *)user_data, "Server connection closed", SERVER_CLOSED);
 }
 
 /* Answer created by our pipeline, to be sent to the peer */
 static void on_answer_created(GstPromise *promise, gpointer user_data) {
+  Call *call = (Call *)user_data;
   GstWebRTCSessionDescription *answer = NULL;
   const GstStructure *reply;
+  GError *error = NULL;
 
-  g_assert_cmphex(app_state, ==, PEER_CALL_NEGOTIATING);
+  if (get_promise_reply(promise, &reply, &error) && gst_structure_get(reply, "answer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &answer, NULL)) {
+    set_local_description(call, answer);
+    gst_webrtc_session_description_free(answer);
+  } else {
+    negotiation_failed(call, "Could not create an answer", error);
+  }
 
-  g_assert_cmphex(gst_promise_wait(promise), ==, GST_PROMISE_RESULT_REPLIED);
-  reply = gst_promise_get_reply(promise);
-  gst_structure_get(reply, "answer", GST_TYPE_WEBRTC_SESSION_DESCRIPTION, &answer, NULL);
+  g_clear_error(&error);
   gst_promise_unref(promise);
+}
+
+/* The remote description was applied, answer it when it was an offer */
+static void on_remote_description_set(GstPromise *promise, gpointer user_data) {
+  CallDescription *call_desc = (CallDescription *)user_data;
+  Call *call = call_desc->call;
+  GError *error = NULL;
 
-  promise = gst_promise_new();
-  g_signal_emit_by_name(webrtc1, "set-local-description", answer, promise);
-  gst_promise_interrupt(promise);
+  if (!get_promise_reply(promise, NULL, &error)) {
+    negotiation_failed(call, "Could not set the remote description", error);
+    g_clear_error(&error);
+    gst_promise_unref(promise);
+    return;
+  }
   gst_promise_unref(promise);
 
-  /* Send answer to peer */
-  send_sdp_to_peer(answer);
-  gst_webrtc_session_description_free(answer);
+  g_idle_add_full(G_PRIORITY_DEFAULT, on_remote_description_applied, call_ref(call), call_unref);
+
+  if (call_desc->desc->type == GST_WEBRTC_SDP_TYPE_OFFER) {
+    promise = gst_promise_new_with_change_func(on_answer_created, call_ref(call), call_unref);
+    g_signal_emit_by_name(call->webrtcbin, "create-answer", NULL, promise);
+  }
 }
 
-static void on_offer_set(GstPromise *promise, gpointer user_data) {
-  gst_promise_unref(promise);
-  promise = gst_promise_new_with_change_func(on_answer_created, NULL, NULL);
-  g_signal_emit_by_name(webrtc1, "create-answer", NULL, promise);
+static void set_remote_description(Call *call, GstWebRTCSessionDescription *desc) {
+  GstPromise *promise;
+
+  promise = gst_promise_new_with_change_func(on_remote_description_set, call_description_new(call, desc), call_description_free);
+  g_signal_emit_by_name(call->webrtcbin, "set-remote-description", desc, promise);
 }
 
-static void on_offer_received(GstSDPMessage *sdp) {
+static void on_offer_received(Call *call, GstSDPMessage *sdp) {
   GstWebRTCSessionDescription *offer = NULL;
-  GstPromise *promise;
 
   /* If we got an offer and we have no webrtcbin, we need to parse the SDP,
    * get the payload types, then start the pipeline */
-  if (!webrtc1 && our_id) {
+  if (!call->webrtcbin && call->our_id) {
     guint medias_len, formats_len;
     guint opus_pt = 0, vp8_pt = 0;
 
@@ -652,16 +956,22 @@ static void on_offer_received(GstSDPMessage *sdp) {
           vp8_pt = pt;
         if (opus_pt == 0 && g_strcmp0(encoding_name, "OPUS") == 0)
           opus_pt = pt;
+        gst_caps_unref(caps);
       }
     }
 
-    g_assert_cmpint(opus_pt, !=, 0);
-    g_assert_cmpint(vp8_pt, !=, 0);
+    if (opus_pt == 0 || vp8_pt == 0) {
+      gst_sdp_message_free(sdp);
+      call_end(call, "ERROR: offer without OPUS and VP8", PEER_CALL_ERROR);
+      return;
+    }
 
     gst_println("Starting pipeline with opus pt: %u vp8 pt: %u", opus_pt, vp8_pt);
 
-    if (!start_pipeline(FALSE, opus_pt, vp8_pt)) {
-      cleanup_and_quit_loop("ERROR: failed to start pipeline", PEER_CALL_ERROR);
+    if (!start_pipeline(call, FALSE, opus_pt, vp8_pt)) {
+      gst_sdp_message_free(sdp);
+      call_end(call, "ERROR: failed to start pipeline", PEER_CALL_ERROR);
+      return;
     }
   }
 
@@ -669,15 +979,29 @@ static void on_offer_received(GstSDPMessage *sdp) {
   g_assert_nonnull(offer);
 
   /* Set remote description on our pipeline */
-  {
-    promise = gst_promise_new_with_change_func(on_offer_set, NULL, NULL);
-    g_signal_emit_by_name(webrtc1, "set-remote-description", offer, promise);
-  }
+  set_remote_description(call, offer);
   gst_webrtc_session_description_free(offer);
 }
 
+/* Add ice candidate sent by remote peer, an empty string marks the end of
+ * candidates */
+static void add_remote_candidate(Call *call, JsonObject *ice) {
+  const gchar *candidate;
+  gint sdpmlineindex;
+
+  candidate = json_object_get_string_member(ice, "candidate");
+  sdpmlineindex = json_object_get_int_member(ice, "sdpMLineIndex");
+
+  if (!call->remote_description_set) {
+    g_queue_push_tail(&call->pending_candidates, pending_candidate_new(sdpmlineindex, candidate));
+  } else if (call->webrtcbin) {
+    g_signal_emit_by_name(call->webrtcbin, "add-ice-candidate", sdpmlineindex, candidate);
+  }
+}
+
 /* One mega message handler for our asynchronous calling mechanism */
 static void on_server_message(SoupWebsocketConnection *conn, SoupWebsocketDataType type, GBytes *message, gpointer user_data) {
+  Call *call = (Call *)user_data;
   gchar *text;
 
   switch (type) {
@@ -697,62 +1021,64 @@ static void on_server_message(SoupWebsocketConnection *conn, SoupWebsocketDataTy
 
   if (g_strcmp0(text, "HELLO") == 0) {
     /* Server has accepted our registration, we are ready to send commands */
-    if (app_state != SERVER_REGISTERING) {
-      cleanup_and_quit_loop("ERROR: Received HELLO when not registering", APP_STATE_ERROR);
+    if (call->app_state != SERVER_REGISTERING) {
+      call_end(call, "ERROR: Received HELLO when not registering", APP_STATE_ERROR);
       goto out;
     }
-    app_state = SERVER_REGISTERED;
-    gst_print("Registered with server\n");
-    if (!our_id) {
+    call->app_state = SERVER_REGISTERED;
+    gst_print("Call %u: registered with server\n", call->index);
+    if (!call->our_id) {
       /* Ask signaling server to connect us with a specific peer */
-      if (!setup_call()) {
-        cleanup_and_quit_loop("ERROR: Failed to setup call", PEER_CALL_ERROR);
+      if (!setup_call(call)) {
+        call_end(call, "ERROR: Failed to setup call", PEER_CALL_ERROR);
         goto out;
       }
     } else {
-      gst_println("Waiting for connection from peer (our-id: %s)", our_id);
+      gst_println("Call %u: waiting for connection from peer (our-id: %s)", call->index, call->our_id);
     }
   } else if (g_strcmp0(text, "SESSION_OK") == 0) {
     /* The call initiated by us has been setup by the server; now we can start
      * negotiation */
-    if (app_state != PEER_CONNECTING) {
-      cleanup_and_quit_loop("ERROR: Received SESSION_OK when not calling", PEER_CONNECTION_ERROR);
+    if (call->app_state != PEER_CONNECTING) {
+      call_end(call, "ERROR: Received SESSION_OK when not calling", PEER_CONNECTION_ERROR);
       goto out;
     }
 
-    app_state = PEER_CONNECTED;
+    call->app_state = PEER_CONNECTED;
     /* Start negotiation (exchange SDP and ICE candidates) */
-    if (!start_pipeline(TRUE, RTP_OPUS_DEFAULT_PT, RTP_VP8_DEFAULT_PT))
-      cleanup_and_quit_loop("ERROR: failed to start pipeline", PEER_CALL_ERROR);
+    if (!start_pipeline(call, TRUE, RTP_OPUS_DEFAULT_PT, RTP_VP8_DEFAULT_PT))
+      call_end(call, "ERROR: failed to start pipeline", PEER_CALL_ERROR);
   } else if (g_strcmp0(text, "OFFER_REQUEST") == 0) {
-    if (app_state != SERVER_REGISTERED) {
+    if (call->app_state != SERVER_REGISTERED) {
       gst_printerr("Received OFFER_REQUEST at a strange time, ignoring\n");
       goto out;
     }
-    gst_print("Received OFFER_REQUEST, sending offer\n");
+    gst_print("Call %u: received OFFER_REQUEST, sending offer\n", call->index);
     /* Peer wants us to start negotiation (exchange SDP and ICE candidates) */
-    if (!start_pipeline(TRUE, RTP_OPUS_DEFAULT_PT, RTP_VP8_DEFAULT_PT))
-      cleanup_and_quit_loop("ERROR: failed to start pipeline", PEER_CALL_ERROR);
+    if (!start_pipeline(call, TRUE, RTP_OPUS_DEFAULT_PT, RTP_VP8_DEFAULT_PT))
+      call_end(call, "ERROR: failed to start pipeline", PEER_CALL_ERROR);
   } else if (g_str_has_prefix(text, "ERROR")) {
+    enum AppState state;
+
     /* Handle errors */
-    switch (app_state) {
+    switch (call->app_state) {
     case SERVER_CONNECTING:
-      app_state = SERVER_CONNECTION_ERROR;
+      state = SERVER_CONNECTION_ERROR;
       break;
     case SERVER_REGISTERING:
-      app_state = SERVER_REGISTRATION_ERROR;
+      state = SERVER_REGISTRATION_ERROR;
       break;
     case PEER_CONNECTING:
-      app_state = PEER_CONNECTION_ERROR;
+      state = PEER_CONNECTION_ERROR;
       break;
     case PEER_CONNECTED:
     case PEER_CALL_NEGOTIATING:
-      app_state = PEER_CALL_ERROR;
+      state = PEER_CALL_ERROR;
       break;
     default:
-      app_state = APP_STATE_ERROR;
+      state = APP_STATE_ERROR;
     }
-    cleanup_and_quit_loop(text, 0);
+    call_end(call, text, state);
   } else {
     /* Look for JSON messages containing SDP and ICE candidates */
     JsonNode *root;
@@ -779,12 +1105,13 @@ static void on_server_message(SoupWebsocketConnection *conn, SoupWebsocketDataTy
       const gchar *text, *sdptype;
       GstWebRTCSessionDescription *answer;
 
-      app_state = PEER_CALL_NEGOTIATING;
+      call->app_state = PEER_CALL_NEGOTIATING;
 
       child = json_object_get_object_member(object, "sdp");
 
       if (!json_object_has_member(child, "type")) {
-        cleanup_and_quit_loop("ERROR: received SDP without 'type'", PEER_CALL_ERROR);
+        call_end(call, "ERROR: received SDP without 'type'", PEER_CALL_ERROR);
+        g_object_unref(parser);
         goto out;
       }
 
@@ -799,36 +1126,48 @@ static void on_server_message(SoupWebsocketConnection *conn, SoupWebsocketDataTy
       ret = gst_sdp_message_new(&sdp);
       g_assert_cmphex(ret, ==, GST_SDP_OK);
       ret = gst_sdp_message_parse_buffer((guint8 *)text, strlen(text), sdp);
-      g_assert_cmphex(ret, ==, GST_SDP_OK);
+      if (ret != GST_SDP_OK) {
+        gst_sdp_message_free(sdp);
+        call_end(call, "ERROR: could not parse the SDP", PEER_CALL_ERROR);
+        g_object_unref(parser);
+        goto out;
+      }
 
       if (g_str_equal(sdptype, "answer")) {
-        gst_print("Received answer:\n%s\n", text);
+        if (n_calls == 1)
+          gst_print("Received answer:\n%s\n", text);
+        if (call->webrtcbin == NULL) {
+          gst_sdp_message_free(sdp);
+          call_end(call, "ERROR: received an answer without an offer", PEER_CALL_ERROR);
+          g_object_unref(parser);
+          goto out;
+        }
         answer = gst_webrtc_session_description_new(GST_WEBRTC_SDP_TYPE_ANSWER, sdp);
         g_assert_nonnull(answer);
 
         /* Set remote description on our pipeline */
-        {
-          GstPromise *promise = gst_promise_new();
-          g_signal_emit_by_name(webrtc1, "set-remote-description", answer, promise);
-          gst_promise_interrupt(promise);
-          gst_promise_unref(promise);
-        }
-        app_state = PEER_CALL_STARTED;
+        set_remote_description(call, answer);
+        gst_webrtc_session_description_free(answer);
+        call->app_state = PEER_CALL_STARTED;
       } else {
-        gst_print("Received offer:\n%s\n", text);
-        on_offer_received(sdp);
+        if (n_calls == 1)
+          gst_print("Received offer:\n%s\n", text);
+        on_offer_received(call, sdp);
       }
 
     } else if (json_object_has_member(object, "ice")) {
-      const gchar *candidate;
-      gint sdpmlineindex;
+      JsonNode *ice = json_object_get_member(object, "ice");
 
-      child = json_object_get_object_member(object, "ice");
-      candidate = json_object_get_string_member(child, "candidate");
-      sdpmlineindex = json_object_get_int_member(child, "sdpMLineIndex");
+      /* A single candidate, or a batch of them */
+      if (JSON_NODE_HOLDS_ARRAY(ice)) {
+        JsonArray *candidates = json_node_get_array(ice);
+        guint i;
 
-      /* Add ice candidate sent by remote peer */
-      g_signal_emit_by_name(webrtc1, "add-ice-candidate", sdpmlineindex, candidate);
+        for (i = 0; i < json_array_get_length(candidates); i++)
+          add_remote_candidate(call, json_array_get_object_element(candidates, i));
+      } else if (JSON_NODE_HOLDS_OBJECT(ice)) {
+        add_remote_candidate(call, json_node_get_object(ice));
+      }
     } else {
       gst_printerr("Ignoring unknown JSON message:\n%s\n", text);
     }
@@ -839,54 +1178,116 @@ out:
   g_free(text);
 }
 
-static void on_server_connected(SoupSession *session, GAsyncResult *res, SoupMessage *msg) {
+static void on_server_connected(SoupSession *session, GAsyncResult *res, gpointer user_data) {
+  Call *call = (Call *)user_data;
   GError *error = NULL;
 
-  ws_conn = soup_session_websocket_connect_finish(session, res, &error);
+  call->ws_conn = soup_session_websocket_connect_finish(session, res, &error);
+  if (call->ended) {
+    /* Stopped while connecting */
+    g_clear_object(&call->ws_conn);
+    g_clear_error(&error);
+    call_unref(call);
+    return;
+  }
   if (error) {
-    cleanup_and_quit_loop(error->message, SERVER_CONNECTION_ERROR);
+    call_end(call, error->message, SERVER_CONNECTION_ERROR);
     g_error_free(error);
+    call_unref(call);
     return;
   }
 
-  g_assert_nonnull(ws_conn);
+  g_assert_nonnull(call->ws_conn);
 
-  app_state = SERVER_CONNECTED;
-  gst_print("Connected to signaling server\n");
+  call->app_state = SERVER_CONNECTED;
+  gst_print("Call %u: connected to signaling server\n", call->index);
 
-  g_signal_connect(ws_conn, "closed", G_CALLBACK(on_server_closed), NULL);
-  g_signal_connect(ws_conn, "message", G_CALLBACK(on_server_message), NULL);
+  g_signal_connect(call->ws_conn, "closed", G_CALLBACK(on_server_closed), call);
+  g_signal_connect(call->ws_conn, "message", G_CALLBACK(on_server_message), call);
 
   /* Register with the server so it knows about us and can accept commands */
-  register_with_server();
+  register_with_server(call);
+  call_unref(call);
 }
 
 /*
  * Connect to the signaling server. This is the entrypoint for everything else.
  */
-static void connect_to_websocket_server_async(void) {
-  SoupLogger *logger;
+static void connect_to_websocket_server_async(Call *call) {
   SoupMessage *message;
+
+  message = soup_message_new(SOUP_METHOD_GET, server_url);
+
+  gst_print("Call %u: connecting to server...\n", call->index);
+
+  /* Once connected, we will register */
+  soup_session_websocket_connect_async(session, message, NULL, NULL, NULL, (GAsyncReadyCallback)on_server_connected, call_ref(call));
+  g_object_unref(message);
+  call->app_state = SERVER_CONNECTING;
+}
+
+/* One id per call, so a peer can reach any of them */
+static gchar *get_call_id(const gchar *id, guint index) {
+  if (id == NULL)
+    return NULL;
+  if (n_calls == 1)
+    return g_strdup(id);
+  return g_strdup_printf("%s-%u", id, index);
+}
+
+static void call_start(guint index) {
+  Call *call;
+
+  call = g_new0(Call, 1);
+  call->ref_count = 1;
+  call->index = index;
+  call->peer_id = get_call_id(peer_id, index);
+  call->our_id = get_call_id(our_id, index);
+  g_queue_init(&call->pending_candidates);
+
+  /* The slot holds the initial reference */
+  g_ptr_array_index(calls, index) = call;
+  connect_to_websocket_server_async(call);
+}
+
+static SoupSession *create_session(void) {
   SoupSession *session;
   const char *https_aliases[] = {"wss", NULL};
 
   session = soup_session_new_with_options( //
       SOUP_SESSION_SSL_STRICT, !disable_ssl, SOUP_SESSION_SSL_USE_SYSTEM_CA_FILE, TRUE,
       // SOUP_SESSION_SSL_CA_FILE, "/etc/ssl/certs/ca-bundle.crt",
-      SOUP_SESSION_HTTPS_ALIASES, https_aliases, NULL);
+      SOUP_SESSION_HTTPS_ALIASES, https_aliases,
+      /* Every call holds a connection to the same server */
+      SOUP_SESSION_MAX_CONNS, MAX(n_calls, 10), SOUP_SESSION_MAX_CONNS_PER_HOST, MAX(n_calls, 2), NULL);
+
+  /* Logging every message body of many calls would dwarf the calls */
+  if (n_calls == 1) {
+    SoupLogger *logger = soup_logger_new(SOUP_LOGGER_LOG_BODY, -1);
+    soup_session_add_feature(session, SOUP_SESSION_FEATURE(logger));
+    g_object_unref(logger);
+  }
 
-  logger = soup_logger_new(SOUP_LOGGER_LOG_BODY, -1);
-  soup_session_add_feature(session, SOUP_SESSION_FEATURE(logger));
-  g_object_unref(logger);
+  return session;
+}
 
-  message = soup_message_new(SOUP_METHOD_GET, server_url);
+#ifdef G_OS_UNIX
+static gboolean exit_sighandler(G_GNUC_UNUSED gpointer user_data) {
+  guint i;
 
-  gst_print("Connecting to server...\n");
+  gst_print("Caught signal, ending calls\n");
+  stopping = TRUE;
+  for (i = 0; i < calls->len; i++) {
+    Call *call = g_ptr_array_index(calls, i);
 
-  /* Once connected, we will register */
-  soup_session_websocket_connect_async(session, message, NULL, NULL, NULL, (GAsyncReadyCallback)on_server_connected, message);
-  app_state = SERVER_CONNECTING;
+    if (call != NULL)
+      call_end(call, NULL, 0);
+  }
+  /* With every slot waiting for its restart, there was nothing to end */
+  g_main_loop_quit(loop);
+  return G_SOURCE_REMOVE;
 }
+#endif
 
 static gboolean check_plugins(void) {
   int i;
@@ -913,6 +1314,8 @@ int gst_main(int argc, char *argv[]) {
   GOptionContext *context;
   GError *error = NULL;
   int ret_code = -1;
+  SoupServer *metrics_server = NULL;
+  guint i;
 
   context = g_option_context_new("- gstreamer webrtc sendrecv demo");
   g_option_context_add_main_entries(context, entries, NULL);
@@ -938,6 +1341,11 @@ int gst_main(int argc, char *argv[]) {
     goto out;
   }
 
+  if (n_calls <= 0) {
+    gst_printerr("--calls must be positive\n");
+    goto out;
+  }
+
   ret_code = 0;
 
   /* Disable ssl when running a localhost server, because
@@ -949,29 +1357,92 @@ int gst_main(int argc, char *argv[]) {
     gst_uri_unref(uri);
   }
 
-  loop = g_main_loop_new(NULL, FALSE);
+  if (impair_settings != NULL && impair_script != NULL) {
+    gst_printerr("specify only --impair or --impair-script\n");
+    ret_code = -1;
+    goto out;
+  }
+  if (impair_settings != NULL || impair_script != NULL) {
+    if (g_strcmp0(impair_direction, "send") == 0) {
+      impair_directions = IMPAIR_SEND;
+    } else if (g_strcmp0(impair_direction, "receive") == 0) {
+      impair_directions = IMPAIR_RECEIVE;
+    } else if (impair_direction != NULL && g_strcmp0(impair_direction, "both") != 0) {
+      gst_printerr("--impair-direction must be send, receive or both\n");
+      ret_code = -1;
+      goto out;
+    }
 
-  connect_to_websocket_server_async();
+    if (impair_settings != NULL)
+      impair_scenario = impair_scenario_new(impair_settings, impair_seed, &error);
+    else
+      impair_scenario = impair_scenario_new_from_file(impair_script, impair_seed, &error);
+    if (impair_scenario == NULL) {
+      gst_printerr("Invalid impairment: %s\n", error->message);
+      g_clear_error(&error);
+      ret_code = -1;
+      goto out;
+    }
+  }
 
-  g_main_loop_run(loop);
+  if (udp_mux_port > 0) {
+    if (ice_hosts == NULL) {
+      gst_printerr("--udp-mux-port needs --ice-host\n");
+      ret_code = -1;
+      goto out;
+    }
+    udp_mux = udp_mux_new(NULL, udp_mux_port, MAX(udp_mux_sockets, 1), &error);
+    if (udp_mux == NULL) {
+      gst_printerr("Could not open the UDP mux port: %s\n", error->message);
+      g_clear_error(&error);
+      ret_code = -1;
+      goto out;
+    }
+  }
 
-  if (loop)
-    g_main_loop_unref(loop);
+  loop = g_main_loop_new(NULL, FALSE);
 
-  if (pipe1) {
-    GstBus *bus;
+#ifdef G_OS_UNIX
+  g_unix_signal_add(SIGINT, exit_sighandler, NULL);
+  g_unix_signal_add(SIGTERM, exit_sighandler, NULL);
+#endif
+
+  if (metrics_port > 0) {
+    metrics_server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "webrtc-sendrecv", NULL);
+    soup_server_add_handler(metrics_server, "/metrics", stats_metrics_handler, NULL, NULL);
+    if (!soup_server_listen_all(metrics_server, metrics_port, (SoupServerListenOptions)0, &error)) {
+      gst_printerr("Could not serve metrics: %s\n", error->message);
+      g_clear_error(&error);
+    }
+  }
 
-    gst_element_set_state(GST_ELEMENT(pipe1), GST_STATE_NULL);
-    gst_print("Pipeline stopped\n");
+  session = create_session();
+  calls = g_ptr_array_new();
+  g_ptr_array_set_size(calls, n_calls);
+  for (i = 0; i < (guint)n_calls; i++)
+    call_start(i);
 
-    bus = gst_pipeline_get_bus(GST_PIPELINE(pipe1));
-    gst_bus_remove_watch(bus);
-    gst_object_unref(bus);
+  g_main_loop_run(loop);
+
+  stopping = TRUE;
+  for (i = 0; i < calls->len; i++) {
+    Call *call = g_ptr_array_index(calls, i);
 
-    gst_object_unref(pipe1);
+    if (call != NULL)
+      call_end(call, NULL, 0);
   }
+  g_ptr_array_unref(calls);
+  g_object_unref(session);
+  g_main_loop_unref(loop);
+
+  if (metrics_server)
+    g_object_unref(metrics_server);
+  if (udp_mux != NULL)
+    udp_mux_free(udp_mux);
 
 out:
+  if (impair_scenario != NULL)
+    impair_scenario_unref(impair_scenario);
   g_free(peer_id);
   g_free(our_id);
 
@@ -0,0 +1,180 @@
+#include "webrtc-shard.h"
+
+#ifdef G_OS_UNIX
+#include <netinet/in.h>
+#include <sys/socket.h>
+#endif
+
+struct _SessionShard {
+  guint port;
+  SessionShardSetupFunc setup;
+  gpointer user_data;
+
+  GThread *thread;
+  GMainContext *context;
+  GMainLoop *loop;
+  SoupServer *soup_server;
+
+  /* Startup handshake with session_shards_start() */
+  GMutex lock;
+  GCond cond;
+  gboolean started;
+  GError *error;
+};
+
+static GSocket *create_listen_socket(GSocketFamily family, guint port, GError **error) {
+  GSocket *socket;
+  GInetAddress *any;
+  GSocketAddress *address;
+  gboolean ret;
+
+  socket = g_socket_new(family, G_SOCKET_TYPE_STREAM, G_SOCKET_PROTOCOL_TCP, error);
+  if (socket == NULL)
+    return NULL;
+
+#ifdef IPV6_V6ONLY
+  /* The IPv4 socket on the same port takes the rest */
+  if (family == G_SOCKET_FAMILY_IPV6 && !g_socket_set_option(socket, IPPROTO_IPV6, IPV6_V6ONLY, 1, error)) {
+    g_object_unref(socket);
+    return NULL;
+  }
+#endif
+
+#ifdef SO_REUSEPORT
+  if (!g_socket_set_option(socket, SOL_SOCKET, SO_REUSEPORT, 1, error)) {
+    g_object_unref(socket);
+    return NULL;
+  }
+#endif
+
+  /* GLib defaults to a backlog of 10, far too short when a burst of peers
+   * connects at once */
+  g_socket_set_listen_backlog(socket, SOMAXCONN);
+
+  any = g_inet_address_new_any(family);
+  address = g_inet_socket_address_new(any, port);
+  ret = g_socket_bind(socket, address, TRUE, error) && g_socket_listen(socket, error);
+  g_object_unref(address);
+  g_object_unref(any);
+
+  if (!ret) {
+    g_object_unref(socket);
+    return NULL;
+  }
+  return socket;
+}
+
+static gpointer session_shard_thread(gpointer user_data) {
+  SessionShard *shard = (SessionShard *)user_data;
+  GSocket *socket;
+  GError *error = NULL;
+  GError *ipv6_error = NULL;
+
+  /* Everything created from here on, the listener, accepted websockets and
+   * the bus watches of new sessions, attaches to the shard context */
+  g_main_context_push_thread_default(shard->context);
+
+  shard->soup_server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "webrtc-soup-server", NULL);
+  shard->setup(shard->soup_server, shard->user_data);
+
+  socket = create_listen_socket(G_SOCKET_FAMILY_IPV4, shard->port, &error);
+  if (socket != NULL) {
+    soup_server_listen_socket(shard->soup_server, socket, (SoupServerListenOptions)0, &error);
+    g_object_unref(socket);
+  }
+
+  /* Both families as soup_server_listen_all() does, IPv6 only where the
+   * host has it */
+  if (error == NULL) {
+    socket = create_listen_socket(G_SOCKET_FAMILY_IPV6, shard->port, &ipv6_error);
+    if (socket != NULL) {
+      soup_server_listen_socket(shard->soup_server, socket, (SoupServerListenOptions)0, &error);
+      g_object_unref(socket);
+    } else if (g_error_matches(ipv6_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED)) {
+      g_clear_error(&ipv6_error);
+    } else {
+      error = ipv6_error;
+    }
+  }
+
+  g_mutex_lock(&shard->lock);
+  shard->error = error;
+  shard->started = TRUE;
+  g_cond_signal(&shard->cond);
+  g_mutex_unlock(&shard->lock);
+
+  if (error == NULL)
+    g_main_loop_run(shard->loop);
+
+  g_clear_object(&shard->soup_server);
+  g_main_context_pop_thread_default(shard->context);
+
+  return NULL;
+}
+
+static gboolean session_shard_quit(gpointer user_data) {
+  SessionShard *shard = (SessionShard *)user_data;
+  g_main_loop_quit(shard->loop);
+  return G_SOURCE_REMOVE;
+}
+
+static void session_shard_free(gpointer shard_ptr) {
+  SessionShard *shard = (SessionShard *)shard_ptr;
+
+  if (shard->thread != NULL) {
+    g_main_context_invoke(shard->context, session_shard_quit, shard);
+    g_thread_join(shard->thread);
+  }
+
+  g_clear_error(&shard->error);
+  g_main_loop_unref(shard->loop);
+  g_main_context_unref(shard->context);
+  g_mutex_clear(&shard->lock);
+  g_cond_clear(&shard->cond);
+  g_free(shard);
+}
+
+GPtrArray *session_shards_start(guint n_shards, guint port, SessionShardSetupFunc setup, gpointer user_data, GError **error) {
+  GPtrArray *shards;
+  guint i;
+
+  shards = g_ptr_array_new_with_free_func(session_shard_free);
+
+  for (i = 0; i < n_shards; i++) {
+    SessionShard *shard;
+    gchar *name;
+
+    shard = g_new0(SessionShard, 1);
+    shard->port = port;
+    shard->setup = setup;
+    shard->user_data = user_data;
+    shard->context = g_main_context_new();
+    shard->loop = g_main_loop_new(shard->context, FALSE);
+    g_mutex_init(&shard->lock);
+    g_cond_init(&shard->cond);
+    g_ptr_array_add(shards, shard);
+
+    name = g_strdup_printf("shard-%u", i);
+    shard->thread = g_thread_new(name, session_shard_thread, shard);
+    g_free(name);
+
+    g_mutex_lock(&shard->lock);
+    while (!shard->started)
+      g_cond_wait(&shard->cond, &shard->lock);
+    g_mutex_unlock(&shard->lock);
+
+    if (shard->error != NULL) {
+      g_propagate_error(error, shard->error);
+      shard->error = NULL;
+      g_ptr_array_unref(shards);
+      return NULL;
+    }
+  }
+
+  g_print("Serving sessions from %u shards\n", n_shards);
+  return shards;
+}
+
+void session_shards_stop(GPtrArray *shards) {
+  g_ptr_array_unref(shards);
+}
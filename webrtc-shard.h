@@ -0,0 +1,25 @@
+#ifndef __WEBRTC_SHARD_H__
+#define __WEBRTC_SHARD_H__
+
+#include <glib.h>
+#include <libsoup/soup.h>
+
+G_BEGIN_DECLS
+
+typedef struct _SessionShard SessionShard;
+
+/* Adds the HTTP and websocket handlers, called once per shard from the shard
+ * thread */
+typedef void (*SessionShardSetupFunc)(SoupServer *soup_server, gpointer user_data);
+
+/* Starts @n_shards worker threads, each running its own GMainContext and its
+ * own SoupServer on @port over IPv4 and IPv6. The kernel spreads incoming connections over the
+ * shards through SO_REUSEPORT, and every session then lives entirely on the
+ * shard that accepted it */
+GPtrArray *session_shards_start(guint n_shards, guint port, SessionShardSetupFunc setup, gpointer user_data, GError **error);
+
+void session_shards_stop(GPtrArray *shards);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_SHARD_H__ */
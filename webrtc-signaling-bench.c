@@ -0,0 +1,201 @@
+/*
+ * Microbenchmark of the signaling codec against the json-glib code path it
+ * replaced: parsing the answer and candidates a viewer sends, and
+ * serializing the offer it gets.
+ */
+#include <glib.h>
+#include <json-glib/json-glib.h>
+#include <string.h>
+
+#include "webrtc-signaling.h"
+
+#define SDP_LINE(line) line "\\r\\n"
+
+/* A browser answer to the unidirectional offer, as it arrives */
+static const gchar answer_message[] = "{\"type\":\"sdp\",\"data\":{\"type\":\"answer\",\"sdp\":\"" //
+    SDP_LINE("v=0")                                                                          //
+    SDP_LINE("o=- 4611731400430051336 2 IN IP4 127.0.0.1")                                   //
+    SDP_LINE("s=-")                                                                          //
+    SDP_LINE("t=0 0")                                                                        //
+    SDP_LINE("a=group:BUNDLE video0 audio1")                                                 //
+    SDP_LINE("a=extmap-allow-mixed")                                                         //
+    SDP_LINE("a=msid-semantic: WMS")                                                         //
+    SDP_LINE("m=video 9 UDP/TLS/RTP/SAVPF 96")                                               //
+    SDP_LINE("c=IN IP4 0.0.0.0")                                                             //
+    SDP_LINE("a=rtcp:9 IN IP4 0.0.0.0")                                                      //
+    SDP_LINE("a=ice-ufrag:8hhY")                                                             //
+    SDP_LINE("a=ice-pwd:asd88fgpdd777uzjYhagZg")                                             //
+    SDP_LINE("a=ice-options:trickle")                                                        //
+    SDP_LINE("a=fingerprint:sha-256 D2:FA:0E:C3:22:59:5E:14:95:69:92:3D:13:B4:84:24:2C:C2:A2:C0:3E:FD:34:8E:5E:EA:6F:AF:52:CE:E6:0F") //
+    SDP_LINE("a=setup:active")                                                               //
+    SDP_LINE("a=mid:video0")                                                                 //
+    SDP_LINE("a=recvonly")                                                                   //
+    SDP_LINE("a=rtcp-mux")                                                                   //
+    SDP_LINE("a=rtcp-rsize")                                                                 //
+    SDP_LINE("a=rtpmap:96 H264/90000")                                                       //
+    SDP_LINE("a=rtcp-fb:96 goog-remb")                                                       //
+    SDP_LINE("a=rtcp-fb:96 transport-cc")                                                    //
+    SDP_LINE("a=rtcp-fb:96 ccm fir")                                                         //
+    SDP_LINE("a=rtcp-fb:96 nack")                                                            //
+    SDP_LINE("a=rtcp-fb:96 nack pli")                                                        //
+    SDP_LINE("a=fmtp:96 level-asymmetry-allowed=1;packetization-mode=1;profile-level-id=42e01f") //
+    SDP_LINE("m=audio 9 UDP/TLS/RTP/SAVPF 97")                                               //
+    SDP_LINE("c=IN IP4 0.0.0.0")                                                             //
+    SDP_LINE("a=rtcp:9 IN IP4 0.0.0.0")                                                      //
+    SDP_LINE("a=ice-ufrag:8hhY")                                                             //
+    SDP_LINE("a=ice-pwd:asd88fgpdd777uzjYhagZg")                                             //
+    SDP_LINE("a=ice-options:trickle")                                                        //
+    SDP_LINE("a=fingerprint:sha-256 D2:FA:0E:C3:22:59:5E:14:95:69:92:3D:13:B4:84:24:2C:C2:A2:C0:3E:FD:34:8E:5E:EA:6F:AF:52:CE:E6:0F") //
+    SDP_LINE("a=setup:active")                                                               //
+    SDP_LINE("a=mid:audio1")                                                                 //
+    SDP_LINE("a=recvonly")                                                                   //
+    SDP_LINE("a=rtcp-mux")                                                                   //
+    SDP_LINE("a=rtpmap:97 OPUS/48000/2")                                                     //
+    SDP_LINE("a=fmtp:97 minptime=10;useinbandfec=1")                                         //
+    "\"}}";
+
+static const gchar candidate_message[] = "{\"type\":\"ice\",\"data\":{\"candidate\":\"candidate:842163049 1 udp 1677729535 203.0.113.7 51234 typ srflx "
+                                         "raddr 192.168.1.20 rport 51234 generation 0 ufrag 8hhY network-cost 999\",\"sdpMid\":\"video0\","
+                                         "\"sdpMLineIndex\":0,\"usernameFragment\":\"8hhY\"}}";
+
+static gint iterations = 100000;
+
+static GOptionEntry entries[] = {
+    {"iterations", 0, 0, G_OPTION_ARG_INT, &iterations, "Messages per measurement", "N"},
+    {NULL},
+};
+
+/* Keeps the compiler from dropping the work */
+static volatile gsize sink;
+
+typedef void (*BenchFunc)(const gchar *message, gsize size, GString *buffer);
+
+/* The per message work soup_websocket_message_cb used to do */
+static void parse_json_glib(const gchar *message, gsize size, G_GNUC_UNUSED GString *buffer) {
+  gchar *data_string;
+  JsonParser *json_parser;
+  JsonObject *root_json_object, *data_json_object;
+  const gchar *type_string;
+
+  data_string = g_strndup(message, size);
+  json_parser = json_parser_new();
+  if (json_parser_load_from_data(json_parser, data_string, -1, NULL)) {
+    root_json_object = json_node_get_object(json_parser_get_root(json_parser));
+    if (json_object_has_member(root_json_object, "type") && json_object_has_member(root_json_object, "data")) {
+      type_string = json_object_get_string_member(root_json_object, "type");
+      data_json_object = json_object_get_object_member(root_json_object, "data");
+      if (g_strcmp0(type_string, "sdp") == 0 && json_object_has_member(data_json_object, "type") && json_object_has_member(data_json_object, "sdp"))
+        sink += strlen(json_object_get_string_member(data_json_object, "sdp"));
+      else if (json_object_has_member(data_json_object, "sdpMLineIndex") && json_object_has_member(data_json_object, "candidate"))
+        sink += strlen(json_object_get_string_member(data_json_object, "candidate")) + json_object_get_int_member(data_json_object, "sdpMLineIndex");
+    }
+  }
+  g_object_unref(json_parser);
+  g_free(data_string);
+}
+
+static void parse_codec(const gchar *message, gsize size, GString *buffer) {
+  SignalingMessage signaling_message;
+
+  if (!signaling_message_parse(message, size, &signaling_message))
+    return;
+
+  if (signaling_message.type == SIGNALING_MESSAGE_SDP && signaling_message.has_sdp_type && signaling_message.has_sdp) {
+    signaling_string_unescape(&signaling_message.sdp, buffer);
+    sink += buffer->len;
+  } else if (signaling_message.type == SIGNALING_MESSAGE_ICE && signaling_message.n_candidates > 0) {
+    signaling_string_unescape(&signaling_message.candidates[0].candidate, buffer);
+    sink += buffer->len + signaling_message.candidates[0].mline_index;
+  }
+}
+
+/* What send_offer used to do */
+static void write_json_glib(const gchar *sdp, G_GNUC_UNUSED gsize size, G_GNUC_UNUSED GString *buffer) {
+  JsonObject *sdp_json, *sdp_data_json;
+  JsonNode *root;
+  JsonGenerator *generator;
+  gchar *text;
+
+  sdp_json = json_object_new();
+  json_object_set_string_member(sdp_json, "type", "sdp");
+  sdp_data_json = json_object_new();
+  json_object_set_string_member(sdp_data_json, "type", "offer");
+  json_object_set_string_member(sdp_data_json, "sdp", sdp);
+  json_object_set_object_member(sdp_json, "data", sdp_data_json);
+
+  root = json_node_init_object(json_node_alloc(), sdp_json);
+  generator = json_generator_new();
+  json_generator_set_root(generator, root);
+  text = json_generator_to_data(generator, NULL);
+  sink += strlen(text);
+
+  g_object_unref(generator);
+  json_node_free(root);
+  json_object_unref(sdp_json);
+  g_free(text);
+}
+
+static void write_codec(const gchar *sdp, G_GNUC_UNUSED gsize size, GString *buffer) {
+  signaling_write_sdp(buffer, "offer", sdp);
+  sink += buffer->len;
+}
+
+static gdouble run(BenchFunc func, const gchar *message, gsize size) {
+  GString *buffer;
+  gint64 start;
+  gint i;
+
+  buffer = g_string_sized_new(8192);
+
+  /* Warm up caches, the allocator and the reused buffer */
+  for (i = 0; i < MAX(iterations / 10, 1); i++)
+    func(message, size, buffer);
+
+  start = g_get_monotonic_time();
+  for (i = 0; i < iterations; i++)
+    func(message, size, buffer);
+
+  g_string_free(buffer, TRUE);
+  return (gdouble)(g_get_monotonic_time() - start) / iterations;
+}
+
+static void compare(const gchar *name, BenchFunc json_glib, BenchFunc codec, const gchar *message, gsize size) {
+  gdouble json_glib_us, codec_us;
+
+  json_glib_us = run(json_glib, message, size);
+  codec_us = run(codec, message, size);
+
+  g_print("%-16s %6" G_GSIZE_FORMAT " bytes  json-glib %8.2f us %10.0f msg/s  codec %8.2f us %10.0f msg/s  %5.1fx\n", name, size, //
+          json_glib_us, 1e6 / json_glib_us, codec_us, 1e6 / codec_us, json_glib_us / codec_us);
+}
+
+int main(int argc, char *argv[]) {
+  GOptionContext *context;
+  GError *error = NULL;
+  SignalingMessage signaling_message;
+  GString *sdp;
+
+  context = g_option_context_new("- signaling codec benchmark");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Error initializing: %s\n", error->message);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  /* The offer going out is the SDP of the answer coming in, unescaped */
+  sdp = g_string_new(NULL);
+  if (!signaling_message_parse(answer_message, strlen(answer_message), &signaling_message) || signaling_message.type != SIGNALING_MESSAGE_SDP) {
+    g_printerr("Sample answer doesn't parse\n");
+    return -1;
+  }
+  signaling_string_unescape(&signaling_message.sdp, sdp);
+
+  g_print("%d iterations each\n", iterations);
+  compare("parse answer", parse_json_glib, parse_codec, answer_message, strlen(answer_message));
+  compare("parse candidate", parse_json_glib, parse_codec, candidate_message, strlen(candidate_message));
+  compare("write offer", write_json_glib, write_codec, sdp->str, sdp->len);
+
+  g_string_free(sdp, TRUE);
+  return 0;
+}
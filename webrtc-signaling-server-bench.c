@@ -0,0 +1,574 @@
+/*
+ * Load generator for webrtc-signaling-server: registers N peers over
+ * loopback, pairs them up into sessions and has every pair bounce
+ * candidate-sized messages off the server, reporting how long registration
+ * took, what every peer costs the server and the relay rate it sustains.
+ *
+ * Works against signaling/server.py too, with --server= and --url.
+ */
+#include <glib.h>
+#include <libsoup/soup.h>
+#include <string.h>
+
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#include <signal.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#define SIGNALING_PORT 8443
+#define SERVER_START_TIMEOUT_SECONDS 10
+#define PHASE_TIMEOUT_SECONDS 120
+/* Handshakes in flight per worker, enough to keep the server busy without
+ * overflowing its accept queue */
+#define CONNECT_WINDOW 64
+/* Every RTT_SAMPLE_INTERVAL-th round trip goes into the percentiles */
+#define RTT_SAMPLE_INTERVAL 16
+
+typedef struct _BenchWorker BenchWorker;
+typedef struct _BenchPeer BenchPeer;
+
+struct _BenchPeer {
+  BenchWorker *worker;
+  guint index;
+  SoupWebsocketConnection *connection;
+  gboolean registered;
+};
+
+/* A thread with its own context, session and slice of the peers. Partners
+ * always live on the same worker */
+struct _BenchWorker {
+  GThread *thread;
+  GMainContext *context;
+  GMainLoop *loop;
+  SoupSession *session;
+  GPtrArray *peers;
+  guint next_connect;
+
+  guint n_round_trips;
+  GArray *rtts; /* gdouble, ms */
+};
+
+typedef struct _ProcessUsage {
+  gdouble cpu_seconds;
+  gdouble rss_mib;
+} ProcessUsage;
+
+static gchar *server_path = "./webrtc-signaling-server";
+static gchar *server_args = NULL;
+static gchar *server_url = NULL;
+static gint n_peers = 20000;
+static gint n_workers = 4;
+static gint window = 1;
+static gint warmup_seconds = 2;
+static gint duration_seconds = 10;
+
+static GOptionEntry entries[] = {
+    {"server", 0, 0, G_OPTION_ARG_FILENAME, &server_path, "Server binary to start, empty to use an already running server", "PATH"},
+    {"server-args", 0, 0, G_OPTION_ARG_STRING, &server_args, "Extra arguments for the server, e.g. \"--shards=4\"", "ARGS"},
+    {"url", 0, 0, G_OPTION_ARG_STRING, &server_url, "Websocket URL of the server (default: ws://127.0.0.1:8443/)", "URL"},
+    {"peers", 0, 0, G_OPTION_ARG_INT, &n_peers, "Number of peers to register, paired up into sessions", "N"},
+    {"workers", 0, 0, G_OPTION_ARG_INT, &n_workers, "Client threads the peers are spread over", "N"},
+    {"window", 0, 0, G_OPTION_ARG_INT, &window, "Messages every session keeps in flight", "N"},
+    {"warmup", 0, 0, G_OPTION_ARG_INT, &warmup_seconds, "Seconds of relaying before measuring", "SECONDS"},
+    {"duration", 0, 0, G_OPTION_ARG_INT, &duration_seconds, "Seconds to measure", "SECONDS"},
+    {NULL},
+};
+
+static GPtrArray *workers = NULL;
+static GPid server_pid = 0;
+
+static gint n_connected = 0;
+static gint n_registered = 0;
+static gint n_paired = 0;
+static gint n_failed = 0;
+/* Registered or failed */
+static gint n_settled = 0;
+static gint n_relayed = 0;
+static gint measuring = FALSE;
+static gint interrupted = FALSE;
+
+static void send_ping(BenchPeer *caller) {
+  gchar *text;
+
+  /* About the size of a batched trickle message */
+  text = g_strdup_printf("{\"ice\":[{\"candidate\":\"candidate:842163049 1 udp 1677729535 203.0.113.7 51234 typ srflx raddr 192.168.1.20 rport 51234 "
+                         "generation 0 ufrag 8hhY network-cost 999\",\"sdpMLineIndex\":0}],\"t\":%" G_GINT64_FORMAT "}",
+                         g_get_monotonic_time());
+  soup_websocket_connection_send_text(caller->connection, text);
+  g_free(text);
+}
+
+static void on_relayed(BenchPeer *peer, const gchar *text) {
+  BenchWorker *worker = peer->worker;
+  const gchar *timestamp;
+
+  g_atomic_int_inc(&n_relayed);
+
+  /* Callees bounce every message back, callers time it and send the next */
+  if (peer->index % 2 == 1) {
+    soup_websocket_connection_send_text(peer->connection, text);
+    return;
+  }
+
+  timestamp = strstr(text, "\"t\":");
+  if (timestamp != NULL && g_atomic_int_get(&measuring) && worker->n_round_trips++ % RTT_SAMPLE_INTERVAL == 0) {
+    gdouble rtt = (gdouble)(g_get_monotonic_time() - g_ascii_strtoll(timestamp + 4, NULL, 10)) / 1000.0;
+    g_array_append_val(worker->rtts, rtt);
+  }
+  send_ping(peer);
+}
+
+static void connect_next_peer(BenchWorker *worker);
+
+static void on_message(G_GNUC_UNUSED SoupWebsocketConnection *connection, SoupWebsocketDataType data_type, GBytes *message, gpointer user_data) {
+  BenchPeer *peer = (BenchPeer *)user_data;
+  gchar *text;
+
+  if (data_type != SOUP_WEBSOCKET_DATA_TEXT)
+    return;
+  text = g_strndup(g_bytes_get_data(message, NULL), g_bytes_get_size(message));
+
+  if (!peer->registered) {
+    if (g_strcmp0(text, "HELLO") == 0) {
+      peer->registered = TRUE;
+      g_atomic_int_inc(&n_registered);
+      g_atomic_int_inc(&n_settled);
+      connect_next_peer(peer->worker);
+    } else {
+      g_printerr("Peer %u: unexpected reply to HELLO: %s\n", peer->index, text);
+    }
+  } else if (g_strcmp0(text, "SESSION_OK") == 0) {
+    g_atomic_int_inc(&n_paired);
+  } else if (g_str_has_prefix(text, "ERROR")) {
+    g_printerr("Peer %u: %s\n", peer->index, text);
+  } else {
+    on_relayed(peer, text);
+  }
+
+  g_free(text);
+}
+
+static void on_closed(G_GNUC_UNUSED SoupWebsocketConnection *connection, gpointer user_data) {
+  BenchPeer *peer = (BenchPeer *)user_data;
+
+  if (!g_atomic_int_get(&interrupted))
+    g_printerr("Peer %u: connection closed by the server\n", peer->index);
+}
+
+static void on_connected(SoupSession *session, GAsyncResult *res, gpointer user_data) {
+  BenchPeer *peer = (BenchPeer *)user_data;
+  GError *error = NULL;
+  gchar *hello;
+
+  peer->connection = soup_session_websocket_connect_finish(session, res, &error);
+  if (peer->connection == NULL) {
+    if (g_atomic_int_add(&n_failed, 1) == 0)
+      g_printerr("Peer %u: could not connect: %s\n", peer->index, error->message);
+    g_error_free(error);
+    g_atomic_int_inc(&n_settled);
+    connect_next_peer(peer->worker);
+    return;
+  }
+
+  g_atomic_int_inc(&n_connected);
+  /* Default is 128 KiB, a waste on tens of thousands of tiny messages */
+  soup_websocket_connection_set_max_incoming_payload_size(peer->connection, 16 * 1024);
+  g_signal_connect(peer->connection, "message", G_CALLBACK(on_message), peer);
+  g_signal_connect(peer->connection, "closed", G_CALLBACK(on_closed), peer);
+
+  hello = g_strdup_printf("HELLO bench-%u", peer->index);
+  soup_websocket_connection_send_text(peer->connection, hello);
+  g_free(hello);
+}
+
+static void connect_next_peer(BenchWorker *worker) {
+  BenchPeer *peer;
+  SoupMessage *message;
+
+  if (worker->next_connect >= worker->peers->len)
+    return;
+
+  peer = g_ptr_array_index(worker->peers, worker->next_connect++);
+  message = soup_message_new(SOUP_METHOD_GET, server_url);
+  soup_session_websocket_connect_async(worker->session, message, NULL, NULL, NULL, (GAsyncReadyCallback)on_connected, peer);
+  g_object_unref(message);
+}
+
+static gboolean start_connecting(gpointer user_data) {
+  BenchWorker *worker = (BenchWorker *)user_data;
+  guint i;
+
+  for (i = 0; i < CONNECT_WINDOW; i++)
+    connect_next_peer(worker);
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean start_sessions(gpointer user_data) {
+  BenchWorker *worker = (BenchWorker *)user_data;
+  guint i;
+
+  for (i = 0; i + 1 < worker->peers->len; i += 2) {
+    BenchPeer *caller = g_ptr_array_index(worker->peers, i);
+    BenchPeer *callee = g_ptr_array_index(worker->peers, i + 1);
+    gchar *request;
+
+    if (!caller->registered || !callee->registered)
+      continue;
+
+    request = g_strdup_printf("SESSION bench-%u", callee->index);
+    soup_websocket_connection_send_text(caller->connection, request);
+    g_free(request);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean start_relaying(gpointer user_data) {
+  BenchWorker *worker = (BenchWorker *)user_data;
+  guint i;
+  gint j;
+
+  for (i = 0; i + 1 < worker->peers->len; i += 2) {
+    BenchPeer *caller = g_ptr_array_index(worker->peers, i);
+
+    if (caller->registered && soup_websocket_connection_get_state(caller->connection) == SOUP_WEBSOCKET_STATE_OPEN)
+      for (j = 0; j < window; j++)
+        send_ping(caller);
+  }
+  return G_SOURCE_REMOVE;
+}
+
+static gpointer bench_worker_thread(gpointer user_data) {
+  BenchWorker *worker = (BenchWorker *)user_data;
+
+  g_main_context_push_thread_default(worker->context);
+  worker->session = soup_session_new_with_options(SOUP_SESSION_MAX_CONNS, G_MAXINT, SOUP_SESSION_MAX_CONNS_PER_HOST, G_MAXINT, NULL);
+  g_main_loop_run(worker->loop);
+  g_main_context_pop_thread_default(worker->context);
+
+  return NULL;
+}
+
+static gboolean bench_worker_quit(gpointer user_data) {
+  g_main_loop_quit(((BenchWorker *)user_data)->loop);
+  return G_SOURCE_REMOVE;
+}
+
+static void bench_worker_stop(BenchWorker *worker) {
+  if (worker->thread == NULL)
+    return;
+
+  g_main_context_invoke(worker->context, bench_worker_quit, worker);
+  g_thread_join(worker->thread);
+  worker->thread = NULL;
+}
+
+static void bench_worker_free(gpointer worker_ptr) {
+  BenchWorker *worker = (BenchWorker *)worker_ptr;
+  guint i;
+
+  bench_worker_stop(worker);
+
+  /* Dropped without a close handshake, there may be tens of thousands */
+  for (i = 0; i < worker->peers->len; i++) {
+    BenchPeer *peer = g_ptr_array_index(worker->peers, i);
+
+    if (peer->connection != NULL) {
+      g_signal_handlers_disconnect_by_data(peer->connection, peer);
+      g_object_unref(peer->connection);
+    }
+  }
+  g_ptr_array_unref(worker->peers);
+  g_array_unref(worker->rtts);
+  g_clear_object(&worker->session);
+  g_main_loop_unref(worker->loop);
+  g_main_context_unref(worker->context);
+  g_free(worker);
+}
+
+static void invoke_workers(GSourceFunc func) {
+  guint i;
+
+  for (i = 0; i < workers->len; i++) {
+    BenchWorker *worker = g_ptr_array_index(workers, i);
+    g_main_context_invoke(worker->context, func, worker);
+  }
+}
+
+/* Waits until @counter reaches @target or stops moving for a while */
+static gboolean wait_for(const gchar *what, gint *counter, gint target) {
+  gint64 start, last_progress;
+  gint last = -1;
+
+  start = last_progress = g_get_monotonic_time();
+  while (!g_atomic_int_get(&interrupted)) {
+    gint value = g_atomic_int_get(counter);
+    gint64 now = g_get_monotonic_time();
+
+    if (value >= target)
+      return TRUE;
+    if (value != last) {
+      last = value;
+      last_progress = now;
+    } else if (now - last_progress > 10 * G_USEC_PER_SEC || now - start > PHASE_TIMEOUT_SECONDS * G_USEC_PER_SEC) {
+      g_printerr("%s stalled at %d of %d\n", what, value, target);
+      return FALSE;
+    }
+    g_usleep(10 * 1000);
+  }
+  return FALSE;
+}
+
+/* utime + stime and VmRSS from /proc, FALSE where there is no procfs */
+static gboolean get_process_usage(GPid pid, ProcessUsage *usage) {
+  gchar *path, *contents;
+  gchar **fields;
+  gchar *rss;
+  gboolean ret = FALSE;
+
+  path = g_strdup_printf("/proc/%d/stat", (gint)pid);
+  if (!g_file_get_contents(path, &contents, NULL, NULL)) {
+    g_free(path);
+    return FALSE;
+  }
+  g_free(path);
+
+  /* The command name may contain spaces, count fields after its ')' */
+  fields = g_strsplit(strrchr(contents, ')') + 2, " ", -1);
+  if (g_strv_length(fields) > 12)
+    usage->cpu_seconds = (g_ascii_strtod(fields[11], NULL) + g_ascii_strtod(fields[12], NULL)) / sysconf(_SC_CLK_TCK);
+  g_strfreev(fields);
+  g_free(contents);
+
+  path = g_strdup_printf("/proc/%d/status", (gint)pid);
+  if (g_file_get_contents(path, &contents, NULL, NULL) && (rss = strstr(contents, "VmRSS:")) != NULL) {
+    usage->rss_mib = g_ascii_strtod(rss + strlen("VmRSS:"), NULL) / 1024.0;
+    ret = TRUE;
+  }
+  g_free(contents);
+  g_free(path);
+
+  return ret;
+}
+
+static gint compare_double(gconstpointer a, gconstpointer b) {
+  gdouble da = *(const gdouble *)a, db = *(const gdouble *)b;
+  return (da > db) - (da < db);
+}
+
+static void print_percentiles(const gchar *name, GArray *values) {
+  if (values->len == 0) {
+    g_print("%-24s no samples\n", name);
+    return;
+  }
+
+  g_array_sort(values, compare_double);
+  g_print("%-24s p50 %7.2f  p90 %7.2f  p99 %7.2f  max %7.2f  (%u samples)\n", name, //
+          g_array_index(values, gdouble, values->len / 2), g_array_index(values, gdouble, values->len * 9 / 10), g_array_index(values, gdouble, values->len * 99 / 100), g_array_index(values, gdouble, values->len - 1), values->len);
+}
+
+static gboolean wait_for_server(void) {
+  GSocketClient *client;
+  gint64 deadline;
+
+  client = g_socket_client_new();
+  deadline = g_get_monotonic_time() + SERVER_START_TIMEOUT_SECONDS * G_USEC_PER_SEC;
+
+  while (g_get_monotonic_time() < deadline) {
+    GSocketConnection *connection = g_socket_client_connect_to_host(client, "127.0.0.1", SIGNALING_PORT, NULL, NULL);
+
+    if (connection != NULL) {
+      g_object_unref(connection);
+      g_object_unref(client);
+      return TRUE;
+    }
+    g_usleep(100 * 1000);
+  }
+
+  g_object_unref(client);
+  return FALSE;
+}
+
+#ifdef G_OS_UNIX
+static gboolean exit_sighandler(G_GNUC_UNUSED gpointer user_data) {
+  g_atomic_int_set(&interrupted, TRUE);
+  return G_SOURCE_REMOVE;
+}
+
+static gpointer signal_thread(gpointer user_data) {
+  g_main_loop_run((GMainLoop *)user_data);
+  return NULL;
+}
+
+static void raise_file_limit(void) {
+  struct rlimit limit;
+
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)n_peers + 64)
+    g_printerr("Open file limit %lu is below --peers, raise it with ulimit -n\n", (gulong)limit.rlim_cur);
+}
+#endif
+
+int main(int argc, char *argv[]) {
+  GOptionContext *context;
+  GError *error = NULL;
+  ProcessUsage idle = {0}, registered = {0}, start = {0}, end = {0};
+  GArray *rtts;
+  gint64 phase_start;
+  gdouble register_seconds = 0, relay_rate = 0;
+  gint relayed_start, n_pairs;
+  gboolean ok = FALSE;
+  guint i;
+#ifdef G_OS_UNIX
+  GMainLoop *signal_loop;
+#endif
+
+  context = g_option_context_new("- load test for webrtc-signaling-server");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Error initializing: %s\n", error->message);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (n_peers < 2 || n_workers <= 0 || window <= 0 || duration_seconds <= 0) {
+    g_printerr("--peers must be at least 2, --workers, --window and --duration positive\n");
+    return -1;
+  }
+  if (server_url == NULL)
+    server_url = g_strdup_printf("ws://127.0.0.1:%d/", SIGNALING_PORT);
+
+#ifdef G_OS_UNIX
+  raise_file_limit();
+
+  /* The main thread only sleeps and polls the counters */
+  signal_loop = g_main_loop_new(NULL, FALSE);
+  g_unix_signal_add(SIGINT, exit_sighandler, NULL);
+  g_thread_unref(g_thread_new("signals", signal_thread, signal_loop));
+#endif
+
+  if (server_path != NULL && server_path[0] != '\0') {
+    gchar **extra_argv = NULL;
+    GPtrArray *server_argv = g_ptr_array_new();
+
+    g_ptr_array_add(server_argv, server_path);
+    if (server_args != NULL && !g_shell_parse_argv(server_args, NULL, &extra_argv, &error)) {
+      g_printerr("Invalid --server-args: %s\n", error->message);
+      return -1;
+    }
+    for (i = 0; extra_argv != NULL && extra_argv[i] != NULL; i++)
+      g_ptr_array_add(server_argv, extra_argv[i]);
+    g_ptr_array_add(server_argv, NULL);
+
+    if (!g_spawn_async(NULL, (gchar **)server_argv->pdata, NULL, G_SPAWN_DO_NOT_REAP_CHILD | G_SPAWN_STDOUT_TO_DEV_NULL, NULL, NULL, &server_pid, &error)) {
+      g_printerr("Could not start %s: %s\n", server_path, error->message);
+      return -1;
+    }
+    g_ptr_array_unref(server_argv);
+    g_strfreev(extra_argv);
+
+    if (!wait_for_server()) {
+      g_printerr("Server did not come up within %d seconds\n", SERVER_START_TIMEOUT_SECONDS);
+      goto out;
+    }
+    get_process_usage(server_pid, &idle);
+  }
+
+  /* Partners land on the same worker */
+  workers = g_ptr_array_new_with_free_func(bench_worker_free);
+  for (i = 0; i < (guint)n_workers; i++) {
+    BenchWorker *worker = g_new0(BenchWorker, 1);
+
+    worker->context = g_main_context_new();
+    worker->loop = g_main_loop_new(worker->context, FALSE);
+    worker->peers = g_ptr_array_new_with_free_func(g_free);
+    worker->rtts = g_array_new(FALSE, FALSE, sizeof(gdouble));
+    g_ptr_array_add(workers, worker);
+  }
+  n_pairs = n_peers / 2;
+  for (i = 0; i < (guint)n_pairs * 2; i++) {
+    BenchWorker *worker = g_ptr_array_index(workers, (i / 2) % workers->len);
+    BenchPeer *peer = g_new0(BenchPeer, 1);
+
+    peer->worker = worker;
+    peer->index = i;
+    g_ptr_array_add(worker->peers, peer);
+  }
+  for (i = 0; i < workers->len; i++) {
+    BenchWorker *worker = g_ptr_array_index(workers, i);
+    worker->thread = g_thread_new("bench-worker", bench_worker_thread, worker);
+  }
+
+  g_print("Registering %d peers with %s from %d workers\n", n_pairs * 2, server_url, n_workers);
+  phase_start = g_get_monotonic_time();
+  invoke_workers(start_connecting);
+  if (!wait_for("registration", &n_settled, n_pairs * 2))
+    goto report;
+  register_seconds = (gdouble)(g_get_monotonic_time() - phase_start) / G_USEC_PER_SEC;
+  if (server_pid != 0)
+    get_process_usage(server_pid, &registered);
+
+  invoke_workers(start_sessions);
+  if (!wait_for("sessions", &n_paired, g_atomic_int_get(&n_registered) / 2))
+    goto report;
+
+  invoke_workers(start_relaying);
+  g_usleep(warmup_seconds * G_USEC_PER_SEC);
+
+  if (server_pid != 0)
+    get_process_usage(server_pid, &start);
+  relayed_start = g_atomic_int_get(&n_relayed);
+  g_atomic_int_set(&measuring, TRUE);
+  g_usleep(duration_seconds * G_USEC_PER_SEC);
+  g_atomic_int_set(&measuring, FALSE);
+  relay_rate = (gdouble)(g_atomic_int_get(&n_relayed) - relayed_start) / duration_seconds;
+  if (server_pid != 0)
+    get_process_usage(server_pid, &end);
+  ok = !g_atomic_int_get(&interrupted);
+
+report:
+  g_atomic_int_set(&interrupted, TRUE);
+  for (i = 0; i < workers->len; i++)
+    bench_worker_stop(g_ptr_array_index(workers, i));
+
+  g_print("\npeers                    %d requested, %d connected, %d registered, %d failed\n", n_pairs * 2, g_atomic_int_get(&n_connected), g_atomic_int_get(&n_registered), g_atomic_int_get(&n_failed));
+  if (register_seconds > 0)
+    g_print("registration             %.2f s, %.0f peers/s\n", register_seconds, g_atomic_int_get(&n_registered) / register_seconds);
+  g_print("sessions                 %d\n", g_atomic_int_get(&n_paired));
+  if (server_pid != 0 && registered.rss_mib > 0)
+    g_print("server rss               %.1f MiB idle, %.1f MiB registered, %.1f KiB per peer\n", idle.rss_mib, registered.rss_mib, //
+            1024.0 * (registered.rss_mib - idle.rss_mib) / MAX(g_atomic_int_get(&n_registered), 1));
+  if (ok) {
+    g_print("relayed                  %.0f msg/s with %d in flight per session\n", relay_rate, window);
+    if (server_pid != 0 && end.cpu_seconds > 0)
+      g_print("server cpu               %.1f%%, %.2f us per message\n", 100.0 * (end.cpu_seconds - start.cpu_seconds) / duration_seconds, //
+              1e6 * (end.cpu_seconds - start.cpu_seconds) / MAX(relay_rate * duration_seconds, 1));
+
+    rtts = g_array_new(FALSE, FALSE, sizeof(gdouble));
+    for (i = 0; i < workers->len; i++) {
+      BenchWorker *worker = g_ptr_array_index(workers, i);
+      g_array_append_vals(rtts, worker->rtts->data, worker->rtts->len);
+    }
+    print_percentiles("round trip ms", rtts);
+    g_array_unref(rtts);
+  }
+
+  g_ptr_array_unref(workers);
+
+out:
+#ifdef G_OS_UNIX
+  if (server_pid != 0) {
+    kill(server_pid, SIGTERM);
+    waitpid(server_pid, NULL, 0);
+  }
+#endif
+  if (server_pid != 0)
+    g_spawn_close_pid(server_pid);
+
+  return ok ? 0 : 1;
+}
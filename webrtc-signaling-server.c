@@ -0,0 +1,498 @@
+/*
+ * Native replacement for signaling/server.py, speaking the same protocol:
+ *
+ *   HELLO <uid>       registers the peer, answered with HELLO
+ *   SESSION <uid>     pairs it with another registered peer, answered with
+ *                     SESSION_OK or ERROR ...
+ *
+ * Once in a session, everything the peer sends is relayed verbatim to the
+ * other one, and either side leaving closes the other.
+ *
+ * Peers are looked up by uid in one hash table, every peer gets its own send
+ * queue that is flushed as fast as its socket drains, so a slow peer never
+ * holds up the ones relaying to it, and idle connections are kept alive with
+ * websocket pings.
+ */
+#include <glib.h>
+#include <libsoup/soup.h>
+#include <locale.h>
+#include <string.h>
+
+#ifdef G_OS_UNIX
+#include <glib-unix.h>
+#include <sys/resource.h>
+#endif
+
+#include "webrtc-outbox.h"
+#include "webrtc-shard.h"
+
+typedef struct _SignalingPeer SignalingPeer;
+
+struct _SignalingPeer {
+  gint ref_count;
+  SoupWebsocketConnection *connection;
+  /* Set once on HELLO, before the peer shows up in the registry */
+  gchar *uid;
+  gboolean registered;
+  /* Last time anything, a message or a pong, came in. Monotonic seconds */
+  gint last_seen;
+
+  /* Guards outbox, which goes away once the connection is closed, and
+   * partner, which is only changed with the registry lock held as well */
+  GMutex lock;
+  Outbox *outbox;
+  SignalingPeer *partner;
+};
+
+static gint port = 8443;
+static gchar *address = NULL;
+static gint keepalive_timeout = 30;
+static gchar *health_path = "/health";
+static gint n_shards = 1;
+static gint max_queue = 256;
+static gboolean verbose = FALSE;
+
+static GOptionEntry entries[] = {
+    {"addr", 0, 0, G_OPTION_ARG_STRING, &address, "Address to listen on (default: all interfaces)", "ADDRESS"},
+    {"port", 0, 0, G_OPTION_ARG_INT, &port, "Port to listen on", "PORT"},
+    {"keepalive-timeout", 0, 0, G_OPTION_ARG_INT, &keepalive_timeout, "Seconds between keepalive pings, peers silent for three times that are dropped", "SECONDS"},
+    {"health", 0, 0, G_OPTION_ARG_STRING, &health_path, "Health check route", "PATH"},
+    {"shards", 0, 0, G_OPTION_ARG_INT, &n_shards, "Number of worker threads, each serving its share of the peers from its own main context", "N"},
+    {"max-queue", 0, 0, G_OPTION_ARG_INT, &max_queue, "Messages queued for a peer before it is dropped as too slow, 0 for no limit", "N"},
+    {"verbose", 0, 0, G_OPTION_ARG_NONE, &verbose, "Print every relayed message", NULL},
+    {NULL},
+};
+
+/* uid -> SignalingPeer, holding a reference. Also guards the sessions */
+static GHashTable *peers = NULL;
+static GMutex peers_lock;
+/* Every open connection, registered or not, holding a reference. Guarded by
+ * peers_lock too */
+static GHashTable *connected = NULL;
+
+static gint n_sessions = 0;
+static gint n_relayed = 0;
+static gint n_dropped = 0;
+
+static gint get_monotonic_seconds(void) {
+  return (gint)(g_get_monotonic_time() / G_USEC_PER_SEC);
+}
+
+static SignalingPeer *signaling_peer_ref(SignalingPeer *peer) {
+  g_atomic_int_inc(&peer->ref_count);
+  return peer;
+}
+
+static void signaling_peer_unref(gpointer peer_ptr) {
+  SignalingPeer *peer = (SignalingPeer *)peer_ptr;
+
+  if (!g_atomic_int_dec_and_test(&peer->ref_count))
+    return;
+
+  g_assert(peer->outbox == NULL && peer->partner == NULL);
+  g_clear_object(&peer->connection);
+  g_mutex_clear(&peer->lock);
+  g_free(peer->uid);
+  g_free(peer);
+}
+
+/* Safe from any thread, takes ownership of @text */
+static void signaling_peer_push(SignalingPeer *peer, gchar *text) {
+  g_mutex_lock(&peer->lock);
+  if (peer->outbox != NULL)
+    outbox_push(peer->outbox, g_steal_pointer(&text));
+  g_mutex_unlock(&peer->lock);
+  g_free(text);
+}
+
+static void signaling_peer_close(SignalingPeer *peer, gushort code, const gchar *reason) {
+  g_mutex_lock(&peer->lock);
+  if (peer->outbox != NULL)
+    outbox_close(peer->outbox, code, reason);
+  g_mutex_unlock(&peer->lock);
+}
+
+/* Same for a peer that stopped reading, nothing queued for it goes out */
+static void signaling_peer_abort(SignalingPeer *peer, gushort code, const gchar *reason) {
+  g_mutex_lock(&peer->lock);
+  if (peer->outbox != NULL)
+    outbox_close_now(peer->outbox, code, reason);
+  g_mutex_unlock(&peer->lock);
+}
+
+/* Called with the registry lock held */
+static void signaling_peer_set_partner(SignalingPeer *peer, SignalingPeer *partner) {
+  SignalingPeer *old;
+
+  g_mutex_lock(&peer->lock);
+  old = peer->partner;
+  peer->partner = partner != NULL ? signaling_peer_ref(partner) : NULL;
+  g_mutex_unlock(&peer->lock);
+
+  if (old != NULL)
+    signaling_peer_unref(old);
+}
+
+/* Splits "<command> <argument>" on the first run of whitespace, like
+ * str.split(maxsplit=1) does. Returns the argument, NULL if there is none */
+static const gchar *split_command(gchar *text) {
+  gchar *argument;
+
+  argument = text + strcspn(text, " \t\r\n\f\v");
+  if (*argument == '\0')
+    return NULL;
+
+  *argument++ = '\0';
+  while (g_ascii_isspace(*argument))
+    argument++;
+  g_strchomp(argument);
+
+  return *argument != '\0' ? argument : NULL;
+}
+
+static void handle_hello(SignalingPeer *peer, gchar *text) {
+  const gchar *uid;
+  gboolean registered = FALSE;
+
+  uid = split_command(text);
+  if (strcmp(text, "HELLO") != 0 || uid == NULL) {
+    g_printerr("Invalid hello from %p\n", (gpointer)peer);
+    signaling_peer_close(peer, SOUP_WEBSOCKET_CLOSE_PROTOCOL_ERROR, "invalid protocol");
+    return;
+  }
+
+  if (strpbrk(uid, " \t\r\n\f\v") == NULL) {
+    g_mutex_lock(&peers_lock);
+    if (!g_hash_table_contains(peers, uid)) {
+      peer->uid = g_strdup(uid);
+      g_hash_table_insert(peers, peer->uid, signaling_peer_ref(peer));
+      registered = TRUE;
+    }
+    g_mutex_unlock(&peers_lock);
+  }
+
+  if (!registered) {
+    g_printerr("Invalid uid '%s' from %p\n", uid, (gpointer)peer);
+    signaling_peer_close(peer, SOUP_WEBSOCKET_CLOSE_PROTOCOL_ERROR, "invalid peer uid");
+    return;
+  }
+
+  peer->registered = TRUE;
+  if (verbose)
+    g_print("Registered peer '%s'\n", peer->uid);
+  signaling_peer_push(peer, g_strdup("HELLO"));
+}
+
+static void handle_session(SignalingPeer *peer, gchar *text) {
+  SignalingPeer *callee;
+  const gchar *callee_uid;
+  gchar *reply;
+
+  callee_uid = split_command(text);
+  if (callee_uid == NULL)
+    callee_uid = "";
+
+  g_mutex_lock(&peers_lock);
+  callee = g_hash_table_lookup(peers, callee_uid);
+  if (callee == NULL) {
+    reply = g_strdup_printf("ERROR peer '%s' not found", callee_uid);
+  } else if (peer->partner != NULL) {
+    reply = g_strdup("ERROR you are already in a session, reconnect to the server to start a new session, or use a ROOM for multi-peer sessions");
+  } else if (callee == peer || callee->partner != NULL) {
+    reply = g_strdup_printf("ERROR peer '%s' busy", callee_uid);
+  } else {
+    signaling_peer_set_partner(peer, callee);
+    signaling_peer_set_partner(callee, peer);
+    n_sessions++;
+    reply = g_strdup("SESSION_OK");
+    if (verbose)
+      g_print("Session from '%s' to '%s'\n", peer->uid, callee_uid);
+  }
+  g_mutex_unlock(&peers_lock);
+
+  signaling_peer_push(peer, reply);
+}
+
+static void relay(SignalingPeer *peer, SignalingPeer *partner, const gchar *data, gsize size) {
+  gboolean full = FALSE;
+
+  if (verbose)
+    g_print("%s -> %s: %.*s\n", peer->uid, partner->uid, (gint)size, data);
+
+  g_mutex_lock(&partner->lock);
+  if (partner->outbox != NULL && !outbox_push(partner->outbox, g_strndup(data, size))) {
+    /* Drop the slow side instead of buffering for it without end */
+    outbox_close_now(partner->outbox, SOUP_WEBSOCKET_CLOSE_GOING_AWAY, "send queue full");
+    full = TRUE;
+  }
+  g_mutex_unlock(&partner->lock);
+
+  if (full) {
+    g_atomic_int_inc(&n_dropped);
+    g_printerr("Peer '%s' doesn't keep up, closing it\n", partner->uid);
+  } else {
+    g_atomic_int_inc(&n_relayed);
+  }
+}
+
+static void on_message(G_GNUC_UNUSED SoupWebsocketConnection *connection, SoupWebsocketDataType data_type, GBytes *message, gpointer user_data) {
+  SignalingPeer *peer = (SignalingPeer *)user_data;
+  SignalingPeer *partner;
+  const gchar *data;
+  gchar *text;
+  gsize size;
+
+  g_atomic_int_set(&peer->last_seen, get_monotonic_seconds());
+
+  if (data_type != SOUP_WEBSOCKET_DATA_TEXT)
+    return;
+  data = g_bytes_get_data(message, &size);
+
+  /* The hot path: a peer in a session, relayed as is without parsing */
+  g_mutex_lock(&peer->lock);
+  partner = peer->partner != NULL ? signaling_peer_ref(peer->partner) : NULL;
+  g_mutex_unlock(&peer->lock);
+
+  if (partner != NULL) {
+    relay(peer, partner, data, size);
+    signaling_peer_unref(partner);
+    return;
+  }
+
+  text = g_strndup(data, size);
+  if (!peer->registered)
+    handle_hello(peer, text);
+  else if (g_str_has_prefix(text, "SESSION"))
+    handle_session(peer, text);
+  else if (verbose)
+    g_print("Ignoring unknown message '%s' from '%s'\n", text, peer->uid);
+  g_free(text);
+}
+
+static void on_pong(G_GNUC_UNUSED SoupWebsocketConnection *connection, G_GNUC_UNUSED GBytes *message, gpointer user_data) {
+  g_atomic_int_set(&((SignalingPeer *)user_data)->last_seen, get_monotonic_seconds());
+}
+
+/* Ends the session of @peer, the other side is removed and closed too so it
+ * can register again, as the Python server does */
+static void remove_peer(SignalingPeer *peer) {
+  SignalingPeer *partner = NULL;
+  gboolean removed = FALSE, removed_partner = FALSE;
+
+  g_mutex_lock(&peers_lock);
+  /* Unless its partner left first and took it out already */
+  if (peer->registered && g_hash_table_lookup(peers, peer->uid) == peer) {
+    g_hash_table_steal(peers, peer->uid);
+    removed = TRUE;
+  }
+
+  if (peer->partner != NULL) {
+    partner = signaling_peer_ref(peer->partner);
+    signaling_peer_set_partner(peer, NULL);
+    if (partner->partner == peer) {
+      signaling_peer_set_partner(partner, NULL);
+      n_sessions--;
+    }
+    if (g_hash_table_lookup(peers, partner->uid) == partner) {
+      g_hash_table_steal(peers, partner->uid);
+      removed_partner = TRUE;
+    }
+  }
+  g_mutex_unlock(&peers_lock);
+
+  if (removed)
+    signaling_peer_unref(peer);
+
+  if (partner != NULL) {
+    signaling_peer_close(partner, SOUP_WEBSOCKET_CLOSE_NORMAL, "peer left");
+    if (removed_partner)
+      signaling_peer_unref(partner);
+    signaling_peer_unref(partner);
+  }
+}
+
+static void on_closed(SoupWebsocketConnection *connection, gpointer user_data) {
+  SignalingPeer *peer = (SignalingPeer *)user_data;
+  Outbox *outbox;
+
+  if (verbose)
+    g_print("Disconnected from peer '%s'\n", peer->uid != NULL ? peer->uid : "");
+
+  g_signal_handlers_disconnect_by_data(connection, peer);
+  remove_peer(peer);
+
+  g_mutex_lock(&peers_lock);
+  g_hash_table_remove(connected, peer);
+  g_mutex_unlock(&peers_lock);
+
+  /* We're on the context the outbox flushes from, it can't be running */
+  g_mutex_lock(&peer->lock);
+  outbox = g_steal_pointer(&peer->outbox);
+  g_mutex_unlock(&peer->lock);
+  outbox_free(outbox);
+
+  signaling_peer_unref(peer);
+}
+
+static void websocket_handler(G_GNUC_UNUSED SoupServer *server, SoupWebsocketConnection *connection, G_GNUC_UNUSED const char *path, G_GNUC_UNUSED SoupClientContext *client_context, G_GNUC_UNUSED gpointer user_data) {
+  SignalingPeer *peer;
+
+  peer = g_new0(SignalingPeer, 1);
+  peer->ref_count = 1;
+  g_mutex_init(&peer->lock);
+  peer->connection = g_object_ref(connection);
+  peer->last_seen = get_monotonic_seconds();
+  peer->outbox = outbox_new(max_queue);
+  outbox_attach(peer->outbox, connection);
+
+  /* Answered by every browser and libsoup client, and what keeps NATs and
+   * proxies on the way from dropping idle connections */
+  soup_websocket_connection_set_keepalive_interval(connection, keepalive_timeout);
+
+  g_mutex_lock(&peers_lock);
+  g_hash_table_add(connected, signaling_peer_ref(peer));
+  g_mutex_unlock(&peers_lock);
+
+  g_signal_connect(connection, "message", G_CALLBACK(on_message), peer);
+  g_signal_connect(connection, "pong", G_CALLBACK(on_pong), peer);
+  g_signal_connect(connection, "closed", G_CALLBACK(on_closed), peer);
+}
+
+static void health_handler(G_GNUC_UNUSED SoupServer *server, SoupMessage *message, G_GNUC_UNUSED const char *path, G_GNUC_UNUSED GHashTable *query, G_GNUC_UNUSED SoupClientContext *client_context, G_GNUC_UNUSED gpointer user_data) {
+  soup_message_set_response(message, "text/plain", SOUP_MEMORY_STATIC, "OK\n", 3);
+  soup_message_set_status(message, SOUP_STATUS_OK);
+}
+
+static void setup_soup_server(SoupServer *soup_server, G_GNUC_UNUSED gpointer user_data) {
+  soup_server_add_handler(soup_server, health_path, health_handler, NULL, NULL);
+  /* Any path, the Python server didn't care either */
+  soup_server_add_websocket_handler(soup_server, "/", NULL, NULL, websocket_handler, NULL, NULL);
+}
+
+/* Drops the peers whose pings went unanswered, libsoup 2 only sends them.
+ * Includes the ones that never sent HELLO */
+static gboolean sweep_peers(G_GNUC_UNUSED gpointer user_data) {
+  GPtrArray *stale;
+  GHashTableIter iter;
+  gpointer value;
+  gint deadline;
+  guint i;
+
+  deadline = get_monotonic_seconds() - 3 * keepalive_timeout;
+  stale = g_ptr_array_new_with_free_func(signaling_peer_unref);
+
+  g_mutex_lock(&peers_lock);
+  g_hash_table_iter_init(&iter, connected);
+  while (g_hash_table_iter_next(&iter, &value, NULL)) {
+    SignalingPeer *peer = (SignalingPeer *)value;
+
+    if (g_atomic_int_get(&peer->last_seen) < deadline)
+      g_ptr_array_add(stale, signaling_peer_ref(peer));
+  }
+  g_mutex_unlock(&peers_lock);
+
+  for (i = 0; i < stale->len; i++)
+    signaling_peer_abort(g_ptr_array_index(stale, i), SOUP_WEBSOCKET_CLOSE_GOING_AWAY, "keepalive timeout");
+  g_ptr_array_unref(stale);
+
+  if (verbose) {
+    g_mutex_lock(&peers_lock);
+    g_print("%u connections, %u peers, %d sessions, %d relayed, %d dropped\n", g_hash_table_size(connected), g_hash_table_size(peers), n_sessions, g_atomic_int_get(&n_relayed), g_atomic_int_get(&n_dropped));
+    g_mutex_unlock(&peers_lock);
+  }
+
+  return G_SOURCE_CONTINUE;
+}
+
+#ifdef G_OS_UNIX
+static gboolean exit_sighandler(gpointer user_data) {
+  g_print("Caught signal, stopping mainloop\n");
+  g_main_loop_quit((GMainLoop *)user_data);
+  return G_SOURCE_REMOVE;
+}
+
+/* Every peer is a socket, the default soft limit of 1024 doesn't go far */
+static void raise_file_limit(void) {
+  struct rlimit limit;
+
+  if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < limit.rlim_max) {
+    limit.rlim_cur = limit.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &limit);
+  }
+}
+#endif
+
+int main(int argc, char *argv[]) {
+  GMainLoop *mainloop;
+  SoupServer *soup_server = NULL;
+  GPtrArray *shards = NULL;
+  GOptionContext *context;
+  GError *error = NULL;
+
+  setlocale(LC_ALL, "");
+
+  context = g_option_context_new("- webrtc signaling server");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Error initializing: %s\n", error->message);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (keepalive_timeout <= 0 || n_shards <= 0 || max_queue < 0) {
+    g_printerr("--keepalive-timeout and --shards must be positive, --max-queue can't be negative\n");
+    return -1;
+  }
+
+#ifdef G_OS_UNIX
+  raise_file_limit();
+#endif
+
+  peers = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, signaling_peer_unref);
+  connected = g_hash_table_new_full(g_direct_hash, g_direct_equal, signaling_peer_unref, NULL);
+  mainloop = g_main_loop_new(NULL, FALSE);
+
+#ifdef G_OS_UNIX
+  g_unix_signal_add(SIGINT, exit_sighandler, mainloop);
+  g_unix_signal_add(SIGTERM, exit_sighandler, mainloop);
+#endif
+
+  if (n_shards > 1) {
+    if (address != NULL)
+      g_printerr("--addr is ignored with --shards, every shard listens on all interfaces\n");
+    shards = session_shards_start(n_shards, port, setup_soup_server, NULL, &error);
+  } else {
+    soup_server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "webrtc-signaling-server", NULL);
+    setup_soup_server(soup_server, NULL);
+    if (address != NULL) {
+      GSocketAddress *socket_address = g_inet_socket_address_new_from_string(address, port);
+
+      if (socket_address == NULL)
+        g_set_error(&error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "Invalid address %s", address);
+      else
+        soup_server_listen(soup_server, socket_address, (SoupServerListenOptions)0, &error);
+      g_clear_object(&socket_address);
+    } else {
+      soup_server_listen_all(soup_server, port, (SoupServerListenOptions)0, &error);
+    }
+  }
+
+  if (error != NULL) {
+    g_printerr("Could not listen on port %d: %s\n", port, error->message);
+    g_error_free(error);
+    return -1;
+  }
+
+  g_print("Listening on ws://%s:%d\n", address != NULL ? address : "0.0.0.0", port);
+  g_timeout_add_seconds(keepalive_timeout, sweep_peers, NULL);
+
+  g_main_loop_run(mainloop);
+
+  if (shards != NULL)
+    session_shards_stop(shards);
+  if (soup_server != NULL)
+    g_object_unref(soup_server);
+  g_main_loop_unref(mainloop);
+
+  return 0;
+}
@@ -0,0 +1,405 @@
+#include "webrtc-signaling.h"
+
+#include <string.h>
+
+/* Deeper than anything in the schema, only there to bound the recursion
+ * when skipping unknown members */
+#define SIGNALING_MAX_DEPTH 16
+
+typedef struct _SignalingCursor {
+  const gchar *p;
+  const gchar *end;
+} SignalingCursor;
+
+/* Called for every member of an object with the cursor on its value, which
+ * it has to consume */
+typedef gboolean (*SignalingMemberFunc)(SignalingCursor *cursor, const SignalingString *key, guint depth, gpointer user_data);
+
+static gboolean skip_value(SignalingCursor *cursor, guint depth);
+
+static void skip_whitespace(SignalingCursor *cursor) {
+  while (cursor->p < cursor->end && (*cursor->p == ' ' || *cursor->p == '\t' || *cursor->p == '\n' || *cursor->p == '\r'))
+    cursor->p++;
+}
+
+static gboolean peek(SignalingCursor *cursor, gchar c) {
+  skip_whitespace(cursor);
+  return cursor->p < cursor->end && *cursor->p == c;
+}
+
+static gboolean expect(SignalingCursor *cursor, gchar c) {
+  if (!peek(cursor, c))
+    return FALSE;
+  cursor->p++;
+  return TRUE;
+}
+
+static gboolean parse_string(SignalingCursor *cursor, SignalingString *string) {
+  const gchar *start;
+  gboolean escaped = FALSE;
+
+  if (!expect(cursor, '"'))
+    return FALSE;
+
+  start = cursor->p;
+  while (cursor->p < cursor->end) {
+    switch (*cursor->p) {
+    case '"':
+      string->data = start;
+      string->length = cursor->p - start;
+      string->escaped = escaped;
+      cursor->p++;
+      return TRUE;
+    case '\\':
+      /* Whatever follows is part of the string, \uXXXX included */
+      escaped = TRUE;
+      if (++cursor->p == cursor->end)
+        return FALSE;
+      break;
+    default:
+      if ((guchar)*cursor->p < 0x20)
+        return FALSE;
+    }
+    cursor->p++;
+  }
+
+  return FALSE;
+}
+
+static gboolean parse_int(SignalingCursor *cursor, gint *value) {
+  const gchar *start;
+  gboolean negative = FALSE;
+  gint64 result = 0;
+
+  skip_whitespace(cursor);
+  if (cursor->p < cursor->end && *cursor->p == '-') {
+    negative = TRUE;
+    cursor->p++;
+  }
+
+  start = cursor->p;
+  while (cursor->p < cursor->end && g_ascii_isdigit(*cursor->p)) {
+    result = result * 10 + (*cursor->p - '0');
+    if (result > G_MAXINT)
+      return FALSE;
+    cursor->p++;
+  }
+  if (cursor->p == start)
+    return FALSE;
+
+  /* Fractions and exponents are no valid mline index */
+  if (cursor->p < cursor->end && (*cursor->p == '.' || *cursor->p == 'e' || *cursor->p == 'E'))
+    return FALSE;
+
+  *value = negative ? -result : result;
+  return TRUE;
+}
+
+static gboolean parse_object(SignalingCursor *cursor, guint depth, SignalingMemberFunc member, gpointer user_data) {
+  SignalingString key;
+
+  if (depth > SIGNALING_MAX_DEPTH || !expect(cursor, '{'))
+    return FALSE;
+  if (expect(cursor, '}'))
+    return TRUE;
+
+  do {
+    if (!parse_string(cursor, &key) || !expect(cursor, ':'))
+      return FALSE;
+    if (!member(cursor, &key, depth, user_data))
+      return FALSE;
+  } while (expect(cursor, ','));
+
+  return expect(cursor, '}');
+}
+
+static gboolean skip_member(SignalingCursor *cursor, G_GNUC_UNUSED const SignalingString *key, guint depth, G_GNUC_UNUSED gpointer user_data) {
+  return skip_value(cursor, depth + 1);
+}
+
+static gboolean skip_array(SignalingCursor *cursor, guint depth) {
+  if (depth > SIGNALING_MAX_DEPTH || !expect(cursor, '['))
+    return FALSE;
+  if (expect(cursor, ']'))
+    return TRUE;
+
+  do {
+    if (!skip_value(cursor, depth + 1))
+      return FALSE;
+  } while (expect(cursor, ','));
+
+  return expect(cursor, ']');
+}
+
+static gboolean skip_literal(SignalingCursor *cursor, const gchar *literal) {
+  gsize length = strlen(literal);
+
+  if ((gsize)(cursor->end - cursor->p) < length || memcmp(cursor->p, literal, length) != 0)
+    return FALSE;
+  cursor->p += length;
+  return TRUE;
+}
+
+static gboolean skip_value(SignalingCursor *cursor, guint depth) {
+  SignalingString string;
+  const gchar *start;
+
+  skip_whitespace(cursor);
+  if (cursor->p == cursor->end)
+    return FALSE;
+
+  switch (*cursor->p) {
+  case '"':
+    return parse_string(cursor, &string);
+  case '{':
+    return parse_object(cursor, depth, skip_member, NULL);
+  case '[':
+    return skip_array(cursor, depth);
+  case 't':
+    return skip_literal(cursor, "true");
+  case 'f':
+    return skip_literal(cursor, "false");
+  case 'n':
+    return skip_literal(cursor, "null");
+  default:
+    start = cursor->p;
+    while (cursor->p < cursor->end && strchr("+-.0123456789eE", *cursor->p) != NULL && *cursor->p != '\0')
+      cursor->p++;
+    return cursor->p != start;
+  }
+}
+
+static gboolean on_sdp_member(SignalingCursor *cursor, const SignalingString *key, guint depth, gpointer user_data) {
+  SignalingMessage *message = (SignalingMessage *)user_data;
+
+  if (signaling_string_equal(key, "type") && peek(cursor, '"'))
+    return message->has_sdp_type = parse_string(cursor, &message->sdp_type);
+  if (signaling_string_equal(key, "sdp") && peek(cursor, '"'))
+    return message->has_sdp = parse_string(cursor, &message->sdp);
+  return skip_value(cursor, depth + 1);
+}
+
+static gboolean on_candidate_member(SignalingCursor *cursor, const SignalingString *key, guint depth, gpointer user_data) {
+  SignalingCandidate *candidate = (SignalingCandidate *)user_data;
+
+  if (signaling_string_equal(key, "candidate") && peek(cursor, '"'))
+    return candidate->has_candidate = parse_string(cursor, &candidate->candidate);
+  if (signaling_string_equal(key, "sdpMLineIndex") && !peek(cursor, 'n'))
+    return parse_int(cursor, &candidate->mline_index);
+  return skip_value(cursor, depth + 1);
+}
+
+static gboolean parse_candidate(SignalingCursor *cursor, guint depth, SignalingMessage *message) {
+  SignalingCandidate *candidate;
+
+  /* Dropping the rest could lose the end-of-candidates marker without
+   * anyone noticing */
+  if (message->n_candidates == SIGNALING_MAX_CANDIDATES)
+    return FALSE;
+
+  candidate = &message->candidates[message->n_candidates++];
+  memset(candidate, 0, sizeof(SignalingCandidate));
+  candidate->mline_index = -1;
+
+  return parse_object(cursor, depth, on_candidate_member, candidate);
+}
+
+static gboolean parse_candidates(SignalingCursor *cursor, SignalingMessage *message) {
+  if (!peek(cursor, '['))
+    return parse_candidate(cursor, 1, message);
+
+  cursor->p++;
+  if (expect(cursor, ']'))
+    return TRUE;
+
+  do {
+    if (!parse_candidate(cursor, 2, message))
+      return FALSE;
+  } while (expect(cursor, ','));
+
+  return expect(cursor, ']');
+}
+
+typedef struct _SignalingEnvelope {
+  SignalingString type;
+  gboolean has_type;
+  SignalingCursor data;
+  gboolean has_data;
+} SignalingEnvelope;
+
+static gboolean on_envelope_member(SignalingCursor *cursor, const SignalingString *key, guint depth, gpointer user_data) {
+  SignalingEnvelope *envelope = (SignalingEnvelope *)user_data;
+
+  if (signaling_string_equal(key, "type") && peek(cursor, '"'))
+    return envelope->has_type = parse_string(cursor, &envelope->type);
+
+  /* "type" may come after it, so only remember where it is */
+  if (signaling_string_equal(key, "data")) {
+    skip_whitespace(cursor);
+    envelope->data = *cursor;
+    envelope->has_data = TRUE;
+  }
+  return skip_value(cursor, depth + 1);
+}
+
+gboolean signaling_message_parse(const gchar *data, gsize size, SignalingMessage *message) {
+  SignalingCursor cursor = {data, data + size};
+  SignalingEnvelope envelope = {0};
+
+  message->type = SIGNALING_MESSAGE_UNKNOWN;
+  message->has_sdp_type = FALSE;
+  message->has_sdp = FALSE;
+  message->n_candidates = 0;
+
+  if (!parse_object(&cursor, 0, on_envelope_member, &envelope))
+    return FALSE;
+  skip_whitespace(&cursor);
+  if (cursor.p != cursor.end)
+    return FALSE;
+
+  if (!envelope.has_type || !envelope.has_data)
+    return TRUE;
+
+  if (signaling_string_equal(&envelope.type, "sdp")) {
+    if (parse_object(&envelope.data, 1, on_sdp_member, message))
+      message->type = SIGNALING_MESSAGE_SDP;
+  } else if (signaling_string_equal(&envelope.type, "ice")) {
+    if (parse_candidates(&envelope.data, message))
+      message->type = SIGNALING_MESSAGE_ICE;
+    else
+      message->n_candidates = 0;
+  }
+
+  return TRUE;
+}
+
+gboolean signaling_string_equal(const SignalingString *string, const gchar *literal) {
+  gsize length = strlen(literal);
+
+  return string->length == length && memcmp(string->data, literal, length) == 0;
+}
+
+static gboolean parse_hex4(const gchar *p, const gchar *end, gunichar *value) {
+  gint i;
+
+  if (end - p < 4)
+    return FALSE;
+
+  *value = 0;
+  for (i = 0; i < 4; i++) {
+    gint digit = g_ascii_xdigit_value(p[i]);
+    if (digit < 0)
+      return FALSE;
+    *value = (*value << 4) | digit;
+  }
+  return TRUE;
+}
+
+const gchar *signaling_string_unescape(const SignalingString *string, GString *buffer) {
+  const gchar *p = string->data;
+  const gchar *end = string->data + string->length;
+  const gchar *backslash;
+  gunichar c, low;
+
+  g_string_truncate(buffer, 0);
+  if (!string->escaped) {
+    g_string_append_len(buffer, string->data, string->length);
+    return buffer->str;
+  }
+
+  while (p < end) {
+    backslash = memchr(p, '\\', end - p);
+    if (backslash == NULL) {
+      g_string_append_len(buffer, p, end - p);
+      break;
+    }
+    g_string_append_len(buffer, p, backslash - p);
+
+    /* The parser made sure something follows every backslash */
+    p = backslash + 1;
+    switch (*p) {
+    case 'n':
+      g_string_append_c(buffer, '\n');
+      break;
+    case 'r':
+      g_string_append_c(buffer, '\r');
+      break;
+    case 't':
+      g_string_append_c(buffer, '\t');
+      break;
+    case 'b':
+      g_string_append_c(buffer, '\b');
+      break;
+    case 'f':
+      g_string_append_c(buffer, '\f');
+      break;
+    case 'u':
+      if (!parse_hex4(p + 1, end, &c))
+        break;
+      p += 4;
+      /* Characters outside the BMP come as a surrogate pair */
+      if (c >= 0xd800 && c < 0xdc00 && end - p > 6 && p[1] == '\\' && p[2] == 'u' && parse_hex4(p + 3, end, &low) && low >= 0xdc00 && low < 0xe000) {
+        c = 0x10000 + ((c - 0xd800) << 10) + (low - 0xdc00);
+        p += 6;
+      }
+      g_string_append_unichar(buffer, c);
+      break;
+    default:
+      /* \" \\ and \/ */
+      g_string_append_c(buffer, *p);
+    }
+    p++;
+  }
+
+  return buffer->str;
+}
+
+void signaling_append_json_string(GString *buffer, const gchar *text) {
+  const gchar *run = text;
+  const gchar *p;
+
+  g_string_append_c(buffer, '"');
+  for (p = text; *p != '\0'; p++) {
+    const gchar *escape;
+
+    switch (*p) {
+    case '"':
+      escape = "\\\"";
+      break;
+    case '\\':
+      escape = "\\\\";
+      break;
+    case '\n':
+      escape = "\\n";
+      break;
+    case '\r':
+      escape = "\\r";
+      break;
+    case '\t':
+      escape = "\\t";
+      break;
+    default:
+      if ((guchar)*p >= 0x20)
+        continue;
+      escape = NULL;
+    }
+
+    g_string_append_len(buffer, run, p - run);
+    if (escape != NULL)
+      g_string_append(buffer, escape);
+    else
+      g_string_append_printf(buffer, "\\u%04x", (guchar)*p);
+    run = p + 1;
+  }
+  g_string_append_len(buffer, run, p - run);
+  g_string_append_c(buffer, '"');
+}
+
+void signaling_write_sdp(GString *buffer, const gchar *sdp_type, const gchar *sdp) {
+  g_string_truncate(buffer, 0);
+  g_string_append(buffer, "{\"type\":\"sdp\",\"data\":{\"type\":");
+  signaling_append_json_string(buffer, sdp_type);
+  g_string_append(buffer, ",\"sdp\":");
+  signaling_append_json_string(buffer, sdp);
+  g_string_append(buffer, "}}");
+}
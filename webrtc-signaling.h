@@ -0,0 +1,74 @@
+#ifndef __WEBRTC_SIGNALING_H__
+#define __WEBRTC_SIGNALING_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Codec for the fixed signaling schema spoken with the viewers:
+ *
+ *   {"type":"sdp","data":{"type":"offer"|"answer","sdp":"..."}}
+ *   {"type":"ice","data":{"sdpMLineIndex":N,"candidate":"..."}}
+ *   {"type":"ice","data":[{"sdpMLineIndex":N,"candidate":"..."},...]}
+ *
+ * Parsing runs in place over the received payload, strings come back as
+ * slices of it, and members outside the schema are skipped. Only the
+ * strings that are needed get unescaped, into a caller provided buffer that
+ * is meant to be reused from message to message */
+
+/* A single message with more candidates than that is rejected as a whole,
+ * like any other malformed one */
+#define SIGNALING_MAX_CANDIDATES 32
+
+typedef enum {
+  SIGNALING_MESSAGE_UNKNOWN,
+  SIGNALING_MESSAGE_SDP,
+  SIGNALING_MESSAGE_ICE,
+} SignalingMessageType;
+
+/* Still JSON escaped, not NUL terminated */
+typedef struct _SignalingString {
+  const gchar *data;
+  gsize length;
+  gboolean escaped;
+} SignalingString;
+
+typedef struct _SignalingCandidate {
+  gint mline_index; /* -1 when missing */
+  SignalingString candidate;
+  gboolean has_candidate;
+} SignalingCandidate;
+
+typedef struct _SignalingMessage {
+  SignalingMessageType type;
+
+  /* SIGNALING_MESSAGE_SDP */
+  SignalingString sdp_type;
+  SignalingString sdp;
+  gboolean has_sdp_type;
+  gboolean has_sdp;
+
+  /* SIGNALING_MESSAGE_ICE */
+  guint n_candidates;
+  SignalingCandidate candidates[SIGNALING_MAX_CANDIDATES];
+} SignalingMessage;
+
+/* Returns FALSE when @data isn't a JSON object. @message points into @data
+ * afterwards, which has to outlive it */
+gboolean signaling_message_parse(const gchar *data, gsize size, SignalingMessage *message);
+
+gboolean signaling_string_equal(const SignalingString *string, const gchar *literal);
+
+/* Unescapes @string into @buffer, replacing its contents. Returns the NUL
+ * terminated result, which stays valid until @buffer is modified */
+const gchar *signaling_string_unescape(const SignalingString *string, GString *buffer);
+
+/* Appends @text as a quoted JSON string */
+void signaling_append_json_string(GString *buffer, const gchar *text);
+
+/* Replace the contents of @buffer with the serialized message */
+void signaling_write_sdp(GString *buffer, const gchar *sdp_type, const gchar *sdp);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_SIGNALING_H__ */
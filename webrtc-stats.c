@@ -0,0 +1,495 @@
+#include "webrtc-stats.h"
+
+#define GST_USE_UNSTABLE_API
+#include <gst/webrtc/webrtc.h>
+
+#include <string.h>
+
+#define STATS_RING_SIZE 32
+#define STATS_INTERVAL_MIN_MS 1000
+#define STATS_INTERVAL_MAX_MS 8000
+/* A bitrate change bigger than this counts as something happening */
+#define STATS_BITRATE_SWING 0.20
+
+struct _StatsCollector {
+  gint ref_count;
+
+  GstElement *webrtcbin;
+  gchar *session_label;
+  GMainContext *context;
+
+  GMutex lock;
+  gboolean stopped;
+  GSource *timeout_source;
+  guint interval;
+  gboolean pinned;
+
+  StatsSample samples[STATS_RING_SIZE];
+  guint head;
+  guint n_samples;
+
+  gint frame_count;
+  gint last_frame_count;
+};
+
+typedef struct _StatsQuarks {
+  GQuark type;
+  GQuark bytes_sent;
+  GQuark bytes_received;
+  GQuark packets_sent;
+  GQuark packets_received;
+  GQuark packets_lost;
+  GQuark jitter;
+  GQuark round_trip_time;
+  GQuark nack_count;
+  GQuark pli_count;
+} StatsQuarks;
+
+static StatsQuarks quarks;
+
+/* Every live collector, walked by the /metrics handler */
+static GMutex collectors_lock;
+static GPtrArray *collectors = NULL;
+
+static gint failures[STATS_N_FAILURES];
+static gint rebuilds = 0;
+
+static void stats_quarks_init(void) {
+  static gsize initialized = 0;
+
+  if (g_once_init_enter(&initialized)) {
+    quarks.type = g_quark_from_static_string("type");
+    quarks.bytes_sent = g_quark_from_static_string("bytes-sent");
+    quarks.bytes_received = g_quark_from_static_string("bytes-received");
+    quarks.packets_sent = g_quark_from_static_string("packets-sent");
+    quarks.packets_received = g_quark_from_static_string("packets-received");
+    quarks.packets_lost = g_quark_from_static_string("packets-lost");
+    quarks.jitter = g_quark_from_static_string("jitter");
+    quarks.round_trip_time = g_quark_from_static_string("round-trip-time");
+    quarks.nack_count = g_quark_from_static_string("nack-count");
+    quarks.pli_count = g_quark_from_static_string("pli-count");
+    g_once_init_leave(&initialized, 1);
+  }
+}
+
+static StatsCollector *stats_collector_ref(StatsCollector *collector) {
+  g_atomic_int_inc(&collector->ref_count);
+  return collector;
+}
+
+static void stats_collector_unref(gpointer collector_ptr) {
+  StatsCollector *collector = (StatsCollector *)collector_ptr;
+
+  if (!g_atomic_int_dec_and_test(&collector->ref_count))
+    return;
+
+  gst_object_unref(collector->webrtcbin);
+  g_main_context_unref(collector->context);
+  g_mutex_clear(&collector->lock);
+  g_free(collector->session_label);
+  g_free(collector);
+}
+
+/* webrtcbin is not consistent about integer widths across versions */
+static gboolean stats_get_int64(const GstStructure *s, GQuark field, gint64 *value) {
+  const GValue *v = gst_structure_id_get_value(s, field);
+
+  if (v == NULL)
+    return FALSE;
+
+  if (G_VALUE_HOLDS_INT(v))
+    *value = g_value_get_int(v);
+  else if (G_VALUE_HOLDS_UINT(v))
+    *value = g_value_get_uint(v);
+  else if (G_VALUE_HOLDS_INT64(v))
+    *value = g_value_get_int64(v);
+  else if (G_VALUE_HOLDS_UINT64(v))
+    *value = (gint64)g_value_get_uint64(v);
+  else
+    return FALSE;
+
+  return TRUE;
+}
+
+static gboolean stats_get_double(const GstStructure *s, GQuark field, gdouble *value) {
+  const GValue *v = gst_structure_id_get_value(s, field);
+
+  if (v == NULL || !G_VALUE_HOLDS_DOUBLE(v))
+    return FALSE;
+
+  *value = g_value_get_double(v);
+  return TRUE;
+}
+
+static gboolean on_collector_stat(G_GNUC_UNUSED GQuark field_id, const GValue *value, gpointer user_data) {
+  StatsSample *sample = (StatsSample *)user_data;
+  const GstStructure *s;
+  const GValue *type_value;
+  gint64 v;
+  gdouble d;
+  enum StatsDirection direction;
+
+  if (!GST_VALUE_HOLDS_STRUCTURE(value))
+    return TRUE;
+
+  s = gst_value_get_structure(value);
+  type_value = gst_structure_id_get_value(s, quarks.type);
+  if (type_value == NULL)
+    return TRUE;
+
+  /* Only the rtp stream entries carry anything we want, skip the rest
+   * without looking at their fields */
+  switch (g_value_get_enum(type_value)) {
+  case GST_WEBRTC_STATS_INBOUND_RTP:
+    direction = STATS_INBOUND;
+    if (stats_get_int64(s, quarks.bytes_received, &v))
+      sample->bytes[direction] += v;
+    if (stats_get_int64(s, quarks.packets_received, &v))
+      sample->packets[direction] += v;
+    if (stats_get_int64(s, quarks.packets_lost, &v))
+      sample->packets_lost[direction] += v;
+    if (stats_get_double(s, quarks.jitter, &d))
+      sample->jitter = MAX(sample->jitter, d);
+    break;
+  case GST_WEBRTC_STATS_OUTBOUND_RTP:
+    direction = STATS_OUTBOUND;
+    if (stats_get_int64(s, quarks.bytes_sent, &v))
+      sample->bytes[direction] += v;
+    if (stats_get_int64(s, quarks.packets_sent, &v))
+      sample->packets[direction] += v;
+    break;
+  case GST_WEBRTC_STATS_REMOTE_INBOUND_RTP:
+    if (stats_get_int64(s, quarks.packets_lost, &v))
+      sample->packets_lost[STATS_OUTBOUND] += v;
+    if (stats_get_double(s, quarks.round_trip_time, &d))
+      sample->rtt = MAX(sample->rtt, d);
+    return TRUE;
+  default:
+    return TRUE;
+  }
+
+  if (stats_get_int64(s, quarks.nack_count, &v))
+    sample->nack_count[direction] += v;
+  if (stats_get_int64(s, quarks.pli_count, &v))
+    sample->pli_count[direction] += v;
+
+  return TRUE;
+}
+
+/* Called with the lock held */
+static gboolean stats_sample_is_eventful(const StatsSample *sample, const StatsSample *previous) {
+  guint i;
+
+  for (i = 0; i < STATS_N_DIRECTIONS; i++) {
+    if (sample->packets_lost[i] > previous->packets_lost[i] || sample->nack_count[i] > previous->nack_count[i] || sample->pli_count[i] > previous->pli_count[i])
+      return TRUE;
+    if (ABS((gdouble)sample->bitrate[i] - (gdouble)previous->bitrate[i]) > STATS_BITRATE_SWING * MAX(previous->bitrate[i], 1))
+      return TRUE;
+  }
+  return FALSE;
+}
+
+static gboolean stats_collector_poll(gpointer user_data);
+
+/* Called with the lock held */
+static void stats_collector_schedule(StatsCollector *collector, guint interval) {
+  if (collector->stopped)
+    return;
+
+  if (collector->timeout_source != NULL) {
+    g_source_destroy(collector->timeout_source);
+    g_source_unref(collector->timeout_source);
+  }
+
+  collector->timeout_source = g_timeout_source_new(interval);
+  g_source_set_callback(collector->timeout_source, stats_collector_poll, stats_collector_ref(collector), stats_collector_unref);
+  g_source_attach(collector->timeout_source, collector->context);
+}
+
+static void on_collector_get_stats(GstPromise *promise, gpointer user_data) {
+  StatsCollector *collector = (StatsCollector *)user_data;
+  const GstStructure *reply;
+  StatsSample sample = {0};
+  gint frame_count;
+  guint i;
+
+  reply = gst_promise_get_reply(promise);
+  if (reply != NULL)
+    gst_structure_foreach(reply, on_collector_stat, &sample);
+  sample.timestamp = g_get_monotonic_time();
+  frame_count = g_atomic_int_get(&collector->frame_count);
+
+  g_mutex_lock(&collector->lock);
+  if (reply != NULL) {
+    if (collector->n_samples > 0) {
+      const StatsSample *previous = &collector->samples[collector->head];
+      gdouble elapsed = (gdouble)MAX(sample.timestamp - previous->timestamp, 1) / G_USEC_PER_SEC;
+
+      for (i = 0; i < STATS_N_DIRECTIONS; i++) {
+        if (sample.bytes[i] >= previous->bytes[i])
+          sample.bitrate[i] = (sample.bytes[i] - previous->bytes[i]) * 8 / elapsed;
+      }
+      sample.frames_per_second = (frame_count - collector->last_frame_count) / elapsed;
+
+      if (collector->pinned || stats_sample_is_eventful(&sample, previous))
+        collector->interval = STATS_INTERVAL_MIN_MS;
+      else
+        collector->interval = MIN(collector->interval * 2, STATS_INTERVAL_MAX_MS);
+    }
+
+    collector->head = (collector->head + 1) % STATS_RING_SIZE;
+    collector->samples[collector->head] = sample;
+    collector->n_samples = MIN(collector->n_samples + 1, STATS_RING_SIZE);
+    collector->last_frame_count = frame_count;
+  }
+
+  /* Re-armed from here rather than on a fixed timer, so a slow webrtcbin
+   * never has two requests in flight */
+  stats_collector_schedule(collector, collector->interval);
+  g_mutex_unlock(&collector->lock);
+
+  gst_promise_unref(promise);
+}
+
+static gboolean stats_collector_poll(gpointer user_data) {
+  StatsCollector *collector = (StatsCollector *)user_data;
+  GstPromise *promise;
+
+  g_mutex_lock(&collector->lock);
+  g_clear_pointer(&collector->timeout_source, g_source_unref);
+  g_mutex_unlock(&collector->lock);
+
+  promise = gst_promise_new_with_change_func(on_collector_get_stats, stats_collector_ref(collector), stats_collector_unref);
+  g_signal_emit_by_name(collector->webrtcbin, "get-stats", NULL, promise);
+
+  return G_SOURCE_REMOVE;
+}
+
+static GstPadProbeReturn on_frame_probe(G_GNUC_UNUSED GstPad *pad, GstPadProbeInfo *info, gpointer user_data) {
+  StatsCollector *collector = (StatsCollector *)user_data;
+
+  if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_BUFFER_LIST)
+    g_atomic_int_add(&collector->frame_count, gst_buffer_list_length(GST_PAD_PROBE_INFO_BUFFER_LIST(info)));
+  else
+    g_atomic_int_inc(&collector->frame_count);
+
+  return GST_PAD_PROBE_OK;
+}
+
+StatsCollector *stats_collector_new(GstElement *webrtcbin, const gchar *session_label) {
+  StatsCollector *collector;
+
+  stats_quarks_init();
+
+  collector = g_new0(StatsCollector, 1);
+  collector->ref_count = 1;
+  collector->webrtcbin = gst_object_ref(webrtcbin);
+  collector->session_label = g_strdup(session_label);
+  collector->context = g_main_context_ref_thread_default();
+  collector->interval = STATS_INTERVAL_MIN_MS;
+  g_mutex_init(&collector->lock);
+
+  g_mutex_lock(&collectors_lock);
+  if (collectors == NULL)
+    collectors = g_ptr_array_new();
+  g_ptr_array_add(collectors, collector);
+  g_mutex_unlock(&collectors_lock);
+
+  /* Spread the first poll so hundreds of sessions started together don't
+   * all hit their webrtcbin in the same main loop iteration */
+  g_mutex_lock(&collector->lock);
+  stats_collector_schedule(collector, g_random_int_range(STATS_INTERVAL_MIN_MS / 2, STATS_INTERVAL_MIN_MS * 3 / 2));
+  g_mutex_unlock(&collector->lock);
+
+  return collector;
+}
+
+void stats_collector_set_context(StatsCollector *collector, GMainContext *context) {
+  g_return_if_fail(collector != NULL);
+
+  g_mutex_lock(&collector->lock);
+  g_main_context_unref(collector->context);
+  collector->context = g_main_context_ref(context);
+  /* Without a pending timeout a request is in flight, and its reply re-arms
+   * on the new context */
+  if (collector->timeout_source != NULL)
+    stats_collector_schedule(collector, collector->interval);
+  g_mutex_unlock(&collector->lock);
+}
+
+void stats_collector_pin_interval(StatsCollector *collector) {
+  g_return_if_fail(collector != NULL);
+
+  g_mutex_lock(&collector->lock);
+  collector->pinned = TRUE;
+  if (collector->interval != STATS_INTERVAL_MIN_MS) {
+    collector->interval = STATS_INTERVAL_MIN_MS;
+    if (collector->timeout_source != NULL)
+      stats_collector_schedule(collector, collector->interval);
+  }
+  g_mutex_unlock(&collector->lock);
+}
+
+void stats_collector_count_frames(StatsCollector *collector, GstPad *pad) {
+  g_return_if_fail(collector != NULL);
+
+  gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST, on_frame_probe, stats_collector_ref(collector), stats_collector_unref);
+}
+
+guint stats_collector_get_samples(StatsCollector *collector, StatsSample *samples, guint n_samples) {
+  guint i;
+
+  g_return_val_if_fail(collector != NULL, 0);
+
+  g_mutex_lock(&collector->lock);
+  n_samples = MIN(n_samples, collector->n_samples);
+  for (i = 0; i < n_samples; i++)
+    samples[i] = collector->samples[(collector->head + STATS_RING_SIZE - i) % STATS_RING_SIZE];
+  g_mutex_unlock(&collector->lock);
+
+  return n_samples;
+}
+
+void stats_collector_free(StatsCollector *collector) {
+  g_return_if_fail(collector != NULL);
+
+  g_mutex_lock(&collectors_lock);
+  g_ptr_array_remove_fast(collectors, collector);
+  g_mutex_unlock(&collectors_lock);
+
+  g_mutex_lock(&collector->lock);
+  collector->stopped = TRUE;
+  if (collector->timeout_source != NULL) {
+    g_source_destroy(collector->timeout_source);
+    g_clear_pointer(&collector->timeout_source, g_source_unref);
+  }
+  g_mutex_unlock(&collector->lock);
+
+  stats_collector_unref(collector);
+}
+
+typedef struct _StatsMetric {
+  const gchar *name;
+  const gchar *type;
+  const gchar *help;
+  gboolean per_direction;
+} StatsMetric;
+
+static const StatsMetric metrics[] = {
+    {"webrtc_round_trip_time_seconds", "gauge", "Round trip time reported by the remote", FALSE},
+    {"webrtc_jitter_seconds", "gauge", "Highest interarrival jitter of the received streams", FALSE},
+    {"webrtc_frames_per_second", "gauge", "Encoded video frames per second", FALSE},
+    {"webrtc_bitrate_bits_per_second", "gauge", "RTP bitrate over the last polling interval", TRUE},
+    /* Cumulative, but duplicates make it go down, which a counter can't */
+    {"webrtc_packets_lost", "gauge", "Lost RTP packets so far, as reported", TRUE},
+    {"webrtc_nack_total", "counter", "NACK requests sent (inbound) or received (outbound)", TRUE},
+    {"webrtc_pli_total", "counter", "PLI requests sent (inbound) or received (outbound)", TRUE},
+};
+
+static const gchar *direction_names[STATS_N_DIRECTIONS] = {"inbound", "outbound"};
+static const gchar *failure_names[STATS_N_FAILURES] = {"setup", "pipeline", "signaling"};
+
+void stats_count_failure(enum StatsFailure failure) {
+  g_return_if_fail(failure < STATS_N_FAILURES);
+
+  g_atomic_int_inc(&failures[failure]);
+}
+
+void stats_count_rebuild(void) {
+  g_atomic_int_inc(&rebuilds);
+}
+
+static void stats_append_label(GString *text, const gchar *label) {
+  const gchar *p;
+
+  for (p = label; *p != '\0'; p++) {
+    if (*p == '\\' || *p == '"')
+      g_string_append_c(text, '\\');
+    if (*p == '\n')
+      g_string_append(text, "\\n");
+    else
+      g_string_append_c(text, *p);
+  }
+}
+
+static gdouble stats_sample_value(const StatsSample *sample, guint metric, guint direction) {
+  switch (metric) {
+  case 0:
+    return sample->rtt;
+  case 1:
+    return sample->jitter;
+  case 2:
+    return sample->frames_per_second;
+  case 3:
+    return sample->bitrate[direction];
+  case 4:
+    return sample->packets_lost[direction];
+  case 5:
+    return sample->nack_count[direction];
+  case 6:
+    return sample->pli_count[direction];
+  default:
+    g_assert_not_reached();
+  }
+}
+
+void stats_metrics_handler(G_GNUC_UNUSED SoupServer *soup_server, SoupMessage *message, G_GNUC_UNUSED const char *path, G_GNUC_UNUSED GHashTable *query, G_GNUC_UNUSED SoupClientContext *client_context, G_GNUC_UNUSED gpointer user_data) {
+  GArray *latest;
+  GPtrArray *labels;
+  GString *text;
+  guint i, j, k;
+
+  if (message->method != SOUP_METHOD_GET) {
+    soup_message_set_status(message, SOUP_STATUS_NOT_IMPLEMENTED);
+    return;
+  }
+
+  /* Snapshot first, so formatting never holds a collector lock */
+  latest = g_array_new(FALSE, TRUE, sizeof(StatsSample));
+  labels = g_ptr_array_new_with_free_func(g_free);
+
+  g_mutex_lock(&collectors_lock);
+  for (i = 0; collectors != NULL && i < collectors->len; i++) {
+    StatsCollector *collector = g_ptr_array_index(collectors, i);
+    StatsSample sample;
+
+    if (stats_collector_get_samples(collector, &sample, 1) == 1) {
+      g_array_append_val(latest, sample);
+      g_ptr_array_add(labels, g_strdup(collector->session_label));
+    }
+  }
+  g_mutex_unlock(&collectors_lock);
+
+  text = g_string_sized_new(256 + latest->len * G_N_ELEMENTS(metrics) * 96);
+  g_string_append_printf(text, "# HELP webrtc_sessions Sessions with stats\n# TYPE webrtc_sessions gauge\nwebrtc_sessions %u\n", latest->len);
+
+  g_string_append(text, "# HELP webrtc_session_failures_total Sessions ended by an error of their own\n# TYPE webrtc_session_failures_total counter\n");
+  for (i = 0; i < STATS_N_FAILURES; i++)
+    g_string_append_printf(text, "webrtc_session_failures_total{reason=\"%s\"} %d\n", failure_names[i], g_atomic_int_get(&failures[i]));
+  g_string_append_printf(text, "# HELP webrtc_session_rebuilds_total Failed sessions built again for the same viewer\n# TYPE webrtc_session_rebuilds_total counter\nwebrtc_session_rebuilds_total %d\n", g_atomic_int_get(&rebuilds));
+
+  for (i = 0; i < G_N_ELEMENTS(metrics); i++) {
+    g_string_append_printf(text, "# HELP %s %s\n# TYPE %s %s\n", metrics[i].name, metrics[i].help, metrics[i].name, metrics[i].type);
+
+    for (j = 0; j < latest->len; j++) {
+      const StatsSample *sample = &g_array_index(latest, StatsSample, j);
+
+      for (k = 0; k < (metrics[i].per_direction ? STATS_N_DIRECTIONS : 1); k++) {
+        g_string_append_printf(text, "%s{session=\"", metrics[i].name);
+        stats_append_label(text, g_ptr_array_index(labels, j));
+        if (metrics[i].per_direction)
+          g_string_append_printf(text, "\",direction=\"%s", direction_names[k]);
+        g_string_append_printf(text, "\"} %.15g\n", stats_sample_value(sample, i, k));
+      }
+    }
+  }
+
+  g_array_unref(latest);
+  g_ptr_array_unref(labels);
+
+  soup_message_headers_set_content_type(message->response_headers, "text/plain; version=0.0.4", NULL);
+  soup_message_body_append(message->response_body, SOUP_MEMORY_TAKE, text->str, text->len);
+  g_string_free(text, FALSE);
+
+  soup_message_set_status(message, SOUP_STATUS_OK);
+}
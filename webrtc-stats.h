@@ -0,0 +1,77 @@
+#ifndef __WEBRTC_STATS_H__
+#define __WEBRTC_STATS_H__
+
+#include <gst/gst.h>
+#include <libsoup/soup.h>
+
+G_BEGIN_DECLS
+
+typedef struct _StatsSample StatsSample;
+typedef struct _StatsCollector StatsCollector;
+
+enum StatsDirection {
+  STATS_INBOUND = 0,
+  STATS_OUTBOUND,
+  STATS_N_DIRECTIONS,
+};
+
+/* Why a session ended before its viewer left */
+enum StatsFailure {
+  STATS_FAILURE_SETUP = 0, /* its pipeline could not be built or started */
+  STATS_FAILURE_PIPELINE,  /* error message on its bus */
+  STATS_FAILURE_SIGNALING, /* message from the viewer it could not act on */
+  STATS_N_FAILURES,
+};
+
+/* The handful of fields we actually look at, pulled out of one get-stats
+ * reply. Outbound loss and RTT are what the remote reports back to us, the
+ * nack/pli counts are the requests sent (inbound) or received (outbound) */
+struct _StatsSample {
+  gint64 timestamp; /* monotonic, us */
+  gdouble rtt;      /* seconds */
+  gdouble jitter;   /* seconds */
+  gdouble frames_per_second;
+  guint64 packets[STATS_N_DIRECTIONS];
+  gint64 packets_lost[STATS_N_DIRECTIONS];
+  guint64 bytes[STATS_N_DIRECTIONS];
+  guint64 bitrate[STATS_N_DIRECTIONS]; /* bit/s */
+  guint64 nack_count[STATS_N_DIRECTIONS];
+  guint64 pli_count[STATS_N_DIRECTIONS];
+};
+
+/* Polls get-stats on @webrtcbin from the thread-default main context and
+ * keeps the last samples in a small ring buffer. The polling interval backs
+ * off while nothing changes and snaps back on loss, keyframe requests or
+ * bitrate swings. @session_label identifies the session on /metrics */
+StatsCollector *stats_collector_new(GstElement *webrtcbin, const gchar *session_label);
+
+/* Moves the polling over to @context */
+void stats_collector_set_context(StatsCollector *collector, GMainContext *context);
+
+/* Keeps polling at the shortest interval without ever backing off, for a
+ * consumer such as the bitrate controller that needs fresh samples */
+void stats_collector_pin_interval(StatsCollector *collector);
+
+/* Counts buffers flowing through @pad to report frames per second, best put
+ * on a payloader sink pad where one buffer is one encoded frame */
+void stats_collector_count_frames(StatsCollector *collector, GstPad *pad);
+
+/* Copies up to @n_samples samples, newest first, and returns how many */
+guint stats_collector_get_samples(StatsCollector *collector, StatsSample *samples, guint n_samples);
+
+void stats_collector_free(StatsCollector *collector);
+
+/* Safe from any thread. Served as process wide counters, the sessions
+ * themselves are gone by then */
+void stats_count_failure(enum StatsFailure failure);
+
+/* Failed sessions built again on the same connection */
+void stats_count_rebuild(void);
+
+/* SoupServerCallback serving the latest sample of every live collector in
+ * the Prometheus text format */
+void stats_metrics_handler(SoupServer *soup_server, SoupMessage *message, const char *path, GHashTable *query, SoupClientContext *client_context, gpointer user_data);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_STATS_H__ */
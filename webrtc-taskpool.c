@@ -0,0 +1,246 @@
+#ifdef __linux__
+/* pthread_setaffinity_np() */
+#define _GNU_SOURCE
+#endif
+
+#include "webrtc-taskpool.h"
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+typedef struct _SessionTaskPool SessionTaskPool;
+typedef struct _SessionTaskPoolClass SessionTaskPoolClass;
+typedef struct _TaskPoolJob TaskPoolJob;
+typedef struct _TaskPoolWorker TaskPoolWorker;
+
+/* One run of a task, the handle GstTask joins on */
+struct _TaskPoolJob {
+  gint ref_count;
+  GstTaskPoolFunction func;
+  gpointer user_data;
+  gboolean done;
+};
+
+struct _TaskPoolWorker {
+  SessionTaskPool *pool;
+  guint cpu;
+  /* Handed over by push, guarded by the pool lock */
+  TaskPoolJob *job;
+  GCond cond;
+};
+
+struct _SessionTaskPool {
+  GstTaskPool parent;
+
+  GMutex lock;
+  /* Broadcast whenever a job is done */
+  GCond done_cond;
+  /* TaskPoolWorker waiting for a job */
+  GQueue idle;
+  guint max_idle;
+  guint n_cpus;
+  guint next_cpu;
+};
+
+struct _SessionTaskPoolClass {
+  GstTaskPoolClass parent_class;
+};
+
+/* *INDENT-OFF* */
+G_DEFINE_TYPE(SessionTaskPool, session_task_pool, GST_TYPE_TASK_POOL)
+/* *INDENT-ON* */
+
+static void task_pool_job_unref(TaskPoolJob *job) {
+  if (g_atomic_int_dec_and_test(&job->ref_count))
+    g_free(job);
+}
+
+static gpointer task_pool_worker_thread(gpointer user_data) {
+  TaskPoolWorker *worker = (TaskPoolWorker *)user_data;
+  SessionTaskPool *pool = worker->pool;
+  TaskPoolJob *job;
+
+#ifdef __linux__
+  {
+    cpu_set_t cpus;
+
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->cpu, &cpus);
+    pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  }
+#endif
+
+  g_mutex_lock(&pool->lock);
+  for (;;) {
+    while ((job = worker->job) == NULL)
+      g_cond_wait(&worker->cond, &pool->lock);
+    g_mutex_unlock(&pool->lock);
+
+    job->func(job->user_data);
+
+    g_mutex_lock(&pool->lock);
+    job->done = TRUE;
+    g_cond_broadcast(&pool->done_cond);
+    task_pool_job_unref(job);
+    worker->job = NULL;
+
+    if (pool->idle.length >= pool->max_idle)
+      break;
+    g_queue_push_tail(&pool->idle, worker);
+  }
+  g_mutex_unlock(&pool->lock);
+
+  g_cond_clear(&worker->cond);
+  g_free(worker);
+  return NULL;
+}
+
+/* Shared by every session, nothing to set up or tear down per user */
+static void session_task_pool_prepare(G_GNUC_UNUSED GstTaskPool *task_pool, G_GNUC_UNUSED GError **error) {
+}
+
+static void session_task_pool_cleanup(G_GNUC_UNUSED GstTaskPool *task_pool) {
+}
+
+static gpointer session_task_pool_push(GstTaskPool *task_pool, GstTaskPoolFunction func, gpointer user_data, GError **error) {
+  SessionTaskPool *pool = (SessionTaskPool *)task_pool;
+  TaskPoolWorker *worker;
+  TaskPoolJob *job;
+  GThread *thread;
+
+  job = g_new0(TaskPoolJob, 1);
+  /* One for the worker, one for the handle */
+  job->ref_count = 2;
+  job->func = func;
+  job->user_data = user_data;
+
+  g_mutex_lock(&pool->lock);
+  worker = g_queue_pop_head(&pool->idle);
+  if (worker != NULL) {
+    worker->job = job;
+    g_cond_signal(&worker->cond);
+    g_mutex_unlock(&pool->lock);
+    return job;
+  }
+  worker = g_new0(TaskPoolWorker, 1);
+  worker->pool = pool;
+  worker->cpu = pool->next_cpu++ % pool->n_cpus;
+  worker->job = job;
+  g_cond_init(&worker->cond);
+  g_mutex_unlock(&pool->lock);
+
+  thread = g_thread_try_new("session-task", task_pool_worker_thread, worker, error);
+  if (thread == NULL) {
+    g_cond_clear(&worker->cond);
+    g_free(worker);
+    g_free(job);
+    return NULL;
+  }
+  g_thread_unref(thread);
+  return job;
+}
+
+static void session_task_pool_join(GstTaskPool *task_pool, gpointer id) {
+  SessionTaskPool *pool = (SessionTaskPool *)task_pool;
+  TaskPoolJob *job = (TaskPoolJob *)id;
+
+  g_mutex_lock(&pool->lock);
+  while (!job->done)
+    g_cond_wait(&pool->done_cond, &pool->lock);
+  g_mutex_unlock(&pool->lock);
+
+  task_pool_job_unref(job);
+}
+
+#if GST_CHECK_VERSION(1, 20, 0)
+static void session_task_pool_dispose_handle(G_GNUC_UNUSED GstTaskPool *task_pool, gpointer id) {
+  task_pool_job_unref((TaskPoolJob *)id);
+}
+#endif
+
+static void session_task_pool_class_init(SessionTaskPoolClass *klass) {
+  GstTaskPoolClass *task_pool_class = GST_TASK_POOL_CLASS(klass);
+
+  task_pool_class->prepare = session_task_pool_prepare;
+  task_pool_class->cleanup = session_task_pool_cleanup;
+  task_pool_class->push = session_task_pool_push;
+  task_pool_class->join = session_task_pool_join;
+#if GST_CHECK_VERSION(1, 20, 0)
+  task_pool_class->dispose_handle = session_task_pool_dispose_handle;
+#endif
+}
+
+static void session_task_pool_init(SessionTaskPool *pool) {
+  g_mutex_init(&pool->lock);
+  g_cond_init(&pool->done_cond);
+  g_queue_init(&pool->idle);
+  pool->n_cpus = MAX(g_get_num_processors(), 1);
+  pool->max_idle = pool->n_cpus;
+}
+
+/* Lives as long as the process */
+static GstTaskPool *session_task_pool_get(void) {
+  static GstTaskPool *pool = NULL;
+
+  if (g_once_init_enter(&pool))
+    g_once_init_leave(&pool, gst_object_ref_sink(g_object_new(session_task_pool_get_type(), NULL)));
+  return pool;
+}
+
+/* Called synchronously from the thread creating the task, before it starts */
+static void on_stream_status(G_GNUC_UNUSED GstBus *bus, GstMessage *message, G_GNUC_UNUSED gpointer user_data) {
+  GstStreamStatusType type;
+  GstElement *owner;
+  const GValue *value;
+
+  gst_message_parse_stream_status(message, &type, &owner);
+  if (type != GST_STREAM_STATUS_TYPE_CREATE)
+    return;
+
+  value = gst_message_get_stream_status_object(message);
+  if (value != NULL && G_VALUE_HOLDS(value, GST_TYPE_TASK))
+    gst_task_set_pool(GST_TASK(g_value_get_object(value)), session_task_pool_get());
+}
+
+/* x264enc, vp8enc and vp8dec call it threads, avdec_* max-threads, 0 being
+ * one per core or more */
+static void limit_codec_threads(GstElement *element) {
+  static const gchar *const names[] = {"threads", "max-threads"};
+  GObjectClass *klass = G_OBJECT_GET_CLASS(element);
+  guint i;
+
+  for (i = 0; i < G_N_ELEMENTS(names); i++) {
+    GParamSpec *pspec = g_object_class_find_property(klass, names[i]);
+
+    if (pspec != NULL && (pspec->flags & G_PARAM_WRITABLE) && (pspec->value_type == G_TYPE_INT || pspec->value_type == G_TYPE_UINT))
+      g_object_set(element, names[i], 1, NULL);
+  }
+}
+
+static void limit_codec_threads_foreach(const GValue *item, G_GNUC_UNUSED gpointer user_data) {
+  limit_codec_threads(GST_ELEMENT(g_value_get_object(item)));
+}
+
+static void on_deep_element_added(G_GNUC_UNUSED GstBin *bin, G_GNUC_UNUSED GstBin *sub_bin, GstElement *element, G_GNUC_UNUSED gpointer user_data) {
+  limit_codec_threads(element);
+}
+
+void session_task_pool_install(GstElement *pipeline) {
+  GstBus *bus;
+  GstIterator *iterator;
+
+  g_return_if_fail(GST_IS_PIPELINE(pipeline));
+
+  bus = gst_pipeline_get_bus(GST_PIPELINE(pipeline));
+  gst_bus_enable_sync_message_emission(bus);
+  g_signal_connect(bus, "sync-message::stream-status", G_CALLBACK(on_stream_status), NULL);
+  gst_object_unref(bus);
+
+  /* Decoders only show up once decodebin knows the stream */
+  iterator = gst_bin_iterate_recurse(GST_BIN(pipeline));
+  gst_iterator_foreach(iterator, limit_codec_threads_foreach, NULL);
+  gst_iterator_free(iterator);
+  g_signal_connect(pipeline, "deep-element-added", G_CALLBACK(on_deep_element_added), NULL);
+}
@@ -0,0 +1,28 @@
+#ifndef __WEBRTC_TASKPOOL_H__
+#define __WEBRTC_TASKPOOL_H__
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+/* One task pool for the streaming threads of every session pipeline,
+ * instead of a new thread per queue and source, per session.
+ *
+ * A GstTask keeps its thread for as long as it runs, so no pool can run
+ * fewer threads than there are live tasks: what the pool bounds is the
+ * threads parked between sessions, one per core, which the next session
+ * reuses instead of creating its own. Each thread is pinned to a core,
+ * round robin, so a session's threads stay on warm caches.
+ *
+ * The threads codecs start on their own are what add up to hundreds: an
+ * x264enc or avdec_h264 runs about one and a half per core, per session.
+ * Installed pipelines run their codecs single threaded on the pool thread
+ * feeding them, sessions are spread over the cores anyway. */
+
+/* Moves every task @pipeline starts from then on to the shared pool, and
+ * limits the codecs in it, including those added later, to one thread */
+void session_task_pool_install(GstElement *pipeline);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_TASKPOOL_H__ */
@@ -0,0 +1,114 @@
+#include "webrtc-trickle.h"
+
+#include "webrtc-signaling.h"
+
+/* Long enough to catch the host candidates of every interface in one go,
+ * short enough to not hold up connectivity checks */
+#define TRICKLE_BATCH_INTERVAL_MS 20
+#define TRICKLE_BATCH_INITIAL_SIZE 1024
+
+struct _TrickleBatch {
+  GMutex lock;
+  GMainContext *context;
+  gchar *prefix;
+  TrickleReadyFunc ready;
+  gpointer user_data;
+
+  GString *message; /* NULL while nothing is pending */
+  gboolean released;
+  GSource *timeout_source;
+};
+
+static gboolean trickle_batch_dispatch(gpointer user_data) {
+  TrickleBatch *batch = (TrickleBatch *)user_data;
+  GString *message;
+
+  g_mutex_lock(&batch->lock);
+  g_clear_pointer(&batch->timeout_source, g_source_unref);
+  message = g_steal_pointer(&batch->message);
+  g_mutex_unlock(&batch->lock);
+
+  if (message != NULL) {
+    g_string_append(message, "]}");
+    batch->ready(g_string_free(message, FALSE), batch->user_data);
+  }
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Called with the lock held */
+static void trickle_batch_schedule(TrickleBatch *batch) {
+  if (!batch->released || batch->message == NULL || batch->timeout_source != NULL)
+    return;
+
+  batch->timeout_source = g_timeout_source_new(TRICKLE_BATCH_INTERVAL_MS);
+  g_source_set_callback(batch->timeout_source, trickle_batch_dispatch, batch, NULL);
+  g_source_attach(batch->timeout_source, batch->context);
+}
+
+TrickleBatch *trickle_batch_new(const gchar *prefix, TrickleReadyFunc ready, gpointer user_data) {
+  TrickleBatch *batch;
+
+  batch = g_new0(TrickleBatch, 1);
+  g_mutex_init(&batch->lock);
+  batch->context = g_main_context_ref_thread_default();
+  batch->prefix = g_strdup(prefix);
+  batch->ready = ready;
+  batch->user_data = user_data;
+
+  return batch;
+}
+
+void trickle_batch_add(TrickleBatch *batch, guint mline_index, const gchar *candidate) {
+  g_mutex_lock(&batch->lock);
+  if (batch->message == NULL) {
+    batch->message = g_string_sized_new(TRICKLE_BATCH_INITIAL_SIZE);
+    g_string_append(batch->message, batch->prefix);
+  } else {
+    g_string_append_c(batch->message, ',');
+  }
+
+  g_string_append_printf(batch->message, "{\"sdpMLineIndex\":%u,\"candidate\":", mline_index);
+  signaling_append_json_string(batch->message, candidate != NULL ? candidate : "");
+  g_string_append_c(batch->message, '}');
+
+  trickle_batch_schedule(batch);
+  g_mutex_unlock(&batch->lock);
+}
+
+void trickle_batch_release(TrickleBatch *batch) {
+  g_mutex_lock(&batch->lock);
+  batch->released = TRUE;
+  trickle_batch_schedule(batch);
+  g_mutex_unlock(&batch->lock);
+}
+
+void trickle_batch_set_context(TrickleBatch *batch, GMainContext *context) {
+  g_return_if_fail(batch != NULL);
+
+  g_mutex_lock(&batch->lock);
+  g_main_context_unref(batch->context);
+  batch->context = g_main_context_ref(context);
+  if (batch->timeout_source != NULL) {
+    g_source_destroy(batch->timeout_source);
+    g_clear_pointer(&batch->timeout_source, g_source_unref);
+    trickle_batch_schedule(batch);
+  }
+  g_mutex_unlock(&batch->lock);
+}
+
+void trickle_batch_free(TrickleBatch *batch) {
+  g_return_if_fail(batch != NULL);
+
+  if (batch->timeout_source != NULL) {
+    g_source_destroy(batch->timeout_source);
+    g_source_unref(batch->timeout_source);
+  }
+  if (batch->message != NULL)
+    g_string_free(batch->message, TRUE);
+
+  g_main_context_unref(batch->context);
+  g_free(batch->prefix);
+  g_mutex_clear(&batch->lock);
+  g_free(batch);
+}
@@ -0,0 +1,42 @@
+#ifndef __WEBRTC_TRICKLE_H__
+#define __WEBRTC_TRICKLE_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _TrickleBatch TrickleBatch;
+
+/* Takes ownership of @message */
+typedef void (*TrickleReadyFunc)(gchar *message, gpointer user_data);
+
+/* Trickle ICE batching for one session. Local candidates gathered within a
+ * short window are serialized straight into a single JSON message, instead
+ * of one message (and one JsonObject and JsonGenerator) per candidate.
+ *
+ * @prefix opens the JSON array the candidates go into, e.g.
+ * {"type":"ice","data":[ and the message is closed with ]}. Each entry is a
+ * {"sdpMLineIndex":N,"candidate":"..."} object, and an empty candidate
+ * string marks the end of candidates.
+ *
+ * Nothing goes out before trickle_batch_release(), so candidates never
+ * overtake the description they belong to. @ready is called from the thread
+ * default context of the caller of trickle_batch_new() */
+TrickleBatch *trickle_batch_new(const gchar *prefix, TrickleReadyFunc ready, gpointer user_data);
+
+/* Safe from any thread, webrtcbin gathers on its own. A NULL @candidate
+ * signals the end of candidates */
+void trickle_batch_add(TrickleBatch *batch, guint mline_index, const gchar *candidate);
+
+/* Call once the local description was sent */
+void trickle_batch_release(TrickleBatch *batch);
+
+/* Moves a pending and any later dispatch over to @context, @ready is called
+ * from there from now on */
+void trickle_batch_set_context(TrickleBatch *batch, GMainContext *context);
+
+void trickle_batch_free(TrickleBatch *batch);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_TRICKLE_H__ */
@@ -0,0 +1,331 @@
+/*
+ * Packets per second and per core through the ICE transport path over
+ * loopback: the stock libnice agent sending one datagram per call, against
+ * the shared UdpMux sending a packet per call, and a burst per call with
+ * sendmmsg/UDP GSO on the way out and recvmmsg on the way in.
+ */
+#include <agent.h>
+#include <gio/gio.h>
+#include <glib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+
+#include "webrtc-udpmux.h"
+
+#define STUN_HEADER_SIZE 20
+#define STUN_MAGIC_COOKIE 0x2112A442
+#define STUN_HMAC_SIZE 20
+#define MUX_PWD_A "benchmarkpasswordforthesendside"
+#define MUX_PWD_B "benchmarkpasswordforthereceiver"
+#define CONNECT_TIMEOUT_US (5 * G_USEC_PER_SEC)
+
+typedef struct _NiceEnd NiceEnd;
+
+struct _NiceEnd {
+  NiceAgent *agent;
+  guint stream_id;
+  GMainContext *context;
+  GMainLoop *loop;
+  GThread *thread;
+  gint gathered;
+  gint ready;
+};
+
+static gint duration = 5;
+static gint packet_size = 1200;
+static gint burst = 32;
+
+static GOptionEntry entries[] = {
+    {"duration", 0, 0, G_OPTION_ARG_INT, &duration, "Seconds per measurement (default: 5)", "SECONDS"},
+    {"size", 0, 0, G_OPTION_ARG_INT, &packet_size, "Bytes per packet (default: 1200)", "BYTES"},
+    {"burst", 0, 0, G_OPTION_ARG_INT, &burst, "Packets sent back-to-back, like the fragments of one frame (default: 32)", "N"},
+    {NULL},
+};
+
+/* Bumped from the receive threads */
+static gint received;
+
+static gdouble cpu_seconds(void) {
+  struct rusage usage;
+
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static gboolean wait_for(gint *flag) {
+  gint64 deadline = g_get_monotonic_time() + CONNECT_TIMEOUT_US;
+
+  while (!g_atomic_int_get(flag)) {
+    if (g_get_monotonic_time() > deadline)
+      return FALSE;
+    g_usleep(1000);
+  }
+  return TRUE;
+}
+
+static void report(const gchar *name, gint64 sent, gint64 elapsed_us, gdouble cpu) {
+  gint n = g_atomic_int_get(&received);
+
+  g_print("%-12s sent %10" G_GINT64_FORMAT "  received %10d  %10.0f packets/s  cpu %6.2f s  %10.0f packets/s per core\n", name, sent, n, //
+          n * (gdouble)G_USEC_PER_SEC / elapsed_us, cpu, cpu > 0 ? n / cpu : 0);
+}
+
+/* === stock libnice ============================================ */
+
+static gpointer nice_end_thread(gpointer user_data) {
+  NiceEnd *end = (NiceEnd *)user_data;
+
+  g_main_context_push_thread_default(end->context);
+  g_main_loop_run(end->loop);
+  g_main_context_pop_thread_default(end->context);
+  return NULL;
+}
+
+static void nice_end_on_gathering_done(G_GNUC_UNUSED NiceAgent *agent, G_GNUC_UNUSED guint stream_id, gpointer user_data) {
+  g_atomic_int_set(&((NiceEnd *)user_data)->gathered, TRUE);
+}
+
+static void nice_end_on_state_changed(G_GNUC_UNUSED NiceAgent *agent, G_GNUC_UNUSED guint stream_id, G_GNUC_UNUSED guint component_id, guint state, gpointer user_data) {
+  if (state == NICE_COMPONENT_STATE_READY)
+    g_atomic_int_set(&((NiceEnd *)user_data)->ready, TRUE);
+}
+
+static void nice_end_on_receive(G_GNUC_UNUSED NiceAgent *agent, G_GNUC_UNUSED guint stream_id, G_GNUC_UNUSED guint component_id, G_GNUC_UNUSED guint size, G_GNUC_UNUSED gchar *data, G_GNUC_UNUSED gpointer user_data) {
+  g_atomic_int_inc(&received);
+}
+
+static void nice_end_init(NiceEnd *end, gboolean controlling) {
+  NiceAddress address;
+
+  end->context = g_main_context_new();
+  end->loop = g_main_loop_new(end->context, FALSE);
+  end->agent = nice_agent_new(end->context, NICE_COMPATIBILITY_RFC5245);
+  g_object_set(end->agent, "upnp", FALSE, "ice-tcp", FALSE, "controlling-mode", controlling, NULL);
+  g_signal_connect(end->agent, "candidate-gathering-done", G_CALLBACK(nice_end_on_gathering_done), end);
+  g_signal_connect(end->agent, "component-state-changed", G_CALLBACK(nice_end_on_state_changed), end);
+
+  nice_address_init(&address);
+  nice_address_set_from_string(&address, "127.0.0.1");
+  nice_agent_add_local_address(end->agent, &address);
+
+  end->stream_id = nice_agent_add_stream(end->agent, 1);
+  nice_agent_attach_recv(end->agent, end->stream_id, 1, end->context, nice_end_on_receive, end);
+  end->thread = g_thread_new("nice", nice_end_thread, end);
+  nice_agent_gather_candidates(end->agent, end->stream_id);
+}
+
+static void nice_end_connect_to(NiceEnd *end, NiceEnd *remote) {
+  gchar *ufrag, *pwd;
+  GSList *candidates;
+
+  nice_agent_get_local_credentials(remote->agent, remote->stream_id, &ufrag, &pwd);
+  nice_agent_set_remote_credentials(end->agent, end->stream_id, ufrag, pwd);
+  g_free(ufrag);
+  g_free(pwd);
+
+  candidates = nice_agent_get_local_candidates(remote->agent, remote->stream_id, 1);
+  nice_agent_set_remote_candidates(end->agent, end->stream_id, 1, candidates);
+  g_slist_free_full(candidates, (GDestroyNotify)nice_candidate_free);
+}
+
+static void nice_end_clear(NiceEnd *end) {
+  g_main_loop_quit(end->loop);
+  g_thread_join(end->thread);
+  g_object_unref(end->agent);
+  g_main_loop_unref(end->loop);
+  g_main_context_unref(end->context);
+}
+
+static void bench_nice(const guint8 *payload) {
+  NiceEnd sender = {0}, receiver = {0};
+  gint64 start, end_time, sent = 0;
+  gdouble cpu;
+  gint i;
+
+  nice_end_init(&sender, TRUE);
+  nice_end_init(&receiver, FALSE);
+  if (!wait_for(&sender.gathered) || !wait_for(&receiver.gathered)) {
+    g_printerr("libnice gathering timed out\n");
+    return;
+  }
+  nice_end_connect_to(&sender, &receiver);
+  nice_end_connect_to(&receiver, &sender);
+  if (!wait_for(&sender.ready) || !wait_for(&receiver.ready)) {
+    g_printerr("libnice connectivity checks timed out\n");
+    return;
+  }
+
+  g_atomic_int_set(&received, 0);
+  cpu = cpu_seconds();
+  start = g_get_monotonic_time();
+  end_time = start + duration * G_USEC_PER_SEC;
+  while (g_get_monotonic_time() < end_time) {
+    for (i = 0; i < burst; i++) {
+      nice_agent_send(sender.agent, sender.stream_id, 1, packet_size, (const gchar *)payload);
+      sent++;
+    }
+  }
+  /* Let the receiver catch up with what is in flight */
+  g_usleep(100000);
+  report("nice", sent, g_get_monotonic_time() - start, cpu_seconds() - cpu);
+
+  nice_end_clear(&sender);
+  nice_end_clear(&receiver);
+}
+
+/* === UdpMux =================================================== */
+
+static void mux_on_receive(G_GNUC_UNUSED const guint8 *data, G_GNUC_UNUSED gsize size, gpointer user_data) {
+  if (user_data != NULL)
+    g_atomic_int_inc(&received);
+}
+
+static void mux_on_selected(gpointer user_data) {
+  g_atomic_int_set((gint *)user_data, TRUE);
+}
+
+/* A binding request for @ufrag, as the peer's full agent would send it */
+static gsize build_binding_request(guint8 *out, const gchar *ufrag, const gchar *pwd) {
+  GHmac *hmac;
+  gsize username_size = strlen(ufrag) + 5, padded = (username_size + 3) & ~3, size, digest_size = STUN_HMAC_SIZE;
+  guint i;
+
+  memset(out, 0, STUN_HEADER_SIZE + 4 + padded + 4 + STUN_HMAC_SIZE);
+  out[1] = 0x01;
+  *(guint32 *)(out + 4) = GUINT32_TO_BE(STUN_MAGIC_COOKIE);
+  for (i = 8; i < STUN_HEADER_SIZE; i++)
+    out[i] = g_random_int_range(0, 256);
+
+  size = STUN_HEADER_SIZE;
+  out[size + 1] = 0x06;
+  out[size + 3] = username_size;
+  memcpy(out + size + 4, ufrag, strlen(ufrag));
+  memcpy(out + size + 4 + strlen(ufrag), ":peer", 5);
+  size += 4 + padded;
+
+  out[2] = (size + 4 + STUN_HMAC_SIZE - STUN_HEADER_SIZE) >> 8;
+  out[3] = (size + 4 + STUN_HMAC_SIZE - STUN_HEADER_SIZE) & 0xff;
+  hmac = g_hmac_new(G_CHECKSUM_SHA1, (const guchar *)pwd, strlen(pwd));
+  g_hmac_update(hmac, out, size);
+  out[size + 1] = 0x08;
+  out[size + 3] = STUN_HMAC_SIZE;
+  g_hmac_get_digest(hmac, out + size + 4, &digest_size);
+  g_hmac_unref(hmac);
+
+  return size + 4 + STUN_HMAC_SIZE;
+}
+
+/* Checks @mux's session @ufrag from a socket sharing @source_port, which
+ * makes that port the session's remote address */
+static gboolean check_from_port(UdpMux *mux, const gchar *ufrag, const gchar *pwd, guint source_port, gint *selected) {
+  GSocket *socket;
+  GInetAddress *loopback;
+  GSocketAddress *address;
+  guint8 request[128];
+  gsize size;
+  gboolean ret;
+
+  socket = g_socket_new(G_SOCKET_FAMILY_IPV4, G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, NULL);
+  g_socket_set_option(socket, SOL_SOCKET, SO_REUSEPORT, 1, NULL);
+  loopback = g_inet_address_new_any(G_SOCKET_FAMILY_IPV4);
+  address = g_inet_socket_address_new(loopback, source_port);
+  g_object_unref(loopback);
+  ret = g_socket_bind(socket, address, FALSE, NULL);
+  g_object_unref(address);
+
+  if (ret) {
+    loopback = g_inet_address_new_loopback(G_SOCKET_FAMILY_IPV4);
+    address = g_inet_socket_address_new(loopback, udp_mux_get_port(mux));
+    g_object_unref(loopback);
+    size = build_binding_request(request, ufrag, pwd);
+    g_socket_send_to(socket, address, (const gchar *)request, size, NULL, NULL);
+    g_object_unref(address);
+    ret = wait_for(selected);
+  }
+
+  /* Gone before the data flows, so the kernel hands all of it to the mux */
+  g_object_unref(socket);
+  return ret;
+}
+
+static void bench_mux(const gchar *name, const guint8 *payload, gboolean batched) {
+  UdpMux *mux_a, *mux_b;
+  UdpMuxSession *session_a, *session_b;
+  UdpMuxPacket *packets;
+  gint selected_a = FALSE, selected_b = FALSE;
+  gint64 start, end_time, sent = 0;
+  gdouble cpu;
+  gint i;
+
+  mux_a = udp_mux_new("0.0.0.0", 0, 1, NULL);
+  mux_b = udp_mux_new("0.0.0.0", 0, 1, NULL);
+  g_assert(mux_a != NULL && mux_b != NULL);
+  session_a = udp_mux_session_new(mux_a, "a", MUX_PWD_A, mux_on_receive, mux_on_selected, &selected_a);
+  session_b = udp_mux_session_new(mux_b, "b", MUX_PWD_B, mux_on_receive, mux_on_selected, &selected_b);
+
+  if (!check_from_port(mux_a, "a", MUX_PWD_A, udp_mux_get_port(mux_b), &selected_a) || !check_from_port(mux_b, "b", MUX_PWD_B, udp_mux_get_port(mux_a), &selected_b)) {
+    g_printerr("UdpMux checks timed out\n");
+    return;
+  }
+
+  packets = g_new(UdpMuxPacket, burst);
+  for (i = 0; i < burst; i++) {
+    packets[i].data = payload;
+    packets[i].size = packet_size;
+  }
+
+  g_atomic_int_set(&received, 0);
+  cpu = cpu_seconds();
+  start = g_get_monotonic_time();
+  end_time = start + duration * G_USEC_PER_SEC;
+  while (g_get_monotonic_time() < end_time) {
+    if (batched) {
+      udp_mux_session_send_many(session_a, packets, burst);
+    } else {
+      for (i = 0; i < burst; i++)
+        udp_mux_session_send(session_a, payload, packet_size);
+    }
+    sent += burst;
+  }
+  g_usleep(100000);
+  report(name, sent, g_get_monotonic_time() - start, cpu_seconds() - cpu);
+
+  g_free(packets);
+  udp_mux_session_free(session_a);
+  udp_mux_session_free(session_b);
+  udp_mux_free(mux_a);
+  udp_mux_free(mux_b);
+}
+
+int main(int argc, char *argv[]) {
+  GOptionContext *context;
+  GError *error = NULL;
+  guint8 *payload;
+
+  context = g_option_context_new("- ICE transport throughput benchmark");
+  g_option_context_add_main_entries(context, entries, NULL);
+  if (!g_option_context_parse(context, &argc, &argv, &error)) {
+    g_printerr("Error initializing: %s\n", error->message);
+    return -1;
+  }
+  g_option_context_free(context);
+
+  if (packet_size <= 0 || packet_size > 1500 || burst <= 0) {
+    g_printerr("--size must be within 1-1500 and --burst positive\n");
+    return -1;
+  }
+
+  /* Looks like SRTP to the mux, first byte 0x80 */
+  payload = g_malloc(packet_size);
+  memset(payload, 0xab, packet_size);
+  payload[0] = 0x80;
+
+  g_print("%d byte packets in bursts of %d, %d s each\n", packet_size, burst, duration);
+  bench_nice(payload);
+  bench_mux("mux", payload, FALSE);
+  bench_mux("mux batched", payload, TRUE);
+
+  g_free(payload);
+  return 0;
+}
@@ -0,0 +1,675 @@
+#ifdef __linux__
+/* recvmmsg() and sendmmsg() */
+#define _GNU_SOURCE
+#endif
+
+#include "webrtc-udpmux.h"
+
+#include <errno.h>
+#include <gio/gio.h>
+#include <glib-unix.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <netinet/udp.h>
+#endif
+
+/* Larger than any DTLS record or SRTP packet we get to see */
+#define UDP_MUX_MAX_PACKET_SIZE 2048
+
+#define STUN_HEADER_SIZE 20
+#define STUN_MAGIC_COOKIE 0x2112A442
+#define STUN_FINGERPRINT_XOR 0x5354554e
+#define STUN_BINDING_REQUEST 0x0001
+#define STUN_BINDING_SUCCESS 0x0101
+#define STUN_ATTR_USERNAME 0x0006
+#define STUN_ATTR_MESSAGE_INTEGRITY 0x0008
+#define STUN_ATTR_XOR_MAPPED_ADDRESS 0x0020
+#define STUN_ATTR_USE_CANDIDATE 0x0025
+#define STUN_ATTR_FINGERPRINT 0x8028
+#define STUN_HMAC_SIZE 20
+
+typedef struct _UdpMuxSocket UdpMuxSocket;
+typedef struct _UdpMuxAddress UdpMuxAddress;
+
+struct _UdpMuxAddress {
+  socklen_t length;
+  struct sockaddr_storage native;
+};
+
+struct _UdpMuxSocket {
+  UdpMux *mux;
+  GSocket *socket;
+  gint fd;
+  GThread *thread;
+};
+
+struct _UdpMux {
+  GPtrArray *sockets;
+  guint port;
+  /* Written to on udp_mux_free() to wake up the receive threads */
+  gint wakeup_fds[2];
+  /* Cleared for good when the kernel or the NIC turns down a GSO send */
+  gint gso;
+
+  /* Guards both tables */
+  GMutex lock;
+  GHashTable *by_ufrag;
+  GHashTable *by_address;
+};
+
+struct _UdpMuxSession {
+  gint ref_count;
+  UdpMux *mux;
+  gchar *ufrag;
+  gchar *pwd;
+
+  /* Held while calling back, and while the remote address is in use */
+  GMutex lock;
+  UdpMuxReceiveFunc receive;
+  UdpMuxSelectedFunc selected;
+  gpointer user_data;
+  gboolean closed;
+
+  /* Selected by the last check, sent from the socket that check came in on */
+  UdpMuxAddress *remote;
+  gint fd;
+};
+
+static guint udp_mux_address_hash(gconstpointer key) {
+  const UdpMuxAddress *address = (const UdpMuxAddress *)key;
+  const guint8 *bytes = (const guint8 *)&address->native;
+  guint hash = 2166136261u;
+  socklen_t i;
+
+  for (i = 0; i < address->length; i++)
+    hash = (hash ^ bytes[i]) * 16777619u;
+  return hash;
+}
+
+static gboolean udp_mux_address_equal(gconstpointer a, gconstpointer b) {
+  const UdpMuxAddress *address_a = (const UdpMuxAddress *)a, *address_b = (const UdpMuxAddress *)b;
+
+  return address_a->length == address_b->length && memcmp(&address_a->native, &address_b->native, address_a->length) == 0;
+}
+
+static UdpMuxSession *udp_mux_session_ref(UdpMuxSession *session) {
+  g_atomic_int_inc(&session->ref_count);
+  return session;
+}
+
+static void udp_mux_session_unref(UdpMuxSession *session) {
+  if (!g_atomic_int_dec_and_test(&session->ref_count))
+    return;
+
+  g_free(session->remote);
+  g_free(session->ufrag);
+  g_free(session->pwd);
+  g_mutex_clear(&session->lock);
+  g_free(session);
+}
+
+static guint32 stun_crc32(const guint8 *data, gsize size) {
+  static guint32 table[256];
+  static gsize initialized = 0;
+  guint32 crc = 0xffffffff;
+  gsize i;
+
+  if (g_once_init_enter(&initialized)) {
+    guint32 n, k, c;
+
+    for (n = 0; n < 256; n++) {
+      c = n;
+      for (k = 0; k < 8; k++)
+        c = c & 1 ? 0xedb88320 ^ (c >> 1) : c >> 1;
+      table[n] = c;
+    }
+    g_once_init_leave(&initialized, 1);
+  }
+
+  for (i = 0; i < size; i++)
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  return crc ^ 0xffffffff;
+}
+
+/* HMAC-SHA1 over @message up to @offset, with the header length pretending
+ * the message ends right after the MESSAGE-INTEGRITY attribute at @offset */
+static void stun_message_integrity(const guint8 *message, gsize offset, const gchar *pwd, guint8 *digest) {
+  GHmac *hmac;
+  guint8 header[STUN_HEADER_SIZE];
+  gsize digest_size = STUN_HMAC_SIZE;
+
+  memcpy(header, message, STUN_HEADER_SIZE);
+  header[2] = (offset + 4 + STUN_HMAC_SIZE - STUN_HEADER_SIZE) >> 8;
+  header[3] = (offset + 4 + STUN_HMAC_SIZE - STUN_HEADER_SIZE) & 0xff;
+
+  hmac = g_hmac_new(G_CHECKSUM_SHA1, (const guchar *)pwd, strlen(pwd));
+  g_hmac_update(hmac, header, STUN_HEADER_SIZE);
+  g_hmac_update(hmac, message + STUN_HEADER_SIZE, offset - STUN_HEADER_SIZE);
+  g_hmac_get_digest(hmac, digest, &digest_size);
+  g_hmac_unref(hmac);
+}
+
+static gsize stun_put_attribute_header(guint8 *out, guint16 type, guint16 length) {
+  out[0] = type >> 8;
+  out[1] = type & 0xff;
+  out[2] = length >> 8;
+  out[3] = length & 0xff;
+  return 4;
+}
+
+/* Binding success response carrying the request's source address, signed
+ * with the session password */
+static gsize stun_build_binding_success(guint8 *out, const guint8 *request, const UdpMuxAddress *from, const gchar *pwd) {
+  const struct sockaddr *sa = (const struct sockaddr *)&from->native;
+  guint8 fingerprint[4];
+  guint32 crc;
+  gsize size = STUN_HEADER_SIZE, i;
+
+  out[0] = STUN_BINDING_SUCCESS >> 8;
+  out[1] = STUN_BINDING_SUCCESS & 0xff;
+  /* Same cookie and transaction id */
+  memcpy(out + 4, request + 4, 16);
+
+  if (sa->sa_family == AF_INET) {
+    const struct sockaddr_in *sin = (const struct sockaddr_in *)sa;
+    const guint8 *ip = (const guint8 *)&sin->sin_addr;
+
+    size += stun_put_attribute_header(out + size, STUN_ATTR_XOR_MAPPED_ADDRESS, 8);
+    out[size++] = 0;
+    out[size++] = 0x01;
+    out[size++] = ((const guint8 *)&sin->sin_port)[0] ^ out[4];
+    out[size++] = ((const guint8 *)&sin->sin_port)[1] ^ out[5];
+    for (i = 0; i < 4; i++)
+      out[size++] = ip[i] ^ out[4 + i];
+  } else {
+    const struct sockaddr_in6 *sin6 = (const struct sockaddr_in6 *)sa;
+    const guint8 *ip = (const guint8 *)&sin6->sin6_addr;
+
+    size += stun_put_attribute_header(out + size, STUN_ATTR_XOR_MAPPED_ADDRESS, 20);
+    out[size++] = 0;
+    out[size++] = 0x02;
+    out[size++] = ((const guint8 *)&sin6->sin6_port)[0] ^ out[4];
+    out[size++] = ((const guint8 *)&sin6->sin6_port)[1] ^ out[5];
+    /* XORed with the cookie followed by the transaction id */
+    for (i = 0; i < 16; i++)
+      out[size++] = ip[i] ^ out[4 + i];
+  }
+
+  stun_message_integrity(out, size, pwd, out + size + 4);
+  size += stun_put_attribute_header(out + size, STUN_ATTR_MESSAGE_INTEGRITY, STUN_HMAC_SIZE) + STUN_HMAC_SIZE;
+
+  out[2] = (size + 8 - STUN_HEADER_SIZE) >> 8;
+  out[3] = (size + 8 - STUN_HEADER_SIZE) & 0xff;
+  crc = stun_crc32(out, size) ^ STUN_FINGERPRINT_XOR;
+  fingerprint[0] = crc >> 24;
+  fingerprint[1] = (crc >> 16) & 0xff;
+  fingerprint[2] = (crc >> 8) & 0xff;
+  fingerprint[3] = crc & 0xff;
+  size += stun_put_attribute_header(out + size, STUN_ATTR_FINGERPRINT, 4);
+  memcpy(out + size, fingerprint, 4);
+  return size + 4;
+}
+
+static void udp_mux_handle_binding_request(UdpMuxSocket *mux_socket, const guint8 *data, gsize size, const UdpMuxAddress *from) {
+  UdpMux *mux = mux_socket->mux;
+  UdpMuxSession *session = NULL, *displaced;
+  guint8 response[STUN_HEADER_SIZE + 24 + 24 + 8], digest[STUN_HMAC_SIZE];
+  const guint8 *username = NULL, *integrity = NULL;
+  gsize username_size = 0, integrity_offset = 0, offset, response_size;
+  gboolean use_candidate = FALSE, newly_selected = FALSE;
+  gchar *ufrag;
+
+  /* Walk the attributes, nothing after MESSAGE-INTEGRITY but FINGERPRINT
+   * is covered by it */
+  for (offset = STUN_HEADER_SIZE; offset + 4 <= size && integrity == NULL;) {
+    guint16 type = (data[offset] << 8) | data[offset + 1];
+    guint16 length = (data[offset + 2] << 8) | data[offset + 3];
+
+    if (offset + 4 + length > size)
+      return;
+    if (type == STUN_ATTR_USERNAME) {
+      username = data + offset + 4;
+      username_size = length;
+    } else if (type == STUN_ATTR_MESSAGE_INTEGRITY && length == STUN_HMAC_SIZE) {
+      integrity = data + offset + 4;
+      integrity_offset = offset;
+    } else if (type == STUN_ATTR_USE_CANDIDATE) {
+      use_candidate = TRUE;
+    }
+    offset += 4 + ((length + 3) & ~3);
+  }
+  if (username == NULL || integrity == NULL)
+    return;
+
+  /* USERNAME is <our ufrag>:<their ufrag> */
+  ufrag = g_strndup((const gchar *)username, username_size);
+  if (strchr(ufrag, ':') != NULL)
+    *strchr(ufrag, ':') = '\0';
+
+  g_mutex_lock(&mux->lock);
+  session = g_hash_table_lookup(mux->by_ufrag, ufrag);
+  if (session != NULL)
+    udp_mux_session_ref(session);
+  g_mutex_unlock(&mux->lock);
+  g_free(ufrag);
+  if (session == NULL)
+    return;
+
+  stun_message_integrity(data, integrity_offset, session->pwd, digest);
+  if (memcmp(digest, integrity, STUN_HMAC_SIZE) != 0)
+    goto out;
+
+  response_size = stun_build_binding_success(response, data, from, session->pwd);
+  sendto(mux_socket->fd, response, response_size, 0, (const struct sockaddr *)&from->native, from->length);
+
+  /* A lite agent takes the first pair that checks out, and whatever the
+   * controlling side nominates after */
+  g_mutex_lock(&mux->lock);
+  g_mutex_lock(&session->lock);
+  if (!session->closed && (session->remote == NULL || (use_candidate && !udp_mux_address_equal(session->remote, from)))) {
+    if (session->remote != NULL)
+      g_hash_table_remove(mux->by_address, session->remote);
+
+    /* The address moves over from a session the peer left behind, that one
+     * stops sending there until its own checks select something again */
+    displaced = g_hash_table_lookup(mux->by_address, from);
+    if (displaced != NULL) {
+      g_mutex_lock(&displaced->lock);
+      g_hash_table_remove(mux->by_address, displaced->remote);
+      g_clear_pointer(&displaced->remote, g_free);
+      displaced->fd = -1;
+      g_mutex_unlock(&displaced->lock);
+    }
+
+    g_free(session->remote);
+    session->remote = g_memdup2(from, sizeof(UdpMuxAddress));
+    session->fd = mux_socket->fd;
+    g_hash_table_replace(mux->by_address, session->remote, session);
+    newly_selected = TRUE;
+  }
+  g_mutex_unlock(&mux->lock);
+  if (newly_selected && session->selected != NULL)
+    session->selected(session->user_data);
+  g_mutex_unlock(&session->lock);
+
+out:
+  udp_mux_session_unref(session);
+}
+
+static void udp_mux_handle_packet(UdpMuxSocket *mux_socket, const guint8 *data, gsize size, const UdpMuxAddress *from) {
+  UdpMux *mux = mux_socket->mux;
+  UdpMuxSession *session;
+
+  /* STUN starts with two zero bits, DTLS and RTP never do (RFC 7983) */
+  if (size >= STUN_HEADER_SIZE && (data[0] & 0xc0) == 0) {
+    if (((data[0] << 8) | data[1]) == STUN_BINDING_REQUEST && GUINT32_FROM_BE(*(const guint32 *)(data + 4)) == STUN_MAGIC_COOKIE)
+      udp_mux_handle_binding_request(mux_socket, data, size, from);
+    return;
+  }
+
+  g_mutex_lock(&mux->lock);
+  session = g_hash_table_lookup(mux->by_address, from);
+  if (session != NULL)
+    udp_mux_session_ref(session);
+  g_mutex_unlock(&mux->lock);
+  if (session == NULL)
+    return;
+
+  g_mutex_lock(&session->lock);
+  if (!session->closed)
+    session->receive(data, size, session->user_data);
+  g_mutex_unlock(&session->lock);
+  udp_mux_session_unref(session);
+}
+
+#ifdef __linux__
+/* Drains the socket a batch per system call */
+static void udp_mux_receive_all(UdpMuxSocket *mux_socket, guint8 *data, UdpMuxAddress *from) {
+  struct mmsghdr messages[UDP_MUX_BATCH_SIZE];
+  struct iovec iovecs[UDP_MUX_BATCH_SIZE];
+  gint i, n;
+
+  memset(messages, 0, sizeof(messages));
+  for (i = 0; i < UDP_MUX_BATCH_SIZE; i++) {
+    iovecs[i].iov_base = data + i * UDP_MUX_MAX_PACKET_SIZE;
+    iovecs[i].iov_len = UDP_MUX_MAX_PACKET_SIZE;
+    messages[i].msg_hdr.msg_iov = &iovecs[i];
+    messages[i].msg_hdr.msg_iovlen = 1;
+    messages[i].msg_hdr.msg_name = &from[i].native;
+  }
+
+  do {
+    for (i = 0; i < UDP_MUX_BATCH_SIZE; i++)
+      messages[i].msg_hdr.msg_namelen = sizeof(from[i].native);
+
+    n = recvmmsg(mux_socket->fd, messages, UDP_MUX_BATCH_SIZE, MSG_DONTWAIT, NULL);
+    for (i = 0; i < n; i++) {
+      from[i].length = messages[i].msg_hdr.msg_namelen;
+      udp_mux_handle_packet(mux_socket, (const guint8 *)iovecs[i].iov_base, messages[i].msg_len, &from[i]);
+    }
+  } while (n == UDP_MUX_BATCH_SIZE);
+}
+#else
+static void udp_mux_receive_all(UdpMuxSocket *mux_socket, guint8 *data, UdpMuxAddress *from) {
+  gssize size;
+
+  for (;;) {
+    from->length = sizeof(from->native);
+    size = recvfrom(mux_socket->fd, data, UDP_MUX_MAX_PACKET_SIZE, MSG_DONTWAIT, (struct sockaddr *)&from->native, &from->length);
+    if (size < 0)
+      break;
+    udp_mux_handle_packet(mux_socket, data, size, from);
+  }
+}
+#endif
+
+static gpointer udp_mux_receive_thread(gpointer user_data) {
+  UdpMuxSocket *mux_socket = (UdpMuxSocket *)user_data;
+  guint8 *data;
+  UdpMuxAddress *from;
+  GPollFD fds[2];
+
+  data = g_malloc(UDP_MUX_BATCH_SIZE * UDP_MUX_MAX_PACKET_SIZE);
+  from = g_new0(UdpMuxAddress, UDP_MUX_BATCH_SIZE);
+
+  fds[0].fd = mux_socket->fd;
+  fds[0].events = G_IO_IN;
+  fds[1].fd = mux_socket->mux->wakeup_fds[0];
+  fds[1].events = G_IO_IN;
+
+  for (;;) {
+    fds[0].revents = fds[1].revents = 0;
+    if (g_poll(fds, 2, -1) < 0 && errno != EINTR)
+      break;
+    if (fds[1].revents != 0)
+      break;
+
+    /* Drain everything that piled up before polling again */
+    udp_mux_receive_all(mux_socket, data, from);
+  }
+
+  g_free(from);
+  g_free(data);
+  return NULL;
+}
+
+static UdpMuxSocket *udp_mux_socket_new(UdpMux *mux, GSocketAddress *address, guint index, GError **error) {
+  UdpMuxSocket *mux_socket;
+  GSocket *socket;
+  gchar *name;
+
+  socket = g_socket_new(g_socket_address_get_family(address), G_SOCKET_TYPE_DATAGRAM, G_SOCKET_PROTOCOL_UDP, error);
+  if (socket == NULL)
+    return NULL;
+
+#ifdef SO_REUSEPORT
+  if (!g_socket_set_option(socket, SOL_SOCKET, SO_REUSEPORT, 1, error)) {
+    g_object_unref(socket);
+    return NULL;
+  }
+#endif
+
+  if (!g_socket_bind(socket, address, FALSE, error)) {
+    g_object_unref(socket);
+    return NULL;
+  }
+
+  mux_socket = g_new0(UdpMuxSocket, 1);
+  mux_socket->mux = mux;
+  mux_socket->socket = socket;
+  mux_socket->fd = g_socket_get_fd(socket);
+
+  name = g_strdup_printf("udp-mux-%u", index);
+  mux_socket->thread = g_thread_new(name, udp_mux_receive_thread, mux_socket);
+  g_free(name);
+
+  return mux_socket;
+}
+
+static void udp_mux_socket_free(gpointer mux_socket_ptr) {
+  UdpMuxSocket *mux_socket = (UdpMuxSocket *)mux_socket_ptr;
+
+  g_thread_join(mux_socket->thread);
+  g_object_unref(mux_socket->socket);
+  g_free(mux_socket);
+}
+
+UdpMux *udp_mux_new(const gchar *bind_address, guint port, guint n_sockets, GError **error) {
+  UdpMux *mux;
+  GInetAddress *inet_address;
+  GSocketAddress *address;
+  guint i;
+
+  g_return_val_if_fail(n_sockets > 0, NULL);
+
+  inet_address = bind_address != NULL ? g_inet_address_new_from_string(bind_address) : g_inet_address_new_any(G_SOCKET_FAMILY_IPV4);
+  if (inet_address == NULL) {
+    g_set_error(error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT, "invalid address %s", bind_address);
+    return NULL;
+  }
+
+  mux = g_new0(UdpMux, 1);
+  g_mutex_init(&mux->lock);
+  mux->by_ufrag = g_hash_table_new(g_str_hash, g_str_equal);
+  mux->by_address = g_hash_table_new(udp_mux_address_hash, udp_mux_address_equal);
+  mux->sockets = g_ptr_array_new_with_free_func(udp_mux_socket_free);
+  if (!g_unix_open_pipe(mux->wakeup_fds, FD_CLOEXEC, error)) {
+    g_object_unref(inet_address);
+    udp_mux_free(mux);
+    return NULL;
+  }
+
+  mux->gso = TRUE;
+  mux->port = port;
+  for (i = 0; i < n_sockets; i++) {
+    UdpMuxSocket *mux_socket;
+
+    /* Port 0 picks one for the first socket, the others share it */
+    address = g_inet_socket_address_new(inet_address, mux->port);
+    mux_socket = udp_mux_socket_new(mux, address, i, error);
+    g_object_unref(address);
+    if (mux_socket == NULL) {
+      g_object_unref(inet_address);
+      udp_mux_free(mux);
+      return NULL;
+    }
+    g_ptr_array_add(mux->sockets, mux_socket);
+
+    if (mux->port == 0) {
+      address = g_socket_get_local_address(mux_socket->socket, NULL);
+      mux->port = g_inet_socket_address_get_port(G_INET_SOCKET_ADDRESS(address));
+      g_object_unref(address);
+    }
+  }
+  g_object_unref(inet_address);
+
+  return mux;
+}
+
+guint udp_mux_get_port(UdpMux *mux) {
+  return mux->port;
+}
+
+UdpMuxSession *udp_mux_session_new(UdpMux *mux, const gchar *ufrag, const gchar *pwd, UdpMuxReceiveFunc receive, UdpMuxSelectedFunc selected, gpointer user_data) {
+  UdpMuxSession *session;
+
+  g_return_val_if_fail(mux != NULL && ufrag != NULL && pwd != NULL && receive != NULL, NULL);
+
+  session = g_new0(UdpMuxSession, 1);
+  session->ref_count = 1;
+  session->mux = mux;
+  session->ufrag = g_strdup(ufrag);
+  session->pwd = g_strdup(pwd);
+  g_mutex_init(&session->lock);
+  session->receive = receive;
+  session->selected = selected;
+  session->user_data = user_data;
+  session->fd = -1;
+
+  g_mutex_lock(&mux->lock);
+  if (g_hash_table_contains(mux->by_ufrag, ufrag)) {
+    g_mutex_unlock(&mux->lock);
+    udp_mux_session_unref(session);
+    return NULL;
+  }
+  g_hash_table_insert(mux->by_ufrag, session->ufrag, session);
+  g_mutex_unlock(&mux->lock);
+
+  return session;
+}
+
+#ifdef UDP_SEGMENT
+/* A run of equally sized packets, only the last may be shorter */
+static gboolean udp_mux_can_segment(const UdpMuxPacket *packets, guint n_packets) {
+  gsize total = 0;
+  guint i;
+
+  if (n_packets < 2 || n_packets > UDP_MUX_BATCH_SIZE)
+    return FALSE;
+  for (i = 0; i < n_packets; i++) {
+    if (i < n_packets - 1 ? packets[i].size != packets[0].size : packets[i].size > packets[0].size)
+      return FALSE;
+    total += packets[i].size;
+  }
+  return total <= G_MAXUINT16 - 8 - 40;
+}
+
+/* One send, the kernel or the NIC cuts it into packets[0].size datagrams */
+static gboolean udp_mux_send_segmented(UdpMux *mux, gint fd, const UdpMuxAddress *remote, const UdpMuxPacket *packets, guint n_packets) {
+  struct iovec iovecs[UDP_MUX_BATCH_SIZE];
+  struct msghdr message = {0};
+  union {
+    gchar buffer[CMSG_SPACE(sizeof(guint16))];
+    struct cmsghdr align;
+  } control;
+  struct cmsghdr *cmsg;
+  guint16 segment_size = packets[0].size;
+  guint i;
+
+  for (i = 0; i < n_packets; i++) {
+    iovecs[i].iov_base = (gpointer)packets[i].data;
+    iovecs[i].iov_len = packets[i].size;
+  }
+  message.msg_name = (gpointer)&remote->native;
+  message.msg_namelen = remote->length;
+  message.msg_iov = iovecs;
+  message.msg_iovlen = n_packets;
+  message.msg_control = control.buffer;
+  message.msg_controllen = sizeof(control.buffer);
+
+  cmsg = CMSG_FIRSTHDR(&message);
+  cmsg->cmsg_level = IPPROTO_UDP;
+  cmsg->cmsg_type = UDP_SEGMENT;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(guint16));
+  memcpy(CMSG_DATA(cmsg), &segment_size, sizeof(segment_size));
+
+  if (sendmsg(fd, &message, 0) >= 0)
+    return TRUE;
+  if ((errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP) && g_atomic_int_compare_and_exchange(&mux->gso, TRUE, FALSE))
+    g_printerr("UDP GSO unavailable, sending batches with sendmmsg\n");
+  return FALSE;
+}
+#endif
+
+#ifdef __linux__
+static gboolean udp_mux_send_batch(gint fd, const UdpMuxAddress *remote, const UdpMuxPacket *packets, guint n_packets) {
+  struct mmsghdr messages[UDP_MUX_BATCH_SIZE];
+  struct iovec iovecs[UDP_MUX_BATCH_SIZE];
+  guint i, n, sent = 0;
+  gint ret;
+
+  while (sent < n_packets) {
+    n = MIN(n_packets - sent, UDP_MUX_BATCH_SIZE);
+    memset(messages, 0, n * sizeof(struct mmsghdr));
+    for (i = 0; i < n; i++) {
+      iovecs[i].iov_base = (gpointer)packets[sent + i].data;
+      iovecs[i].iov_len = packets[sent + i].size;
+      messages[i].msg_hdr.msg_name = (gpointer)&remote->native;
+      messages[i].msg_hdr.msg_namelen = remote->length;
+      messages[i].msg_hdr.msg_iov = &iovecs[i];
+      messages[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    /* Sends fewer than asked when the socket buffer fills up */
+    ret = sendmmsg(fd, messages, n, 0);
+    if (ret <= 0)
+      return FALSE;
+    sent += ret;
+  }
+  return TRUE;
+}
+#else
+static gboolean udp_mux_send_batch(gint fd, const UdpMuxAddress *remote, const UdpMuxPacket *packets, guint n_packets) {
+  guint i;
+
+  for (i = 0; i < n_packets; i++) {
+    if (sendto(fd, packets[i].data, packets[i].size, 0, (const struct sockaddr *)&remote->native, remote->length) < 0)
+      return FALSE;
+  }
+  return TRUE;
+}
+#endif
+
+gboolean udp_mux_session_send_many(UdpMuxSession *session, const UdpMuxPacket *packets, guint n_packets) {
+  gboolean ret = FALSE;
+
+  g_mutex_lock(&session->lock);
+  if (session->remote == NULL)
+    goto out;
+
+#ifdef UDP_SEGMENT
+  if (g_atomic_int_get(&session->mux->gso) && udp_mux_can_segment(packets, n_packets) && udp_mux_send_segmented(session->mux, session->fd, session->remote, packets, n_packets)) {
+    ret = TRUE;
+    goto out;
+  }
+#endif
+  ret = udp_mux_send_batch(session->fd, session->remote, packets, n_packets);
+
+out:
+  g_mutex_unlock(&session->lock);
+  return ret;
+}
+
+gboolean udp_mux_session_send(UdpMuxSession *session, const guint8 *data, gsize size) {
+  UdpMuxPacket packet = {data, size};
+
+  return udp_mux_session_send_many(session, &packet, 1);
+}
+
+void udp_mux_session_free(UdpMuxSession *session) {
+  UdpMux *mux = session->mux;
+
+  g_mutex_lock(&mux->lock);
+  /* Waits for a callback that is still running */
+  g_mutex_lock(&session->lock);
+  session->closed = TRUE;
+  g_hash_table_remove(mux->by_ufrag, session->ufrag);
+  if (session->remote != NULL)
+    g_hash_table_remove(mux->by_address, session->remote);
+  g_mutex_unlock(&session->lock);
+  g_mutex_unlock(&mux->lock);
+
+  udp_mux_session_unref(session);
+}
+
+void udp_mux_free(UdpMux *mux) {
+  if (mux->wakeup_fds[1] > 0) {
+    /* Every receive thread sees the pipe readable and leaves */
+    if (write(mux->wakeup_fds[1], "x", 1) < 0)
+      g_printerr("Could not stop the UDP mux threads\n");
+  }
+  g_ptr_array_unref(mux->sockets);
+
+  if (mux->wakeup_fds[1] > 0) {
+    close(mux->wakeup_fds[0]);
+    close(mux->wakeup_fds[1]);
+  }
+  g_hash_table_unref(mux->by_address);
+  g_hash_table_unref(mux->by_ufrag);
+  g_mutex_clear(&mux->lock);
+  g_free(mux);
+}
@@ -0,0 +1,62 @@
+#ifndef __WEBRTC_UDPMUX_H__
+#define __WEBRTC_UDPMUX_H__
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Packets handed to the kernel or taken from it per system call, and the
+ * most a UDP GSO send may carry */
+#define UDP_MUX_BATCH_SIZE 64
+
+typedef struct _UdpMux UdpMux;
+typedef struct _UdpMuxSession UdpMuxSession;
+typedef struct _UdpMuxPacket UdpMuxPacket;
+
+struct _UdpMuxPacket {
+  const guint8 *data;
+  gsize size;
+};
+
+/* Called from a receive thread for every non-STUN packet of the session */
+typedef void (*UdpMuxReceiveFunc)(const guint8 *data, gsize size, gpointer user_data);
+/* Called from a receive thread whenever checks select a new remote address */
+typedef void (*UdpMuxSelectedFunc)(gpointer user_data);
+
+/* One UDP port shared by every session of the process, instead of a libnice
+ * agent and its own sockets per session.
+ *
+ * @n_sockets sockets are bound to the same port with SO_REUSEPORT, each read
+ * by its own thread, and the kernel keeps every remote address on one of
+ * them. Connectivity checks are answered right away, ICE-lite style: a
+ * binding request is matched to its session by the local ufrag in USERNAME
+ * and authenticated with the session's password, and its source address
+ * then routes all further packets to that session.
+ *
+ * On Linux packets are read with recvmmsg() and sent with sendmmsg(), or as
+ * a single UDP GSO send when a batch is a run of equally sized packets as a
+ * fragmented frame is. */
+UdpMux *udp_mux_new(const gchar *bind_address, guint port, guint n_sockets, GError **error);
+
+/* The bound port, useful when asked for port 0 */
+guint udp_mux_get_port(UdpMux *mux);
+
+/* Registers the local credentials of one ICE component, NULL when @ufrag is
+ * taken already */
+UdpMuxSession *udp_mux_session_new(UdpMux *mux, const gchar *ufrag, const gchar *pwd, UdpMuxReceiveFunc receive, UdpMuxSelectedFunc selected, gpointer user_data);
+
+/* FALSE until checks selected a remote address, or when sending failed */
+gboolean udp_mux_session_send(UdpMuxSession *session, const guint8 *data, gsize size);
+
+/* Same for a batch, in as few system calls as the kernel allows */
+gboolean udp_mux_session_send_many(UdpMuxSession *session, const UdpMuxPacket *packets, guint n_packets);
+
+/* No callback runs anymore once this returns */
+void udp_mux_session_free(UdpMuxSession *session);
+
+/* Every session must be freed first */
+void udp_mux_free(UdpMux *mux);
+
+G_END_DECLS
+
+#endif /* __WEBRTC_UDPMUX_H__ */
@@ -4,6 +4,7 @@
 #define RTP_AUDIO_PAYLOAD_TYPE "97"
 #define SOUP_HTTP_PORT 57778
 #define STUN_SERVER "stun.l.google.com:19302"
+#define LATENCY_HDREXT_ID 1
 
 #ifdef G_OS_WIN32
 #define VIDEO_SRC "mfvideosrc"
@@ -13,8 +14,48 @@
 #define VIDEO_SRC "v4l2src"
 #endif
 
+#define VIDEO_WIDTH 640
+#define VIDEO_HEIGHT 360
+#define VIDEO_FPS 15
+#define VIDEO_FRAMERATE G_STRINGIFY(VIDEO_FPS) "/1"
+/* Long GOP: a keyframe only when a viewer asks for one, through the keyframe
+ * limiter, unless --keyframe-interval sets a periodic one as well */
+#define X264ENC_PARAMS "speed-preset=ultrafast tune=zerolatency key-int-max=%u"
+#define X264_KEYINT_INFINITE 1073741824
+#define DEFAULT_RENDITIONS "1920x1080@2500,1280x720@1200,640x360@600"
+
+/* Encode after the capture chain from build_capture_description(), shared by
+ * every viewer in --shared-encode mode */
+#define VIDEO_X264_DESC "queue max-size-buffers=1 ! x264enc bitrate=600 " X264ENC_PARAMS " ! video/x-h264,profile=constrained-baseline ! queue max-size-time=100000000 ! h264parse config-interval=-1 "
+#define AUDIO_SRC "autoaudiosrc"
+#define AUDIO_OPUS_DESC "queue max-size-buffers=1 leaky=downstream ! audioconvert ! audioresample ! opusenc perfect-timestamp=true "
+
+/* Payload and send, always per viewer */
+#define VIDEO_PAY_DESC "rtph264pay config-interval=-1 name=payloader aggregate-mode=zero-latency ! application/x-rtp,media=video,encoding-name=H264,payload=" RTP_PAYLOAD_TYPE " ! webrtcbin. "
+#define AUDIO_PAY_DESC "rtpopuspay pt=" RTP_AUDIO_PAYLOAD_TYPE " ! application/x-rtp, encoding-name=OPUS ! webrtcbin. "
+
 gchar *video_priority = NULL;
 gchar *audio_priority = NULL;
+gboolean shared_encode = FALSE;
+gchar *renditions_spec = NULL;
+gchar *video_source = NULL;
+gchar *audio_source = NULL;
+gboolean benchmark = FALSE;
+gboolean measure_latency = FALSE;
+gboolean zero_copy = FALSE;
+gint pool_size = 0;
+gboolean task_pool = FALSE;
+gboolean rebuild_on_error = FALSE;
+gboolean stock_scale = FALSE;
+gint n_shards = 1;
+gint keyframe_interval = 0;
+gint keyframe_min_interval = KEYFRAME_MIN_INTERVAL_MS;
+
+gchar *video_encode_desc = NULL;
+gchar *audio_encode_desc = NULL;
+FanoutSource *fanout = NULL;
+GArray *renditions = NULL;
+ReceiverEntryPool *receiver_entry_pool = NULL;
 
 const gchar *html_source = " \n \
 <html>\n \
@@ -27,10 +68,14 @@ const gchar *html_source = " \n \
         ws.onmessage = async (event) => {\n \
           try {\n \
             const { type, data } = JSON.parse(event.data)\n \
+            if (type == 'sdp' && conn) {\n \
+              conn.close()\n \
+              conn = null\n \
+            }\n \
             if (!conn) {\n \
               conn = new RTCPeerConnection({ iceServers: [{ urls: 'stun:" STUN_SERVER "' }] })\n \
               conn.ontrack = (event) => (document.getElementById('stream').srcObject = event.streams[0])\n \
-              conn.onicecandidate = (event) => event.candidate && ws.send(JSON.stringify({ type: 'ice', data: event.candidate }))\n \
+              conn.onicecandidate = (event) => ws.send(JSON.stringify({ type: 'ice', data: event.candidate || { candidate: '', sdpMLineIndex: 0 } }))\n \
             }\n \
             if (type == 'sdp') {\n \
               await conn.setRemoteDescription(data)\n \
@@ -38,7 +83,7 @@ const gchar *html_source = " \n \
               await conn.setLocalDescription(desc)\n \
               ws.send(JSON.stringify({ type: 'sdp', data: conn.localDescription }))\n \
             } else if (type == 'ice') {\n \
-              await conn.addIceCandidate(new RTCIceCandidate(data))\n \
+              for (const candidate of [].concat(data)) await conn.addIceCandidate(candidate)\n \
             }\n \
           } catch (err) {\n \
             console.error(err)\n \
@@ -79,60 +124,205 @@ void set_sender_priority(GstWebRTCRTPTransceiver *trans, gchar *_priority) {
   }
 }
 
-void soup_websocket_handler(G_GNUC_UNUSED SoupServer *server, SoupWebsocketConnection *connection, G_GNUC_UNUSED const char *path, G_GNUC_UNUSED SoupClientContext *client_context, gpointer user_data) {
-  ReceiverEntry *receiver_entry;
-  GHashTable *receiver_entry_table = (GHashTable *)user_data;
+/* Returns what @source_desc can produce, or NULL when it can't be opened or
+ * probed */
+GstCaps *probe_source_caps(const gchar *source_desc) {
+  GstElement *source;
+  GstPad *pad;
+  GstCaps *caps;
+  GError *error = NULL;
 
-  gst_print("Processing new websocket connection %p", (gpointer)connection);
+  source = gst_parse_bin_from_description(source_desc, TRUE, &error);
+  if (source == NULL || error != NULL) {
+    g_printerr("Could not create video source: %s\n", error ? error->message : "unknown error");
+    g_clear_error(&error);
+    if (source != NULL)
+      gst_object_unref(source);
+    return NULL;
+  }
 
-  g_signal_connect(G_OBJECT(connection), "closed", G_CALLBACK(soup_websocket_closed_cb), (gpointer)receiver_entry_table);
+  /* Devices only report what they can do once they are open */
+  if (gst_element_set_state(source, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+    gst_object_unref(source);
+    return NULL;
+  }
+
+  /* Only there when the description leaves a single source pad unlinked,
+   * not for a sometimes pad such as decodebin's */
+  pad = gst_element_get_static_pad(source, "src");
+  if (pad == NULL) {
+    gst_print("Video source has no static source pad to probe\n");
+    gst_element_set_state(source, GST_STATE_NULL);
+    gst_object_unref(source);
+    return NULL;
+  }
+  caps = gst_pad_query_caps(pad, NULL);
+
+  gst_object_unref(pad);
+  gst_element_set_state(source, GST_STATE_NULL);
+  gst_object_unref(source);
+
+  return caps;
+}
+
+/* Returns the first raw format x264enc takes as is that a source producing
+ * @caps gives at @width x @height without any conversion, or NULL */
+const gchar *find_native_format(GstCaps *caps, guint width, guint height) {
+  static const gchar *formats[] = {"NV12", "I420", NULL};
+  const gchar *native_format = NULL;
+  guint i;
+
+  for (i = 0; formats[i] != NULL && native_format == NULL; i++) {
+    GstCaps *target = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, formats[i], "width", G_TYPE_INT, width, "height", G_TYPE_INT, height, NULL);
+
+    if (gst_caps_can_intersect(caps, target))
+      native_format = formats[i];
+    gst_caps_unref(target);
+  }
+
+  return native_format;
+}
+
+/* Capture chain ending in raw video at @width x @height and VIDEO_FRAMERATE.
+ *
+ * In --zero-copy mode, when the source produces a format the encoder takes
+ * at that size, v4l2src exports its dmabufs and they reach the encoder
+ * untouched: videorate only drops or duplicates buffer references. Anything
+ * else is scaled and converted to I420 in one pass by scaleconvert, or by
+ * videoscale and videoconvert with --stock-scale or when the source gives
+ * nothing scaleconvert takes, such as a camera only giving MJPEG */
+gchar *build_capture_description(guint width, guint height) {
+  const gchar *source_desc = video_source ? video_source : VIDEO_SRC;
+  const gchar *native_format = NULL;
+  gboolean fused = !stock_scale;
+  GstCaps *caps = NULL;
+  gchar *source_with_io_mode;
+  gchar *description;
+
+  if (zero_copy || fused)
+    caps = probe_source_caps(source_desc);
+  if (zero_copy && caps != NULL)
+    native_format = find_native_format(caps, width, height);
+  if (fused && (caps == NULL || !scale_convert_accepts(caps))) {
+    gst_print("Video source gives neither YUY2, NV12 nor I420, using videoscale and videoconvert\n");
+    fused = FALSE;
+  }
+  if (caps != NULL)
+    gst_caps_unref(caps);
+
+  if (native_format == NULL) {
+    if (zero_copy)
+      gst_print("Video source can't produce %ux%u natively, converting\n", width, height);
+    if (!fused)
+      return g_strdup_printf("%s ! videorate ! videoscale ! video/x-raw,width=%u,height=%u,framerate=" VIDEO_FRAMERATE " ! videoconvert ", source_desc, width, height);
+    return g_strdup_printf("%s ! videorate ! scaleconvert ! video/x-raw,format=I420,width=%u,height=%u,framerate=" VIDEO_FRAMERATE " ", source_desc, width, height);
+  }
+
+  if (g_str_has_prefix(source_desc, "v4l2src") && strstr(source_desc, "io-mode") == NULL)
+    source_with_io_mode = g_strconcat(source_desc, " io-mode=dmabuf", NULL);
+  else
+    source_with_io_mode = g_strdup(source_desc);
+
+  gst_print("Video source produces %s %ux%u natively, skipping conversion\n", native_format, width, height);
+  description = g_strdup_printf("%s ! video/x-raw,format=%s,width=%u,height=%u ! videorate ! video/x-raw,framerate=" VIDEO_FRAMERATE " ", source_with_io_mode, native_format, width, height);
+  g_free(source_with_io_mode);
+
+  return description;
+}
 
+/* x264enc key-int-max for --keyframe-interval, only requested keyframes at 0 */
+guint x264_key_int_max(void) {
+  return keyframe_interval > 0 ? (guint)keyframe_interval * VIDEO_FPS : X264_KEYINT_INFINITE;
+}
+
+/* One capture, one encoder per rendition, every encoder ending in an appsink
+ * named video_<layer>. The top rendition is captured directly so it never
+ * needs scaling */
+gchar *build_ladder_description(GArray *renditions) {
+  LadderRendition *top = &g_array_index(renditions, LadderRendition, renditions->len - 1);
+  GString *description;
+  gchar *capture;
+  guint i;
+
+  capture = build_capture_description(top->width, top->height);
+  description = g_string_new(capture);
+  g_string_append(description, "! tee name=ladder ");
+  g_free(capture);
+
+  for (i = 0; i < renditions->len; i++) {
+    LadderRendition *rendition = &g_array_index(renditions, LadderRendition, i);
+
+    g_string_append(description, "ladder. ! queue max-size-buffers=1 leaky=downstream ! ");
+    if (rendition->width != top->width || rendition->height != top->height)
+      g_string_append_printf(description, "%s ! video/x-raw,width=%u,height=%u ! ", stock_scale ? "videoscale" : "scaleconvert", rendition->width, rendition->height);
+
+    g_string_append_printf(description,
+                           "x264enc bitrate=%u " X264ENC_PARAMS " ! video/x-h264,profile=constrained-baseline ! "
+                           "h264parse config-interval=-1 ! appsink name=video_%u ",
+                           rendition->bitrate, x264_key_int_max(), i);
+  }
+
+  g_string_append_printf(description, "%s! appsink name=audio", audio_encode_desc);
+  return g_string_free(description, FALSE);
+}
+
+/* Loopback only, and sender reports carry pipeline clock times instead of
+ * wall clock ones so a receiver on this host can compare them against its
+ * own system clock to get the end-to-end latency of every frame */
+void configure_benchmark_webrtcbin(GstElement *webrtcbin) {
+  GstElement *rtpbin;
+
+  g_object_set(webrtcbin, "stun-server", NULL, NULL);
+
+  rtpbin = gst_bin_get_by_name(GST_BIN(webrtcbin), "rtpbin");
+  g_assert(rtpbin != NULL);
+  gst_util_set_object_arg(G_OBJECT(rtpbin), "ntp-time-source", "clock-time");
+  g_object_set(rtpbin, "rtcp-sync-send-time", FALSE, NULL);
+  gst_object_unref(rtpbin);
+}
+
+ReceiverEntry *create_receiver_entry(G_GNUC_UNUSED gpointer user_data) {
+  ReceiverEntry *receiver_entry;
   GError *error;
   GstWebRTCRTPTransceiver *trans;
   GArray *transceivers;
+  gchar *description;
   GstBus *bus;
+  GstElement *payloader;
+  GstPad *pad;
+  gchar *label;
 
-  receiver_entry = g_new0(ReceiverEntry, 1);
-  receiver_entry->connection = connection;
-
-  g_object_ref(G_OBJECT(connection));
-
-  g_signal_connect(G_OBJECT(connection), "message", G_CALLBACK(soup_websocket_message_cb), (gpointer)receiver_entry);
+  receiver_entry = receiver_entry_new();
+  receiver_entry->fanout = fanout;
 
   // === pipeline config =============================
   error = NULL;
-  receiver_entry->pipeline = gst_parse_launch( //
-      "webrtcbin name=webrtcbin stun-server=stun://" STUN_SERVER " " VIDEO_SRC " ! "
-      "videorate ! "
-      "videoscale ! "
-      "video/x-raw,width=640,height=360,framerate=15/1 ! "
-      "videoconvert ! "
-      "queue max-size-buffers=1 ! "
-      "x264enc bitrate=600 speed-preset=ultrafast tune=zerolatency key-int-max=15 ! "
-      "video/x-h264,profile=constrained-baseline ! "
-      "queue max-size-time=100000000 ! "
-      "h264parse ! "
-      "rtph264pay config-interval=-1 name=payloader aggregate-mode=zero-latency ! "
-      "application/x-rtp,media=video,encoding-name=H264,payload=" RTP_PAYLOAD_TYPE " ! "
-      "webrtcbin. "
-      "autoaudiosrc ! "
-      "queue max-size-buffers=1 leaky=downstream ! "
-      "audioconvert ! "
-      "audioresample ! "
-      "opusenc perfect-timestamp=true ! "
-      "rtpopuspay pt=" RTP_AUDIO_PAYLOAD_TYPE " ! "
-      "application/x-rtp, encoding-name=OPUS ! "
-      "webrtcbin. ",
-      &error);
+  if (fanout != NULL) {
+    receiver_entry->pipeline = gst_parse_launch( //
+        "webrtcbin name=webrtcbin stun-server=stun://" STUN_SERVER " "
+        "appsrc name=video is-live=true format=time ! " VIDEO_PAY_DESC "appsrc name=audio is-live=true format=time ! " AUDIO_PAY_DESC,
+        &error);
+  } else {
+    description = g_strdup_printf("webrtcbin name=webrtcbin stun-server=stun://" STUN_SERVER " %s! " VIDEO_PAY_DESC "%s! " AUDIO_PAY_DESC, video_encode_desc, audio_encode_desc);
+    receiver_entry->pipeline = gst_parse_launch(description, &error);
+    g_free(description);
+    if (error == NULL)
+      keyframe_limiter_install_all(GST_BIN(receiver_entry->pipeline), keyframe_min_interval);
+  }
   if (error != NULL) {
-    g_error("Could not create WebRTC pipeline: %s\n", error->message);
+    gst_printerr("Could not create WebRTC pipeline: %s\n", error->message);
     g_error_free(error);
+    /* Possibly partial, with no webrtcbin to go with it */
+    g_clear_pointer(&receiver_entry->pipeline, gst_object_unref);
     goto cleanup;
   }
 
   receiver_entry->webrtcbin = gst_bin_get_by_name(GST_BIN(receiver_entry->pipeline), "webrtcbin");
   g_assert(receiver_entry->webrtcbin != NULL);
 
+  if (benchmark)
+    configure_benchmark_webrtcbin(receiver_entry->webrtcbin);
+
   // === transceiver config =============================
 
   g_signal_emit_by_name(receiver_entry->webrtcbin, "get-transceivers", &transceivers);
@@ -150,19 +340,75 @@ void soup_websocket_handler(G_GNUC_UNUSED SoupServer *server, SoupWebsocketConne
   g_signal_connect(receiver_entry->webrtcbin, "on-negotiation-needed", G_CALLBACK(on_negotiation_needed_cb), (gpointer)receiver_entry);
 
   g_signal_connect(receiver_entry->webrtcbin, "on-ice-candidate", G_CALLBACK(on_ice_candidate_cb), (gpointer)receiver_entry);
+  g_signal_connect(receiver_entry->webrtcbin, "notify::ice-gathering-state", G_CALLBACK(on_ice_gathering_state_notify_cb), (gpointer)receiver_entry);
+
+  if (task_pool)
+    session_task_pool_install(receiver_entry->pipeline);
 
   bus = gst_pipeline_get_bus(GST_PIPELINE(receiver_entry->pipeline));
-  gst_bus_add_watch(bus, bus_watch_cb, receiver_entry->pipeline);
+  gst_bus_add_watch(bus, receiver_entry_bus_watch_cb, receiver_entry);
   gst_object_unref(bus);
 
-  if (gst_element_set_state(receiver_entry->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
-    g_error("Could not start pipeline");
+  if (fanout != NULL)
+    fanout_source_attach(fanout, receiver_entry->pipeline);
+
+  if (renditions != NULL)
+    receiver_entry->ladder = ladder_controller_new(fanout, receiver_entry->pipeline, receiver_entry->webrtcbin, renditions);
+
+  label = g_strdup_printf("%u", receiver_entry->id);
+  receiver_entry->stats = stats_collector_new(receiver_entry->webrtcbin, label);
+  g_free(label);
 
-  g_hash_table_replace(receiver_entry_table, connection, receiver_entry);
-  return;
+  payloader = gst_bin_get_by_name(GST_BIN(receiver_entry->pipeline), "payloader");
+  pad = gst_element_get_static_pad(payloader, "sink");
+  stats_collector_count_frames(receiver_entry->stats, pad);
+  if (measure_latency) {
+    latency_stamp_capture(pad);
+    latency_add_header_extension(payloader, LATENCY_HDREXT_ID);
+  }
+  gst_object_unref(pad);
+  gst_object_unref(payloader);
+
+  if (gst_element_set_state(receiver_entry->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+    gst_printerr("Could not start pipeline\n");
+    goto cleanup;
+  }
+
+  return receiver_entry;
 
 cleanup:
+  stats_count_failure(STATS_FAILURE_SETUP);
   destroy_receiver_entry((gpointer)receiver_entry);
+  return NULL;
+}
+
+void soup_websocket_handler(G_GNUC_UNUSED SoupServer *server, SoupWebsocketConnection *connection, G_GNUC_UNUSED const char *path, G_GNUC_UNUSED SoupClientContext *client_context, gpointer user_data) {
+  ReceiverEntry *receiver_entry = NULL;
+  ReceiverEntryTable *receiver_entry_table = (ReceiverEntryTable *)user_data;
+
+  gst_print("Processing new websocket connection %p", (gpointer)connection);
+
+  g_signal_connect(G_OBJECT(connection), "closed", G_CALLBACK(soup_websocket_closed_cb), (gpointer)receiver_entry_table);
+
+  if (receiver_entry_pool != NULL)
+    receiver_entry = receiver_entry_pool_take(receiver_entry_pool);
+  if (receiver_entry == NULL)
+    receiver_entry = create_receiver_entry(NULL);
+  if (receiver_entry == NULL) {
+    soup_websocket_connection_close(connection, SOUP_WEBSOCKET_CLOSE_SERVER_ERROR, "Could not create a session");
+    return;
+  }
+  if (rebuild_on_error)
+    receiver_entry_set_rebuild(receiver_entry, create_receiver_entry, NULL);
+
+  receiver_entry_attach_connection(receiver_entry, connection);
+  receiver_entry_table_insert(receiver_entry_table, connection, receiver_entry);
+}
+
+void setup_soup_server(SoupServer *soup_server, gpointer user_data) {
+  soup_server_add_handler(soup_server, "/", soup_http_handler, (gpointer)html_source, NULL);
+  soup_server_add_handler(soup_server, "/metrics", stats_metrics_handler, NULL, NULL);
+  soup_server_add_websocket_handler(soup_server, "/ws", NULL, NULL, soup_websocket_handler, user_data, NULL);
 }
 
 #if defined(G_OS_UNIX) || defined(__APPLE__)
@@ -177,15 +423,31 @@ gboolean exit_sighandler(gpointer user_data) {
 static GOptionEntry entries[] = {
     {"video-priority", 0, 0, G_OPTION_ARG_STRING, &video_priority, "Priority of the video stream (very-low, low, medium or high)", "PRIORITY"},
     {"audio-priority", 0, 0, G_OPTION_ARG_STRING, &audio_priority, "Priority of the audio stream (very-low, low, medium or high)", "PRIORITY"},
+    {"shared-encode", 0, 0, G_OPTION_ARG_NONE, &shared_encode, "Capture and encode once, every viewer only payloads the shared stream", NULL},
+    {"renditions", 0, 0, G_OPTION_ARG_STRING, &renditions_spec, "Encode a ladder of renditions once and switch every viewer between them by its bandwidth (e.g. " DEFAULT_RENDITIONS "), implies --shared-encode", "LADDER"},
+    {"pool-size", 0, 0, G_OPTION_ARG_INT, &pool_size, "Number of pre-warmed sessions kept ready for new viewers, best combined with --shared-encode", "N"},
+    {"video-source", 0, 0, G_OPTION_ARG_STRING, &video_source, "Video source element and its properties (default: " VIDEO_SRC ")", "DESC"},
+    {"audio-source", 0, 0, G_OPTION_ARG_STRING, &audio_source, "Audio source element and its properties (default: " AUDIO_SRC ")", "DESC"},
+    {"benchmark", 0, 0, G_OPTION_ARG_NONE, &benchmark, "Serve test sources without STUN and send RTCP timestamps on the pipeline clock, for webrtc-bench on the same host", NULL},
+    {"measure-latency", 0, 0, G_OPTION_ARG_NONE, &measure_latency, "Send the capture time of every frame in an NTP-64 RTP header extension", NULL},
+    {"zero-copy", 0, 0, G_OPTION_ARG_NONE, &zero_copy, "Feed the encoder straight from the camera buffers (dmabuf on v4l2src) when the camera natively produces the encoded size", NULL},
+    {"shards", 0, 0, G_OPTION_ARG_INT, &n_shards, "Number of worker threads, each serving its share of the sessions from its own main context", "N"},
+    {"keyframe-interval", 0, 0, G_OPTION_ARG_INT, &keyframe_interval, "Seconds between periodic keyframes, 0 sends them only when a viewer joins or reports loss (default: 0)", "SECONDS"},
+    {"keyframe-min-interval", 0, 0, G_OPTION_ARG_INT, &keyframe_min_interval, "Keyframe requests arriving faster than this are merged into one (default: " G_STRINGIFY(KEYFRAME_MIN_INTERVAL_MS) ")", "MS"},
+    {"task-pool", 0, 0, G_OPTION_ARG_NONE, &task_pool, "Run the streaming threads of every session on one shared pool, which reuses up to one parked thread per core and pins each thread to a core, and every codec single threaded", NULL},
+    {"stock-scale", 0, 0, G_OPTION_ARG_NONE, &stock_scale, "Always scale and convert the capture with videoscale and videoconvert, as sources giving neither YUY2, NV12 nor I420 already are", NULL},
+    {"rebuild-on-error", 0, 0, G_OPTION_ARG_NONE, &rebuild_on_error, "Build a session whose pipeline fails again for the same viewer, instead of closing it", NULL},
     {NULL},
 };
 
 int gst_main(int argc, char *argv[]) {
   GMainLoop *mainloop;
-  SoupServer *soup_server;
-  GHashTable *receiver_entry_table;
+  SoupServer *soup_server = NULL;
+  GPtrArray *shards = NULL;
+  ReceiverEntryTable *receiver_entry_table;
   GOptionContext *context;
   GError *error = NULL;
+  int ret = 0;
 
   setlocale(LC_ALL, "");
 
@@ -197,32 +459,115 @@ int gst_main(int argc, char *argv[]) {
     return -1;
   }
 
-  receiver_entry_table = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, destroy_receiver_entry);
+  if (!stock_scale && !scale_convert_register()) {
+    g_printerr("Could not register scaleconvert\n");
+    return -1;
+  }
+
+  receiver_entry_table = receiver_entry_table_new();
 
   mainloop = g_main_loop_new(NULL, FALSE);
   g_assert(mainloop != NULL);
 
+  if (benchmark) {
+    if (video_source == NULL)
+      video_source = g_strdup("videotestsrc is-live=true pattern=ball");
+    if (audio_source == NULL)
+      audio_source = g_strdup("audiotestsrc is-live=true wave=red-noise");
+  }
+  audio_encode_desc = g_strconcat(audio_source ? audio_source : AUDIO_SRC, " ! " AUDIO_OPUS_DESC, NULL);
+
+  /* The ladder captures at its top rendition instead */
+  if (renditions_spec == NULL) {
+    gchar *capture = build_capture_description(VIDEO_WIDTH, VIDEO_HEIGHT);
+    video_encode_desc = g_strdup_printf("%s! " VIDEO_X264_DESC, capture, x264_key_int_max());
+    g_free(capture);
+  }
+
+  if (renditions_spec != NULL) {
+    gchar *description;
+
+    renditions = ladder_renditions_parse(renditions_spec);
+    if (renditions == NULL)
+      return -1;
+
+    description = build_ladder_description(renditions);
+    fanout = fanout_source_new(description, &error);
+    g_free(description);
+  } else if (shared_encode) {
+    gchar *description = g_strdup_printf("%s! appsink name=video %s! appsink name=audio", video_encode_desc, audio_encode_desc);
+    fanout = fanout_source_new(description, &error);
+    g_free(description);
+  }
+
+  if (renditions_spec != NULL || shared_encode) {
+    if (fanout == NULL) {
+      g_printerr("Could not create shared encoder: %s\n", error->message);
+      g_error_free(error);
+      return -1;
+    }
+    /* One encoder for everybody, the limiter keeps a crowd of joining or
+     * lossy viewers from turning every frame into an IDR */
+    fanout_source_limit_keyframes(fanout, keyframe_min_interval);
+    if (!fanout_source_start(fanout, mainloop)) {
+      g_printerr("Could not start shared encoder\n");
+      fanout_source_free(fanout);
+      return -1;
+    }
+  }
+
 #if defined(G_OS_UNIX) || defined(__APPLE__)
   g_unix_signal_add(SIGINT, exit_sighandler, mainloop);
   g_unix_signal_add(SIGTERM, exit_sighandler, mainloop);
 #endif
 
-  soup_server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "webrtc-soup-server", NULL);
-  soup_server_add_handler(soup_server, "/", soup_http_handler, (gpointer)html_source, NULL);
-  soup_server_add_websocket_handler(soup_server, "/ws", NULL, NULL, soup_websocket_handler, (gpointer)receiver_entry_table, NULL);
-  soup_server_listen_all(soup_server, SOUP_HTTP_PORT, (SoupServerListenOptions)0, NULL);
+  if (pool_size > 0)
+    receiver_entry_pool = receiver_entry_pool_new(pool_size, create_receiver_entry, NULL);
+
+  if (n_shards > 1) {
+    shards = session_shards_start(n_shards, SOUP_HTTP_PORT, setup_soup_server, receiver_entry_table, &error);
+    if (shards == NULL) {
+      g_printerr("Could not start shards: %s\n", error->message);
+      g_error_free(error);
+      return -1;
+    }
+  } else {
+    soup_server = soup_server_new(SOUP_SERVER_SERVER_HEADER, "webrtc-soup-server", NULL);
+    setup_soup_server(soup_server, (gpointer)receiver_entry_table);
+    soup_server_listen_all(soup_server, SOUP_HTTP_PORT, (SoupServerListenOptions)0, NULL);
+  }
 
   gst_print("WebRTC page link: http://127.0.0.1:%d/\n", (gint)SOUP_HTTP_PORT);
 
   g_main_loop_run(mainloop);
 
-  g_object_unref(G_OBJECT(soup_server));
-  g_hash_table_destroy(receiver_entry_table);
+  /* Sessions already on their way down hand their entries back to the
+   * context they came from, shards included, so before those stop */
+  session_reaper_stop();
+  while (g_main_context_iteration(NULL, FALSE))
+    ;
+  if (shards != NULL)
+    session_shards_stop(shards);
+  if (soup_server != NULL)
+    g_object_unref(G_OBJECT(soup_server));
+  receiver_entry_table_free(receiver_entry_table);
+  if (receiver_entry_pool != NULL)
+    receiver_entry_pool_free(receiver_entry_pool);
+  if (fanout != NULL) {
+    /* Left for a supervisor to restart us */
+    if (fanout_source_has_failed(fanout))
+      ret = 1;
+    fanout_source_free(fanout);
+  }
+  if (renditions != NULL)
+    g_array_unref(renditions);
+  g_free(video_encode_desc);
+  g_free(audio_encode_desc);
   g_main_loop_unref(mainloop);
 
   gst_deinit();
 
-  return 0;
+  return ret;
 }
 
 #ifdef __APPLE__